@@ -0,0 +1,161 @@
+#include <libdriver/block.hpp>
+#include <algorithm>
+#include <memory>
+#include <stdio.h>
+
+using namespace block;
+
+queue::queue(device& dev, size_t max_depth): dev{dev}, max_depth{std::min(max_depth, dev.get_queue_depth())}, in_flight{0}, barrier_in_flight{false}, pending{}, failed{}, stats{} {
+    if(this->max_depth == 0)
+        this->max_depth = 1;
+}
+
+static bool continues(const buffer& a, const buffer& b){
+    if((a.phys + a.size) != b.phys)
+        return false;
+
+    return (a.virt == nullptr && b.virt == nullptr) || ((uintptr_t)a.virt + a.size) == (uintptr_t)b.virt;
+}
+
+// Appends segments to dst, folding pieces that continue physically into the previous one
+static void append_segments(std::vector<buffer>& dst, const std::vector<buffer>& src){
+    for(const auto& segment : src){
+        if(!dst.empty() && continues(dst.back(), segment))
+            dst.back().size += segment.size;
+        else
+            dst.push_back(segment);
+    }
+}
+
+static size_t count_merged_segments(const std::vector<buffer>& a, const std::vector<buffer>& b){
+    size_t n = a.size() + b.size();
+    if(!a.empty() && !b.empty() && continues(a.back(), b.front()))
+        n--;
+    return n;
+}
+
+bool queue::try_merge(command& cmd){
+    // Only look at what is still waiting, and never across a flush
+    for(auto it = this->pending.rbegin(); it != this->pending.rend(); ++it){
+        auto& other = *it;
+        if(other.type == request_types::Flush)
+            return false;
+
+        if(cmd.lba < (other.lba + other.n_sectors) && other.lba < (cmd.lba + cmd.n_sectors))
+            return false; // Merging past this would reorder overlapping requests
+
+        if(other.type != cmd.type || (other.n_sectors + cmd.n_sectors) > this->dev.get_max_sectors())
+            continue;
+
+        if((other.lba + other.n_sectors) == cmd.lba && count_merged_segments(other.segments, cmd.segments) <= this->dev.get_max_segments()){
+            append_segments(other.segments, cmd.segments); // Back merge
+        } else if((cmd.lba + cmd.n_sectors) == other.lba && count_merged_segments(cmd.segments, other.segments) <= this->dev.get_max_segments()){
+            append_segments(cmd.segments, other.segments); // Front merge
+            other.segments = std::move(cmd.segments);
+            other.lba = cmd.lba;
+        } else {
+            continue;
+        }
+
+        other.n_sectors += cmd.n_sectors;
+        for(auto& cb : cmd.callbacks)
+            other.callbacks.push_back(std::move(cb));
+
+        this->stats.n_merged++;
+        return true;
+    }
+
+    return false;
+}
+
+bool queue::submit(request_types type, uint64_t lba, size_t n_sectors, const buffer& buf, io_callback cb){
+    command cmd{.type = type, .lba = lba, .n_sectors = n_sectors, .segments = {}, .callbacks = {}};
+    if(type != request_types::Flush){
+        size_t bytes = n_sectors * this->dev.get_sector_size();
+        if(n_sectors == 0 || (lba + n_sectors) > this->dev.get_n_sectors() || bytes > buf.size)
+            return false;
+
+        cmd.segments.push_back(buffer{.virt = buf.virt, .phys = buf.phys, .size = bytes});
+    }
+    cmd.callbacks.push_back(std::move(cb));
+    this->stats.n_requests++;
+
+    // A request larger than 1 command goes through as is, the driver splits it
+    if(type == request_types::Flush || n_sectors > this->dev.get_max_sectors() || !this->try_merge(cmd))
+        this->pending.push_back(std::move(cmd));
+
+    this->dispatch();
+    return true;
+}
+
+void queue::dispatch(){
+    size_t n_started = 0;
+    while(!this->pending.empty() && this->in_flight < this->max_depth && !this->barrier_in_flight){
+        auto& cmd = this->pending.front();
+        bool barrier = (cmd.type == request_types::Flush);
+        if(barrier && this->in_flight)
+            break; // Wait for everything before the flush to finish
+
+        auto callbacks = std::make_shared<std::vector<io_callback>>(std::move(cmd.callbacks));
+        bool started = this->dev.start(cmd.type, cmd.lba, cmd.n_sectors, cmd.segments, [this, callbacks, barrier](bool success){
+            this->in_flight--;
+            if(barrier)
+                this->barrier_in_flight = false;
+
+            for(auto& cb : *callbacks)
+                if(cb)
+                    cb(success);
+
+            this->dispatch();
+        });
+
+        if(!started){
+            if(this->in_flight == 0){
+                // No completion is coming to retry it, so it never fits
+                for(auto& cb : *callbacks)
+                    this->failed.push_back(std::move(cb));
+
+                this->pending.pop_front();
+                continue;
+            }
+
+            cmd.callbacks = std::move(*callbacks);
+            break;
+        }
+
+        this->pending.pop_front();
+        this->in_flight++;
+        this->barrier_in_flight = barrier;
+        this->stats.n_commands++;
+        n_started++;
+    }
+
+    if(n_started)
+        this->dev.kick();
+}
+
+size_t queue::complete_failed(){
+    auto callbacks = std::move(this->failed);
+    this->failed.clear();
+    for(auto& cb : callbacks)
+        if(cb)
+            cb(false);
+
+    return callbacks.size();
+}
+
+size_t queue::poll(){
+    return this->complete_failed() + this->dev.poll();
+}
+
+size_t queue::wait(){
+    // Sleeping with nothing in flight would never wake up
+    if(auto n = this->complete_failed(); n)
+        return n;
+
+    return this->dev.wait();
+}
+
+void block::print_device(const std::string& name, queue& q){
+    printf("block: %s, %ld sectors of %ld bytes, queue depth %ld\n", name.c_str(), q.get_device().get_n_sectors(), q.get_device().get_sector_size(), q.get_device().get_queue_depth());
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace block
+{
+    using io_callback = std::function<void(bool success)>;
+
+    // Physically contiguous memory, phys is what the controller DMAs to, virt is only needed for PIO fallbacks
+    struct buffer {
+        void* virt;
+        uintptr_t phys;
+        size_t size;
+    };
+
+    enum class request_types {
+        Read,
+        Write,
+        Flush,
+    };
+
+    // Implemented by every storage driver, 1 per disk or namespace
+    class device {
+        public:
+        virtual ~device() = default;
+
+        virtual size_t get_sector_size() = 0;
+        virtual uint64_t get_n_sectors() = 0;
+
+        virtual size_t get_queue_depth() = 0; // Commands the hardware can have outstanding
+        virtual size_t get_max_sectors() = 0; // Largest single command, merging stays below this
+        virtual size_t get_max_segments() = 0; // Physically discontiguous pieces 1 command can take
+
+        // Starts 1 command on the segments in order, done runs from poll() or wait() and never from inside start()
+        // Returns false if the hardware has no room right now, the queue retries after the next completion
+        // If nothing is outstanding there won't be one, so the queue fails the command instead
+        virtual bool start(request_types type, uint64_t lba, size_t n_sectors, const std::vector<buffer>& segments, io_callback done) = 0;
+        virtual void kick() {} // Called after a batch of start()s, for doorbells
+        virtual size_t poll() = 0;
+        virtual size_t wait() = 0; // Sleeps until something completes
+    };
+
+    // Feeds requests to a device, merging adjacent ones and keeping at most max_depth commands outstanding
+    // Not thread safe, same as the drivers under it
+    class queue {
+        public:
+        queue(device& dev, size_t max_depth = SIZE_MAX);
+
+        // Transfers n_sectors between the device and buf starting at lba, buf has to be at least n_sectors * sector size long
+        // A Flush waits for everything before it and holds back everything after it, lba, n_sectors and buf are ignored for it
+        // Returns false if the request is invalid, cb runs from poll() or wait()
+        bool submit(request_types type, uint64_t lba, size_t n_sectors, const buffer& buf, io_callback cb);
+
+        size_t poll();
+        size_t wait();
+
+        device& get_device(){
+            return dev;
+        }
+
+        struct statistics {
+            uint64_t n_requests;
+            uint64_t n_merged;
+            uint64_t n_commands;
+        };
+
+        const statistics& get_statistics(){
+            return stats;
+        }
+
+        private:
+        struct command {
+            request_types type;
+            uint64_t lba;
+            size_t n_sectors;
+            std::vector<buffer> segments;
+            std::vector<io_callback> callbacks;
+        };
+
+        bool try_merge(command& cmd);
+        void dispatch();
+        size_t complete_failed();
+
+        device& dev;
+        size_t max_depth;
+        size_t in_flight;
+        bool barrier_in_flight;
+
+        std::deque<command> pending;
+        std::vector<io_callback> failed; // Run from poll() or wait(), like every other completion
+        statistics stats;
+    };
+
+    // Logs the geometry of a disk, there is no devfs to publish it in yet so filesystems have to live in the driver for now
+    void print_device(const std::string& name, queue& q);
+} // namespace block
@@ -0,0 +1,310 @@
+#include <libdriver/block_cache.hpp>
+#include <libsigma/sys.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <cstring>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace block;
+
+static void read_override(const char* name, uint64_t& value){
+    const char* str = getenv(name);
+    if(!str)
+        return;
+
+    char* end = nullptr;
+    uint64_t v = strtoull(str, &end, 0);
+    if(end == str || *end != '\0' || v == 0){
+        printf("block: Ignoring invalid %s=%s\n", name, str);
+        return;
+    }
+
+    value = v;
+}
+
+cache::config cache::config::from_environment(){
+    config cfg{};
+    uint64_t n_blocks = cfg.n_blocks, block_size = cfg.block_size, max_readahead = cfg.max_readahead, max_dirty = cfg.max_dirty;
+    read_override("BLOCK_CACHE_BLOCKS", n_blocks);
+    read_override("BLOCK_CACHE_BLOCK_SIZE", block_size);
+    read_override("BLOCK_CACHE_READAHEAD", max_readahead);
+    read_override("BLOCK_CACHE_MAX_DIRTY", max_dirty);
+    read_override("BLOCK_CACHE_WRITEBACK_MS", cfg.writeback_interval_ms);
+
+    cfg.n_blocks = n_blocks;
+    cfg.block_size = block_size;
+    cfg.max_readahead = max_readahead;
+    cfg.max_dirty = max_dirty;
+    return cfg;
+}
+
+cache::cache(queue& q, const config& cfg): q{q}, cfg{cfg}, sector_size{0}, block_sectors{0}, max_chunk{0}, n_disk_blocks{0}, lru{}, map{}, generation{0}, n_dirty{0}, readahead_next{invalid_block}, readahead_window{0}, stats{} {
+    auto& dev = q.get_device();
+    this->sector_size = dev.get_sector_size();
+    this->block_sectors = std::max<size_t>(1, (cfg.block_size + this->sector_size - 1) / this->sector_size);
+    this->n_disk_blocks = (dev.get_n_sectors() + this->block_sectors - 1) / this->block_sectors;
+
+    // Allocate in pieces, a large cache doesn't need to be physically contiguous as a whole
+    constexpr size_t region_size = 0x40000;
+    size_t block_bytes = this->block_sectors * this->sector_size;
+    size_t per_region = std::max<size_t>(1, region_size / block_bytes);
+    for(size_t i = 0; i < cfg.n_blocks; i += per_region){
+        size_t n = std::min(per_region, cfg.n_blocks - i);
+        libsigma_phys_region_t region = {};
+        if(libsigma_get_phys_region(n * block_bytes, PROT_READ | PROT_WRITE, MAP_ANON, &region)){
+            printf("block: Couldn't allocate cache memory, continuing with %ld blocks\n", this->lru.size());
+            break;
+        }
+
+        for(size_t j = 0; j < n; j++){
+            buffer buf{.virt = (void*)(region.virtual_addr + j * block_bytes), .phys = region.physical_addr + j * block_bytes, .size = block_bytes};
+            this->lru.push_back(entry{.block = invalid_block, .n_sectors = 0, .buf = buf, .valid = false, .dirty = false, .loading = false, .pinned = false, .dirty_generation = 0});
+        }
+    }
+
+    // Keep a single request and its readahead from pinning the whole cache
+    this->max_chunk = std::max<size_t>(1, this->lru.size() / 4);
+    this->cfg.max_readahead = std::min(this->cfg.max_readahead, this->max_chunk);
+}
+
+cache::entry* cache::lookup(uint64_t block){
+    auto it = this->map.find(block);
+    if(it == this->map.end())
+        return nullptr;
+
+    this->lru.splice(this->lru.begin(), this->lru, it->second);
+    return &*it->second;
+}
+
+cache::entry* cache::insert(uint64_t block){
+    for(auto it = this->lru.rbegin(); it != this->lru.rend(); ++it){
+        auto victim = std::prev(it.base());
+        if(victim->loading || victim->pinned)
+            continue;
+
+        if(victim->dirty && !this->write_back([&victim](const entry& e){ return &e == &*victim; }))
+            continue; // Don't drop data we couldn't write, try the next one
+
+        if(victim->block != invalid_block){
+            this->map.erase(victim->block);
+            this->stats.n_evictions++;
+        }
+
+        uint64_t lba = block * this->block_sectors;
+        victim->block = block;
+        victim->n_sectors = std::min<uint64_t>(this->block_sectors, this->q.get_device().get_n_sectors() - lba);
+        victim->valid = false;
+
+        this->lru.splice(this->lru.begin(), this->lru, victim);
+        this->map[block] = victim;
+        return &*victim;
+    }
+
+    return nullptr;
+}
+
+void cache::start_read(entry* e){
+    e->loading = true;
+    if(!this->q.submit(request_types::Read, e->block * this->block_sectors, e->n_sectors, e->buf, [e](bool success){
+        e->loading = false;
+        e->valid = success;
+    }))
+        e->loading = false;
+}
+
+void cache::readahead(uint64_t first, uint64_t last){
+    // The window starts small and doubles for every read that picks up where the last one stopped
+    if(first == this->readahead_next)
+        this->readahead_window = this->readahead_window ? std::min(this->readahead_window * 2, this->cfg.max_readahead) : std::min<size_t>(4, this->cfg.max_readahead);
+    else
+        this->readahead_window = 0;
+
+    this->readahead_next = last + 1;
+    for(uint64_t block = last + 1; block <= (last + this->readahead_window) && block < this->n_disk_blocks; block++){
+        if(this->map.find(block) != this->map.end())
+            continue;
+
+        auto* e = this->insert(block);
+        if(!e)
+            break;
+
+        this->stats.n_readahead++;
+        this->start_read(e);
+    }
+}
+
+void cache::wait_loaded(const std::vector<entry*>& entries){
+    while(std::any_of(entries.begin(), entries.end(), [](const entry* e){ return e->loading; }))
+        this->q.wait();
+}
+
+void cache::mark_dirty(entry* e){
+    if(e->dirty)
+        return; // Keep the generation of the first write, so a busy block still gets written back
+
+    e->dirty = true;
+    e->dirty_generation = this->generation;
+    this->n_dirty++;
+}
+
+template<typename F>
+bool cache::write_back(F predicate){
+    std::vector<entry*> entries{};
+    for(auto& e : this->lru)
+        if(e.dirty && predicate(e))
+            entries.push_back(&e);
+
+    // Submit in disk order so the queue can merge neighbours into large writes
+    std::sort(entries.begin(), entries.end(), [](const entry* a, const entry* b){ return a->block < b->block; });
+
+    size_t outstanding = 0;
+    bool success = true;
+    for(auto* e : entries){
+        if(this->q.submit(request_types::Write, e->block * this->block_sectors, e->n_sectors, e->buf, [this, e, &outstanding, &success](bool ok){
+            outstanding--;
+            if(!ok){
+                success = false;
+                return;
+            }
+
+            e->dirty = false;
+            this->n_dirty--;
+            this->stats.n_writebacks++;
+        }))
+            outstanding++;
+        else
+            success = false;
+    }
+
+    while(outstanding)
+        this->q.wait();
+
+    return success;
+}
+
+bool cache::transfer(uint64_t lba, size_t n_sectors, uint8_t* buf, bool write){
+    if(n_sectors == 0 || (lba + n_sectors) > this->q.get_device().get_n_sectors() || this->lru.empty())
+        return false;
+
+    uint64_t first = lba / this->block_sectors, last = (lba + n_sectors - 1) / this->block_sectors;
+    for(uint64_t chunk = first; chunk <= last; chunk += this->max_chunk){
+        uint64_t chunk_last = std::min<uint64_t>(last, chunk + this->max_chunk - 1);
+
+        // Start every missing block before waiting on any of them, so the queue can merge them
+        std::vector<entry*> entries{};
+        bool success = true;
+        for(uint64_t block = chunk; block <= chunk_last; block++){
+            uint64_t block_lba = block * this->block_sectors;
+            auto* e = this->lookup(block);
+            bool cached = e && (e->valid || e->loading);
+            if(!e)
+                e = this->insert(block);
+
+            if(!e){
+                printf("block: No evictable cache blocks left\n");
+                success = false;
+                break;
+            }
+
+            e->pinned = true;
+            entries.push_back(e);
+            if(cached){
+                this->stats.n_hits++;
+                continue;
+            }
+
+            this->stats.n_misses++;
+            bool whole = lba <= block_lba && (lba + n_sectors) >= (block_lba + e->n_sectors);
+            if(!write || !whole)
+                this->start_read(e); // A block that gets overwritten completely doesn't need reading
+        }
+
+        if(!write && success)
+            this->readahead(chunk, chunk_last);
+
+        this->wait_loaded(entries);
+
+        for(auto* e : entries){
+            e->pinned = false;
+            if(!success)
+                continue;
+
+            uint64_t block_lba = e->block * this->block_sectors;
+            uint64_t start = std::max(lba, block_lba), end = std::min(lba + n_sectors, block_lba + e->n_sectors);
+            bool whole = start == block_lba && end == (block_lba + e->n_sectors);
+            if(!e->valid && !(write && whole)){
+                success = false;
+                continue;
+            }
+
+            auto* data = (uint8_t*)e->buf.virt + (start - block_lba) * this->sector_size;
+            auto* user = buf + (start - lba) * this->sector_size;
+            size_t size = (end - start) * this->sector_size;
+            if(write){
+                memcpy(data, user, size);
+                e->valid = true;
+                this->mark_dirty(e);
+            } else {
+                memcpy(user, data, size);
+            }
+        }
+
+        if(!success)
+            return false;
+    }
+
+    if(write && this->n_dirty > this->cfg.max_dirty)
+        this->write_back([](const entry&){ return true; });
+
+    return true;
+}
+
+bool cache::read(uint64_t lba, size_t n_sectors, void* buf){
+    return this->transfer(lba, n_sectors, (uint8_t*)buf, false);
+}
+
+bool cache::write(uint64_t lba, size_t n_sectors, const void* buf){
+    return this->transfer(lba, n_sectors, const_cast<uint8_t*>((const uint8_t*)buf), true);
+}
+
+void cache::tick(){
+    this->q.poll(); // Finish readahead nobody waited on
+
+    // Anything dirtied before the previous tick has been sitting around for at least 1 interval
+    uint64_t current = this->generation++;
+    this->write_back([current](const entry& e){ return e.dirty_generation < current; });
+}
+
+bool cache::sync(){
+    if(!this->write_back([](const entry&){ return true; }))
+        return false;
+
+    bool done = false, success = false;
+    if(!this->q.submit(request_types::Flush, 0, 0, buffer{}, [&done, &success](bool ok){ done = true; success = ok; }))
+        return false;
+
+    while(!done)
+        this->q.wait();
+
+    return success;
+}
+
+void block::run_writeback(const std::vector<cache*>& caches, uint64_t interval_ms){
+    auto waitset = libsigma_waitset_create();
+    auto timer = libsigma_timer_create(interval_ms, true);
+    if(timer == UINT64_MAX || libsigma_waitset_add(waitset, timer)){
+        printf("block: Couldn't set up the writeback timer\n");
+    } else {
+        handle_t ready[1] = {};
+        while(libsigma_waitset_wait(waitset, ready, 1) != SIZE_MAX)
+            for(auto* c : caches)
+                c->tick();
+
+        printf("block: Waiting for the writeback timer failed\n");
+    }
+
+    // Don't take dirty blocks down with us
+    for(auto* c : caches)
+        c->sync();
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <libdriver/block.hpp>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace block
+{
+    // LRU cache of fixed size blocks in front of a queue, this is what filesystems talk to instead of the device
+    // There is no devfs to publish it in yet, so only code inside the driver process can reach it
+    // Writes stay in memory until tick() or sync() write them back, or too many blocks are dirty
+    // Not thread safe, same as the queue under it
+    class cache {
+        public:
+        struct config {
+            size_t n_blocks = 1024; // 4MiB per disk with the default block size
+            size_t block_size = 0x1000; // Rounded up to a multiple of the sector size
+            size_t max_readahead = 32; // In blocks, the window doubles every sequential read up to this
+            size_t max_dirty = 256; // Writes everything back early once this many blocks are dirty
+            uint64_t writeback_interval_ms = 5000; // For run_writeback
+
+            // The defaults above, overridden by BLOCK_CACHE_BLOCKS, BLOCK_CACHE_BLOCK_SIZE, BLOCK_CACHE_READAHEAD,
+            // BLOCK_CACHE_MAX_DIRTY and BLOCK_CACHE_WRITEBACK_MS if they are set in the environment the driver was spawned with
+            static config from_environment();
+        };
+
+        cache(queue& q, const config& cfg);
+
+        bool read(uint64_t lba, size_t n_sectors, void* buf);
+        bool write(uint64_t lba, size_t n_sectors, const void* buf);
+
+        // Writes back blocks that have been dirty since before the previous tick, call it periodically
+        void tick();
+        // Writes back every dirty block and flushes the device cache
+        bool sync();
+
+        struct statistics {
+            uint64_t n_hits;
+            uint64_t n_misses;
+            uint64_t n_evictions;
+            uint64_t n_readahead;
+            uint64_t n_writebacks;
+        };
+
+        const statistics& get_statistics(){
+            return stats;
+        }
+
+        queue& get_queue(){
+            return q;
+        }
+
+        private:
+        struct entry {
+            uint64_t block;
+            size_t n_sectors; // Less than a whole block at the end of the disk
+            buffer buf;
+            bool valid, dirty, loading, pinned;
+            uint64_t dirty_generation;
+        };
+
+        static constexpr uint64_t invalid_block = UINT64_MAX;
+
+        entry* lookup(uint64_t block);
+        entry* insert(uint64_t block);
+        void start_read(entry* e);
+        void readahead(uint64_t first, uint64_t last);
+        void wait_loaded(const std::vector<entry*>& entries);
+        void mark_dirty(entry* e);
+
+        template<typename F>
+        bool write_back(F predicate);
+
+        bool transfer(uint64_t lba, size_t n_sectors, uint8_t* buf, bool write);
+
+        queue& q;
+        config cfg;
+        size_t sector_size, block_sectors, max_chunk;
+        uint64_t n_disk_blocks;
+
+        std::list<entry> lru; // Front is the most recently used, unused entries sit at the back
+        std::unordered_map<uint64_t, std::list<entry>::iterator> map;
+
+        uint64_t generation;
+        size_t n_dirty;
+
+        uint64_t readahead_next;
+        size_t readahead_window;
+
+        statistics stats;
+    };
+
+    // Runs tick() on every cache each interval_ms, for the main loop of a driver
+    // Only returns if the timer stops working, after syncing every cache
+    void run_writeback(const std::vector<cache*>& caches, uint64_t interval_ms);
+} // namespace block
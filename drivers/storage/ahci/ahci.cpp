@@ -6,11 +6,13 @@
 #include <sys/mman.h>
 #include <assert.h>
 #include <cstring>
+#include <algorithm>
+#include <memory>
 
 using namespace ahci::regs;
 
 
-ahci::controller::controller(uintptr_t phys_base, size_t size){
+ahci::controller::controller(uint64_t device_descriptor, uintptr_t phys_base, size_t size): irq{UINT64_MAX} {
     this->base = (volatile regs::hba_t*)libsigma_vm_map(size, nullptr, (void*)phys_base, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON);
     
     printf("ahci: Initializing controller, phys: [0x%lx -> 0x%lx], virt: %p\n", phys_base, phys_base + size, base);
@@ -36,6 +38,8 @@ ahci::controller::controller(uintptr_t phys_base, size_t size){
     ghc.ea = 1; // Enable AHCI access
     base->ghcr.ghc = ghc.raw;
 
+    this->irq = devctl(devCtlEnableIrq, device_descriptor, 0, 0, 0);
+
     ghcr_t::cap_t cap{base->ghcr.cap};
 
     printf("      Link speed: ");
@@ -103,6 +107,7 @@ ahci::controller::controller(uintptr_t phys_base, size_t size){
         if(pi.is_implemented(i)){
             // Initialize port, just print Sig
             ports[i].regs = &base->ports[i];
+            ports[i].clo = cap.sclo;
 
             prs_t::ssts_t ssts{ports[i].regs->ssts};
             if(ssts.det != 3) { // Not Device Detected, Comms Active
@@ -172,6 +177,20 @@ ahci::controller::controller(uintptr_t phys_base, size_t size){
             if(addressing_64bit) ports[i].regs->fbu = (region.physical_addr >> 32) & 0xFFFFFFFF;
             printf("installed\n");
 
+            // Allocate the tables for all slots upfront so issuing a command never has to go to the kernel
+            libsigma_phys_region_t tables = {};
+            if(libsigma_get_phys_region(regs::command_table_size * 32, PROT_READ | PROT_WRITE, MAP_ANON, &tables)){
+                std::cerr << "ahci: Failed to allocate physical region for command tables\n";
+                continue;
+            }
+
+            ports[i].command_tables = (std::byte*)tables.virtual_addr;
+            for(size_t slot = 0; slot < 32; slot++){
+                uint64_t table = tables.physical_addr + (slot * regs::command_table_size);
+                ports[i].region->command_headers[slot].ctba = table & 0xFFFFFFFF;
+                if(addressing_64bit) ports[i].region->command_headers[slot].ctbau = (table >> 32) & 0xFFFFFFFF;
+            }
+
             printf("      Command engine:...");
 
             prs_t::cmd_t cmd{ports[i].regs->cmd};
@@ -235,6 +254,16 @@ ahci::controller::controller(uintptr_t phys_base, size_t size){
 
             ports[i].lba48 = (ports[i].identification[167] & (1 << 2)) && (ports[i].identification[173] & (1 << 2));
 
+            // Word 76 bit 8 is NCQ support, word 75 bits 4:0 the max queue depth - 1
+            // 1 slot stays free for reading the NCQ error log, so at least 2 are needed
+            if(cap.sncq && n_command_slots >= 2 && ports[i].type == prs_t::sig_t::device_types::SATA && (ports[i].identification[153] & (1 << 0))){
+                if(libsigma_get_phys_region(512, PROT_READ | PROT_WRITE, MAP_ANON, &ports[i].log_buffer) == 0){
+                    ports[i].ncq = true;
+                    ports[i].queue_depth = std::min((uint8_t)(n_command_slots - 1), (uint8_t)((ports[i].identification[150] & 0x1F) + 1));
+                    ports[i].log_slot = ports[i].queue_depth;
+                }
+            }
+
             if(ports[i].type == prs_t::sig_t::device_types::SATA){
                 ports[i].n_sectors = *(uint64_t*)(&ports[i].identification[200]);
                 if(ports[i].n_sectors == 0){
@@ -266,9 +295,31 @@ ahci::controller::controller(uintptr_t phys_base, size_t size){
             printf("      Features: ");
             if(ports[i].lba48) printf("LBA48 ");
             if(ports[i].removeable) printf("Removeable ");
+            if(ports[i].ncq) printf("NCQ[Depth %d] ", ports[i].queue_depth);
             printf("\n");
+
+            ports[i].regs->serr = 0xFFFFFFFF;
+            ports[i].regs->is = 0xFFFFFFFF;
+
+            // Register FIS for non-queued commands, Set Device Bits FIS for NCQ and anything that indicates an error
+            prs_t::ie_t ie{0};
+            ie.dhre = 1;
+            ie.sdbe = 1;
+            ie.tfee = 1;
+            ie.hbfe = 1;
+            ie.hbde = 1;
+            ie.ife = 1;
+            ports[i].regs->ie = ie.raw;
+
+            ports[i].active = true;
         }
     }
+
+    // All ports share the 1 interrupt, poll() figures out which ones have work
+    base->ghcr.is = 0xFFFFFFFF;
+    ghc = ghcr_t::ghc_t{base->ghcr.ghc};
+    ghc.ie = (this->irq != UINT64_MAX) ? 1 : 0;
+    base->ghcr.ghc = ghc.raw;
 }
 
 bool ahci::controller::bios_gain_ownership(){
@@ -324,6 +375,126 @@ void ahci::controller::port::wait_idle(){
     }
 }
 
+static void sleep_ms(uint64_t ms){
+    uint32_t word = 0;
+    libsigma_futex_wait(&word, 0, ms + 1); // Nobody wakes it up, +1 since the current ms is already partly over
+}
+
+// Brings the port back after a task file or fatal error, this aborts every outstanding command
+void ahci::controller::port::recover(bool reset){
+    prs_t::cmd_t cmd{this->regs->cmd};
+    cmd.st = 0;
+    this->regs->cmd = cmd.raw;
+
+    while(1){
+        prs_t::cmd_t poll{this->regs->cmd};
+        if(!poll.cr)
+            break;
+    }
+
+    this->regs->serr = 0xFFFFFFFF;
+    this->regs->is = 0xFFFFFFFF;
+
+    // The device can still be BSY or DRQ from the failed command, ST can't be set again until that is gone
+    prs_t::tfd_t tfd{this->regs->tfd};
+    if(reset || tfd.status.busy || tfd.status.drq){
+        bool cleared = false;
+        if(this->clo && !reset){
+            cmd = prs_t::cmd_t{this->regs->cmd};
+            cmd.clo = 1;
+            this->regs->cmd = cmd.raw;
+
+            for(int i = 0; i < 500; i++){
+                if(!prs_t::cmd_t{this->regs->cmd}.clo){
+                    cleared = true;
+                    break;
+                }
+
+                sleep_ms(1);
+            }
+        }
+
+        if(!cleared){
+            // COMRESET, DET has to stay at 1 for at least 1ms
+            prs_t::sctl_t sctl{this->regs->sctl};
+            sctl.det = 1;
+            this->regs->sctl = sctl.raw;
+            sleep_ms(1);
+
+            sctl = prs_t::sctl_t{this->regs->sctl};
+            sctl.det = 0;
+            this->regs->sctl = sctl.raw;
+
+            for(int i = 0; i < 1000 && prs_t::ssts_t{this->regs->ssts}.det != 3; i++)
+                sleep_ms(1);
+
+            if(prs_t::ssts_t{this->regs->ssts}.det == 3)
+                this->wait_ready(); // The device sends a fresh D2H register FIS once it is done resetting
+            else
+                std::cerr << "ahci: Link didn't come back after COMRESET" << std::endl;
+        }
+
+        // Both of them can raise errors of their own
+        this->regs->serr = 0xFFFFFFFF;
+        this->regs->is = 0xFFFFFFFF;
+    }
+
+    cmd = prs_t::cmd_t{this->regs->cmd};
+    cmd.st = 1;
+    this->regs->cmd = cmd.raw;
+}
+
+int ahci::controller::read_ncq_error_log(ahci::controller::port& port){
+    // Non-queued, the port has just been restarted so nothing else is running on it
+    int slot = port.log_slot;
+    auto& header = port.region->command_headers[slot];
+    header.flags = {};
+    header.flags.prdtl = 1;
+    header.flags.write = 0;
+    header.flags.cfl = 5; // h2d fis is 5 dwords long
+    header.prdbc = 0;
+
+    auto* table = (ahci::regs::command_table_t*)(port.command_tables + (slot * regs::command_table_size));
+    memset((void*)table, 0, regs::command_table_size);
+
+    auto& fis = *(ahci::regs::h2d_register_fis*)(table->fis);
+    fis.type = 0x27;
+    fis.flags.c = 1;
+    fis.command = commands::read_log_extended;
+    fis.control = 0x08; // Legacy stuff
+    fis.dev_head = 0xA0;
+    fis.lba_0 = commands::ncq_command_error_log;
+    fis.sector_count_low = 1;
+
+    auto& prdt = table->prdts[0];
+    prdt.flags.byte_count = regs::prdt_t::calculate_bytecount(512);
+    prdt.low = port.log_buffer.physical_addr & 0xFFFFFFFF;
+    prdt.high = (port.log_buffer.physical_addr >> 32) & 0xFFFFFFFF;
+
+    port.wait_ready();
+    port.regs->ci = (1u << slot);
+
+    for(int i = 0; i < 1000 && (port.regs->ci & (1u << slot)); i++){
+        if(prs_t::is_t{port.regs->is}.tfes)
+            break;
+
+        sleep_ms(1);
+    }
+
+    if(port.regs->ci & (1u << slot)){
+        std::cerr << "ahci: Reading the NCQ error log failed" << std::endl;
+        port.recover(true); // Without the log the drive keeps rejecting queued commands, a COMRESET clears that instead
+        return -1;
+    }
+
+    // Byte 0 has the tag in bits 4:0 and NQ in bit 7, set when the failed command wasn't a queued one
+    auto* log = (volatile uint8_t*)port.log_buffer.virtual_addr;
+    if(log[0] & (1 << 7))
+        return -1;
+
+    return log[0] & 0x1F;
+}
+
 void ahci::controller::port::wait_ready(){
     while(1){
         prs_t::tfd_t tfd{this->regs->tfd};
@@ -334,37 +505,39 @@ void ahci::controller::port::wait_ready(){
     }
 }
 
-std::pair<int, ahci::regs::command_table_t*> ahci::controller::allocate_command(ahci::controller::port& port, size_t fis_size){
+std::pair<int, ahci::regs::command_table_t*> ahci::controller::allocate_command(ahci::controller::port& port){
     auto index = get_free_command_slot(port);
     if(index == -1)
         return {-1, nullptr}; // No free command slot available rn
 
     assert(index < 32);
+    port.in_flight |= (1u << index);
 
     auto& header = port.region->command_headers[index];
+    header.flags = {};
+    header.prdbc = 0;
 
-    libsigma_phys_region_t region = {};
-    if(libsigma_get_phys_region(fis_size, PROT_READ | PROT_WRITE, MAP_ANON, &region)){
-        std::cerr << "ahci: Failed to allocate physical region for h2d FIS\n";
-        return {-1, nullptr};
-    }
+    auto* table = (ahci::regs::command_table_t*)(port.command_tables + (index * regs::command_table_size));
+    memset((void*)table, 0, regs::command_table_size);
 
-    header.ctba = region.physical_addr & 0xFFFFFFFF;
-    if(addressing_64bit) header.ctbau = (region.physical_addr >> 32) & 0xFFFFFFFF;
+    return {index, table};
+}
 
-    return {index, (ahci::regs::command_table_t*)region.virtual_addr};
+void ahci::controller::free_command(ahci::controller::port& port, int slot){
+    port.in_flight &= ~(1u << slot);
 }
 
 int ahci::controller::get_free_command_slot(ahci::controller::port& port){
-    for(int i = 0; i < n_command_slots; i++)
-        if((port.regs->ci & (1u << i)) == 0)
+    // NCQ tags are the slot numbers, so only hand out as many as the drive has queue entries
+    for(int i = 0; i < port.queue_depth; i++)
+        if((port.in_flight & (1u << i)) == 0)
             return i;
                     
     return -1;
 }
 
 void ahci::controller::identify(bool packet_device, ahci::controller::port& port){
-    auto slot = allocate_command(port, command_table_t::calculate_length(1)); // We only need 1 prdt since its only 512 bytes
+    auto slot = allocate_command(port); // We only need 1 prdt since its only 512 bytes
 
     auto command_index = slot.first;
     assert(command_index != -1);
@@ -404,11 +577,13 @@ void ahci::controller::identify(bool packet_device, ahci::controller::port& port
 
             if(tfd.status.error){
                 std::cerr << "ahci: Error on identify code: " << tfd.err << std::endl;
+                free_command(port, command_index);
                 return;
             }
         }
     }
 
+    free_command(port, command_index);
     memcpy((void*)port.identification, (void*)region.virtual_addr, 512);
 
     auto verify_region_integrity = +[](uint8_t* identity) -> bool {
@@ -430,7 +605,7 @@ void ahci::controller::identify(bool packet_device, ahci::controller::port& port
 }
 
 std::pair<uint32_t, uint32_t> ahci::controller::pi_read_capacity(ahci::controller::port& port){
-    auto slot = allocate_command(port, command_table_t::calculate_length(1)); // We only need 1 prdt since its only 512 bytes
+    auto slot = allocate_command(port); // We only need 1 prdt since its only 512 bytes
 
     auto command_index = slot.first;
     assert(command_index != -1);
@@ -475,11 +650,13 @@ std::pair<uint32_t, uint32_t> ahci::controller::pi_read_capacity(ahci::controlle
 
             if(tfd.status.error){
                 std::cerr << "ahci: Error on identify code: " << tfd.err << std::endl;
+                free_command(port, command_index);
                 return {0, 0};
             }
         }
     }
 
+    free_command(port, command_index);
 
     auto& response = *(commands::packet_commands::read_capacity::response*)(region.virtual_addr);
     uint32_t lba = response.lba;
@@ -487,63 +664,347 @@ std::pair<uint32_t, uint32_t> ahci::controller::pi_read_capacity(ahci::controlle
     return {bswap32(lba), bswap32(block_size)};
 }
 
-std::vector<uint8_t> ahci::controller::read_sector(ahci::controller::port& port, uint64_t lba){
-    auto slot = allocate_command(port, command_table_t::calculate_length(1)); // Sector size > 4MiB not happening
+bool ahci::controller::submit_rw(ahci::controller::port& port, bool write, uint64_t lba, size_t n_sectors, const std::vector<ahci::sg_entry>& sg, ahci::controller::io_callback cb){
+    if(!port.active || port.type != prs_t::sig_t::device_types::SATA || n_sectors == 0 || (lba + n_sectors) > port.n_sectors)
+        return false;
+
+    size_t bytes = n_sectors * port.bytes_per_sector, sg_bytes = 0;
+    for(const auto& entry : sg){
+        if((entry.phys & 1) || (entry.size & 1) || entry.size == 0)
+            return false; // PRDT entries have to be word aligned
+        sg_bytes += entry.size;
+    }
 
+    if(sg_bytes < bytes)
+        return false;
+
+    struct request {
+        size_t remaining;
+        bool success;
+        io_callback cb;
+    };
+    auto req = std::make_shared<request>(request{.remaining = 0, .success = true, .cb = std::move(cb)});
+
+    // Split into commands that each end on a sector boundary and fit in 1 command table
+    std::vector<command> commands{};
+    size_t entry = 0, entry_offset = 0;
+    auto advance = [&](size_t n){
+        while(n){
+            size_t len = std::min(n, sg[entry].size - entry_offset);
+            n -= len;
+            entry_offset += len;
+            if(entry_offset == sg[entry].size){
+                entry++;
+                entry_offset = 0;
+            }
+        }
+    };
+
+    size_t max_command_bytes = 0xFFFF * port.bytes_per_sector;
+    while(bytes){
+        command cmd{.type = write ? command_types::Write : command_types::Read, .lba = lba, .n_sectors = 0, .prdts = {}, .cb = nullptr};
+
+        size_t cmd_bytes = 0, limit = std::min(bytes, max_command_bytes);
+        size_t i = entry, offset = entry_offset;
+        while(cmd_bytes < limit && cmd.prdts.size() < regs::prdts_per_command){
+            size_t len = std::min({sg[i].size - offset, limit - cmd_bytes, regs::prdt_max_bytes});
+            cmd.prdts.push_back({.phys = sg[i].phys + offset, .size = len});
+            cmd_bytes += len;
+            offset += len;
+            if(offset == sg[i].size){
+                i++;
+                offset = 0;
+            }
+        }
+
+        // Ran out of PRDT entries in the middle of a sector, leave the partial sector to the next command
+        size_t partial = cmd_bytes % port.bytes_per_sector;
+        cmd_bytes -= partial;
+        while(partial){
+            auto& last = cmd.prdts.back();
+            size_t len = std::min(partial, last.size);
+            last.size -= len;
+            partial -= len;
+            if(last.size == 0)
+                cmd.prdts.pop_back();
+        }
+
+        if(cmd_bytes == 0)
+            return false; // Too fragmented to fit even 1 sector in a table
+
+        cmd.n_sectors = cmd_bytes / port.bytes_per_sector;
+        cmd.cb = [req](bool success){
+            if(!success)
+                req->success = false;
+
+            if(--req->remaining == 0 && req->cb)
+                req->cb(req->success);
+        };
+
+        advance(cmd_bytes);
+        lba += cmd.n_sectors;
+        bytes -= cmd_bytes;
+        commands.push_back(std::move(cmd));
+    }
+
+    req->remaining = commands.size();
+    for(auto& cmd : commands)
+        port.pending.push_back(std::move(cmd));
+
+    this->issue_pending(port);
+    return true;
+}
+
+bool ahci::controller::issue(ahci::controller::port& port, ahci::controller::command& cmd){
+    auto slot = allocate_command(port);
     auto command_index = slot.first;
-    assert(command_index != -1);
+    if(command_index == -1)
+        return false;
 
-    port.region->command_headers[command_index].flags.prdtl = 1; // 1 PRDT entry
-    port.region->command_headers[command_index].flags.write = 0; // Reading from device
+    bool queued = port.ncq && cmd.type != command_types::Flush;
+
+    port.region->command_headers[command_index].flags.prdtl = cmd.prdts.size();
+    port.region->command_headers[command_index].flags.write = (cmd.type == command_types::Write) ? 1 : 0;
     port.region->command_headers[command_index].flags.cfl = 5; // h2d fis is 5 dwords long
 
     auto& fis = *(ahci::regs::h2d_register_fis*)(slot.second->fis);
     fis.type = 0x27;
     fis.flags.c = 1;
-    fis.command = commands::read_extended_dma;
     fis.control = 0x08; // Legacy stuff
-    fis.dev_head = 0xA0 | (1 << 6); // Legacy stuff + LBA mode
-    fis.sector_count_low = 1;
-    fis.sector_count_high = 0;
-    fis.lba_0 = lba & 0xFF;
-    fis.lba_1 = (lba >> 8) & 0xFF;
-    fis.lba_2 = (lba >> 16) & 0xFF;
-    fis.lba_3 = (lba >> 24) & 0xFF;
-    fis.lba_4 = (lba >> 32) & 0xFF;
-    fis.lba_5 = (lba >> 40) & 0xFF;    
+    if(cmd.type == command_types::Flush){
+        fis.command = port.lba48 ? commands::flush_cache_extended : commands::flush_cache;
+        fis.dev_head = 0xA0; // Legacy stuff
+    } else if(queued){
+        fis.command = (cmd.type == command_types::Write) ? commands::write_fpdma_queued : commands::read_fpdma_queued;
+        fis.dev_head = (1 << 6); // LBA mode
+        fis.features = cmd.n_sectors & 0xFF;
+        fis.features_exp = (cmd.n_sectors >> 8) & 0xFF;
+        fis.sector_count_low = command_index << 3; // Tag
+    } else {
+        fis.command = (cmd.type == command_types::Write) ? commands::write_extended_dma : commands::read_extended_dma;
+        fis.dev_head = 0xA0 | (1 << 6); // Legacy stuff + LBA mode
+        fis.sector_count_low = cmd.n_sectors & 0xFF;
+        fis.sector_count_high = (cmd.n_sectors >> 8) & 0xFF;
+    }
 
-    auto& prdt = slot.second->prdts[0];
-    prdt.flags.byte_count = regs::prdt_t::calculate_bytecount(port.bytes_per_sector);
-    
-    libsigma_phys_region_t region = {};
-    if(libsigma_get_phys_region(port.bytes_per_sector, PROT_READ | PROT_WRITE, MAP_ANON, &region)){
-        std::cerr << "Failed to allocate physical region for sector data\n";
-        return {};
+    if(cmd.type != command_types::Flush){
+        fis.lba_0 = cmd.lba & 0xFF;
+        fis.lba_1 = (cmd.lba >> 8) & 0xFF;
+        fis.lba_2 = (cmd.lba >> 16) & 0xFF;
+        fis.lba_3 = (cmd.lba >> 24) & 0xFF;
+        fis.lba_4 = (cmd.lba >> 32) & 0xFF;
+        fis.lba_5 = (cmd.lba >> 40) & 0xFF;
     }
 
-    prdt.low = region.physical_addr & 0xFFFFFFFF;
-    prdt.high = (region.physical_addr >> 32) & 0xFFFFFFFF;
+    for(size_t i = 0; i < cmd.prdts.size(); i++){
+        auto& prdt = slot.second->prdts[i];
+        prdt.flags.byte_count = regs::prdt_t::calculate_bytecount(cmd.prdts[i].size);
+        prdt.low = cmd.prdts[i].phys & 0xFFFFFFFF;
+        prdt.high = (cmd.prdts[i].phys >> 32) & 0xFFFFFFFF;
+    }
 
-    port.wait_ready();
+    port.callbacks[command_index] = std::move(cmd.cb);
 
-    port.regs->ci |= (1u << command_index); // Start command
+    // Both registers ignore 0 bits on write, so only touch our own slot and leave the other outstanding ones alone
+    if(queued){
+        port.regs->sact = (1u << command_index);
+    } else {
+        port.non_queued_in_flight = true;
+        port.wait_ready();
+    }
+    port.regs->ci = (1u << command_index); // Start command
 
-    while(port.regs->ci & (1u << command_index)){
-        prs_t::is_t is{port.regs->is};
-        if(is.tfes){
-            prs_t::tfd_t tfd{port.regs->tfd};
+    return true;
+}
 
-            if(tfd.status.error){
-                std::cerr << "ahci: Error on identify code: " << tfd.err << std::endl;
-                return {};
+void ahci::controller::issue_pending(ahci::controller::port& port){
+    while(!port.pending.empty()){
+        auto& cmd = port.pending.front();
+
+        // Queued and non-queued commands can't be mixed, so a non-queued one waits for the port to drain and blocks everything behind it
+        bool queued = port.ncq && cmd.type != command_types::Flush;
+        if(port.non_queued_in_flight || (!queued && port.in_flight))
+            break;
+
+        if(!this->issue(port, cmd))
+            break; // No free slot
+
+        port.pending.pop_front();
+    }
+}
+
+bool ahci::controller::read_async(ahci::controller::port& port, uint64_t lba, size_t n_sectors, const std::vector<ahci::sg_entry>& sg, ahci::controller::io_callback cb){
+    return this->submit_rw(port, false, lba, n_sectors, sg, std::move(cb));
+}
+
+bool ahci::controller::write_async(ahci::controller::port& port, uint64_t lba, size_t n_sectors, const std::vector<ahci::sg_entry>& sg, ahci::controller::io_callback cb){
+    return this->submit_rw(port, true, lba, n_sectors, sg, std::move(cb));
+}
+
+bool ahci::controller::read_async(ahci::controller::port& port, uint64_t lba, size_t n_sectors, uintptr_t phys, ahci::controller::io_callback cb){
+    return this->submit_rw(port, false, lba, n_sectors, {{.phys = phys, .size = n_sectors * port.bytes_per_sector}}, std::move(cb));
+}
+
+bool ahci::controller::write_async(ahci::controller::port& port, uint64_t lba, size_t n_sectors, uintptr_t phys, ahci::controller::io_callback cb){
+    return this->submit_rw(port, true, lba, n_sectors, {{.phys = phys, .size = n_sectors * port.bytes_per_sector}}, std::move(cb));
+}
+
+bool ahci::controller::flush_async(ahci::controller::port& port, ahci::controller::io_callback cb){
+    if(!port.active || port.type != prs_t::sig_t::device_types::SATA)
+        return false;
+
+    port.pending.push_back(command{.type = command_types::Flush, .lba = 0, .n_sectors = 0, .prdts = {}, .cb = std::move(cb)});
+    this->issue_pending(port);
+    return true;
+}
+
+size_t ahci::controller::handle_port(ahci::controller::port& port){
+    // Acknowledge first, anything finishing after this raises a new interrupt
+    prs_t::is_t is{port.regs->is};
+    port.regs->is = is.raw;
+
+    uint32_t completed = 0, failed = 0;
+    if(is.tfes || is.hbfs || is.hbds || is.ifs){
+        prs_t::tfd_t tfd{port.regs->tfd};
+        std::cerr << "ahci: Error on I/O, is: 0x" << std::hex << is.raw << ", error: 0x" << tfd.err << std::dec << std::endl;
+
+        // Whatever already left CI / SACT finished fine before the error, stopping the engine clears both so look first
+        uint32_t running = port.regs->ci;
+        if(port.ncq)
+            running |= port.regs->sact;
+
+        completed = port.in_flight & ~running;
+        failed = port.in_flight & running;
+        port.recover();
+
+        // A queued command failing only takes that tag down, the log says which one it was and the rest can go again
+        if(port.ncq && is.tfes){
+            int tag = this->read_ncq_error_log(port);
+            if(tag != -1 && (failed & (1u << tag))){
+                uint32_t reissue = failed & ~(1u << tag);
+                failed = (1u << tag);
+
+                // The command tables are untouched, so the slots only have to be started again
+                if(reissue){
+                    port.regs->sact = reissue;
+                    port.regs->ci = reissue;
+                }
             }
         }
+    } else {
+        uint32_t running = port.regs->ci;
+        if(port.ncq)
+            running |= port.regs->sact;
+
+        completed = port.in_flight & ~running;
+    }
+
+    // Release the slots before running the callbacks so they can reuse them
+    io_callback callbacks[32];
+    uint32_t done = completed | failed;
+    for(int i = 0; i < 32; i++){
+        if(done & (1u << i)){
+            callbacks[i] = std::move(port.callbacks[i]);
+            port.callbacks[i] = nullptr;
+            free_command(port, i);
+        }
+    }
+
+    if(port.in_flight == 0)
+        port.non_queued_in_flight = false;
+
+    this->issue_pending(port);
+
+    for(int i = 0; i < 32; i++)
+        if((done & (1u << i)) && callbacks[i])
+            callbacks[i]((completed & (1u << i)) != 0);
+
+    return __builtin_popcount(done);
+}
+
+size_t ahci::controller::poll(){
+    uint32_t pending = base->ghcr.is;
+
+    size_t n = 0;
+    for(int i = 0; i < n_allocated_ports; i++)
+        if(ports[i].active && (ports[i].in_flight || (pending & (1u << i))))
+            n += this->handle_port(ports[i]);
+
+    base->ghcr.is = pending; // Port IS has to be cleared before the HBA one
+    return n;
+}
+
+size_t ahci::controller::wait(){
+    if(this->irq != UINT64_MAX)
+        devctl(devCtlWaitOnIrq, this->irq, 0, 0, 0);
+
+    return this->poll();
+}
+
+std::vector<uint8_t> ahci::controller::read_sector(ahci::controller::port& port, uint64_t lba){
+    libsigma_phys_region_t region = {};
+    if(libsigma_get_phys_region(port.bytes_per_sector, PROT_READ | PROT_WRITE, MAP_ANON, &region)){
+        std::cerr << "Failed to allocate physical region for sector data\n";
+        return {};
     }
 
+    bool done = false, success = false;
+    if(!this->read_async(port, lba, 1, region.physical_addr, [&](bool status){ done = true; success = status; }))
+        return {};
+
+    while(!done)
+        this->wait();
+
+    if(!success)
+        return {};
+
     std::vector<uint8_t> ret{};
     ret.resize(port.bytes_per_sector);
 
     memcpy((void*)ret.data(), (void*)region.virtual_addr, port.bytes_per_sector);
 
     return ret;
+}
+
+size_t ahci::block_device::get_sector_size(){
+    return hba.ports[port].bytes_per_sector;
+}
+
+uint64_t ahci::block_device::get_n_sectors(){
+    return hba.ports[port].n_sectors;
+}
+
+size_t ahci::block_device::get_queue_depth(){
+    return hba.ports[port].queue_depth;
+}
+
+size_t ahci::block_device::get_max_sectors(){
+    return 0xFFFF;
+}
+
+size_t ahci::block_device::get_max_segments(){
+    return regs::prdts_per_command;
+}
+
+bool ahci::block_device::start(block::request_types type, uint64_t lba, size_t n_sectors, const std::vector<block::buffer>& segments, block::io_callback done){
+    if(type == block::request_types::Flush)
+        return hba.flush_async(hba.ports[port], std::move(done));
+
+    std::vector<ahci::sg_entry> sg{};
+    sg.reserve(segments.size());
+    for(const auto& segment : segments)
+        sg.push_back({.phys = segment.phys, .size = segment.size});
+
+    if(type == block::request_types::Read)
+        return hba.read_async(hba.ports[port], lba, n_sectors, sg, std::move(done));
+    else
+        return hba.write_async(hba.ports[port], lba, n_sectors, sg, std::move(done));
+}
+
+size_t ahci::block_device::poll(){
+    return hba.poll();
+}
+
+size_t ahci::block_device::wait(){
+    return hba.wait();
 }
\ No newline at end of file
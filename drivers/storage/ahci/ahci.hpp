@@ -5,11 +5,21 @@
 #include <cstddef>
 #include <utility>
 #include <vector>
+#include <functional>
+#include <deque>
+#include <libsigma/sys.h>
+#include <libdriver/block.hpp>
 
 #define PACKED [[gnu::packed]]
 
 namespace ahci
 {
+    // 1 physically contiguous piece of a caller buffer, both fields have to be even
+    struct sg_entry {
+        uintptr_t phys;
+        size_t size;
+    };
+
     namespace regs
     {
         struct PACKED ghcr_t 
@@ -568,6 +578,15 @@ namespace ahci
             }
         };
         static_assert(command_table_t::calculate_length(0) == sizeof(command_table_t));
+
+        // Every slot gets a fixed size table carved out of 1 region per port, tables have to be 128 byte aligned
+        // 248 entries makes a table exactly 1 page, larger or more fragmented transfers get split over several commands
+        constexpr size_t prdts_per_command = 248;
+        constexpr size_t command_table_size = command_table_t::calculate_length(prdts_per_command);
+        static_assert((command_table_size % 128) == 0);
+        static_assert(command_table_size == 0x1000);
+
+        constexpr size_t prdt_max_bytes = 0x3FF000; // Byte count is 22 bits, keep entries page sized so splitting them stays aligned
     } // namespace regs
 
 
@@ -586,10 +605,22 @@ namespace ahci
         constexpr uint8_t write_extended = 0x34;
         constexpr uint8_t write_extended_dma = 0x35;
 
+        // NCQ, sector count goes in the features registers and the tag in bits 7:3 of the sector count
+        constexpr uint8_t read_fpdma_queued = 0x60;
+        constexpr uint8_t write_fpdma_queued = 0x61;
+
         // Identification
         constexpr uint8_t identify = 0xEC;
         constexpr uint8_t identify_packet_interface = 0xA1;
 
+        // Log, after an NCQ error the drive rejects every queued command until page 10h has been read
+        constexpr uint8_t read_log_extended = 0x2F;
+        constexpr uint8_t ncq_command_error_log = 0x10;
+
+        // Cache
+        constexpr uint8_t flush_cache = 0xE7;
+        constexpr uint8_t flush_cache_extended = 0xEA;
+
         // Misc
         constexpr uint8_t send_packet = 0xA0;
 
@@ -622,7 +653,9 @@ namespace ahci
 
     class controller {
         public:
-        controller(uintptr_t phys_base, size_t size);
+        controller(uint64_t device_descriptor, uintptr_t phys_base, size_t size);
+
+        using io_callback = std::function<void(bool success)>;
 
 
         private:
@@ -631,6 +664,21 @@ namespace ahci
         volatile regs::hba_t* base;
         uint8_t major_version, minor_version, subminor_version, n_allocated_ports, n_command_slots;
         bool addressing_64bit;
+        handle_t irq; // 1 MSI for the whole HBA, UINT64_MAX when completions have to be polled
+
+        enum class command_types {
+            Read,
+            Write,
+            Flush,
+        };
+
+        struct command {
+            command_types type;
+            uint64_t lba;
+            size_t n_sectors;
+            std::vector<sg_entry> prdts;
+            io_callback cb;
+        };
 
         struct port {
             volatile regs::prs_t* regs;
@@ -646,29 +694,98 @@ namespace ahci
 
 
             phys_region* region;
+            std::byte* command_tables; // 32 * regs::command_table_size
+            bool active = false; // Engine running and ready for I/O
+            bool clo = false; // HBA can clear a stuck BSY / DRQ with a command list override instead of a COMRESET
 
             uint8_t identification[512];
             bool lba48;
             bool removeable;
+            bool ncq = false;
+            uint8_t queue_depth = 1; // Without NCQ only 1 command may be outstanding
+            uint8_t log_slot; // With NCQ, the slot past the last tag, kept free for reading the error log
+            libsigma_phys_region_t log_buffer;
 
             uint64_t n_sectors;
             uint32_t bytes_per_sector;
 
+            uint32_t in_flight = 0; // Slots owned by a command that hasn't completed yet
+            bool non_queued_in_flight = false; // A non-NCQ command has to run alone on the port
+            io_callback callbacks[32];
+
+            std::deque<command> pending; // Commands waiting for a slot, issued in order
+
             void wait_idle();
             void wait_ready();
+            void recover(bool reset = false); // reset forces a COMRESET even if the device isn't stuck
         };
 
-        std::pair<int, regs::command_table_t*> allocate_command(port& port, size_t fis_size);
+        std::pair<int, regs::command_table_t*> allocate_command(port& port);
+        void free_command(port& port, int slot);
         int get_free_command_slot(port& port);
 
         void identify(bool packet_device, port& port);
         std::pair<uint32_t, uint32_t> pi_read_capacity(port& port);
+        int read_ncq_error_log(port& port); // Returns the tag of the failed command, -1 if it wasn't a queued one or the log couldn't be read
+
+        bool submit_rw(port& port, bool write, uint64_t lba, size_t n_sectors, const std::vector<sg_entry>& sg, io_callback cb);
+        bool issue(port& port, command& cmd);
+        void issue_pending(port& port);
+        size_t handle_port(port& port);
 
         public:
+        // Transfers n_sectors between the drive and the buffer described by sg, the HBA DMAs straight into it
+        // Uses NCQ when the drive supports it so up to queue_depth commands per port can be outstanding, anything beyond that waits in software
+        // Large or fragmented transfers are split over several commands, cb runs once from poll() or wait() after all of them completed and may queue new commands
+        // Returns false if the request is invalid
+        bool read_async(port& port, uint64_t lba, size_t n_sectors, const std::vector<sg_entry>& sg, io_callback cb);
+        bool write_async(port& port, uint64_t lba, size_t n_sectors, const std::vector<sg_entry>& sg, io_callback cb);
+
+        // Same as above for a physically contiguous buffer
+        bool read_async(port& port, uint64_t lba, size_t n_sectors, uintptr_t phys, io_callback cb);
+        bool write_async(port& port, uint64_t lba, size_t n_sectors, uintptr_t phys, io_callback cb);
+
+        // Commits the drive's write cache, only starts once everything queued before it completed
+        bool flush_async(port& port, io_callback cb);
+
+        // Completes finished commands on all ports, returns how many completed
+        size_t poll();
+        // Sleeps until the HBA interrupt fires and then polls, spins instead if there is no interrupt
+        size_t wait();
 
         std::vector<uint8_t> read_sector(port& port, uint64_t lba);
 
+        size_t get_n_ports(){
+            return n_allocated_ports;
+        }
+
+        // Whether the port has a SATA disk ready for I/O
+        bool is_disk(size_t port){
+            return ports[port].active && ports[port].type == regs::prs_t::sig_t::device_types::SATA;
+        }
+
         
         port* ports;
     };
+
+    // Exposes the disk on 1 port to the block layer
+    class block_device : public block::device {
+        public:
+        block_device(controller& hba, size_t port): hba{hba}, port{port} {}
+
+        size_t get_sector_size() override;
+        uint64_t get_n_sectors() override;
+
+        size_t get_queue_depth() override;
+        size_t get_max_sectors() override;
+        size_t get_max_segments() override;
+
+        bool start(block::request_types type, uint64_t lba, size_t n_sectors, const std::vector<block::buffer>& segments, block::io_callback done) override;
+        size_t poll() override;
+        size_t wait() override;
+
+        private:
+        controller& hba;
+        size_t port;
+    };
 } // namespace ahci
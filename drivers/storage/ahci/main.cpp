@@ -3,8 +3,10 @@
 #include <limits.h>
 #include <libsigma/sys.h>
 #include <iostream>
+#include <memory>
 
 #include "ahci.hpp"
+#include <libdriver/block_cache.hpp>
 
 int main(){
     // Disable buffering for stdout and stderr so debug message show up immediately
@@ -25,7 +27,23 @@ int main(){
     libsigma_resource_region_t region = {};
     devctl(devCtlGetResourceRegion, device_descriptor, resourceRegionOriginPciBar, 5, (uint64_t)&region);
 
-    ahci::controller controller{region.base, region.len};
-    while(1)
-        asm("pause");
+    ahci::controller controller{device_descriptor, region.base, region.len};
+
+    std::vector<std::unique_ptr<ahci::block_device>> devices{};
+    std::vector<std::unique_ptr<block::queue>> queues{};
+    std::vector<std::unique_ptr<block::cache>> caches{};
+    std::vector<block::cache*> writeback{};
+    auto cache_config = block::cache::config::from_environment();
+    for(size_t i = 0; i < controller.get_n_ports(); i++){
+        if(!controller.is_disk(i))
+            continue;
+
+        auto& device = devices.emplace_back(std::make_unique<ahci::block_device>(controller, i));
+        auto& queue = queues.emplace_back(std::make_unique<block::queue>(*device));
+        auto& cache = caches.emplace_back(std::make_unique<block::cache>(*queue, cache_config));
+        writeback.push_back(cache.get());
+        block::print_device(std::string{"/dev/sd"} + (char)('a' + devices.size() - 1), *queue);
+    }
+
+    block::run_writeback(writeback, cache_config.writeback_interval_ms);
 }
\ No newline at end of file
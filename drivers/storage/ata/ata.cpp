@@ -2,6 +2,8 @@
 #include <iostream>
 #include <cstring>
 #include <libdriver/io.hpp>
+#include <algorithm>
+#include <sys/mman.h>
 
 uint8_t ata::controller::read_cmd(uint8_t reg){
     return inb(this->base.first + reg);
@@ -230,6 +232,12 @@ void ata::controller::init_drive(disk& device){
         device.flags.lba = 1;
     //}
     device.flags.lba48 = (device.identity[167] & (1 << 2)) && (device.identity[173] & (1 << 2));
+    device.flags.dma = (device.identity[99] & (1 << 0)) != 0; // Word 49 bit 8
+
+    if(device.flags.lba48)
+        device.n_sectors = *(uint64_t*)(device.identity + 200); // Words 100 - 103
+    else
+        device.n_sectors = *(uint32_t*)(device.identity + 120); // Words 60 - 61
 
     if(!device.flags.lba){
         std::cout << "ata: No LBA support detected, not furthering initialization" << std::endl;
@@ -247,7 +255,7 @@ void ata::controller::init_drive(disk& device){
 		model[i + 1] = tmp;
     }
 
-    std::cout << "ata: Identified device, model: " << model << ", pio32: " << (device.flags.pio32 ? ("supported") : ("unsupported")) << ", lba48: " << (device.flags.lba48 ? ("supported") : ("unsupported")) << std::endl;
+    std::cout << "ata: Identified device, model: " << model << ", pio32: " << (device.flags.pio32 ? ("supported") : ("unsupported")) << ", lba48: " << (device.flags.lba48 ? ("supported") : ("unsupported")) << ", dma: " << (device.flags.dma ? ("supported") : ("unsupported")) << std::endl;
 
     device.flags.exists = 1;
 }
@@ -280,4 +288,245 @@ void ata::controller::init(){
     this->ports[1] = {};
     this->ports[1].slave = true;
     this->init_drive(this->ports[1]);
+}
+
+void ata::controller::init_dma(){
+    if(this->busmaster_base == 0){
+        std::cout << "ata: No bus master IDE, using PIO" << std::endl;
+        return;
+    }
+
+    libsigma_phys_region_t region = {};
+    if(libsigma_get_phys_region(prdt_entries * sizeof(regs::prd), PROT_READ | PROT_WRITE, MAP_ANON, &region)){
+        std::cerr << "ata: Failed to allocate physical region for PRDT" << std::endl;
+        return;
+    }
+
+    if((region.physical_addr + region.size) > 0x100000000){
+        std::cerr << "ata: PRDT is above 4GiB, using PIO" << std::endl;
+        return;
+    }
+
+    this->prdt = (regs::prd*)region.virtual_addr;
+    this->prdt_phys = region.physical_addr;
+    std::cout << "ata: Using bus master DMA, base: 0x" << std::hex << this->busmaster_base << ", irq: " << ((this->irq != UINT64_MAX) ? "yes" : "no, polling") << std::endl;
+}
+
+void ata::controller::setup_lba(disk& device, uint64_t lba, size_t n_sectors){
+    namespace cmd = command_registers;
+
+    if(device.flags.lba48){
+        this->select_drive(device.slave, true, 0);
+        wait_busy_clear();
+
+        // High order bytes go first, the registers are 2 deep FIFOs
+        write_cmd(cmd::sector_count, (n_sectors >> 8) & 0xFF);
+        write_cmd(cmd::lba_low, (lba >> 24) & 0xFF);
+        write_cmd(cmd::lba_mid, (lba >> 32) & 0xFF);
+        write_cmd(cmd::lba_high, (lba >> 40) & 0xFF);
+    } else {
+        this->select_drive(device.slave, true, (lba >> 24) & 0xF);
+        wait_busy_clear();
+    }
+
+    write_cmd(cmd::sector_count, n_sectors & 0xFF); // 0 means 256 or 65536 sectors
+    write_cmd(cmd::lba_low, lba & 0xFF);
+    write_cmd(cmd::lba_mid, (lba >> 8) & 0xFF);
+    write_cmd(cmd::lba_high, (lba >> 16) & 0xFF);
+}
+
+bool ata::controller::wait_drq(){
+    while(true){
+        auto status = regs::status{.raw = read_control(control_registers::alt_status)};
+        if(status.busy)
+            continue;
+
+        if(status.error || status.drive_fault)
+            return false;
+
+        if(status.drq)
+            return true;
+    }
+}
+
+bool ata::controller::wait_dma(){
+    namespace bm = busmaster_registers;
+
+    // The IRQ can be stale from an earlier PIO command, the bus master status tells if it was really this transfer
+    while(true){
+        auto status = regs::busmaster_status{.raw = inb(this->busmaster_base + bm::status)};
+        if(status.irq || status.error)
+            break;
+
+        if(this->irq != UINT64_MAX)
+            devctl(devCtlWaitOnIrq, this->irq, 0, 0, 0);
+        else
+            asm("pause");
+    }
+
+    outb(this->busmaster_base + bm::command, 0); // Stop the engine
+
+    auto bm_status = regs::busmaster_status{.raw = inb(this->busmaster_base + bm::status)};
+    auto status = regs::status{.raw = read_cmd(command_registers::status)}; // Also acknowledges the drive's IRQ
+    outb(this->busmaster_base + bm::status, bm_status.raw); // Error and IRQ are write 1 to clear
+
+    if(bm_status.error || status.error || status.drive_fault){
+        std::cerr << "ata: DMA transfer failed, status: 0x" << std::hex << uint64_t{status.raw} << ", bus master status: 0x" << uint64_t{bm_status.raw} << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool ata::controller::transfer_dma(disk& device, bool write, uint64_t lba, size_t n_sectors, uintptr_t phys){
+    namespace cmd = command_registers;
+    namespace bm = busmaster_registers;
+
+    // Split the buffer on 64KiB boundaries, a PRD can't cross one
+    size_t bytes = n_sectors * sector_size, n_prds = 0;
+    while(bytes){
+        size_t len = std::min(bytes, 0x10000 - (phys & 0xFFFF));
+        this->prdt[n_prds++] = regs::prd{.phys = (uint32_t)phys, .size = (uint16_t)(len & 0xFFFF), .flags = 0};
+        phys += len;
+        bytes -= len;
+    }
+    this->prdt[n_prds - 1].flags = regs::prd::end_of_table;
+
+    outd(this->busmaster_base + bm::prdt, this->prdt_phys);
+
+    regs::busmaster_command command{};
+    command.read = !write;
+    outb(this->busmaster_base + bm::command, command.raw);
+    outb(this->busmaster_base + bm::status, inb(this->busmaster_base + bm::status) | (1 << 1) | (1 << 2)); // Clear stale error and IRQ
+
+    this->setup_lba(device, lba, n_sectors);
+    if(device.flags.lba48)
+        write_cmd(cmd::command, write ? commands::write_dma_ext : commands::read_dma_ext);
+    else
+        write_cmd(cmd::command, write ? commands::write_dma : commands::read_dma);
+
+    command.start = 1;
+    outb(this->busmaster_base + bm::command, command.raw);
+
+    return this->wait_dma();
+}
+
+bool ata::controller::transfer_pio(disk& device, bool write, uint64_t lba, size_t n_sectors, uint8_t* buffer){
+    namespace cmd = command_registers;
+
+    this->setup_lba(device, lba, n_sectors);
+    if(device.flags.lba48)
+        write_cmd(cmd::command, write ? commands::write_ext : commands::read_ext);
+    else
+        write_cmd(cmd::command, write ? commands::write : commands::read);
+    ns_wait();
+
+    auto* data = (uint16_t*)buffer;
+    for(size_t i = 0; i < n_sectors; i++){
+        if(!this->wait_drq())
+            return false;
+
+        for(size_t j = 0; j < (sector_size / 2); j++){
+            if(write)
+                outw(this->base.first + cmd::data, *data++);
+            else
+                *data++ = inw(this->base.first + cmd::data);
+        }
+    }
+
+    return wait_busy_clear();
+}
+
+bool ata::controller::transfer(uint8_t drive, bool write, uint64_t lba, size_t n_sectors, uint8_t* buffer, uintptr_t phys){
+    if(drive >= 2 || !this->ports[drive].flags.exists || n_sectors == 0)
+        return false;
+
+    auto& device = this->ports[drive];
+    if(!device.flags.lba48 && (lba + n_sectors) > 0x10000000)
+        return false; // Out of reach of LBA28
+
+    size_t max_sectors = device.flags.lba48 ? max_sectors_lba48 : max_sectors_lba28;
+    bool dma = device.flags.dma && this->prdt && phys && ((phys & 1) == 0) && ((phys + (n_sectors * sector_size)) <= 0x100000000);
+    while(n_sectors){
+        size_t n = std::min(n_sectors, max_sectors);
+        if(!(dma ? this->transfer_dma(device, write, lba, n, phys) : this->transfer_pio(device, write, lba, n, buffer)))
+            return false;
+
+        lba += n;
+        n_sectors -= n;
+        buffer += n * sector_size;
+        phys += n * sector_size;
+    }
+
+    return true;
+}
+
+bool ata::controller::read(uint8_t drive, uint64_t lba, size_t n_sectors, void* buffer, uintptr_t phys){
+    return this->transfer(drive, false, lba, n_sectors, (uint8_t*)buffer, phys);
+}
+
+bool ata::controller::write(uint8_t drive, uint64_t lba, size_t n_sectors, const void* buffer, uintptr_t phys){
+    return this->transfer(drive, true, lba, n_sectors, (uint8_t*)buffer, phys);
+}
+
+bool ata::controller::flush(uint8_t drive){
+    if(drive >= 2 || !this->ports[drive].flags.exists)
+        return false;
+
+    auto& device = this->ports[drive];
+    this->select_drive(device.slave, true, 0);
+    wait_busy_clear();
+
+    write_cmd(command_registers::command, device.flags.lba48 ? commands::flush_cache_ext : commands::flush_cache);
+    ns_wait();
+
+    return wait_busy_clear();
+}
+
+size_t ata::block_device::get_sector_size(){
+    return controller::sector_size;
+}
+
+uint64_t ata::block_device::get_n_sectors(){
+    return channel.get_n_sectors(drive);
+}
+
+size_t ata::block_device::get_queue_depth(){
+    return 1;
+}
+
+size_t ata::block_device::get_max_sectors(){
+    return channel.get_max_sectors(drive);
+}
+
+size_t ata::block_device::get_max_segments(){
+    return 1;
+}
+
+bool ata::block_device::start(block::request_types type, uint64_t lba, size_t n_sectors, const std::vector<block::buffer>& segments, block::io_callback done){
+    bool success = false;
+    if(type == block::request_types::Flush)
+        success = channel.flush(drive);
+    else if(segments.size() == 1 && type == block::request_types::Read)
+        success = channel.read(drive, lba, n_sectors, segments[0].virt, segments[0].phys);
+    else if(segments.size() == 1 && type == block::request_types::Write)
+        success = channel.write(drive, lba, n_sectors, segments[0].virt, segments[0].phys);
+
+    this->completed.push_back({std::move(done), success});
+    return true;
+}
+
+size_t ata::block_device::poll(){
+    // Callbacks can start new I/O which lands in the fresh list
+    auto done = std::move(this->completed);
+    this->completed = {};
+
+    for(auto& [cb, success] : done)
+        cb(success);
+
+    return done.size();
+}
+
+size_t ata::block_device::wait(){
+    return this->poll();
 }
\ No newline at end of file
@@ -1,7 +1,11 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <utility>
+#include <libsigma/sys.h>
+#include <libdriver/block.hpp>
+#include <vector>
 
 
 namespace ata {
@@ -36,6 +40,13 @@ namespace ata {
         constexpr uint16_t drive_address = 3;
     }
 
+    // Offsets into the channel's 8 bytes of the PCI bus master IDE BAR
+    namespace busmaster_registers {
+        constexpr uint16_t command = 0;
+        constexpr uint16_t status = 2;
+        constexpr uint16_t prdt = 4;
+    }
+
     namespace regs {
         union status {
             struct {
@@ -81,22 +92,88 @@ namespace ata {
             uint8_t raw;
         };
         static_assert(sizeof(device_control) == 1);
+
+        union busmaster_command {
+            struct {
+                uint8_t start : 1;
+                uint8_t reserved : 2;
+                uint8_t read : 1; // Direction is from the bus master's view, set when the device writes to memory
+                uint8_t reserved1 : 4;
+            };
+            uint8_t raw;
+        };
+        static_assert(sizeof(busmaster_command) == 1);
+
+        union busmaster_status {
+            struct {
+                uint8_t active : 1;
+                uint8_t error : 1;
+                uint8_t irq : 1;
+                uint8_t reserved : 2;
+                uint8_t drive0_dma : 1;
+                uint8_t drive1_dma : 1;
+                uint8_t simplex : 1;
+            };
+            uint8_t raw;
+        };
+        static_assert(sizeof(busmaster_status) == 1);
+
+        // Physical Region Descriptor, the region can't cross a 64KiB boundary and a size of 0 means 64KiB
+        struct [[gnu::packed]] prd {
+            uint32_t phys;
+            uint16_t size;
+            uint16_t flags;
+
+            static constexpr uint16_t end_of_table = (1 << 15);
+        };
+        static_assert(sizeof(prd) == 8);
     };
 
     namespace commands {
         constexpr uint8_t read = 0x20;
         constexpr uint8_t write = 0x30;
 
+        constexpr uint8_t read_ext = 0x24;
+        constexpr uint8_t write_ext = 0x34;
+
         constexpr uint8_t read_dma = 0xC8;
         constexpr uint8_t write_dma = 0xCA;
 
+        constexpr uint8_t read_dma_ext = 0x25;
+        constexpr uint8_t write_dma_ext = 0x35;
+
         constexpr uint8_t identify = 0xEC;
+
+        constexpr uint8_t flush_cache = 0xE7;
+        constexpr uint8_t flush_cache_ext = 0xEA;
     }
 
     class controller {
         public:
-        controller(std::pair<uint16_t, uint16_t> base): base(base) {
+        // busmaster_base is the channel's part of the bus master IDE BAR, 0 if there is none, irq is used to sleep during DMA
+        controller(std::pair<uint16_t, uint16_t> base, uint16_t busmaster_base = 0, handle_t irq = UINT64_MAX): base(base), busmaster_base(busmaster_base), irq(irq), prdt(nullptr), prdt_phys(0) {
             this->init();
+            this->init_dma();
+        }
+
+        static constexpr size_t sector_size = 512;
+
+        // Transfers n_sectors between drive 0 (master) or 1 (slave) and buffer
+        // phys is the physical address of the contiguous buffer, DMA is used when the drive supports it and it is below 4GiB, otherwise it falls back to PIO
+        bool read(uint8_t drive, uint64_t lba, size_t n_sectors, void* buffer, uintptr_t phys);
+        bool write(uint8_t drive, uint64_t lba, size_t n_sectors, const void* buffer, uintptr_t phys);
+        bool flush(uint8_t drive);
+
+        bool is_present(uint8_t drive){
+            return drive < 2 && ports[drive].flags.exists;
+        }
+
+        uint64_t get_n_sectors(uint8_t drive){
+            return ports[drive].n_sectors;
+        }
+
+        size_t get_max_sectors(uint8_t drive){
+            return ports[drive].flags.lba48 ? max_sectors_lba48 : max_sectors_lba28;
         }
 
         private:
@@ -107,9 +184,11 @@ namespace ata {
                 uint64_t lba : 1;
                 uint64_t lba48 : 1;
                 uint64_t pio32 : 1;
+                uint64_t dma : 1;
             } flags;
 
             std::pair<uint8_t, uint8_t> id;
+            uint64_t n_sectors;
 
             uint8_t identity[512];
         };
@@ -117,6 +196,14 @@ namespace ata {
 
         void init();
         void init_drive(disk& device);
+        void init_dma();
+
+        bool transfer(uint8_t drive, bool write, uint64_t lba, size_t n_sectors, uint8_t* buffer, uintptr_t phys);
+        bool transfer_dma(disk& device, bool write, uint64_t lba, size_t n_sectors, uintptr_t phys);
+        bool transfer_pio(disk& device, bool write, uint64_t lba, size_t n_sectors, uint8_t* buffer);
+        void setup_lba(disk& device, uint64_t lba, size_t n_sectors);
+        bool wait_drq();
+        bool wait_dma();
 
         uint8_t read_cmd(uint8_t reg);
         uint8_t read_control(uint8_t reg);
@@ -137,8 +224,39 @@ namespace ata {
         void select_drive(bool slave, bool lba, uint8_t lba28_nibble);
 
         std::pair<uint16_t, uint16_t> base;
+        uint16_t busmaster_base;
+        handle_t irq;
+
+        // 1 page of PRDs, enough for the largest command
+        static constexpr size_t prdt_entries = 0x1000 / sizeof(regs::prd);
+        static constexpr size_t max_sectors_lba48 = 0x8000; // 16MiB, at most 257 PRDs for a contiguous buffer
+        static constexpr size_t max_sectors_lba28 = 256;
+        regs::prd* prdt;
+        uintptr_t prdt_phys;
 
         
         disk ports[2];
     };
+
+    // Exposes 1 drive to the block layer, the channel runs 1 command at a time so I/O completes inside start() and is reported on the next poll()
+    class block_device : public block::device {
+        public:
+        block_device(controller& channel, uint8_t drive): channel{channel}, drive{drive}, completed{} {}
+
+        size_t get_sector_size() override;
+        uint64_t get_n_sectors() override;
+
+        size_t get_queue_depth() override;
+        size_t get_max_sectors() override;
+        size_t get_max_segments() override;
+
+        bool start(block::request_types type, uint64_t lba, size_t n_sectors, const std::vector<block::buffer>& segments, block::io_callback done) override;
+        size_t poll() override;
+        size_t wait() override;
+
+        private:
+        controller& channel;
+        uint8_t drive;
+        std::vector<std::pair<block::io_callback, bool>> completed;
+    };
 }
\ No newline at end of file
@@ -1,9 +1,11 @@
 #include "ata.hpp"
+#include <libdriver/block_cache.hpp>
 #include <fcntl.h>
 #include <unistd.h>
 #include <limits.h>
 #include <libsigma/sys.h>
 #include <iostream>
+#include <memory>
 
 int main(){
     // Disable buffering for stdout and stderr so debug message show up immediately
@@ -22,11 +24,22 @@ int main(){
         std::cout << "ata: Failed to claim controller" << std::endl;
     }
 
-    libsigma_resource_region_t regions[4] = {};
+    libsigma_resource_region_t regions[5] = {};
     devctl(devCtlGetResourceRegion, device_descriptor, resourceRegionOriginPciBar, 0, (uint64_t)&regions[0]);
     devctl(devCtlGetResourceRegion, device_descriptor, resourceRegionOriginPciBar, 1, (uint64_t)&regions[1]);
     devctl(devCtlGetResourceRegion, device_descriptor, resourceRegionOriginPciBar, 2, (uint64_t)&regions[2]);
     devctl(devCtlGetResourceRegion, device_descriptor, resourceRegionOriginPciBar, 3, (uint64_t)&regions[3]);
+    devctl(devCtlGetResourceRegion, device_descriptor, resourceRegionOriginPciBar, 4, (uint64_t)&regions[4]); // Bus master IDE
+
+    uint16_t busmaster_base = regions[4].base;
+    if(busmaster_base != 0){
+        // Let the controller DMA
+        auto command = devctl(devCtlReadPci, device_descriptor, 0x4, 2, 0);
+        devctl(devCtlWritePci, device_descriptor, 0x4, 2, command | (1 << 2));
+    }
+
+    // In compatibility mode the primary channel is hardwired to ISA IRQ 14
+    handle_t irq = devctl(devCtlEnableIrq, device_descriptor, (regions[0].base == 0) ? 14 : 0, 0, 0);
 
     std::pair<uint16_t, uint16_t> ata1_base = ata::isa_ata1_base;
 
@@ -37,7 +50,24 @@ int main(){
         ata1_base.second = regions[1].base;
 
     std::cout << "ata: Booting controller 1 with region 0x" << std::hex << ata1_base.first << " : 0x" << ata1_base.second << std::endl;
-    ata::controller ata1{ata1_base};
+    ata::controller ata1{ata1_base, busmaster_base, irq};
     std::cout << "ata: Initialized controller 1" << std::endl;
-    while(1);
+
+    std::vector<std::unique_ptr<ata::block_device>> devices{};
+    std::vector<std::unique_ptr<block::queue>> queues{};
+    std::vector<std::unique_ptr<block::cache>> caches{};
+    std::vector<block::cache*> writeback{};
+    auto cache_config = block::cache::config::from_environment();
+    for(uint8_t drive = 0; drive < 2; drive++){
+        if(!ata1.is_present(drive))
+            continue;
+
+        auto& device = devices.emplace_back(std::make_unique<ata::block_device>(ata1, drive));
+        auto& queue = queues.emplace_back(std::make_unique<block::queue>(*device));
+        auto& cache = caches.emplace_back(std::make_unique<block::cache>(*queue, cache_config));
+        writeback.push_back(cache.get());
+        block::print_device(std::string{"/dev/hd"} + (char)('a' + drive), *queue);
+    }
+
+    block::run_writeback(writeback, cache_config.writeback_interval_ms);
 }
\ No newline at end of file
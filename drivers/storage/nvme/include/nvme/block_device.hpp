@@ -0,0 +1,30 @@
+#pragma once
+
+#include <libdriver/block.hpp>
+#include <nvme/io_controller.hpp>
+
+namespace nvme
+{
+    // Exposes 1 namespace to the block layer, all its I/O goes through 1 I/O queue
+    class block_device : public block::device {
+        public:
+        block_device(io_controller& controller, nsid_t nsid, size_t queue): controller{controller}, nsid{nsid}, queue{queue} {}
+
+        size_t get_sector_size() override;
+        uint64_t get_n_sectors() override;
+
+        size_t get_queue_depth() override;
+        size_t get_max_sectors() override;
+        size_t get_max_segments() override;
+
+        bool start(block::request_types type, uint64_t lba, size_t n_sectors, const std::vector<block::buffer>& segments, block::io_callback done) override;
+        void kick() override;
+        size_t poll() override;
+        size_t wait() override;
+
+        private:
+        io_controller& controller;
+        nsid_t nsid;
+        size_t queue;
+    };
+} // namespace nvme
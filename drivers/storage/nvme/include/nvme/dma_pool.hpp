@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <libsigma/sys.h>
+#include <optional>
+#include <vector>
+
+namespace nvme
+{
+    // Physically contiguous memory the controller can DMA into directly
+    struct dma_buffer {
+        void* virt;
+        uintptr_t phys;
+        size_t size;
+    };
+
+    // Fixed size buffers carved out of 1 physical region allocated upfront, nothing is ever returned to the kernel
+    // Not thread safe, every I/O queue owns its own pools
+    class dma_pool {
+        public:
+        dma_pool() = default;
+        dma_pool(size_t n_buffers, size_t buffer_size);
+
+        std::optional<dma_buffer> alloc();
+        void free(const dma_buffer& buffer);
+
+        size_t get_buffer_size(){
+            return buffer_size;
+        }
+
+        size_t get_n_free(){
+            return free_list.size();
+        }
+
+        private:
+        libsigma_phys_region_t region;
+        size_t buffer_size;
+        std::vector<size_t> free_list;
+    };
+} // namespace nvme
@@ -4,15 +4,17 @@
 #include <libsigma/sys.h>
 #include <vector>
 #include <unordered_map>
+#include <functional>
 
 #include <nvme/common.hpp>
 #include <nvme/queue.hpp>
 #include <nvme/regs.hpp>
+#include <nvme/dma_pool.hpp>
 
 namespace nvme {
     class io_controller {
         public:
-        io_controller(libsigma_resource_region_t region);
+        io_controller(uint64_t device_descriptor, libsigma_resource_region_t region);
 
         enum class shutdown_types {
             NormalShutdown,
@@ -22,11 +24,75 @@ namespace nvme {
         void set_power_state(shutdown_types type);
         void reset_subsystem();
         
-        std::vector<uint8_t> read_sector(nsid_t nsid, uint64_t lba);
+        using io_callback = std::function<void(bool success)>;
+
+        // There is 1 I/O queue per CPU, up to what the driver has threads for and the controller grants, and each one is only meant to be used from its CPU
+        // There is no locking on the I/O path, so the first thread to use a queue owns it and any other thread using it trips an assert
+        // Pinning alone isn't enough, 2 threads on the same CPU can still preempt each other halfway through a submit
+        size_t get_n_io_queues(){
+            return io_queues.size();
+        }
+
+        uint64_t get_io_queue_cpu(size_t queue){
+            return io_queues[queue].cpu;
+        }
+
+        // Transfers n_sectors between the namespace and the buffer starting offset bytes into it, the controller DMAs straight into the buffer
+        // Anything above the max transfer size is split into several commands and cb runs once all of them completed
+        // Nothing is sent until submit(), returns false if the request is invalid or the queue has no room for it, cb runs from poll() or wait()
+        bool read_async(size_t queue, nsid_t nsid, uint64_t lba, size_t n_sectors, const dma_buffer& buffer, size_t offset, io_callback cb);
+        bool write_async(size_t queue, nsid_t nsid, uint64_t lba, size_t n_sectors, const dma_buffer& buffer, size_t offset, io_callback cb);
+        // Commits the volatile write cache to media
+        bool flush_async(size_t queue, nsid_t nsid, io_callback cb);
+        // Tells the controller the {lba, n_sectors} ranges are unused, at most regs::dsm_max_ranges at a time
+        bool deallocate_async(size_t queue, nsid_t nsid, const std::vector<std::pair<uint64_t, uint32_t>>& ranges, io_callback cb);
+
+        // Synchronous versions of the above
+        bool read(size_t queue, nsid_t nsid, uint64_t lba, size_t n_sectors, const dma_buffer& buffer, size_t offset);
+        bool write(size_t queue, nsid_t nsid, uint64_t lba, size_t n_sectors, const dma_buffer& buffer, size_t offset);
+        bool flush(size_t queue, nsid_t nsid);
+
+        // Buffers of get_dma_pool(queue).get_buffer_size() bytes owned by the driver, only use them from the thread that owns the queue
+        dma_pool& get_dma_pool(size_t queue){
+            return get_owned_queue(queue).data_pool;
+        }
+
+        size_t get_max_transfer_size(){
+            return max_transfer_size;
+        }
+
+        uint64_t get_sector_size(nsid_t nsid){
+            return namespaces[nsid].sector_size;
+        }
+
+        uint64_t get_n_sectors(nsid_t nsid){
+            return namespaces[nsid].n_lbas;
+        }
+
+        const std::string& get_namespace_path(nsid_t nsid){
+            return namespaces[nsid].path;
+        }
+
+        size_t get_io_queue_depth(size_t queue){
+            return io_queues[queue].pair.get_n_entries() - 1; // 1 entry always stays empty to tell a full queue from an empty one
+        }
+
+        void submit(size_t queue); // Rings the doorbell for everything queued so far
+        size_t poll(size_t queue);
+        // Sleeps until the interrupt of the queue fires and reaps, spins instead if the queue has no interrupt
+        size_t wait(size_t queue);
+
+        // Keeps depth random single sector reads in flight for ms milliseconds, rounded up to whole benchmark ticks, returns the achieved IOPS
+        uint64_t benchmark(size_t queue, nsid_t nsid, size_t depth, uint64_t ms);
+
+        std::vector<nsid_t> get_namespaces();
 
         private:
-        bool set_features(uint8_t fid, uint32_t data);
-        bool register_queue_pair(queue_pair& pair);
+        bool set_features(uint8_t fid, uint32_t data, uint32_t* result = nullptr);
+        bool register_queue_pair(queue_pair& pair, bool irq_enable, uint16_t irq_vector);
+        void create_io_queues(uint64_t device_descriptor);
+        bool submit_rw(size_t queue, uint8_t opcode, nsid_t nsid, uint64_t lba, size_t n_sectors, const dma_buffer& buffer, size_t offset, io_callback cb);
+        bool wait_for(size_t queue, const std::function<bool(io_callback)>& start);
         bool identify_controller(regs::controller_identify_info* info);
         bool identify_namespace(nsid_t nsid, regs::namespace_identify_info* info);
 
@@ -34,7 +100,15 @@ namespace nvme {
 
         std::vector<nsid_t> get_active_namespaces(nsid_t max_nsid);
 
+        bool init_benchmark();
+
+        struct io_queue;
+        io_queue& get_owned_queue(size_t queue);
+
         bool weighted_round_robin_supported;
+        bool sgl_supported;
+        bool dsm_supported;
+        size_t max_transfer_size;
 
         size_t doorbell_stride;
         size_t n_queue_entries;
@@ -42,7 +116,16 @@ namespace nvme {
         volatile regs::bar* base;
 
         queue_pair admin_queue;
-        queue_pair io_queue;
+
+        struct io_queue {
+            queue_pair pair;
+            uint64_t cpu;
+            handle_t irq; // UINT64_MAX when completions have to be polled
+            dma_pool prp_pool; // Pages for PRP lists and DSM ranges of commands in flight
+            dma_pool data_pool;
+            tid_t owner = UINT64_MAX; // Thread that first used the queue
+        };
+        std::vector<io_queue> io_queues;
 
         std::string path;
 
@@ -53,5 +136,12 @@ namespace nvme {
         };
 
         std::unordered_map<nsid_t, ns> namespaces;
+
+        // There is no way to free a physical region or close a handle, so every benchmark run shares these
+        struct {
+            bool initialized = false;
+            libsigma_phys_region_t region;
+            handle_t waitset, timer; // The timer is periodic and stays in the waitset
+        } bench;
     };
 }
\ No newline at end of file
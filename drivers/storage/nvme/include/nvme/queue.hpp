@@ -4,6 +4,9 @@
 #include <stddef.h>
 #include <libsigma/sys.h>
 #include <libdriver/bit.hpp>
+#include <functional>
+#include <optional>
+#include <vector>
 
 #include <nvme/common.hpp>
 #include <nvme/regs.hpp>
@@ -15,8 +18,25 @@ namespace nvme
         queue_pair() = default;
         queue_pair(size_t n_entries, uint16_t* submission_doorbell, uint16_t* completion_doorbell, qid_t qid);
 
-        cid_t send_command(regs::command* cmd);
-        bool send_and_wait(regs::command* cmd);
+        using callback = std::function<void(const regs::completion&)>;
+
+        // Queues the command without ringing the doorbell, returns std::nullopt if the queue is full
+        // The callback runs from reap() once the command completes
+        std::optional<cid_t> submit(regs::command* cmd, callback cb);
+        // Rings the submission doorbell once for everything submitted since the last flush
+        void flush();
+        // Handles up to max completions and rings the completion doorbell once, returns how many were handled
+        size_t reap(size_t max = SIZE_MAX);
+
+        bool send_and_wait(regs::command* cmd, uint32_t* result = nullptr); // result receives the command specific dword of the completion
+
+        size_t get_n_in_flight(){
+            return n_in_flight;
+        }
+
+        bool is_full(){
+            return n_in_flight == (n_entries - 1); // A full ring would look empty to the controller
+        }
 
         size_t get_n_entries();
         uintptr_t get_submission_phys_base();
@@ -31,6 +51,8 @@ namespace nvme
 
         static constexpr uint64_t n_commands = pow(2, 16); 
         bitmap<n_commands> available_cids;
+        std::vector<callback> callbacks; // Indexed by CID, never more than n_entries are in flight
+        size_t n_in_flight;
 
         struct submission_info {
             submission_info() = default;
@@ -39,6 +61,7 @@ namespace nvme
             volatile uint16_t* doorbell;
 
             uint16_t head, tail;
+            uint16_t doorbell_tail; // Last tail written to the doorbell
             libsigma_phys_region_t region;
         };
         submission_info submission;
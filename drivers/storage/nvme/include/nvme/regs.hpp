@@ -359,4 +359,50 @@ namespace nvme::regs {
     };
     static_assert(sizeof(read_command) == sizeof(command));
     constexpr uint8_t read_opcode = 0x02;
+
+    using write_command = read_command; // Same layout
+    constexpr uint8_t write_opcode = 0x01;
+
+    constexpr uint8_t flush_opcode = 0x00;
+
+    struct PACKED dsm_command {
+        command_header header;
+        struct {
+            uint32_t n_ranges : 8; // Zero based
+            uint32_t reserved : 24;
+        };
+        struct {
+            uint32_t idr : 1; // Integral Dataset for Read
+            uint32_t idw : 1; // Integral Dataset for Write
+            uint32_t ad : 1; // Deallocate
+            uint32_t reserved_1 : 29;
+        };
+        uint32_t reserved_2[4];
+    };
+    static_assert(sizeof(dsm_command) == sizeof(command));
+    constexpr uint8_t dsm_opcode = 0x09;
+
+    struct PACKED dsm_range {
+        uint32_t attributes;
+        uint32_t n_lbas;
+        uint64_t start_lba;
+    };
+    static_assert(sizeof(dsm_range) == 16);
+    constexpr uint16_t dsm_max_ranges = 256;
+
+    struct PACKED sgl_descriptor {
+        uint64_t address;
+        uint32_t length;
+        uint8_t reserved[3];
+        uint8_t id; // Type in the high nibble, subtype in the low one
+    };
+    static_assert(sizeof(sgl_descriptor) == 16);
+    constexpr uint8_t sgl_data_block_descriptor = 0x00;
+
+    constexpr uint8_t psdt_prp = 0;
+    constexpr uint8_t psdt_sgl_contiguous = 1; // SGL, metadata pointer is a contiguous buffer
+
+    constexpr uint16_t oncs_dsm = (1 << 2);
+    constexpr uint8_t vwc_present = (1 << 0);
+    constexpr uint32_t sgls_supported_mask = 0x3; // 0 means no SGL support
 }
\ No newline at end of file
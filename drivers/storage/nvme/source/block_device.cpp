@@ -0,0 +1,57 @@
+#include <nvme/block_device.hpp>
+
+using namespace nvme;
+
+size_t block_device::get_sector_size(){
+    return this->controller.get_sector_size(this->nsid);
+}
+
+uint64_t block_device::get_n_sectors(){
+    return this->controller.get_n_sectors(this->nsid);
+}
+
+size_t block_device::get_queue_depth(){
+    return this->controller.get_io_queue_depth(this->queue);
+}
+
+size_t block_device::get_max_sectors(){
+    return this->controller.get_max_transfer_size() / this->get_sector_size();
+}
+
+size_t block_device::get_max_segments(){
+    return 1; // PRP lists and the SGL are built for 1 contiguous buffer
+}
+
+bool block_device::start(block::request_types type, uint64_t lba, size_t n_sectors, const std::vector<block::buffer>& segments, block::io_callback done){
+    switch (type)
+    {
+    case block::request_types::Flush:
+        return this->controller.flush_async(this->queue, this->nsid, std::move(done));
+
+    case block::request_types::Read:
+    case block::request_types::Write: {
+        if(segments.size() != 1)
+            return false;
+
+        dma_buffer buffer{.virt = segments[0].virt, .phys = segments[0].phys, .size = segments[0].size};
+        if(type == block::request_types::Read)
+            return this->controller.read_async(this->queue, this->nsid, lba, n_sectors, buffer, 0, std::move(done));
+        else
+            return this->controller.write_async(this->queue, this->nsid, lba, n_sectors, buffer, 0, std::move(done));
+    }
+    }
+
+    return false;
+}
+
+void block_device::kick(){
+    this->controller.submit(this->queue);
+}
+
+size_t block_device::poll(){
+    return this->controller.poll(this->queue);
+}
+
+size_t block_device::wait(){
+    return this->controller.wait(this->queue);
+}
@@ -0,0 +1,30 @@
+#include <nvme/dma_pool.hpp>
+#include <sys/mman.h>
+#include <iostream>
+
+using namespace nvme;
+
+dma_pool::dma_pool(size_t n_buffers, size_t buffer_size): region{}, buffer_size{buffer_size}, free_list{} {
+    if(libsigma_get_phys_region(n_buffers * buffer_size, PROT_READ | PROT_WRITE, MAP_ANON, &region)){
+        std::cerr << "nvme: Couldn't allocate DMA pool\n";
+        return;
+    }
+
+    this->free_list.reserve(n_buffers);
+    for(size_t i = n_buffers; i > 0; i--)
+        this->free_list.push_back(i - 1);
+}
+
+std::optional<dma_buffer> dma_pool::alloc(){
+    if(this->free_list.empty())
+        return std::nullopt;
+
+    size_t i = this->free_list.back();
+    this->free_list.pop_back();
+
+    return dma_buffer{.virt = (void*)(region.virtual_addr + (i * buffer_size)), .phys = region.physical_addr + (i * buffer_size), .size = buffer_size};
+}
+
+void dma_pool::free(const dma_buffer& buffer){
+    this->free_list.push_back((buffer.phys - region.physical_addr) / buffer_size);
+}
@@ -8,13 +8,15 @@
 #include <cstring>
 #include <string_view>
 #include <libdriver/math.hpp>
+#include <algorithm>
+#include <memory>
 
 constexpr uint32_t get_vs(uint16_t major, uint8_t minor, uint8_t tertiary){
     return (major << 16) | (minor << 8) | tertiary;
 }
 
 
-nvme::io_controller::io_controller(libsigma_resource_region_t region){
+nvme::io_controller::io_controller(uint64_t device_descriptor, libsigma_resource_region_t region){
     this->base = (volatile regs::bar*)libsigma_vm_map(region.len, nullptr, (void*)region.base, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON);
     
     printf("nvme: Initializing controller, phys: [0x%lx -> 0x%lx], virt: %p\n", region.base, region.base + region.len, base);
@@ -107,6 +109,16 @@ nvme::io_controller::io_controller(libsigma_resource_region_t region){
     std::cout << "Done\n";
     this->print_identify_info(info);
 
+    // MDTS is a power of 2 in units of the minimum page size, 0 means no limit
+    // A single PRP list page can describe 2 MiB, so never go above that
+    this->max_transfer_size = 2 * 1024 * 1024;
+    if(info.mtds && (pow2(info.mtds) * pow2(12 + cap.mpsmin)) < this->max_transfer_size)
+        this->max_transfer_size = pow2(info.mtds) * pow2(12 + cap.mpsmin);
+
+    this->sgl_supported = (info.sgls & regs::sgls_supported_mask) != 0;
+    this->dsm_supported = (info.oncs & regs::oncs_dsm) != 0;
+    printf("      Max transfer: 0x%lx bytes, using %s\n", this->max_transfer_size, this->sgl_supported ? "SGLs" : "PRP lists");
+
     std::ostringstream stream{};
     stream << "/dev/nvme" << info.controller_id;
     this->path = std::move(stream.str());
@@ -151,21 +163,65 @@ nvme::io_controller::io_controller(libsigma_resource_region_t region){
         namespaces[nsid].path = std::move(ns_stream.str());
 
         printf("      Blockdev path: %s\n", namespaces[nsid].path.c_str());
+    }
+
+    this->create_io_queues(device_descriptor);
+}
+
+// The driver serves everything from its main thread on queue 0, libsigma threads can't run C++ yet since they come without TLS
+// More queues would only sit there with their vectors unused, raise this once there are threads to give them to
+constexpr size_t max_io_queues = 1;
+
+void nvme::io_controller::create_io_queues(uint64_t device_descriptor){
+    size_t n_cpus = 0;
+    libsigma_cpu_stats_t stats = {};
+    while(libsigma_get_cpu_stats(n_cpus, &stats) == 0)
+        n_cpus++;
+
+    if(n_cpus == 0)
+        n_cpus = 1;
+
+    // Both counts are zero based, the controller answers with how many it actually allocated
+    size_t n_wanted = std::min(n_cpus, max_io_queues);
+    uint32_t requested = n_wanted - 1;
+    uint32_t granted = 0;
+    if(!this->set_features(regs::n_queues_fid, (requested << 16) | requested, &granted)){
+        std::cerr << "nvme: Failed to set the number of I/O queues\n";
+        granted = 0;
+    }
+
+    size_t n_queues = std::min({n_wanted, (size_t)(granted & 0xFFFF) + 1, (size_t)(granted >> 16) + 1});
+
+    // Queue i completes on vector i targeted at CPU i, the admin queue shares vector 0 but is only used while polling
+    std::vector<uint64_t> cpus(n_queues);
+    std::vector<handle_t> irqs(n_queues, UINT64_MAX);
+    for(size_t i = 0; i < n_queues; i++)
+        cpus[i] = i;
 
-        // TODO: Register blockdev in VFS
+    bool irq_enable = (devctl(devCtlEnableMsix, device_descriptor, n_queues, (uint64_t)cpus.data(), (uint64_t)irqs.data()) == 0);
+    if(!irq_enable){
+        std::cerr << "nvme: Couldn't enable MSI-X, falling back to polling\n";
+        std::fill(irqs.begin(), irqs.end(), UINT64_MAX);
     }
 
-    // Let the controller allocate as many queues as possible so we don't have to care about it
-    this->set_features(regs::n_queues_fid, ~0);
+    printf("nvme: Creating %ld I/O queues [%ld CPUs, %d granted]\n", n_queues, n_cpus, (granted & 0xFFFF) + 1);
 
-    qid_t io_qid = 1; // IO queue
-    uint16_t* io_submission_doorbell = (uint16_t*)((size_t)this->base + 0x1000 + (2 * io_qid * (4 << this->doorbell_stride)));
-    uint16_t* io_completion_doorbell = (uint16_t*)((size_t)this->base + 0x1000 + ((2 * io_qid + 1) * (4 << this->doorbell_stride)));
-    this->io_queue = queue_pair{n_queue_entries, io_submission_doorbell, io_completion_doorbell, io_qid};
+    this->io_queues.reserve(n_queues);
+    for(size_t i = 0; i < n_queues; i++){
+        qid_t qid = i + 1;
+        uint16_t* submission_doorbell = (uint16_t*)((size_t)this->base + 0x1000 + (2 * qid * (4 << this->doorbell_stride)));
+        uint16_t* completion_doorbell = (uint16_t*)((size_t)this->base + 0x1000 + ((2 * qid + 1) * (4 << this->doorbell_stride)));
+
+        // 1 PRP list page per command is the worst case, data buffers are capped so the pool stays small on controllers without an MDTS
+        io_queue queue{.pair = queue_pair{n_queue_entries, submission_doorbell, completion_doorbell, qid}, .cpu = cpus[i], .irq = irqs[i],
+                       .prp_pool = dma_pool{std::min(n_queue_entries - 1, (size_t)64), 0x1000},
+                       .data_pool = dma_pool{8, std::min(this->max_transfer_size, (size_t)(128 * 1024))}};
+        if(!this->register_queue_pair(queue.pair, irq_enable, i)){
+            std::cerr << "nvme: Failed to create I/O queue " << qid << std::endl;
+            break;
+        }
 
-    if(!this->register_queue_pair(this->io_queue)){
-        std::cerr << "nvme: Failed to create I/O queue\n";
-        return;
+        this->io_queues.push_back(std::move(queue));
     }
 }
 
@@ -263,7 +319,7 @@ std::vector<nvme::nsid_t> nvme::io_controller::get_active_namespaces(nvme::nsid_
     return list;
 }
 
-bool nvme::io_controller::set_features(uint8_t fid, uint32_t data){
+bool nvme::io_controller::set_features(uint8_t fid, uint32_t data, uint32_t* result){
     regs::set_features_command cmd{};
 
     cmd.header.opcode = regs::set_features_opcode;
@@ -271,21 +327,17 @@ bool nvme::io_controller::set_features(uint8_t fid, uint32_t data){
     cmd.fid = fid;
     cmd.data = data;
     
-    auto status = this->admin_queue.send_and_wait((regs::command*)&cmd);
-    if(status != 0){
-        return false;
-    }
-    
-    return true;
+    return this->admin_queue.send_and_wait((regs::command*)&cmd, result);
 }
 
-bool nvme::io_controller::register_queue_pair(nvme::queue_pair& pair){
+bool nvme::io_controller::register_queue_pair(nvme::queue_pair& pair, bool irq_enable, uint16_t irq_vector){
     regs::create_completion_queue_command cq_cmd{};
     cq_cmd.header.opcode = regs::create_completion_queue_opcode;
     cq_cmd.header.prp1 = pair.get_completion_phys_base();
     cq_cmd.qid = pair.get_qid();
     cq_cmd.size = pair.get_n_entries() - 1;
-    cq_cmd.irq_enable = 0;
+    cq_cmd.irq_enable = irq_enable;
+    cq_cmd.irq_vector = irq_vector;
     cq_cmd.pc = 1;
     if(!this->admin_queue.send_and_wait((regs::command*)&cq_cmd))
         return false;
@@ -304,35 +356,314 @@ bool nvme::io_controller::register_queue_pair(nvme::queue_pair& pair){
     return true;
 }
 
-std::vector<uint8_t> nvme::io_controller::read_sector(nvme::nsid_t nsid, uint64_t lba){
-    if(lba >= namespaces[nsid].n_lbas){
-        printf("nvme: Tried to read from invalid LBA, namespace: %d\n", nsid);
-        return {};
+bool nvme::io_controller::submit_rw(size_t queue, uint8_t opcode, nvme::nsid_t nsid, uint64_t lba, size_t n_sectors, const nvme::dma_buffer& buffer, size_t offset, nvme::io_controller::io_callback cb){
+    auto it = namespaces.find(nsid);
+    if(queue >= io_queues.size() || it == namespaces.end() || n_sectors == 0 || (lba + n_sectors) > it->second.n_lbas)
+        return false;
+
+    auto& q = this->get_owned_queue(queue);
+    size_t sector_size = it->second.sector_size;
+    size_t size = n_sectors * sector_size;
+    if((offset + size) > buffer.size || ((buffer.phys + offset) & 0x3))
+        return false; // Data pointers have to be dword aligned
+
+    size_t sectors_per_command = this->max_transfer_size / sector_size;
+    size_t n_commands = div_ceil(n_sectors, sectors_per_command);
+    size_t n_prp_lists = this->sgl_supported ? 0 : n_commands; // Upper bound, only commands spanning more than 2 pages need one
+    if(n_commands > ((q.pair.get_n_entries() - 1) - q.pair.get_n_in_flight()) || n_prp_lists > q.prp_pool.get_n_free())
+        return false; // Either all commands go in or none
+
+    struct request {
+        size_t remaining;
+        bool success;
+        io_callback cb;
+    };
+    auto req = std::make_shared<request>(request{.remaining = n_commands, .success = true, .cb = std::move(cb)});
+
+    for(size_t i = 0; i < n_commands; i++){
+        size_t n = std::min(sectors_per_command, n_sectors - (i * sectors_per_command));
+        size_t bytes = n * sector_size;
+        uintptr_t phys = buffer.phys + offset + (i * sectors_per_command * sector_size);
+
+        regs::read_command cmd{};
+        cmd.header.opcode = opcode;
+        cmd.header.namespace_id = nsid;
+        cmd.start_lba = lba + (i * sectors_per_command);
+        cmd.n_sectors = n - 1; // Zero based
+
+        // The buffer is physically contiguous, so 1 SGL data block or a linear PRP list describes it
+        std::optional<dma_buffer> prp_list = std::nullopt;
+        if(this->sgl_supported){
+            cmd.header.psdt = regs::psdt_sgl_contiguous;
+            auto* sgl = (regs::sgl_descriptor*)cmd.header.sgl_segment;
+            sgl->address = phys;
+            sgl->length = bytes;
+            sgl->id = (regs::sgl_data_block_descriptor << 4);
+        } else {
+            cmd.header.psdt = regs::psdt_prp;
+            cmd.header.prp1 = phys;
+
+            uintptr_t first_page = phys & ~0xFFFull;
+            size_t n_pages = div_ceil((phys & 0xFFF) + bytes, 0x1000);
+            if(n_pages == 2){
+                cmd.header.prp2 = first_page + 0x1000;
+            } else if(n_pages > 2){
+                prp_list = q.prp_pool.alloc();
+                auto* entries = (uint64_t*)prp_list->virt;
+                for(size_t j = 1; j < n_pages; j++)
+                    entries[j - 1] = first_page + (j * 0x1000);
+
+                cmd.header.prp2 = prp_list->phys;
+            }
+        }
+
+        q.pair.submit((regs::command*)&cmd, [req, prp_list, &q](const regs::completion& entry){
+            if(prp_list)
+                q.prp_pool.free(*prp_list);
+
+            if(entry.status.code){
+                std::cerr << "nvme: I/O command failed, code: 0x" << std::hex << (uint64_t)(entry.status.code & 0xFF) << std::endl;
+                req->success = false;
+            }
+
+            if(--req->remaining == 0 && req->cb)
+                req->cb(req->success);
+        });
     }
 
-    regs::read_command cmd{};
+    return true;
+}
+
+bool nvme::io_controller::read_async(size_t queue, nvme::nsid_t nsid, uint64_t lba, size_t n_sectors, const nvme::dma_buffer& buffer, size_t offset, nvme::io_controller::io_callback cb){
+    return this->submit_rw(queue, regs::read_opcode, nsid, lba, n_sectors, buffer, offset, std::move(cb));
+}
+
+bool nvme::io_controller::write_async(size_t queue, nvme::nsid_t nsid, uint64_t lba, size_t n_sectors, const nvme::dma_buffer& buffer, size_t offset, nvme::io_controller::io_callback cb){
+    return this->submit_rw(queue, regs::write_opcode, nsid, lba, n_sectors, buffer, offset, std::move(cb));
+}
+
+bool nvme::io_controller::flush_async(size_t queue, nvme::nsid_t nsid, nvme::io_controller::io_callback cb){
+    if(queue >= io_queues.size())
+        return false;
+
+    auto& q = this->get_owned_queue(queue);
+    if(q.pair.is_full())
+        return false;
 
-    cmd.header.opcode = regs::read_opcode;
-    cmd.start_lba = lba;
-    cmd.n_sectors = 0; // Zero based so 1 sector
+    regs::command cmd{};
+    cmd.header.opcode = regs::flush_opcode;
     cmd.header.namespace_id = nsid;
 
-    libsigma_phys_region_t region = {};
-    // TODO: get sector size
-    if(libsigma_get_phys_region(512, PROT_READ | PROT_WRITE, MAP_ANON, &region)){
-        std::cerr << "nvme: Failed to allocate physical region for reading\n";
-        return {};
+    q.pair.submit(&cmd, [cb = std::move(cb)](const regs::completion& entry){
+        if(cb)
+            cb(entry.status.code == 0);
+    });
+    return true;
+}
+
+bool nvme::io_controller::deallocate_async(size_t queue, nvme::nsid_t nsid, const std::vector<std::pair<uint64_t, uint32_t>>& ranges, nvme::io_controller::io_callback cb){
+    if(!this->dsm_supported || queue >= io_queues.size() || ranges.empty() || ranges.size() > regs::dsm_max_ranges)
+        return false;
+
+    auto& q = this->get_owned_queue(queue);
+    if(q.pair.is_full())
+        return false;
+
+    auto page = q.prp_pool.alloc();
+    if(!page)
+        return false;
+
+    auto* list = (regs::dsm_range*)page->virt;
+    for(size_t i = 0; i < ranges.size(); i++)
+        list[i] = regs::dsm_range{.attributes = 0, .n_lbas = ranges[i].second, .start_lba = ranges[i].first};
+
+    regs::dsm_command cmd{};
+    cmd.header.opcode = regs::dsm_opcode;
+    cmd.header.namespace_id = nsid;
+    cmd.header.prp1 = page->phys;
+    cmd.n_ranges = ranges.size() - 1; // Zero based
+    cmd.ad = 1;
+
+    q.pair.submit((regs::command*)&cmd, [page = *page, &q, cb = std::move(cb)](const regs::completion& entry){
+        q.prp_pool.free(page);
+        if(cb)
+            cb(entry.status.code == 0);
+    });
+    return true;
+}
+
+bool nvme::io_controller::wait_for(size_t queue, const std::function<bool(nvme::io_controller::io_callback)>& start){
+    bool done = false, success = false;
+    if(!start([&](bool status){ done = true; success = status; }))
+        return false;
+
+    while(!done)
+        this->wait(queue);
+
+    return success;
+}
+
+bool nvme::io_controller::read(size_t queue, nvme::nsid_t nsid, uint64_t lba, size_t n_sectors, const nvme::dma_buffer& buffer, size_t offset){
+    return this->wait_for(queue, [&](io_callback cb){ return this->read_async(queue, nsid, lba, n_sectors, buffer, offset, std::move(cb)); });
+}
+
+bool nvme::io_controller::write(size_t queue, nvme::nsid_t nsid, uint64_t lba, size_t n_sectors, const nvme::dma_buffer& buffer, size_t offset){
+    return this->wait_for(queue, [&](io_callback cb){ return this->write_async(queue, nsid, lba, n_sectors, buffer, offset, std::move(cb)); });
+}
+
+bool nvme::io_controller::flush(size_t queue, nvme::nsid_t nsid){
+    return this->wait_for(queue, [&](io_callback cb){ return this->flush_async(queue, nsid, std::move(cb)); });
+}
+
+nvme::io_controller::io_queue& nvme::io_controller::get_owned_queue(size_t queue){
+    auto& q = this->io_queues[queue];
+    tid_t tid = libsigma_get_current_tid(), owner = UINT64_MAX;
+    if(!__atomic_compare_exchange_n(&q.owner, &owner, tid, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        assert(owner == tid); // Another thread owns the queue, it would race us on the SQ tail and the CIDs
+
+    return q;
+}
+
+void nvme::io_controller::submit(size_t queue){
+    this->get_owned_queue(queue).pair.flush();
+}
+
+size_t nvme::io_controller::poll(size_t queue){
+    return this->get_owned_queue(queue).pair.reap();
+}
+
+size_t nvme::io_controller::wait(size_t queue){
+    auto& q = this->get_owned_queue(queue);
+    q.pair.flush();
+    if(q.irq == UINT64_MAX){
+        size_t n = 0;
+        while((n = q.pair.reap()) == 0 && q.pair.get_n_in_flight())
+            asm("pause");
+        return n;
     }
 
-    cmd.header.prp1 = region.physical_addr;
+    // Completions that land between the reap and the wait still leave the IRQ pending, so none get lost
+    size_t n = q.pair.reap();
+    while(n == 0 && q.pair.get_n_in_flight()){
+        devctl(devCtlWaitOnIrq, q.irq, 0, 0, 0);
+        n = q.pair.reap();
+    }
+    return n;
+}
 
-    this->io_queue.send_and_wait((regs::command*)&cmd);
+constexpr uint64_t benchmark_tick_ms = 10;
 
-    auto* buf = (regs::controller_identify_info*)region.virtual_addr;
+bool nvme::io_controller::init_benchmark(){
+    if(this->bench.initialized)
+        return true;
+
+    // Big enough for the deepest queue with the largest sectors, so later runs never need more
+    size_t max_depth = 0, max_sector_size = 0;
+    for(auto& q : this->io_queues)
+        max_depth = std::max<size_t>(max_depth, q.pair.get_n_entries() - 1);
+    for(const auto& [nsid, ns] : this->namespaces)
+        max_sector_size = std::max<size_t>(max_sector_size, ns.sector_size);
+
+    if(libsigma_get_phys_region(max_depth * max_sector_size, PROT_READ | PROT_WRITE, MAP_ANON, &this->bench.region)){
+        std::cerr << "nvme: Failed to allocate physical region for benchmark\n";
+        return false;
+    }
+
+    this->bench.waitset = libsigma_waitset_create();
+    this->bench.timer = libsigma_timer_create(benchmark_tick_ms, true);
+    if(this->bench.waitset == UINT64_MAX || this->bench.timer == UINT64_MAX || libsigma_waitset_add(this->bench.waitset, this->bench.timer)){
+        std::cerr << "nvme: Failed to set up benchmark timer\n";
+        return false;
+    }
+
+    this->bench.initialized = true;
+    return true;
+}
+
+uint64_t nvme::io_controller::benchmark(size_t queue, nvme::nsid_t nsid, size_t depth, uint64_t ms){
+    auto it = namespaces.find(nsid);
+    if(queue >= io_queues.size() || it == namespaces.end() || depth == 0 || ms == 0)
+        return 0;
+
+    if(!this->init_benchmark())
+        return 0;
+
+    auto& ns = it->second;
+    auto& q = this->get_owned_queue(queue);
+    depth = std::min<size_t>(depth, q.pair.get_n_entries() - 1);
+    dma_buffer buffer{.virt = (void*)this->bench.region.virtual_addr, .phys = this->bench.region.physical_addr, .size = this->bench.region.size};
+
+    auto waitset = this->bench.waitset, timer = this->bench.timer;
+    if(q.irq != UINT64_MAX)
+        libsigma_waitset_add(waitset, q.irq);
+
+    // Throw away ticks that piled up since the last run
+    handle_t ready[2] = {};
+    size_t n_stale = 0;
+    while((n_stale = libsigma_waitset_poll(waitset, ready, 2)) != 0 && n_stale != SIZE_MAX)
+        ;
+
+    uint64_t n_completed = 0, seed = 0x2545F4914F6CDD1D;
+    bool running = true;
+    std::function<void(size_t)> issue = [&](size_t slot){
+        // Xorshift, random LBAs keep the emulated device from just streaming
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        this->read_async(queue, nsid, seed % ns.n_lbas, 1, buffer, slot * ns.sector_size, [&, slot](bool){
+            n_completed++;
+            if(running)
+                issue(slot);
+        });
+    };
+
+    for(size_t i = 0; i < depth; i++)
+        issue(i);
+
+    // Counting starts at the first tick, so the run covers exactly n_ticks whole ticks
+    // With an IRQ the thread sleeps until either a completion or a tick, otherwise it spins on the CQ
+    uint64_t n_ticks = (ms + benchmark_tick_ms - 1) / benchmark_tick_ms, ticks_seen = 0;
+    while(running){
+        q.pair.flush();
+        size_t n_ready = (q.irq != UINT64_MAX) ? libsigma_waitset_wait(waitset, ready, 2) : libsigma_waitset_poll(waitset, ready, 2);
+        if(n_ready == SIZE_MAX){
+            printf("nvme: Benchmark waitset failed\n");
+            running = false;
+            n_ready = 0;
+        }
+
+        q.pair.reap();
+        for(size_t i = 0; i < n_ready; i++){
+            if(ready[i] != timer)
+                continue;
+
+            if(ticks_seen++ == 0)
+                n_completed = 0;
+            else if(ticks_seen > n_ticks)
+                running = false;
+        }
+    }
+
+    uint64_t counted = n_completed;
+    if(q.irq != UINT64_MAX)
+        libsigma_waitset_remove(waitset, q.irq);
+
+    while(q.pair.get_n_in_flight())
+        this->wait(queue);
+
+    if(ticks_seen <= n_ticks)
+        return 0; // The waitset failed before the run was over
+
+    uint64_t iops = (counted * 1000) / (n_ticks * benchmark_tick_ms);
+    printf("nvme: Queue %ld, depth %ld: %ld IOPS\n", queue, depth, iops);
+    return iops;
+}
+
+std::vector<nvme::nsid_t> nvme::io_controller::get_namespaces(){
+    std::vector<nsid_t> ret{};
+    for(const auto& [nsid, ns] : namespaces)
+        ret.push_back(nsid);
 
-    std::vector<uint8_t> ret{};
-    ret.resize(512);
-    memcpy(ret.data(), buf, 512);
     return ret;
 }
 
@@ -4,7 +4,11 @@
 #include <iostream>
 #include <libsigma/sys.h>
 #include <nvme/io_controller.hpp>
+#include <nvme/block_device.hpp>
+#include <libdriver/block_cache.hpp>
+#include <memory>
 
+constexpr bool benchmark_on_startup = false; // Measures random read IOPS at a few queue depths
 
 int main(){
     // Disable buffering for stdout and stderr so debug message show up immediately
@@ -25,7 +29,33 @@ int main(){
     libsigma_resource_region_t region = {};
     devctl(devCtlGetResourceRegion, device_descriptor, resourceRegionOriginPciBar, 0, (uint64_t)&region);
 
-    nvme::io_controller controller{region};
-    while(1)
-        asm("pause");
+    nvme::io_controller controller{device_descriptor, region};
+
+    if constexpr (benchmark_on_startup){
+        auto namespaces = controller.get_namespaces();
+        if(!namespaces.empty() && controller.get_n_io_queues()){
+            libsigma_set_scheduling(SIGMA_PRIORITY_DRIVER, 1ull << controller.get_io_queue_cpu(0)); // Queues are only used from their own CPU
+            for(size_t depth : {1, 8, 32, 128})
+                controller.benchmark(0, namespaces[0], depth, 1000);
+            libsigma_set_scheduling(SIGMA_PRIORITY_DRIVER, SIGMA_AFFINITY_ALL);
+        }
+    }
+
+    // Every namespace goes through queue 0 for now, the driver only runs 1 thread
+    std::vector<std::unique_ptr<nvme::block_device>> devices{};
+    std::vector<std::unique_ptr<block::queue>> queues{};
+    std::vector<std::unique_ptr<block::cache>> caches{};
+    std::vector<block::cache*> writeback{};
+    auto cache_config = block::cache::config::from_environment();
+    if(controller.get_n_io_queues()){
+        for(auto nsid : controller.get_namespaces()){
+            auto& device = devices.emplace_back(std::make_unique<nvme::block_device>(controller, nsid, 0));
+            auto& queue = queues.emplace_back(std::make_unique<block::queue>(*device));
+            auto& cache = caches.emplace_back(std::make_unique<block::cache>(*queue, cache_config));
+            writeback.push_back(cache.get());
+            block::print_device(controller.get_namespace_path(nsid), *queue);
+        }
+    }
+
+    block::run_writeback(writeback, cache_config.writeback_interval_ms);
 }
\ No newline at end of file
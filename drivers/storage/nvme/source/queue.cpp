@@ -3,6 +3,7 @@
 #include <iostream>
 #include <string.h>
 #include <libdriver/bit.hpp>
+#include <atomic>
 
 using namespace nvme;
 
@@ -18,6 +19,7 @@ queue_pair::submission_info::submission_info(size_t n_entries, uint16_t* doorbel
 
     this->head = 0;
     this->tail = 0;
+    this->doorbell_tail = 0;
 }
 
 queue_pair::completion_info::completion_info(size_t n_entries, uint16_t* doorbell): doorbell{doorbell} {
@@ -35,10 +37,16 @@ queue_pair::completion_info::completion_info(size_t n_entries, uint16_t* doorbel
     this->expected_phase = 1;     
 }
 
-queue_pair::queue_pair(size_t n_entries, uint16_t* submission_doorbell, uint16_t* completion_doorbell, qid_t qid): n_entries{n_entries}, qid{qid}, available_cids{bitmap<n_commands>{}}, submission{submission_info{n_entries, submission_doorbell}}, completion{completion_info{n_entries, completion_doorbell}}{}
+queue_pair::queue_pair(size_t n_entries, uint16_t* submission_doorbell, uint16_t* completion_doorbell, qid_t qid): n_entries{n_entries}, qid{qid}, available_cids{bitmap<n_commands>{}}, callbacks(n_entries), n_in_flight{0}, submission{submission_info{n_entries, submission_doorbell}}, completion{completion_info{n_entries, completion_doorbell}}{}
+
+std::optional<cid_t> queue_pair::submit(regs::command* cmd, callback cb){
+    if(this->is_full())
+        return std::nullopt;
 
-cid_t queue_pair::send_command(regs::command* cmd){
     cid_t cid = this->available_cids.get_free_bit();
+    this->available_cids.set(cid);
+    this->callbacks[cid] = std::move(cb);
+    this->n_in_flight++;
 
     cmd->header.cid = cid;
 
@@ -49,38 +57,77 @@ cid_t queue_pair::send_command(regs::command* cmd){
     if(tail == n_entries)
         tail = 0; // Wrap around if end is reached
 
-    *submission.doorbell = tail;
     submission.tail = tail;
 
     return cid;
 }
 
-bool queue_pair::send_and_wait(regs::command* cmd){
-    uint16_t head = completion.head;
+void queue_pair::flush(){
+    if(submission.tail == submission.doorbell_tail)
+        return;
 
-    auto cid = send_command(cmd);
+    std::atomic_thread_fence(std::memory_order_release); // Entries have to be visible before the controller fetches them
+    *submission.doorbell = submission.tail;
+    submission.doorbell_tail = submission.tail;
+}
 
-    while(true){
-        bool phase = completion.queue[completion.head].status.phase;
-        if(phase == completion.expected_phase)
+size_t queue_pair::reap(size_t max){
+    size_t n = 0;
+    while(n < max){
+        if(completion.queue[completion.head].status.phase != completion.expected_phase)
             break;
-    }
 
-    uint8_t status_code = completion.queue[completion.head].status.code;
-    bool ret = true;
-    if(status_code){
-        std::cerr << "nvme: Error in completion queue, code: 0x" << std::hex << (uint64_t)(status_code & 0xFF) << std::endl;
-        ret = false;
-    }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        regs::completion entry{};
+        memcpy(&entry, (const void*)(completion.queue + completion.head), sizeof(regs::completion));
+
+        completion.head++;
+        if(completion.head == n_entries){
+            completion.head = 0;
+            completion.expected_phase = !completion.expected_phase;
+        }
 
-    head++;
-    if(head == n_entries){
-        head = 0;
-        completion.expected_phase = !completion.expected_phase;
+        submission.head = entry.sq_head_pointer;
+
+        // Free the CID before running the callback so it can submit a follow up right away
+        cid_t cid = entry.command_id;
+        auto cb = std::move(this->callbacks[cid]);
+        this->callbacks[cid] = nullptr;
+        this->available_cids.clear(cid);
+        this->n_in_flight--;
+        n++;
+
+        if(cb)
+            cb(entry);
     }
 
-    *completion.doorbell = head;
-    completion.head = head;
+    if(n)
+        *completion.doorbell = completion.head;
+
+    return n;
+}
+
+bool queue_pair::send_and_wait(regs::command* cmd, uint32_t* result){
+    bool done = false, ret = false;
+    auto cb = [&](const regs::completion& entry){
+        done = true;
+        ret = true;
+        if(result)
+            *result = entry.command_specific;
+
+        uint8_t status_code = entry.status.code;
+        if(status_code){
+            std::cerr << "nvme: Error in completion queue, code: 0x" << std::hex << (uint64_t)(status_code & 0xFF) << std::endl;
+            ret = false;
+        }
+    };
+
+    while(!this->submit(cmd, cb))
+        this->reap();
+    this->flush();
+
+    while(!done)
+        this->reap();
 
     return ret;
 }
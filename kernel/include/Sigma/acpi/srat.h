@@ -0,0 +1,147 @@
+#ifndef SIGMA_KERNEL_ACPI_SRAT
+#define SIGMA_KERNEL_ACPI_SRAT
+
+#include <Sigma/common.h>
+#include <Sigma/acpi/acpi.h>
+#include <Sigma/acpi/madt.h>
+#include <Sigma/mm/pmm.h>
+#include <Sigma/types/linked_list.h>
+
+namespace acpi
+{
+    constexpr const char* srat_signature = "SRAT";
+    constexpr const char* slit_signature = "SLIT";
+
+    struct PACKED_ATTRIBUTE srat_header
+    {
+        acpi::sdt_header header;
+        uint32_t reserved; // 1
+        uint64_t reserved_1;
+    }; // Table of entries next
+    static_assert(sizeof(srat_header) == 48);
+
+    constexpr uint8_t srat_type_lapic = 0;
+    constexpr uint8_t srat_type_memory = 1;
+    constexpr uint8_t srat_type_x2apic = 2;
+
+    struct PACKED_ATTRIBUTE srat_lapic
+    {
+        uint8_t type; // 0
+        uint8_t length; // 16
+        uint8_t proximity_domain_low;
+        uint8_t apic_id;
+        uint32_t flags;
+        uint8_t sapic_eid;
+        uint8_t proximity_domain_high[3];
+        uint32_t clock_domain;
+    };
+    static_assert(sizeof(srat_lapic) == 16);
+
+    struct PACKED_ATTRIBUTE srat_memory
+    {
+        uint8_t type; // 1
+        uint8_t length; // 40
+        uint32_t proximity_domain;
+        uint16_t reserved;
+        uint64_t base;
+        uint64_t length_bytes;
+        uint32_t reserved_1;
+        uint32_t flags;
+        uint64_t reserved_2;
+    };
+    static_assert(sizeof(srat_memory) == 40);
+
+    struct PACKED_ATTRIBUTE srat_x2apic
+    {
+        uint8_t type; // 2
+        uint8_t length; // 24
+        uint16_t reserved;
+        uint32_t proximity_domain;
+        uint32_t x2apic_id;
+        uint32_t flags;
+        uint32_t clock_domain;
+        uint32_t reserved_1;
+    };
+    static_assert(sizeof(srat_x2apic) == 24);
+
+    constexpr uint32_t srat_flags_enabled = 0;
+
+    struct PACKED_ATTRIBUTE slit_header
+    {
+        acpi::sdt_header header;
+        uint64_t n_localities;
+        uint8_t entries[]; // n_localities * n_localities matrix
+    };
+    static_assert(sizeof(slit_header) == 44);
+
+    constexpr uint8_t slit_local_distance = 10;
+
+    class srat {
+        public:
+        srat();
+
+        void parse();
+
+        struct cpu_affinity {
+            uint32_t apic_id;
+            uint32_t node;
+        };
+
+        struct memory_affinity {
+            uint64_t base;
+            uint64_t length;
+            uint32_t node;
+        };
+
+        types::linked_list<cpu_affinity>& get_cpus();
+        types::linked_list<memory_affinity>& get_memory_ranges();
+
+        // Nodes are the proximity domains renumbered to be dense
+        size_t get_n_nodes(){
+            return this->n_nodes;
+        }
+
+        uint32_t get_domain_for_node(uint32_t node){
+            return this->domains[node];
+        }
+
+        bool found_table(){
+            return this->table != nullptr;
+        }
+
+        static constexpr size_t max_nodes = mm::pmm::max_numa_nodes;
+
+        private:
+        uint32_t node_for_domain(uint32_t domain);
+
+        void parse_lapic(uint8_t* item);
+        void parse_x2apic(uint8_t* item);
+        void parse_memory(uint8_t* item);
+
+        types::linked_list<cpu_affinity> cpus;
+        types::linked_list<memory_affinity> ranges;
+        uint32_t domains[max_nodes];
+        size_t n_nodes;
+        srat_header* table;
+    };
+
+    class slit {
+        public:
+        slit();
+
+        uint8_t get_distance(uint32_t from_domain, uint32_t to_domain);
+
+        bool found_table(){
+            return this->table != nullptr;
+        }
+
+        private:
+        slit_header* table;
+    };
+
+    // Parses SRAT and SLIT if present, tags the MADT cpus with their node and splits the PMM into per node pools
+    void init_numa(acpi::madt& madt);
+} // namespace acpi
+
+
+#endif
@@ -50,6 +50,10 @@ namespace x86_64
         void init();
     }
 
+    namespace mwait {
+        void init();
+    }
+
     namespace tsd {
         void init();
     }
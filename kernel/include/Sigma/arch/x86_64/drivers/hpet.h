@@ -36,6 +36,7 @@ namespace x86_64::hpet
     void init_hpet();
 
     void poll_sleep(uint64_t ms);
+    uint64_t get_time_ms(); // Milliseconds since the HPET got initialized
 
     enum class hpet_timer_types {ONE_SHOT, PERIODIC};
 
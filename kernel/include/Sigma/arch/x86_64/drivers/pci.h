@@ -79,6 +79,36 @@ namespace x86_64::pci
             uint32_t raw;
         };
     } // namespace msi
+
+    namespace msix
+    {
+        enum {
+            msix_control_reg = 0x2,
+            msix_table_reg = 0x4,
+            msix_pba_reg = 0x8
+        };
+
+        union PACKED_ATTRIBUTE control {
+            struct {
+                uint16_t table_size : 11; // N - 1 encoded
+                uint16_t reserved : 3;
+                uint16_t function_mask : 1;
+                uint16_t enable : 1;
+            };
+            uint16_t raw;
+        };
+        static_assert(sizeof(control) == 2);
+
+        struct PACKED_ATTRIBUTE table_entry {
+            uint32_t addr_low;
+            uint32_t addr_high;
+            uint32_t data;
+            uint32_t vector_control;
+        };
+        static_assert(sizeof(table_entry) == 16);
+
+        constexpr uint32_t vector_control_masked = (1 << 0);
+    } // namespace msix
     
 
     constexpr uint16_t config_addr = 0xCF8;
@@ -126,6 +156,8 @@ namespace x86_64::pci
         struct {
             bool supported;
             uint8_t space_offset;
+            uint16_t n_vectors;
+            volatile msix::table_entry* table; // Mapped on first use
         } msix;
 
         struct {
@@ -137,9 +169,12 @@ namespace x86_64::pci
 
         bool has_irq;
         uint32_t gsi;
+        bool irq_level_triggered, irq_active_low; // From the _PRT entry, INTx is normally level triggered and active low
         x86_64::pci::bar bars[6];
 
         void install_msi(uint32_t dest_id, uint8_t vector);
+        bool install_msix(uint16_t index, uint32_t dest_id, uint8_t vector);
+        void mask_msix(uint16_t index); // For an entry install_msix succeeded on
         const char* class_str() const;
     };
 
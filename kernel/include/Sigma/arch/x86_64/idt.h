@@ -88,6 +88,8 @@ namespace x86_64::idt
     void init();
     void load();
     void register_interrupt_handler(handler h);
+    void unregister_interrupt_handler(uint16_t vector); // Makes the vector available to get_free_vector again
+    bool has_handler(uint16_t vector);
     void register_irq_status(uint16_t n, bool is_irq);
     void register_generic_handlers();
 } // x86_64::idt
@@ -8,6 +8,7 @@
 
 namespace proc::process {
     struct thread;
+    struct process;
 }
 
 constexpr uint64_t map_page_flags_present = (1 << 0);
@@ -15,6 +16,7 @@ constexpr uint64_t map_page_flags_writable = (1 << 1);
 constexpr uint64_t map_page_flags_user = (1 << 2);
 constexpr uint64_t map_page_flags_no_execute = (1 << 3);
 constexpr uint64_t map_page_flags_global = (1 << 4);
+constexpr uint64_t map_page_flags_shared = (1 << 5); // Frames aren't owned by the address space, fork maps them instead of copying
 
 enum class map_page_cache_types {normal, uncacheable, write_through, write_back, write_combining};
 
@@ -52,17 +54,19 @@ namespace x86_64::paging
     constexpr uint64_t page_entry_huge = 7; // 4MiB and 1GiB pages
     constexpr uint64_t page_entry_pat = 7; // 4KiB pages
     constexpr uint64_t page_entry_global = 8;
+    constexpr uint64_t page_entry_shared = 9; // Available to software
     constexpr uint64_t page_entry_no_execute = 63;
 
     class context  {
         public:
-            context(): paging_info(nullptr) {}
+            context(): paging_info(nullptr), generation(0) {}
             ~context() {}
             void init();
             void deinit();
 
             bool map_page(uint64_t phys, uint64_t virt, uint64_t flags, map_page_cache_types cache = map_page_cache_types::normal);
             bool set_page_protection(uint64_t virt, uint64_t flags, map_page_cache_types cache = map_page_cache_types::normal);
+            bool unmap_page(uint64_t virt);
             uint64_t get_phys(uint64_t virt);
             uint64_t get_entry(uint64_t virt);
 
@@ -70,14 +74,24 @@ namespace x86_64::paging
 
             void clone_paging_info(x86_64::paging::context& new_info);
 
-            void fork_address_space(proc::process::thread& new_thread);
+            void fork_address_space(proc::process::process& new_process);
 
             uint64_t get_paging_info();
 
+            // Changes every time init() is called, so PCIDs tagged with an older address space in the same context get flushed
+            uint64_t get_generation(){
+                return this->generation;
+            }
+
+            // Makes CPUs that switch to this context later flush its PCID instead of reusing their cached entries
+            void bump_generation();
+
             uint64_t get_free_range(uint64_t base, uint64_t end, size_t size);
+            bool is_range_free(uint64_t base, size_t size);
         private:
             // Virtual address!
             pml4* paging_info; 
+            uint64_t generation;
     };
 
     x86_64::paging::pml4* get_current_info();
@@ -98,12 +112,14 @@ namespace x86_64::paging
         bool is_active();
 
         uint64_t get_timestamp();
+        uint64_t get_generation();
 
         x86_64::paging::context* get_context();
 
         private:
         uint16_t pcid;
         x86_64::paging::context* context;
+        uint64_t generation;
 
         uint64_t timestamp;
 
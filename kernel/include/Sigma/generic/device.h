@@ -78,6 +78,7 @@ namespace generic::device {
     constexpr uint64_t devctl_cmd_wait_on_irq = 6;
     constexpr uint64_t devctl_cmd_read_pci = 7;
     constexpr uint64_t devctl_cmd_write_pci = 8;
+    constexpr uint64_t devctl_cmd_enable_msix = 9;
 
     uint64_t devctl(uint64_t cmd, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, x86_64::idt::idt_registers* regs);
 }
@@ -2,16 +2,25 @@
 #define SIGMA_GENERIC_EVENT_H
 
 #include <Sigma/common.h>
+#include <Sigma/arch/x86_64/misc/spinlock.h>
 #include <atomic>
+#include <klibcxx/mutex.hpp>
 
 namespace generic
 {
+    class waitset;
+    void notify_waitset(generic::waitset* set, size_t slot);
+
     class event {
         public:
-        event(): count{0} {}
+        event(): count{0}, listener_lock{}, listener{nullptr}, listener_slot{0} {}
 
         void trigger(){
             count.fetch_add(1);
+
+            std::lock_guard guard{listener_lock};
+            if(listener)
+                generic::notify_waitset(listener, listener_slot);
         }
 
         void untrigger(){
@@ -28,12 +37,37 @@ namespace generic
             return true;
         }
 
+        // Doesn't consume a trigger
+        bool is_pending(){
+            return count.load() != 0;
+        }
+
+        // An event can only be in 1 waitset at a time, call with interrupts disabled
+        bool attach(generic::waitset* set, size_t slot){
+            std::lock_guard guard{listener_lock};
+            if(listener)
+                return false;
+
+            listener = set;
+            listener_slot = slot;
+            return true;
+        }
+
+        void detach(){
+            std::lock_guard guard{listener_lock};
+            listener = nullptr;
+        }
+
         private:
         std::atomic<size_t> count;
+
+        x86_64::spinlock::mutex listener_lock;
+        generic::waitset* listener;
+        size_t listener_slot;
     };
 } // namespace generic
 
 
 
 
-#endif
\ No newline at end of file
+#endif
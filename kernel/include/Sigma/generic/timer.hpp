@@ -0,0 +1,34 @@
+#ifndef SIGMA_GENERIC_TIMER_H
+#define SIGMA_GENERIC_TIMER_H
+
+#include <Sigma/common.h>
+#include <Sigma/generic/event.hpp>
+
+namespace generic
+{
+    // Software timer driven by the scheduler tick, so its resolution is 1 time slice of the first CPU
+    class timer {
+        public:
+        timer(uint64_t ms, bool periodic);
+        ~timer();
+
+        timer(const timer&) = delete;
+        timer& operator=(const timer&) = delete;
+
+        generic::event event;
+
+        private:
+        uint64_t deadline; // In HPET ms
+        uint64_t period; // 0 for one shot timers
+        timer* next;
+
+        friend void timers_tick();
+    };
+
+    // Fires all expired timers, called from the scheduler
+    void timers_tick();
+} // namespace generic
+
+
+
+#endif
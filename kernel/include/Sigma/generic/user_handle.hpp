@@ -5,14 +5,21 @@
 #include <Sigma/types/hash_map.hpp>
 #include <Sigma/generic/virt.hpp>
 #include <Sigma/proc/ipc.hpp>
+#include <Sigma/proc/grant.hpp>
+#include <Sigma/proc/shm.hpp>
+#include <Sigma/arch/x86_64/misc/spinlock.h>
+#include <Sigma/smp/cpu.h>
 
 #include <klibcxx/utility.hpp>
+#include <klibcxx/mutex.hpp>
 
 #include <Sigma/generic/event.hpp>
+#include <Sigma/generic/waitset.hpp>
+#include <Sigma/generic/timer.hpp>
 
 namespace generic::handles
 {
-	enum class handle_type {vCpu, vSpace, irq, ipcRing};
+	enum class handle_type {vCpu, vSpace, irq, ipcRing, waitSet, timer, grant, shm};
 
 	struct handle {
 		explicit handle(handle_type type): type{type} {}
@@ -38,12 +45,14 @@ namespace generic::handles
 	};
 
 	struct irq_handle : public handle {
-		explicit irq_handle(uint8_t vector): handle{handle_type::irq}, vector{vector}, event{} {}
+		explicit irq_handle(uint8_t vector, tid_t owner): handle{handle_type::irq}, vector{vector}, owner{owner}, event{} {}
 
 		static constexpr handle_type default_type = handle_type::irq;
 
 		uint8_t vector;
+		tid_t owner; // Thread that gets preempted in when the IRQ fires
 		generic::event event;
+		uint32_t level_gsi = UINT32_MAX; // Level triggered line, masked from when it fires until the driver waits again
 	};
 
 	struct ipc_ring_handle : public handle {
@@ -54,6 +63,38 @@ namespace generic::handles
 		proc::ipc::ring* ring;
 	};
 
+	struct waitset_handle : public handle {
+		explicit waitset_handle(): handle{handle_type::waitSet}, set{} {}
+
+		static constexpr handle_type default_type = handle_type::waitSet;
+
+		generic::waitset set;
+	};
+
+	struct timer_handle : public handle {
+		explicit timer_handle(uint64_t ms, bool periodic): handle{handle_type::timer}, timer{ms, periodic} {}
+
+		static constexpr handle_type default_type = handle_type::timer;
+
+		generic::timer timer;
+	};
+
+	struct grant_handle : public handle {
+		explicit grant_handle(proc::grant::grant* grant): handle{handle_type::grant}, grant{grant} {}
+
+		static constexpr handle_type default_type = handle_type::grant;
+
+		proc::grant::grant* grant; // The reference is tracked in process_resources::grant_objects
+	};
+
+	struct shm_handle : public handle {
+		explicit shm_handle(proc::shm::object* object): handle{handle_type::shm}, object{object} {}
+
+		static constexpr handle_type default_type = handle_type::shm;
+
+		proc::shm::object* object; // The reference is tracked in process_resources::shm_objects
+	};
+
 	class handle_catalogue {
 		public:
 		handle_catalogue& operator=(handle_catalogue&& other){
@@ -63,17 +104,26 @@ namespace generic::handles
             return *this;
         }
 
+		// Shared by all threads of a process
 		NODISCARD_ATTRIBUTE
 		uint64_t push(handles::handle* handle){
+			std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+			std::lock_guard guard{lock};
 			auto id = id_gen.id();
 			catalogue.push_back(id, handle);
 
 			return id;
 		}
 
+		handles::handle* get_handle(uint64_t id){
+			std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+			std::lock_guard guard{lock};
+			return catalogue[id];
+		}
+
 		template<typename T>
 		T* get(uint64_t id){
-			auto* handle = catalogue[id];
+			auto* handle = get_handle(id);
 			if(!handle)
 				return nullptr;
 			
@@ -81,9 +131,28 @@ namespace generic::handles
 			return static_cast<T*>(handle);
 		}
 
+		// For ids straight from userspace, nullptr if the handle doesn't exist instead of a panic
+		handles::handle* find_handle(uint64_t id){
+			std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+			std::lock_guard guard{lock};
+			auto* handle = catalogue.find(id);
+			return handle ? *handle : nullptr;
+		}
+
+		// Same as find_handle, but also nullptr if the handle is of another type
+		template<typename T>
+		T* find(uint64_t id){
+			auto* handle = find_handle(id);
+			if(!handle || handle->type != T::default_type)
+				return nullptr;
+
+			return static_cast<T*>(handle);
+		}
+
 		private:
 		misc::id_generator id_gen;
 		types::hash_map<uint64_t, handles::handle*, types::nop_hasher<uint64_t>> catalogue;
+		x86_64::spinlock::mutex lock;
 	};
 } // namespace handles
 
@@ -0,0 +1,46 @@
+#ifndef SIGMA_GENERIC_WAITSET_H
+#define SIGMA_GENERIC_WAITSET_H
+
+#include <Sigma/common.h>
+#include <Sigma/generic/event.hpp>
+#include <Sigma/arch/x86_64/misc/spinlock.h>
+
+#include <atomic>
+
+namespace generic
+{
+    // Lets a thread block on multiple events at once, readiness is edge triggered:
+    // a source is reported once per batch of triggers that happened since the last harvest
+    class waitset {
+        public:
+        waitset(): ready{}, entries{}, pending{0}, lock{} {}
+        ~waitset();
+
+        static constexpr size_t max_entries = 64; // Readiness is kept in a single 64bit mask
+
+        bool add(generic::event* source, uint64_t key);
+        bool remove(uint64_t key);
+
+        // Copies up to max keys of ready sources to keys, returns the amount copied
+        size_t harvest(uint64_t* keys, size_t max);
+
+        void notify(size_t slot);
+
+        generic::event ready; // Triggered whenever any source becomes ready, block on this
+
+        private:
+        struct entry {
+            bool used;
+            uint64_t key;
+            generic::event* source;
+        };
+
+        entry entries[max_entries];
+        std::atomic<uint64_t> pending;
+        x86_64::spinlock::mutex lock;
+    };
+} // namespace generic
+
+
+
+#endif
@@ -13,11 +13,23 @@ namespace mm::pmm
 {
     constexpr uint64_t block_size = 0x1000;
 
+    constexpr size_t max_numa_nodes = 8;
+    constexpr size_t max_numa_ranges = 32;
+
     void init(boot::boot_protocol* boot_protocol);
     void print_stack();
 
+    // Before init_numa is called all memory is in node 0
+    void add_numa_range(uint64_t base, uint64_t len, uint32_t node);
+    void init_numa(size_t n_nodes, uint8_t distances[max_numa_nodes][max_numa_nodes]);
+    uint32_t get_current_node();
+
+    // Allocate from the node of the current CPU, falling back to the nearest node with free memory
     void* alloc_block();
     void* alloc_n_blocks(size_t n);
+
+    void* alloc_block(uint32_t node);
+    void* alloc_n_blocks(size_t n, uint32_t node);
     void free_block(void* block);
 } // mm::pmm
 
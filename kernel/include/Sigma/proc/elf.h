@@ -143,7 +143,23 @@ namespace proc::elf
         };
     };
 
-    bool start_elf_executable(const char* initrd_filename, proc::process::thread** thread, proc::process::thread_privilege_level privilege);
+    // Sigma specific auxv entries
+    constexpr uint64_t at_vfs_server = 0x1000;
+    constexpr uint64_t at_kbus_server = 0x1001;
+    constexpr uint64_t at_sigma_rings = 0x1002; // Handle of the first ring to the spawner, the others follow it
+    constexpr uint64_t at_sigma_n_rings = 0x1003;
+
+    constexpr size_t spawn_max_string_bytes = 0x1000; // argv and envp together, they have to fit on the initial stack next to the auxv
+
+    struct spawn_args {
+        const char* const* argv; // Kernel copies, nullptr terminated, can be nullptr, at most spawn_max_string_bytes in total
+        const char* const* envp;
+        proc::process::thread* parent; // Thread the rings are created with
+        size_t n_rings;
+        uint64_t* parent_ring_handles; // Receives n_rings handles in the parent catalogue
+    };
+
+    bool start_elf_executable(const char* initrd_filename, proc::process::thread** thread, proc::process::thread_privilege_level privilege, const proc::elf::spawn_args* args = nullptr);
     void map_kernel(boot::boot_protocol& protocol);
     void init_symbol_list(boot::boot_protocol& protocol);
     std::pair<std::pair<size_t, size_t>, std::pair<size_t, size_t>> get_symbol_pmm_exclusion_zones();
@@ -0,0 +1,42 @@
+#ifndef SIGMA_KERNEL_PROC_FILE_MAP
+#define SIGMA_KERNEL_PROC_FILE_MAP
+
+#include <Sigma/common.h>
+#include <Sigma/proc/initrd.h>
+
+namespace proc::process
+{
+    struct process;
+} // namespace proc::process
+
+namespace proc::file_map
+{
+    // Range of an address space backed by an initrd file, pages get populated on the first fault
+    // Pages that only hold file data map the shared initrd page cache, writable ones get copied on the first write
+    struct region {
+        uint64_t base; // Page aligned range covered by the region
+        uint64_t end;
+        uint64_t vaddr; // Address of the byte at offset in the file
+        uint64_t offset;
+        size_t file_size; // Bytes past vaddr + file_size are zero
+        proc::initrd::file* file; // nullptr if all pages were mapped upfront and only have to survive fork
+        uint64_t map_flags;
+    };
+
+    void add_region(proc::process::process* process, const proc::file_map::region& region);
+    // True if [base, base + size) touches a region, including its pages that weren't populated yet, call with the process_lock held
+    bool overlaps(proc::process::process* process, uint64_t base, size_t size);
+
+    // Populates the page containing addr if it is in a region, returns false if the fault wasn't ours to handle
+    bool handle_fault(proc::process::process* process, uint64_t addr, bool write);
+    // Populates the page containing addr like a write would, or a read for read only regions, so its frame doesn't change anymore
+    // Does nothing outside of regions, call without the process_lock held
+    void prefault(proc::process::process* process, uint64_t addr);
+
+    // Forgets the regions, the frames are freed with the rest of the process resources
+    void release_process(proc::process::process* process);
+    // Copies the regions and maps the shared pages populated so far at the same addresses in the child
+    void fork_process(proc::process::process* parent, proc::process::process* child);
+} // namespace proc::file_map
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef SIGMA_KERNEL_PROC_FUTEX
+#define SIGMA_KERNEL_PROC_FUTEX
+
+#include <Sigma/common.h>
+#include <Sigma/generic/event.hpp>
+
+namespace proc::process
+{
+    struct thread;
+} // namespace proc::process
+
+namespace proc::futex
+{
+    constexpr size_t bucket_bits = 6;
+    constexpr size_t n_buckets = (1 << bucket_bits);
+
+    enum class wait_status {woken = 0, mismatch = 1, timed_out = 2, blocked = 3, fault = 4};
+
+    // Every thread has exactly 1 of these embedded, since a thread can only wait on 1 futex at a time
+    struct waiter {
+        waiter(): key{0}, deadline{0}, state{waiter_state::idle}, event{}, next{nullptr} {}
+
+        enum class waiter_state {idle, queued, woken, timed_out};
+
+        uint64_t key; // Physical address of the futex word, so different mappings of the same frame meet in the same queue
+        uint64_t deadline; // In HPET ms, 0 for none
+        waiter_state state;
+        generic::event event;
+        waiter* next;
+    };
+
+    // Queues the thread if the 32bit word at addr still contains expected, the caller should then block on thread->futex.event
+    // Calling it again after waking up with the same addr returns whether the wait got woken or timed out
+    proc::futex::wait_status wait(proc::process::thread* thread, uint64_t addr, uint32_t expected, uint64_t timeout_ms);
+
+    // Wakes up to n waiters on the word at addr, returns the amount woken
+    size_t wake(proc::process::thread* thread, uint64_t addr, size_t n);
+
+    // Fires expired timeouts, called from the scheduler
+    void timeouts_tick();
+
+    // Dequeues the thread if it is waiting, called when it exits
+    void release_thread(proc::process::thread* thread);
+} // namespace proc::futex
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef SIGMA_KERNEL_PROC_GRANT
+#define SIGMA_KERNEL_PROC_GRANT
+
+#include <Sigma/common.h>
+#include <Sigma/mm/pmm.h>
+#include <Sigma/types/vector.h>
+#include <Sigma/arch/x86_64/misc/spinlock.h>
+
+#include <klibcxx/mutex.hpp>
+
+namespace proc::process
+{
+    struct process;
+} // namespace proc::process
+
+namespace proc::grant
+{
+    constexpr uint64_t grant_flags_writable = (1 << 0);
+
+    // A range of pages of the owner that other processes can map, the owner can take them back at any time with revoke()
+    // Every handle holds a reference, the object is revoked and freed when the last one is dropped
+    class grant {
+        public:
+        grant(proc::process::process* owner, uint64_t flags);
+
+        grant(const grant&) = delete;
+        grant& operator=(const grant&) = delete;
+
+        // Collects the frames backing [base, base + size) in the owner, fails if any of them isn't mapped with the requested access or is shared
+        bool init(uint64_t base, size_t size);
+
+        // Returns the address the pages got mapped at in process, 0 on failure
+        uint64_t map(proc::process::process* process, uint64_t flags);
+        bool unmap(proc::process::process* process);
+
+        // Unmaps the pages from every process that mapped them, further maps fail
+        void revoke();
+
+        void ref();
+        void unref(); // May delete the object
+
+        proc::process::process* get_owner(){
+            return this->_owner;
+        }
+
+        size_t get_size(){
+            return this->_frames.size() * mm::pmm::block_size;
+        }
+
+        private:
+        struct mapping {
+            proc::process::process* process;
+            uint64_t base; // 0 when the slot is unused
+        };
+
+        void unmap_int(mapping& entry);
+
+        proc::process::process* _owner;
+        uint64_t _flags;
+        bool _revoked;
+        size_t _refs;
+        types::vector<uint64_t> _frames;
+        types::vector<mapping> _mappings;
+        x86_64::spinlock::mutex _lock;
+
+        friend void release_process(proc::process::process* process);
+    };
+
+    // Revokes all grants owned by the process, forgets its mappings and drops the references of its handles
+    // Called when its last thread exits since its frames are about to be freed
+    void release_process(proc::process::process* process);
+} // namespace proc::grant
+
+#endif
@@ -4,6 +4,11 @@
 #include <Sigma/common.h>
 #include <Sigma/types/linked_list.h>
 
+namespace proc::process
+{
+    struct process;
+} // namespace proc::process
+
 namespace proc::initrd
 {
     struct tar_header{
@@ -17,10 +22,23 @@ namespace proc::initrd
         char typeflag;
     };
 
-    // Initrd is a simple TAR archive
+    // Initrd is a simple TAR archive, init builds a hashed index of the paths in it
     void init(uint64_t address, uint64_t size);
     bool read_file(const char* file_name, uint8_t* buf, uint64_t offset, uint64_t size);
     size_t get_size(const char* file_name);
+
+    // Maps the file read only into the process without copying it, returns the address of the first byte or 0 on failure
+    uint64_t map_file(proc::process::process* process, const char* file_name, size_t* size);
+
+    struct file; // Entry in the index, stays valid forever
+
+    proc::initrd::file* open(const char* file_name);
+    size_t get_size(proc::initrd::file* file);
+    bool read_file(proc::initrd::file* file, uint8_t* buf, uint64_t offset, uint64_t size);
+
+    // Returns a frame holding page n of the file, zero filled past the end
+    // The frames are cached and shared by every process that maps the file, they are never freed
+    uint64_t get_page(proc::initrd::file* file, size_t n);
 } // namespace proc::initrd
 
 
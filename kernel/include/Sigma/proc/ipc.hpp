@@ -7,8 +7,38 @@
 
 #include <klibcxx/mutex.hpp>
 
+namespace x86_64::idt
+{
+    struct idt_registers;
+} // namespace x86_64::idt
+
+namespace proc::process
+{
+    struct thread;
+    struct process;
+} // namespace proc::process
+
 namespace proc::ipc
 {
+    // Per thread page shared with userspace, ipc_call and ipc_reply_and_wait copy straight between the buffers of both threads
+    struct call_buffer {
+        uint64_t size;
+        uint8_t data[];
+    };
+
+    constexpr size_t call_buffer_max = 0x1000 - sizeof(call_buffer);
+    constexpr size_t call_no_reply = ~0ull;
+
+    struct iovec {
+        std::byte* base;
+        size_t len;
+    };
+
+    constexpr size_t iovec_max = 64;
+
+    // Keep updated with libsigma/sys.h
+    enum class receive_status {ok = 0, empty = 1, too_small = 2, truncated = 3, invalid = 4};
+
     class queue {
         public:
         queue(tid_t sender, tid_t receiver);
@@ -18,6 +48,10 @@ namespace proc::ipc
         size_t get_top_message_size();
         size_t get_n_messages();
 
+        // Gathers into a single message / scatters the top message, size is always set to the full message size
+        bool send(const proc::ipc::iovec* iov, size_t n_iov);
+        proc::ipc::receive_status receive(const proc::ipc::iovec* iov, size_t n_iov, size_t& size, bool truncate);
+
         generic::event _receive_event;
 
         private:
@@ -37,30 +71,59 @@ namespace proc::ipc
         std::mutex _lock;
     };
 
+    // Each end belongs to the process of the thread it was created for, so every thread of that process can use it
+    // Synchronous calls stay between the 2 original threads, since they hand the CPU straight to the partner thread
     class ring {
         public:
-        ring(tid_t a, tid_t b): a{a}, b{b}, _a_queue{b, a}, _b_queue{a, b} {}
+        ring(proc::process::thread* a, proc::process::thread* b);
         ~ring() {}
 
         bool send(std::byte* data, size_t size);
         bool receive(std::byte* data);
+        bool send(const proc::ipc::iovec* iov, size_t n_iov);
+        proc::ipc::receive_status receive(const proc::ipc::iovec* iov, size_t n_iov, size_t& size, bool truncate);
         size_t get_n_messages();
         size_t get_top_message_size();
-        generic::event& get_receive_event();
+        generic::event* get_receive_event(); // nullptr if the current thread isn't on either end
         std::pair<tid_t, tid_t> get_recipients();
-        
+        proc::process::process* get_partner(); // Process on the other end, nullptr if it is gone or the current thread isn't on either end
+
+        // Return false on failure, otherwise they block the current thread and hand the CPU to the partner if possible
+        bool call(size_t size, x86_64::idt::idt_registers* regs);
+        bool reply_and_wait(size_t reply_size, x86_64::idt::idt_registers* regs);
 
         private:
+        struct sync_state {
+            bool waiting; // Blocked in reply_and_wait for a call
+            bool has_call; // The partner called while we weren't waiting, its message is still in its buffer
+            size_t call_size; // Size of that message, the size in the buffer is writable by userspace so it can't be trusted
+            bool awaiting_reply; // Blocked in call until the partner replies
+            generic::event event;
+        };
+
+        int get_side(proc::process::thread* thread); // 0 for a, 1 for b, -1 for neither
+        proc::process::thread* get_call_partner(tid_t self); // nullptr if the thread that created the other end is gone
+
         tid_t a, b;
+        proc::process::process* _a_process;
+        proc::process::process* _b_process;
+        uint64_t _a_pid, _b_pid; // Process slots get reused, so check the pid too
         queue _a_queue, _b_queue;
+        sync_state _a_sync, _b_sync;
+        std::mutex _sync_lock;
     };
 
     size_t get_message_size(uint64_t ring);
     size_t get_n_messages(uint64_t ring);
     bool send(uint64_t ring, std::byte* data, size_t size);
     bool receive(uint64_t ring, std::byte* data);
-    generic::event& get_receive_event(uint64_t ring);
+    bool send(uint64_t ring, const proc::ipc::iovec* iov, size_t n_iov);
+    proc::ipc::receive_status receive(uint64_t ring, const proc::ipc::iovec* iov, size_t n_iov, size_t& size, bool truncate);
+    generic::event* get_receive_event(uint64_t ring);
     std::pair<tid_t, tid_t> get_recipients(uint64_t ring);
+    proc::process::process* get_partner(uint64_t ring);
+    bool call(uint64_t ring, size_t size, x86_64::idt::idt_registers* regs);
+    bool reply_and_wait(uint64_t ring, size_t reply_size, x86_64::idt::idt_registers* regs);
 } // namespace proc::ipc
 
 
@@ -8,12 +8,22 @@
 #include <Sigma/arch/x86_64/cpu.h>
 #include <Sigma/acpi/madt.h>
 #include <Sigma/smp/cpu.h>
+#include <Sigma/smp/topology.h>
 #include <Sigma/types/vector.h>
 #include <Sigma/proc/ipc.hpp>
+#include <Sigma/proc/shm.hpp>
+#include <Sigma/proc/grant.hpp>
+#include <Sigma/proc/futex.hpp>
+#include <Sigma/proc/file_map.hpp>
 #include <Sigma/proc/simd.h>
 #include <Sigma/generic/user_handle.hpp>
 #include <Sigma/generic/event.hpp>
 
+namespace proc::syscall
+{
+    struct ring_header;
+} // namespace proc::syscall
+
 namespace proc::process
 {
     struct thread_context {
@@ -61,9 +71,13 @@ namespace proc::process
         }
     };
 
-    struct thread_resources {
-        thread_resources(): frames(types::vector<uint64_t>()) {}
+    struct process_resources {
+        process_resources(): frames(types::vector<uint64_t>()), shm_mappings{}, shm_objects{}, grant_objects{}, file_regions{} {}
         types::vector<uint64_t> frames;
+        types::vector<proc::shm::mapping> shm_mappings;
+        types::vector<proc::shm::object*> shm_objects; // References held by the handle catalogue
+        types::vector<proc::grant::grant*> grant_objects; // Same for grants
+        types::vector<proc::file_map::region> file_regions;
     };
 
     constexpr uint64_t mmap_top = 0x7FFF'FFFF'FFFF;
@@ -78,24 +92,70 @@ namespace proc::process
 
     enum class thread_state {DISABLED, IDLE, RUNNING, BLOCKED, SILENT};
     enum class thread_privilege_level {APPLICATION = 0, DRIVER = 1, KERNEL = 2};
+    enum class thread_priority {IDLE = 0, NORMAL = 1, DRIVER = 2, REALTIME = 3};
+
+    // Time slices in ms, higher classes run first so they get shorter slices to keep latency bounded
+    constexpr uint64_t time_slice_for_priority(proc::process::thread_priority priority){
+        switch (priority)
+        {
+        case proc::process::thread_priority::REALTIME: return 5;
+        case proc::process::thread_priority::DRIVER: return 10;
+        case proc::process::thread_priority::NORMAL: return 25;
+        case proc::process::thread_priority::IDLE: return 50;
+        }
+        return 25;
+    }
+
+    constexpr proc::process::thread_priority default_priority_for_privilege(proc::process::thread_privilege_level privilege){
+        if(privilege == proc::process::thread_privilege_level::DRIVER)
+            return proc::process::thread_priority::DRIVER;
+        return proc::process::thread_priority::NORMAL;
+    }
+
+    constexpr uint64_t cpu_affinity_all = ~0ull;
+
+    struct managed_cpu;
+
+    // Everything the threads of a process share, the slot gets reused once the last thread exits
+    struct process {
+        process(): vmm{}, resources{}, handle_catalogue{}, pid{0}, n_threads{0}, process_lock{} {}
+
+        x86_64::paging::context vmm;
+        proc::process::process_resources resources;
+        generic::handles::handle_catalogue handle_catalogue;
+        uint64_t pid;
+        size_t n_threads;
+        x86_64::spinlock::mutex process_lock; // Protects vmm and resources
+    };
 
     struct thread {
-        thread(): context{}, resources{}, image{}, state{}, \
+        thread(): context{}, image{}, state{}, \
                   privilege{proc::process::thread_privilege_level::APPLICATION}, \
-                  vmm{}, tid{0}, thread_lock{}, handle_catalogue{} {}
+                  priority{proc::process::thread_priority::NORMAL}, affinity{proc::process::cpu_affinity_all}, last_cpu{nullptr}, numa_node{0}, \
+                  process{nullptr}, tid{0}, thread_lock{}, ipc_buffer{nullptr}, ipc_buffer_user{0}, syscall_ring{nullptr}, syscall_ring_user{0}, syscall_ring_entries{0}, syscall_ring_sq_offset{0}, syscall_ring_cq_offset{0}, futex{} {}
 
         proc::process::thread_context context;
-        proc::process::thread_resources resources;
         proc::process::thread_image image;
         proc::process::thread_state state;
         proc::process::thread_privilege_level privilege;
-        x86_64::paging::context vmm;
+        proc::process::thread_priority priority;
+        uint64_t affinity; // Bitmap of managed_cpu ids this thread is allowed to run on
+        proc::process::managed_cpu* last_cpu; // CPU that most likely still has this thread's data in its caches
+        uint32_t numa_node; // Node most of this thread's memory got allocated on
+        proc::process::process* process;
         tid_t tid;
         x86_64::spinlock::mutex thread_lock;
 
         generic::event* event;
 
-		generic::handles::handle_catalogue handle_catalogue;
+        proc::ipc::call_buffer* ipc_buffer; // Kernel view of the synchronous IPC buffer, nullptr until the thread asks for it
+        uint64_t ipc_buffer_user;
+
+        proc::syscall::ring_header* syscall_ring; // Kernel view of the batched syscall ring, nullptr until it is set up
+        uint64_t syscall_ring_user;
+        uint32_t syscall_ring_entries, syscall_ring_sq_offset, syscall_ring_cq_offset; // Userspace can write the header, so the kernel only trusts these copies
+
+        proc::futex::waiter futex;
 
         struct {
             void reset(){
@@ -105,9 +165,11 @@ namespace proc::process
         } stacks;
 
         void set_state(proc::process::thread_state new_state);
+        bool set_scheduling_params(proc::process::thread_priority new_priority, uint64_t new_affinity);
 
 
         void block(generic::event* await, x86_64::idt::idt_registers* regs);
+        void block(generic::event* await); // For kernel threads, which don't have an interrupt frame to switch out of
         void wake();
         bool is_blocked();
 
@@ -117,6 +179,12 @@ namespace proc::process
 
         void set_fsbase(uint64_t fs);
 
+        // Maps the IPC buffer into the thread on first use, returns its userspace address or 0 on failure
+        uint64_t map_ipc_buffer();
+
+        // Same for the batched syscall ring, n_entries gets rounded up to a power of 2
+        uint64_t map_syscall_ring(size_t n_entries);
+
         #define PROT_NONE 0x00
         #define PROT_READ 0x01
         #define PROT_WRITE 0x02
@@ -139,12 +207,34 @@ namespace proc::process
     };
     
 
+    struct cpu_stats {
+        uint64_t load; // Exponential moving average of n_runnable, scaled by load_scale
+        uint64_t n_runnable; // Runnable threads that last ran on this CPU
+        uint64_t n_switches;
+        uint64_t n_migrations; // Threads that moved to this CPU from another one
+        uint64_t n_balanced; // Threads pushed away from this CPU by the load balancer
+        uint64_t n_wakeups_mwait; // Idle wakeups done by a store to the MONITORed need_resched line
+        uint64_t wakeup_tsc_mwait; // Sum of TSC cycles between the wake and the scheduler running
+        uint64_t n_wakeups_ipi; // Idle wakeups done with an IPI, the fallback when MWAIT isn't available
+        uint64_t wakeup_tsc_ipi;
+    };
+
     struct managed_cpu {
         smp::cpu_entry cpu;
         bool enabled;
         proc::process::thread* current_thread;
+        uint64_t id;
+        smp::topology::cpu_topology topology;
+        proc::process::cpu_stats stats;
+        smp::cpu::entry* cpu_data; // Per CPU data of this CPU, nullptr until it is initialized
+        uint64_t wake_tsc; // TSC at the time of the last wake of this CPU while idle, 0 if none is pending
+        bool wake_mwait;
     };
 
+    constexpr uint64_t load_scale = 1024;
+    constexpr uint64_t load_decay = 4;
+    constexpr uint64_t load_balance_interval = 8; // In scheduler ticks of the first CPU
+
     constexpr uint64_t cpu_quantum = 25;
     constexpr uint16_t cpu_quantum_interrupt_vector = 248;
 
@@ -165,7 +255,8 @@ namespace proc::process
     void make_kernel_thread(proc::process::thread* thread, void (*function)(void*), void* arg);
 
 
-    proc::process::thread* create_blocked_thread(proc::process::thread_privilege_level privilege);
+    // Creates a new process for the thread unless one is passed
+    proc::process::thread* create_blocked_thread(proc::process::thread_privilege_level privilege, proc::process::process* process = nullptr);
 
 
     // Get current x
@@ -177,12 +268,30 @@ namespace proc::process
 
     // Blocking
     void block_thread(tid_t tid, generic::event* event, x86_64::idt::idt_registers* regs);
+    // Blocks the current thread on await and switches straight to target if it is blocked on target_event and allowed on this CPU, skipping the run queue
+    void block_and_switch(generic::event* await, tid_t target, generic::event* target_event, x86_64::idt::idt_registers* regs);
     void wake_thread(tid_t tid);
     bool is_blocked(tid_t tid);
+
+    // Preemption
+    void preempt_for(tid_t tid);
+
+    // CPU ids are the ones used in affinity bitmaps
+    bool get_cpu_lapic_id(uint64_t id, uint32_t& lapic_id);
+
+    // Statistics
+    bool get_cpu_stats(uint64_t id, smp::topology::cpu_topology& topology, proc::process::cpu_stats& stats);
     
+    // True if nothing is mapped in the range and no file region will populate it later, call with the process_lock held
+    bool is_range_unused(proc::process::process* process, uint64_t base, size_t size);
+
     // General Management
     tid_t fork(x86_64::idt::idt_registers* regs);
+    // Starts a thread in the address space of the current one, returns its tid or 0 on failure
+    tid_t create_thread(uint64_t rip, uint64_t rsp, uint64_t arg);
     void kill(x86_64::idt::idt_registers* regs);
+    // Tears down a thread from create_blocked_thread that never ran, along with its process if it was the only thread
+    void destroy_blocked_thread(proc::process::thread* thread);
     void yield(x86_64::idt::idt_registers* regs);
 } // namespace proc::sched
 
@@ -0,0 +1,64 @@
+#ifndef SIGMA_KERNEL_PROC_SHM
+#define SIGMA_KERNEL_PROC_SHM
+
+#include <Sigma/common.h>
+#include <Sigma/mm/pmm.h>
+#include <Sigma/types/vector.h>
+#include <Sigma/arch/x86_64/misc/spinlock.h>
+
+#include <klibcxx/mutex.hpp>
+
+namespace proc::process
+{
+    struct process;
+} // namespace proc::process
+
+namespace proc::shm
+{
+    // Reference counted set of frames that can be mapped into any number of address spaces
+    // Every handle and every mapping holds a reference, the frames are freed when the last one is dropped
+    class object {
+        public:
+        object(): _frames{}, _refs{1}, _n_mappings{0}, _lock{} {}
+
+        object(const object&) = delete;
+        object& operator=(const object&) = delete;
+
+        // Growing allocates zeroed frames, shrinking is only possible while nothing is mapped
+        bool resize(size_t size);
+
+        size_t get_size(){
+            return this->_frames.size() * mm::pmm::block_size;
+        }
+
+        // Returns the base of the mapping or 0, virt is a hint unless MAP_FIXED is passed
+        uint64_t map(proc::process::process* process, uint64_t virt, int prot, int flags);
+        bool unmap(proc::process::process* process, uint64_t virt);
+
+        // Maps the same frames at the same address in a forked child
+        void clone_mapping(proc::process::process* child, uint64_t virt, size_t n_pages, uint64_t map_flags);
+
+        void ref();
+        void unref(); // May delete the object
+
+        private:
+        types::vector<uint64_t> _frames;
+        size_t _refs;
+        size_t _n_mappings;
+        x86_64::spinlock::mutex _lock;
+    };
+
+    struct mapping {
+        proc::shm::object* object; // nullptr when the slot is unused
+        uint64_t base;
+        size_t n_pages;
+        uint64_t map_flags;
+    };
+
+    // Drops all references held by the process, called when its last thread exits
+    void release_process(proc::process::process* process);
+    // Handles are not inherited, only the mappings
+    void fork_process(proc::process::process* parent, proc::process::process* child);
+} // namespace proc::shm
+
+#endif
@@ -6,6 +6,7 @@
 #include <Sigma/arch/x86_64/idt.h>
 #include <Sigma/arch/x86_64/misc/misc.h>
 
+#define PTR_IS_USERLAND(ptr) ((ptr) <= 0x8000000000000000)
 
 namespace proc::syscall
 {
@@ -17,6 +18,30 @@ namespace proc::syscall
 
     constexpr uint8_t syscall_isr_number = 249;
 
+    // Submission / completion ring shared with userspace, keep updated with libsigma/ring.h
+    // Userspace owns sq_tail and cq_head, the kernel owns sq_head and cq_tail
+    struct ring_sqe {
+        uint64_t func;
+        uint64_t args[5];
+        uint64_t user_data;
+    };
+
+    struct ring_cqe {
+        uint64_t user_data;
+        uint64_t result;
+    };
+
+    struct ring_header {
+        uint32_t sq_head, sq_tail;
+        uint32_t cq_head, cq_tail;
+        uint32_t n_entries; // Power of 2, same for both queues
+        uint32_t sq_offset, cq_offset; // From the start of the header
+        uint32_t reserved;
+    };
+
+    constexpr size_t ring_max_entries = 256;
+    constexpr uint64_t ring_result_invalid = ~0ull; // Completion result of syscalls that can't be batched
+
     void init_syscall();
 
     void serve_kernel_vfs(uint64_t ring);
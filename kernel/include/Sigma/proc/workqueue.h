@@ -0,0 +1,44 @@
+#ifndef SIGMA_KERNEL_PROC_WORKQUEUE
+#define SIGMA_KERNEL_PROC_WORKQUEUE
+
+#include <Sigma/common.h>
+#include <Sigma/generic/event.hpp>
+#include <Sigma/arch/x86_64/misc/spinlock.h>
+
+namespace proc::workqueue
+{
+    // Deferred work, runs on a per CPU kernel thread with interrupts enabled, so IRQ handlers can stay short
+    struct work {
+        void (*function)(void*);
+        void* userptr;
+    };
+
+    constexpr size_t queue_size = 256;
+
+    class cpu_queue {
+        public:
+        cpu_queue(): items{}, head{0}, tail{0}, n_dropped{0}, worker{0}, event{}, lock{} {}
+
+        bool push(proc::workqueue::work item);
+        bool pop(proc::workqueue::work& item);
+
+        work items[queue_size]; // Fixed size so pushing never has to allocate from IRQ context
+        size_t head, tail;
+        uint64_t n_dropped;
+        tid_t worker;
+        generic::event event;
+
+        private:
+        x86_64::spinlock::mutex lock;
+    };
+
+    // Creates the queue and worker thread of the current CPU, call after proc::process::init_cpu
+    void init_cpu();
+
+    // Queues work on the current CPU, safe to call from IRQ handlers but not with the scheduler locked
+    // Returns false if the queue is full, if the CPU doesn't have a queue yet the work runs immediately instead
+    bool queue(void (*function)(void*), void* userptr);
+} // namespace proc::workqueue
+
+
+#endif
@@ -9,20 +9,31 @@
 #include <Sigma/arch/x86_64/paging.h>
 #include <Sigma/arch/x86_64/cpu.h>
 
+#include <atomic>
+
+namespace proc::workqueue
+{
+    class cpu_queue;
+} // namespace proc::workqueue
+
 namespace smp::cpu
 {
     struct entry;
 
     C_LINKAGE smp::cpu::entry* get_current_cpu();
 
+    // APs that were started but haven't called set_gs yet, get_current_cpu isn't safe on them until then
+    inline std::atomic<size_t> n_booting_without_gs{0};
+
     struct entry {
         public:
-        entry(): self_ptr((uint64_t)this), lapic_id{0}, gdt{}, tss{}, tss_gdt_offset{0}, features{.raw = 0} {}
+        entry(): self_ptr((uint64_t)this), lapic_id{0}, numa_node{0}, gdt{}, tss{}, tss_gdt_offset{0}, need_resched{0}, work_queue{nullptr}, shootdown_seq{0}, features{.raw = 0} {}
 
         uint64_t self_ptr;
 
         x86_64::apic::lapic lapic;
         uint32_t lapic_id;
+        uint32_t numa_node;
 
         x86_64::gdt::gdt gdt;
         x86_64::tss::table tss;
@@ -35,6 +46,16 @@ namespace smp::cpu
         misc::lazy_initializer<x86_64::kernel_stack> idle_stack;
         misc::lazy_initializer<x86_64::kernel_stack> kstack;
 
+        // MONITORed by this CPU while idle, so a remote wake is a plain store to it instead of an IPI
+        // Padded on both sides to keep it on its own cache line, other writes to that line would cause spurious wakeups
+        uint8_t need_resched_pad_before[64];
+        std::atomic<uint64_t> need_resched;
+        uint8_t need_resched_pad_after[64];
+
+        proc::workqueue::cpu_queue* work_queue;
+
+        std::atomic<uint64_t> shootdown_seq; // Last TLB shootdown this CPU went through
+
         union {
             struct {
                 uint64_t pcid : 1;
@@ -43,6 +64,7 @@ namespace smp::cpu
 			    uint64_t svm : 1;
                 uint64_t x2apic : 1;
                 uint64_t vt_d : 1;
+                uint64_t mwait : 1;
             };
             uint64_t raw;
         } features;
@@ -4,6 +4,11 @@
 #include <Sigma/common.h>
 #include <Sigma/arch/x86_64/idt.h>
 
+namespace x86_64::paging
+{
+    class context;
+} // namespace x86_64::paging
+
 namespace smp
 {
     namespace ipi
@@ -11,7 +16,10 @@ namespace smp
         constexpr uint8_t ping_ipi_vector = 250;
         constexpr uint8_t shootdown_ipi_vector = 251;
 
-        void send_shootdown(uint64_t address, uint64_t length);
+        // Makes every other CPU drop its TLB entries for [address, address + length) of context, returns once all of them did so the frames can be reused
+        // Don't call it while holding a lock that other CPUs might be spinning on with interrupts disabled
+        void send_shootdown(x86_64::paging::context& context, uint64_t address, uint64_t length);
+        void set_online(); // Called by every CPU once it can take IPIs, shootdowns wait for all CPUs that are online
         void send_ping(uint32_t apic_id);
         void send_ping();
 
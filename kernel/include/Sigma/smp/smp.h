@@ -16,6 +16,7 @@ namespace smp
         uint32_t lapic_id;
         bool x2apic;
         bool bsp;
+        uint32_t numa_node;
     };
 
     C_LINKAGE uint64_t trampoline_start;
@@ -0,0 +1,29 @@
+#ifndef SIGMA_KERNEL_SMP_TOPOLOGY
+#define SIGMA_KERNEL_SMP_TOPOLOGY
+
+#include <Sigma/common.h>
+#include <Sigma/smp/smp.h>
+#include <Sigma/types/linked_list.h>
+
+namespace smp::topology
+{
+    // All ids are derived from the APIC id, so they are only unique within their parent level
+    struct cpu_topology {
+        uint32_t apic_id;
+        uint32_t smt_id;
+        uint32_t core_id;
+        uint32_t package_id;
+        uint32_t llc_id; // CPUs with the same llc_id share their last level cache
+    };
+
+    enum class distance {SAME_CPU = 0, SMT_SIBLING = 1, SHARED_CACHE = 2, SAME_PACKAGE = 3, REMOTE = 4};
+
+    // Reads CPUID leaves 0x1F / 0xB / 0x4 on the BSP and applies the resulting APIC id layout to all MADT cpus
+    void init(types::linked_list<smp::cpu_entry>& cpus);
+
+    smp::topology::cpu_topology get(uint32_t apic_id);
+    smp::topology::distance get_distance(uint32_t a, uint32_t b);
+} // namespace smp::topology
+
+
+#endif
@@ -52,6 +52,17 @@ namespace types
                 ;
         }
 
+        // nullptr instead of a panic when the key isn't in the map
+        Value* find(Key key){
+            auto hash = this->hasher(key);
+
+            for(auto& entry : list)
+                if(entry.first == hash)
+                    return &entry.second;
+
+            return nullptr;
+        }
+
         private:
         using entry = std::pair<typename Hasher::hash_result, Value>;
 
@@ -1,5 +1,6 @@
 #include <Sigma/acpi/acpi.h>
 #include <Sigma/proc/initrd.h>
+#include <Sigma/proc/workqueue.h>
 
 #include <lai/core.h>
 #include <lai/helpers/sci.h>
@@ -163,8 +164,8 @@ void acpi::init(){
     init_ec();
 }
 
-static void acpi_sci_handler(MAYBE_UNUSED_ATTRIBUTE x86_64::idt::idt_registers* regs, MAYBE_UNUSED_ATTRIBUTE void* userptr) {
-	uint16_t event = lai_get_sci_event();
+static void acpi_sci_work(void* userptr) {
+	uint16_t event = (uint16_t)(uint64_t)userptr;
 	if(event & ACPI_POWER_BUTTON) {
 		debug_printf("[ACPI]: Requested ACPI shutdown at TSC: %x\n", x86_64::read_tsc());
 		lai_enter_sleep(5); // S5 is off
@@ -173,6 +174,12 @@ static void acpi_sci_handler(MAYBE_UNUSED_ATTRIBUTE x86_64::idt::idt_registers*
 	}
 }
 
+static void acpi_sci_handler(MAYBE_UNUSED_ATTRIBUTE x86_64::idt::idt_registers* regs, MAYBE_UNUSED_ATTRIBUTE void* userptr) {
+	uint16_t event = lai_get_sci_event(); // Acks the SCI, has to happen before the EOI since it is level triggered
+	if(!proc::workqueue::queue(acpi_sci_work, (void*)(uint64_t)event))
+		printf("[ACPI]: Dropped SCI event: %x, workqueue full\n", event);
+}
+
 void acpi::init_sci(acpi::madt& madt){
     FUNCTION_CALL_ONCE();
     auto* fadt = reinterpret_cast<acpi::fadt*>(acpi::get_table(acpi::fadt_signature));
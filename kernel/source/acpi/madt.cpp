@@ -22,7 +22,7 @@ void acpi::madt::parse_lapic(uint8_t* item){
             // Assume not BSP
             bsp = false;
         }
-        cpus.push_back({.lapic_id = lapic->apic_id, .x2apic = false, .bsp = bsp});
+        cpus.push_back({.lapic_id = lapic->apic_id, .x2apic = false, .bsp = bsp, .numa_node = 0});
     } else {
         debug_printf(", Disabled");
     }
@@ -43,7 +43,7 @@ void acpi::madt::parse_x2apic(uint8_t* item){
             // Assume not BSP
             bsp = false;
         }
-        cpus.push_back({.lapic_id = lapic->x2apic_id, .x2apic = true, .bsp = bsp});
+        cpus.push_back({.lapic_id = lapic->x2apic_id, .x2apic = true, .bsp = bsp, .numa_node = 0});
     } else {
         debug_printf(", Disabled");
     }
@@ -0,0 +1,136 @@
+#include <Sigma/acpi/srat.h>
+#include <Sigma/mm/pmm.h>
+
+acpi::srat::srat(): cpus{}, ranges{}, domains{}, n_nodes{0}, table{(acpi::srat_header*)acpi::get_table(acpi::srat_signature)} {}
+
+uint32_t acpi::srat::node_for_domain(uint32_t domain){
+    for(size_t i = 0; i < this->n_nodes; i++)
+        if(this->domains[i] == domain)
+            return i;
+
+    if(this->n_nodes == max_nodes){
+        debug_printf("[SRAT]: Too many proximity domains, folding domain %x into node 0\n", domain);
+        return 0;
+    }
+
+    this->domains[this->n_nodes] = domain;
+    return this->n_nodes++;
+}
+
+void acpi::srat::parse_lapic(uint8_t* item){
+    auto* lapic = reinterpret_cast<acpi::srat_lapic*>(item);
+    uint32_t flags = lapic->flags;
+    if(!bitops<uint32_t>::bit_test(flags, acpi::srat_flags_enabled))
+        return;
+
+    uint32_t domain = lapic->proximity_domain_low | (lapic->proximity_domain_high[0] << 8) | (lapic->proximity_domain_high[1] << 16) | (lapic->proximity_domain_high[2] << 24);
+    auto node = this->node_for_domain(domain);
+    debug_printf("[SRAT]: APIC id: %x -> Proximity Domain: %x [Node %d]\n", lapic->apic_id, domain, node);
+
+    this->cpus.push_back({.apic_id = lapic->apic_id, .node = node});
+}
+
+void acpi::srat::parse_x2apic(uint8_t* item){
+    auto* lapic = reinterpret_cast<acpi::srat_x2apic*>(item);
+    uint32_t flags = lapic->flags;
+    if(!bitops<uint32_t>::bit_test(flags, acpi::srat_flags_enabled))
+        return;
+
+    auto node = this->node_for_domain(lapic->proximity_domain);
+    debug_printf("[SRAT]: x2APIC id: %x -> Proximity Domain: %x [Node %d]\n", lapic->x2apic_id, lapic->proximity_domain, node);
+
+    this->cpus.push_back({.apic_id = lapic->x2apic_id, .node = node});
+}
+
+void acpi::srat::parse_memory(uint8_t* item){
+    auto* memory = reinterpret_cast<acpi::srat_memory*>(item);
+    uint32_t flags = memory->flags;
+    if(!bitops<uint32_t>::bit_test(flags, acpi::srat_flags_enabled) || memory->length_bytes == 0)
+        return;
+
+    auto node = this->node_for_domain(memory->proximity_domain);
+    debug_printf("[SRAT]: Memory: [%x -> %x] -> Proximity Domain: %x [Node %d]\n", memory->base, memory->base + memory->length_bytes, memory->proximity_domain, node);
+
+    this->ranges.push_back({.base = memory->base, .length = memory->length_bytes, .node = node});
+}
+
+void acpi::srat::parse(){
+    size_t table_size = (this->table->header.length - sizeof(acpi::srat_header));
+    uint64_t list = reinterpret_cast<uint64_t>(this->table) + sizeof(acpi::srat_header);
+    uint64_t offset = 0;
+    while((list + offset) < (list + table_size)){
+        uint8_t* item = reinterpret_cast<uint8_t*>((list + offset));
+        uint8_t type = item[0]; // Type
+        switch (type)
+        {
+        case acpi::srat_type_lapic:
+            this->parse_lapic(item);
+            break;
+
+        case acpi::srat_type_memory:
+            this->parse_memory(item);
+            break;
+
+        case acpi::srat_type_x2apic:
+            this->parse_x2apic(item);
+            break;
+
+        default:
+            debug_printf("[SRAT]: Unknown table type: %x\n", type);
+            break;
+        }
+
+        if(item[1] == 0)
+            break; // Malformed entry, don't loop forever
+        offset += item[1]; // Length
+    }
+}
+
+types::linked_list<acpi::srat::cpu_affinity>& acpi::srat::get_cpus(){
+    return cpus;
+}
+
+types::linked_list<acpi::srat::memory_affinity>& acpi::srat::get_memory_ranges(){
+    return ranges;
+}
+
+acpi::slit::slit(): table{(acpi::slit_header*)acpi::get_table(acpi::slit_signature)} {}
+
+uint8_t acpi::slit::get_distance(uint32_t from_domain, uint32_t to_domain){
+    if(this->table == nullptr || from_domain >= this->table->n_localities || to_domain >= this->table->n_localities)
+        return (from_domain == to_domain) ? acpi::slit_local_distance : (acpi::slit_local_distance * 2); // Assume a remote node is twice as far
+
+    return this->table->entries[from_domain * this->table->n_localities + to_domain];
+}
+
+void acpi::init_numa(acpi::madt& madt){
+    acpi::srat srat{};
+    if(!srat.found_table()){
+        debug_printf("[SRAT]: No SRAT found, assuming UMA system\n");
+        return;
+    }
+
+    srat.parse();
+    if(srat.get_n_nodes() <= 1)
+        return; // Nothing to gain from splitting a single node
+
+    for(auto& cpu : madt.get_cpus()){
+        for(auto& affinity : srat.get_cpus()){
+            if(affinity.apic_id == cpu.lapic_id){
+                cpu.numa_node = affinity.node;
+                break;
+            }
+        }
+    }
+
+    acpi::slit slit{};
+    uint8_t distances[mm::pmm::max_numa_nodes][mm::pmm::max_numa_nodes] = {};
+    for(size_t i = 0; i < srat.get_n_nodes(); i++)
+        for(size_t j = 0; j < srat.get_n_nodes(); j++)
+            distances[i][j] = slit.get_distance(srat.get_domain_for_node(i), srat.get_domain_for_node(j));
+
+    for(auto& range : srat.get_memory_ranges())
+        mm::pmm::add_numa_range(range.base, range.length, range.node);
+
+    mm::pmm::init_numa(srat.get_n_nodes(), distances);
+}
@@ -126,6 +126,28 @@ void x86_64::pcid::init(){
     }
 }
 
+void x86_64::mwait::init(){
+    if(misc::kernel_args::get_bool("nomwait")){
+        debug_printf("[CPU]: Forced MWAIT disable\n");
+        return;
+    }
+
+    uint32_t a, b, c, d;
+    if(!cpuid(1, a, b, c, d) || !(c & cpuid_bits::MONITOR)){
+        debug_printf("[CPU]: MONITOR / MWAIT is not available\n");
+        return;
+    }
+
+    // Leaf 5 gives the monitor line size, a zero size means MONITOR is unusable, even though the bit is set (some hypervisors do this)
+    if(!cpuid(5, a, b, c, d) || (b & 0xFFFF) == 0){
+        debug_printf("[CPU]: MONITOR / MWAIT is not usable\n");
+        return;
+    }
+
+    smp::cpu::get_current_cpu()->features.mwait = 1;
+    debug_printf("[CPU]: Enabled MWAIT idle\n");
+}
+
 void x86_64::tsd::init(){
     // Assume the TSC is supported since it is *way* older than x86_64
     if(misc::kernel_args::get_bool("enable_tsd")){
@@ -207,6 +229,7 @@ void x86_64::misc_early_features_init(){
     x86_64::umip::init();
     x86_64::pat::init();
     x86_64::pcid::init();
+    x86_64::mwait::init();
 
     uint32_t a, b, c, d;
     x86_64::cpuid(0, a, b, c, d);
@@ -515,6 +538,18 @@ void x86_64::identify_cpu(){
         }
     }
     
+    if(x86_64::cpuid(1, a, b, c, d) && (c & cpuid_bits::MONITOR)){
+        if(x86_64::cpuid(5, a, b, c, d)){
+            debug_printf("    Monitor line size: %d - %d bytes\n", a & 0xFFFF, b & 0xFFFF);
+            if(c & 1){
+                debug_printf("    MWAIT C-state substates: ");
+                for(uint8_t i = 0; i < 8; i++)
+                    debug_printf("C%d: %d ", i, (d >> (i * 4)) & 0xF);
+                debug_printf("\n");
+            }
+        }
+    }
+
     using namespace cpuid_bits;
 
     debug_printf("    Features: ");
@@ -170,6 +170,10 @@ bool x86_64::hpet::create_timer(uint8_t comparator, x86_64::hpet::hpet_timer_typ
     return true;
 }
 
+uint64_t x86_64::hpet::get_time_ms(){
+    return hpet_read(x86_64::hpet::main_counter_reg) / (x86_64::hpet::femto_per_milli / main_counter_clk);
+}
+
 void x86_64::hpet::poll_sleep(uint64_t ms){
     uint64_t goal = hpet_read(x86_64::hpet::main_counter_reg) + ms * x86_64::hpet::femto_per_milli / main_counter_clk;
 
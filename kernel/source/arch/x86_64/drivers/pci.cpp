@@ -263,10 +263,15 @@ static void enumerate_function(uint16_t seg, uint8_t bus, uint8_t device, uint8_
                 dev.msi.space_offset = next_ptr;
                 break;
 
-            case 0x11: // Message Signaled Interrupt-X
+            case 0x11: { // Message Signaled Interrupt-X
                 dev.msix.supported = true;
                 dev.msix.space_offset = next_ptr;
+
+                x86_64::pci::msix::control control{};
+                control.raw = x86_64::pci::read(seg, bus, device, function, next_ptr + x86_64::pci::msix::msix_control_reg, 2);
+                dev.msix.n_vectors = control.table_size + 1;
                 break;
+            }
             
             default:
                 break;
@@ -373,7 +378,7 @@ void x86_64::pci::parse_pci(){
                 debug_printf("MSI ");
 
             if(entry.msix.supported)
-                debug_printf("MSI-X ");
+                debug_printf("MSI-X [%d vectors] ", entry.msix.n_vectors);
 
             if(entry.has_irq)
                 debug_printf("GSI %d ", entry.gsi);
@@ -579,6 +584,8 @@ static void pci_route_all_irqs(){
         while(!(err = lai_pci_parse_prt(&iter))){
             if(iter.slot == tmp->device && (iter.function == tmp->function || iter.function == -1) && iter.pin == (irq_pin - 1)){
                 dev.gsi = iter.gsi;
+                dev.irq_level_triggered = iter.level_triggered;
+                dev.irq_active_low = iter.active_low;
                 dev.has_irq = true;
                 found = true;
                 break;
@@ -638,6 +645,79 @@ void x86_64::pci::device::install_msi(uint32_t dest_id, uint8_t vector){
     x86_64::pci::write(seg, bus, device, function, msi.space_offset + msi::msi_control_reg, control.raw, 2);
 }
 
+bool x86_64::pci::device::install_msix(uint16_t index, uint32_t dest_id, uint8_t vector){
+    ASSERT(this->msix.supported);
+    ASSERT(this->msix.space_offset);
+
+    // ACPI indicates that we shouldn't enable MSIs, probably want to handle this gracefully
+    ASSERT(!(acpi::get_arch_boot_flags() & (1 << acpi::iapc_boot_arch_msi_not_supported)));
+
+    if(index >= this->msix.n_vectors){
+        debug_printf("[PCI]: Tried to install MSI-X vector %d, but device only has %d\n", index, this->msix.n_vectors);
+        return false;
+    }
+
+    if(dest_id > 0xFF){
+        debug_printf("[PCI]: Can't target APIC id %x with an MSI-X without IRQ remapping\n", dest_id);
+        return false;
+    }
+
+    if(!this->msix.table){
+        uint32_t table_reg = x86_64::pci::read(seg, bus, device, function, msix.space_offset + msix::msix_table_reg, 4);
+        auto& bar = this->bars[table_reg & 0x7];
+        if(bar.type != x86_64::pci::bar_type_mem){
+            debug_printf("[PCI]: MSI-X table is in an invalid BAR: %d\n", table_reg & 0x7);
+            return false;
+        }
+
+        uint64_t table_phys = bar.base + (table_reg & ~0x7);
+        uint64_t table_size = this->msix.n_vectors * sizeof(msix::table_entry);
+        for(uint64_t page = ALIGN_DOWN(table_phys, mm::pmm::block_size); page < (table_phys + table_size); page += mm::pmm::block_size)
+            mm::vmm::kernel_vmm::get_instance().map_page(page, (page + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE), map_page_flags_present | map_page_flags_writable | map_page_flags_no_execute | map_page_flags_global, map_page_cache_types::uncacheable);
+
+        this->msix.table = reinterpret_cast<volatile msix::table_entry*>(table_phys + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE);
+    }
+
+    msi::control msi_control{};
+    if(this->msi.supported){
+        // MSI and MSI-X can't be enabled at the same time
+        msi_control.raw = x86_64::pci::read(seg, bus, device, function, msi.space_offset + msi::msi_control_reg, 2);
+        if(msi_control.msie){
+            msi_control.msie = 0;
+            x86_64::pci::write(seg, bus, device, function, msi.space_offset + msi::msi_control_reg, msi_control.raw, 2);
+        }
+    }
+
+    msi::address addr{};
+    addr.base_address = 0xFEE;
+    addr.destination_id = dest_id;
+
+    msi::data data{};
+    data.vector = vector;
+    data.delivery_mode = 0;
+
+    auto& entry = this->msix.table[index];
+    entry.vector_control = entry.vector_control | msix::vector_control_masked; // Don't let the device use a half written entry
+    entry.addr_low = addr.raw;
+    entry.addr_high = 0;
+    entry.data = data.raw;
+    entry.vector_control = entry.vector_control & ~msix::vector_control_masked;
+
+    msix::control control{};
+    control.raw = x86_64::pci::read(seg, bus, device, function, msix.space_offset + msix::msix_control_reg, 2);
+    control.enable = 1;
+    control.function_mask = 0;
+    x86_64::pci::write(seg, bus, device, function, msix.space_offset + msix::msix_control_reg, control.raw, 2);
+    return true;
+}
+
+void x86_64::pci::device::mask_msix(uint16_t index){
+    ASSERT(this->msix.table && index < this->msix.n_vectors);
+
+    auto& entry = this->msix.table[index];
+    entry.vector_control = entry.vector_control | msix::vector_control_masked;
+}
+
 const char* x86_64::pci::device::class_str() const {
     switch (class_code)
     {
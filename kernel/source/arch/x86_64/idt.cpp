@@ -82,11 +82,33 @@ static void sigma_page_fault_handler(x86_64::idt::idt_registers* registers, MAYB
     asm("cli; hlt");
 }
 
+// Faults on lazily populated file mappings are expected, returns true if the access can be retried
+static bool resolve_page_fault(x86_64::idt::idt_registers* registers){
+    uint64_t cr2;
+    asm("mov %%cr2, %0" : "=r"(cr2));
+
+    uint64_t error_code = registers->error_code;
+    if(!misc::is_canonical(cr2) || cr2 >= proc::process::mmap_top || bitops<uint64_t>::bit_test(error_code, 3))
+        return false;
+
+    if(!proc::process::get_current_managed_cpu())
+        return false;
+
+    auto* thread = proc::process::get_current_thread();
+    if(thread == nullptr || thread->process == nullptr)
+        return false;
+
+    return proc::file_map::handle_fault(thread->process, cr2, bitops<uint64_t>::bit_test(error_code, 1));
+}
+
 C_LINKAGE void sigma_isr_handler(x86_64::idt::idt_registers *registers){
     uint8_t n = registers->int_number & 0xFF;
 
     smp::cpu::entry* cpu = smp::cpu::get_current_cpu();
 
+    if(n == 14 && resolve_page_fault(registers))
+        return;
+
     if(n < 32){
         printf("[IDT]: Received interrupt %d, #%s: %s\n    Error Code: %x\n", n, exceptions[n].mnemonic, exceptions[n].message, registers->error_code);
         printf("    RIP: %x, RSP: %x, CPU: %d\n", registers->rip, registers->rsp, cpu->lapic_id);
@@ -138,6 +160,15 @@ void x86_64::idt::register_interrupt_handler(x86_64::idt::handler h){
     handlers[h.vector] = h;
 }
 
+void x86_64::idt::unregister_interrupt_handler(uint16_t vector){
+    // Keep the IRQ status so an interrupt that was already in flight still gets its EOI
+    handlers[vector] = {.vector = vector, .callback = nullptr, .userptr = nullptr, .is_irq = handlers[vector].is_irq};
+}
+
+bool x86_64::idt::has_handler(uint16_t vector){
+    return handlers[vector].callback != nullptr;
+}
+
 void x86_64::idt::register_irq_status(uint16_t n, bool is_irq){
     handlers[n].is_irq = is_irq;
 }
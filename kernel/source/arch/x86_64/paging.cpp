@@ -88,6 +88,11 @@ void x86_64::paging::set_current_info(x86_64::paging::context* info){
             auto* page_context = pcid_context.get_context();
 
             if(page_context && page_context == info){
+                if(pcid_context.get_generation() != info->get_generation()){
+                    pcid = i; // Context got reinitialized for another process, its old TLB entries are stale
+                    break;
+                }
+
                 if(!pcid_context.is_active())
                     pcid_context.set_context();
 
@@ -102,8 +107,12 @@ void x86_64::paging::set_current_info(x86_64::paging::context* info){
         cpu_context.contexts[pcid].set_context(info);
 
     } else {
-        // No PCID, so just use the first one
-        cpu_context.contexts[0].set_context(info);
+        // No PCID, so just use the first one, and don't reload CR3 at all when switching between threads of the same process
+        auto& pcid_context = cpu_context.contexts[0];
+        if(pcid_context.get_context() == info && pcid_context.get_generation() == info->get_generation() && pcid_context.is_active())
+            return;
+
+        pcid_context.set_context(info);
     }
 }
 
@@ -142,6 +151,10 @@ uint64_t x86_64::paging::pcid_context::get_timestamp(){
     return timestamp;
 }
 
+uint64_t x86_64::paging::pcid_context::get_generation(){
+    return generation;
+}
+
 void x86_64::paging::pcid_context::set_context(){
     uint64_t table_phys = reinterpret_cast<uint64_t>(this->context->get_paging_info()) - KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE;
     uint64_t cr3 = table_phys | this->pcid;
@@ -157,6 +170,7 @@ void x86_64::paging::pcid_context::set_context(){
 
 void x86_64::paging::pcid_context::set_context(x86_64::paging::context* context){
     this->context = context;
+    this->generation = context->get_generation();
     // TODO: TLB shootdown
 
     uint64_t table_phys = reinterpret_cast<uint64_t>(this->context->get_paging_info()) - KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE;
@@ -179,11 +193,18 @@ x86_64::paging::context* x86_64::paging::pcid_context::get_context(){
 
 #pragma region paging::paging
 
+static std::atomic<uint64_t> next_generation{1};
+
 void x86_64::paging::context::init(){
     if(this->paging_info != nullptr) this->deinit();
 
     this->paging_info = reinterpret_cast<x86_64::paging::pml4*>(reinterpret_cast<uint64_t>(mm::pmm::alloc_block()) + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE);
     memset_aligned_4k(reinterpret_cast<void*>(this->paging_info), 0);
+    this->generation = next_generation.fetch_add(1);
+}
+
+void x86_64::paging::context::bump_generation(){
+    this->generation = next_generation.fetch_add(1);
 }
 
 static void clean_pd(x86_64::paging::pd* pd){
@@ -250,6 +271,8 @@ bool x86_64::paging::context::map_page(uint64_t phys, uint64_t virt, uint64_t fl
         bitops<uint64_t>::bit_set(entry_flags, x86_64::paging::page_entry_global);
     if(flags & map_page_flags_writable)
         bitops<uint64_t>::bit_set(entry_flags, x86_64::paging::page_entry_writeable);
+    if(flags & map_page_flags_shared)
+        bitops<uint64_t>::bit_set(entry_flags, x86_64::paging::page_entry_shared);
 
     pml4* pml4_addr = this->paging_info;
     uint64_t pml4_entry = pml4_addr->entries[pml4_index_number];
@@ -521,6 +544,35 @@ bool x86_64::paging::context::set_page_protection(uint64_t virt, uint64_t flags,
     return false;
 }
 
+bool x86_64::paging::context::unmap_page(uint64_t virt){
+    uint64_t pml4_index_number = pml4_index(virt);
+    uint64_t pdpt_index_number = pdpt_index(virt);
+    uint64_t pd_index_number = pd_index(virt);
+    uint64_t pt_index_number = pt_index(virt);
+
+    uint64_t pml4_entry = this->paging_info->entries[pml4_index_number];
+    if(bitops<uint64_t>::bit_test(pml4_entry, x86_64::paging::page_entry_present)){
+        x86_64::paging::pdpt* pdpt = reinterpret_cast<x86_64::paging::pdpt*>(get_frame(this->paging_info->entries[pml4_index_number]) + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE);
+        uint64_t pdpt_entry = pdpt->entries[pdpt_index_number];
+        if(bitops<uint64_t>::bit_test(pdpt_entry, x86_64::paging::page_entry_present)){
+            x86_64::paging::pd* pd = reinterpret_cast<x86_64::paging::pd*>(get_frame(pdpt->entries[pdpt_index_number]) + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE);
+            uint64_t pd_entry = pd->entries[pd_index_number];
+            if(bitops<uint64_t>::bit_test(pd_entry, x86_64::paging::page_entry_present)){
+                x86_64::paging::pt* pt = reinterpret_cast<x86_64::paging::pt*>(get_frame(pd->entries[pd_index_number]) + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE);
+                uint64_t pt_entry = pt->entries[pt_index_number];
+                if(bitops<uint64_t>::bit_test(pt_entry, x86_64::paging::page_entry_present)){
+                    pt->entries[pt_index_number] = 0; // Page tables are left in place, they get freed with the context
+
+                    x86_64::paging::invalidate_addr(virt);
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
 uint64_t x86_64::paging::context::get_free_range(uint64_t search_base_hint, uint64_t search_end_hint, size_t size){
     uintptr_t current_addr = (uintptr_t)-1;
     size_t needed_pages = misc::div_ceil(size, mm::pmm::block_size);
@@ -541,10 +593,18 @@ uint64_t x86_64::paging::context::get_free_range(uint64_t search_base_hint, uint
     return current_addr;
 }
 
+bool x86_64::paging::context::is_range_free(uint64_t base, size_t size){
+    for(uintptr_t ptr = base; ptr < (base + size); ptr += mm::pmm::block_size)
+        if(this->get_phys(ptr) != (uint64_t)-1)
+            return false;
+
+    return true;
+}
+
 #pragma endregion
 
-void x86_64::paging::context::fork_address_space(proc::process::thread& new_thread){
-    mm::vmm::kernel_vmm::get_instance().clone_paging_info(new_thread.vmm);
+void x86_64::paging::context::fork_address_space(proc::process::process& new_process){
+    mm::vmm::kernel_vmm::get_instance().clone_paging_info(new_process.vmm);
 
     for(uint64_t i = 0; i < (x86_64::paging::paging_structures_n_entries / 2); i++){
         uint64_t pml4_entry = this->paging_info->entries[i];
@@ -571,6 +631,9 @@ void x86_64::paging::context::fork_address_space(proc::process::thread& new_thre
                     if(!bitops<uint64_t>::bit_test(pt_entry, x86_64::paging::page_entry_present))
                         continue;
 
+                    if(bitops<uint64_t>::bit_test(pt_entry, x86_64::paging::page_entry_shared))
+                        continue; // Shared memory gets mapped by proc::shm::fork_process
+
                     // Clone Page
                     uint64_t new_page_phys = reinterpret_cast<uint64_t>(mm::pmm::alloc_block());
                     uint64_t new_page_virt = indicies_to_addr(i, j, k, l);
@@ -590,8 +653,8 @@ void x86_64::paging::context::fork_address_space(proc::process::thread& new_thre
 
                     memcpy_aligned_4k(reinterpret_cast<void*>(new_page_phys + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE), reinterpret_cast<void*>(get_frame(pt_entry) + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE));
 
-                    new_thread.vmm.map_page(new_page_phys, new_page_virt, flags);
-                    new_thread.resources.frames.push_back(new_page_phys);
+                    new_process.vmm.map_page(new_page_phys, new_page_virt, flags);
+                    new_process.resources.frames.push_back(new_page_phys);
                 }   
             }
         }
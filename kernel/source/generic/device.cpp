@@ -1,6 +1,8 @@
 #include <Sigma/generic/device.h>
 #include <Sigma/proc/process.h>
 #include <Sigma/generic/user_handle.hpp>
+#include <Sigma/proc/syscall.h>
+#include <Sigma/arch/x86_64/drivers/apic.h>
 
 #include <klibcxx/mutex.hpp>
 
@@ -79,8 +81,46 @@ static bool get_resource_region(generic::device::device_descriptor dev, uint64_t
     return true;
 }
 
+// Registers the handler, which also takes vec out of get_free_vector, the handle isn't visible to the process yet
+static generic::handles::irq_handle* make_irq(uint8_t vec, uint32_t level_gsi = UINT32_MAX){
+    auto* irq = new generic::handles::irq_handle{vec, proc::process::get_current_tid()};
+    irq->level_gsi = level_gsi;
+
+    x86_64::idt::register_interrupt_handler({.vector = vec, .callback = +[](MAYBE_UNUSED_ATTRIBUTE x86_64::idt::idt_registers* r, void* userptr){
+        auto* irq = (generic::handles::irq_handle*)userptr;
+
+        // The line stays asserted until the driver has serviced the device, it would fire again right after the EOI
+        if(irq->level_gsi != UINT32_MAX)
+            x86_64::apic::ioapic::mask_gsi(irq->level_gsi);
+
+        irq->event.trigger();
+        proc::process::preempt_for(irq->owner); // Don't let the driver wait for the end of a slice of a lower class
+    }, .userptr = (void*)irq, .is_irq = true});
+
+    return irq;
+}
+
+static uint64_t make_irq_handle(uint8_t vec, uint32_t level_gsi = UINT32_MAX){
+    return proc::process::get_current_thread()->process->handle_catalogue.push(make_irq(vec, level_gsi));
+}
+
+static bool is_user_array(uint64_t ptr, uint64_t n){
+    return misc::is_canonical(ptr) && ptr != 0 && PTR_IS_USERLAND(ptr + n * sizeof(uint64_t));
+}
+
 static std::mutex devctl_lock{};
 
+// Process that claimed each ISA IRQ through enable_irq, the kernel's own handlers, like the SCI, have no entry
+static struct {
+    proc::process::process* process;
+    uint64_t pid;
+} isa_irq_owners[16] = {};
+
+static bool isa_irq_owner_alive(uint8_t irq){
+    auto& owner = isa_irq_owners[irq];
+    return owner.process && owner.process->pid == owner.pid && owner.process->n_threads != 0;
+}
+
 uint64_t generic::device::devctl(uint64_t cmd, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, x86_64::idt::idt_registers* regs){
     std::lock_guard lock{devctl_lock};
     uint64_t ret = UINT64_MAX;
@@ -131,25 +171,124 @@ uint64_t generic::device::devctl(uint64_t cmd, uint64_t arg1, uint64_t arg2, uin
         auto& device = device_list->operator[](arg1);
 
         ASSERT(device.contact.pci);
+        auto& pci_dev = *device.pci_contact.device;
+        if(pci_dev.msi.supported){
+            auto vec = x86_64::idt::get_free_vector();
+            pci_dev.install_msi(0, vec);
+
+            ret = make_irq_handle(vec);
+            break;
+        }
+
+        // No MSI, devices in compatibility mode like IDE controllers are hardwired to an ISA IRQ the driver has to name in arg2
+        if(arg2 != 0){
+            if(arg2 == 2 || arg2 >= 16)
+                break;
+
+            // Don't let a driver take over a vector the kernel or another live driver is using, a dead driver's line can be claimed again
+            uint8_t vec = arg2 + 0x20; // ISA IRQs are already routed to 0x20 + irq, just masked
+            if(x86_64::idt::has_handler(vec) && (!isa_irq_owners[arg2].process || isa_irq_owner_alive(arg2)))
+                break;
+
+            auto* process = proc::process::get_current_thread()->process;
+            isa_irq_owners[arg2] = {.process = process, .pid = process->pid};
+
+            ret = make_irq_handle(vec);
+            x86_64::apic::ioapic::unmask_irq(arg2);
+            break;
+        }
+
+        // Otherwise it's INTx, routed through the _PRT at boot, the Interrupt Line register is only a hint for the legacy PIC
+        if(!pci_dev.has_irq)
+            break;
+
+        if(!(x86_64::apic::ioapic::read_entry(pci_dev.gsi) & (1 << 16)))
+            break; // Unmasked means someone else already owns the line, sharing it isn't supported
 
         auto vec = x86_64::idt::get_free_vector();
-        device.pci_contact.device->install_msi(0, vec);
+        if(vec == (uint8_t)-1)
+            break;
+
+        // Flags in MADT ISO format, polarity in bits 0-1 and trigger mode in bits 2-3
+        uint16_t flags = (pci_dev.irq_active_low ? 0b11 : 0b01) | ((pci_dev.irq_level_triggered ? 0b11 : 0b01) << 2);
+        x86_64::apic::ioapic::set_entry(pci_dev.gsi, vec, x86_64::apic::ioapic_delivery_modes::FIXED, x86_64::apic::ioapic_destination_modes::PHYSICAL, flags, smp::cpu::get_current_cpu()->lapic_id);
 
-        auto* irq = new handles::irq_handle{vec};
+        ret = make_irq_handle(vec, pci_dev.irq_level_triggered ? pci_dev.gsi : UINT32_MAX);
+        x86_64::apic::ioapic::unmask_gsi(pci_dev.gsi);
+        break;
+    }
 
-        x86_64::idt::register_interrupt_handler({.vector = vec, .callback = +[](MAYBE_UNUSED_ATTRIBUTE x86_64::idt::idt_registers* r, void* userptr){
-            auto* event = (generic::event*)userptr;
+    case generic::device::devctl_cmd_enable_msix: {
+        #ifdef LOG_SYSCALLS
+        debug_printf("[DEVICE]: Handling cmd_enable_msix, descriptor: %d, n: %d, cpus: %x, handles: %x\n", arg1, arg2, arg3, arg4);
+        #endif
+        auto& device = device_list->operator[](arg1);
+
+        ASSERT(device.contact.pci);
+        auto& pci_dev = *device.pci_contact.device;
+        if(!pci_dev.msix.supported || arg2 == 0 || arg2 > pci_dev.msix.n_vectors)
+            break;
 
-            event->trigger();
-        }, .userptr = (void*)&irq->event, .is_irq = true});
+        if(!is_user_array(arg3, arg2) || !is_user_array(arg4, arg2))
+            break;
 
-        ret = proc::process::get_current_thread()->handle_catalogue.push(irq);
+        // Nothing gets installed unless every CPU exists
+        auto* cpus = reinterpret_cast<uint64_t*>(arg3);
+        types::vector<uint32_t> lapic_ids{};
+        for(uint64_t i = 0; i < arg2; i++){
+            uint32_t lapic_id = 0;
+            if(!proc::process::get_cpu_lapic_id(cpus[i], lapic_id))
+                break;
+            lapic_ids.push_back(lapic_id);
+        }
+
+        if(lapic_ids.size() != arg2)
+            break;
+
+        types::vector<generic::handles::irq_handle*> irqs{};
+        for(uint64_t i = 0; i < arg2; i++){
+            auto vec = x86_64::idt::get_free_vector();
+            if(vec == (uint8_t)-1)
+                break;
+
+            auto* irq = make_irq(vec);
+            if(!pci_dev.install_msix(i, lapic_ids[i], vec)){
+                x86_64::idt::unregister_interrupt_handler(vec);
+                delete irq;
+                break;
+            }
+            irqs.push_back(irq);
+        }
+
+        if(irqs.size() != arg2){
+            // Undo the entries that did get installed, the vectors go back to get_free_vector
+            for(size_t i = 0; i < irqs.size(); i++){
+                pci_dev.mask_msix(i);
+                x86_64::idt::unregister_interrupt_handler(irqs[i]->vector);
+                delete irqs[i];
+            }
+            break;
+        }
+
+        // Only hand out handles once nothing can fail anymore, there's no way to take them back
+        auto* handles = reinterpret_cast<uint64_t*>(arg4);
+        auto& catalogue = proc::process::get_current_thread()->process->handle_catalogue;
+        for(uint64_t i = 0; i < arg2; i++)
+            handles[i] = catalogue.push(irqs[i]);
+
+        ret = 0;
         break;
     }
 
     case generic::device::devctl_cmd_wait_on_irq: {
         auto* thread = proc::process::get_current_thread();
-        auto& irq = *thread->handle_catalogue.get<generic::handles::irq_handle>(arg1);
+        auto* handle = thread->process->handle_catalogue.find<generic::handles::irq_handle>(arg1);
+        if(!handle)
+            break;
+
+        auto& irq = *handle;
+        if(irq.level_gsi != UINT32_MAX)
+            x86_64::apic::ioapic::unmask_gsi(irq.level_gsi); // Serviced by now, if it's still asserted it fires right away
 
         devctl_lock.unlock(); // block isn't returning
         thread->block(&irq.event, regs);
@@ -0,0 +1,48 @@
+#include <Sigma/generic/timer.hpp>
+#include <Sigma/arch/x86_64/drivers/hpet.h>
+#include <Sigma/smp/cpu.h>
+
+static x86_64::spinlock::mutex timers_lock{};
+static generic::timer* armed_timers = nullptr;
+
+generic::timer::timer(uint64_t ms, bool periodic): event{}, deadline{x86_64::hpet::get_time_ms() + ms}, period{periodic ? ms : 0}, next{nullptr} {
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{timers_lock};
+
+    this->next = armed_timers;
+    armed_timers = this;
+}
+
+generic::timer::~timer(){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{timers_lock};
+
+    for(auto** it = &armed_timers; *it != nullptr; it = &(*it)->next){
+        if(*it == this){
+            *it = this->next;
+            break;
+        }
+    }
+}
+
+void generic::timers_tick(){
+    std::lock_guard guard{timers_lock};
+    uint64_t now = x86_64::hpet::get_time_ms();
+
+    for(auto** it = &armed_timers; *it != nullptr;){
+        auto* timer = *it;
+        if(timer->deadline > now){
+            it = &timer->next;
+            continue;
+        }
+
+        timer->event.trigger();
+        if(timer->period){
+            timer->deadline = now + timer->period;
+            it = &timer->next;
+        } else {
+            *it = timer->next; // One shot, disarm
+            timer->next = nullptr;
+        }
+    }
+}
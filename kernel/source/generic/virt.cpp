@@ -139,8 +139,8 @@ uint64_t generic::virt::vctl(uint64_t cmd, MAYBE_UNUSED_ATTRIBUTE uint64_t arg1,
 	switch(cmd){
 		case vCtlCreateVcpu: {
 			auto* thread = proc::process::get_current_thread();
-			auto* vspace = thread->handle_catalogue.get<handles::vspace_handle>(arg1);
-			auto vcpu_handle = thread->handle_catalogue.push(new handles::vcpu_handle{&vspace->space});
+			auto* vspace = thread->process->handle_catalogue.get<handles::vspace_handle>(arg1);
+			auto vcpu_handle = thread->process->handle_catalogue.push(new handles::vcpu_handle{&vspace->space});
 			#ifdef LOG_SYSCALLS
 			printf("[VIRT]: vCtlCreateVcpu: vcpu: %d, vspace: %d\n", vcpu_handle, arg1);
 			#endif
@@ -150,37 +150,37 @@ uint64_t generic::virt::vctl(uint64_t cmd, MAYBE_UNUSED_ATTRIBUTE uint64_t arg1,
 			#ifdef LOG_SYSCALLS
 			printf("[VIRT]: vCtlRunVcpu handle: %d, vexit: %x\n", arg1, arg2);
 			#endif
-			auto* vcpu = proc::process::get_current_thread()->handle_catalogue.get<handles::vcpu_handle>(arg1);
+			auto* vcpu = proc::process::get_current_thread()->process->handle_catalogue.get<handles::vcpu_handle>(arg1);
 			vcpu->cpu.run((generic::virt::vexit*)arg2);
 			return 0;
 		}
 		case vCtlGetRegs: {
-			proc::process::get_current_thread()->handle_catalogue.get<handles::vcpu_handle>(arg1)->cpu.get_regs((generic::virt::vregs*)arg2);
+			proc::process::get_current_thread()->process->handle_catalogue.get<handles::vcpu_handle>(arg1)->cpu.get_regs((generic::virt::vregs*)arg2);
 			return 0;
 		}
 		case vCtlSetRegs: {
-			proc::process::get_current_thread()->handle_catalogue.get<handles::vcpu_handle>(arg1)->cpu.set_regs((generic::virt::vregs*)arg2);
+			proc::process::get_current_thread()->process->handle_catalogue.get<handles::vcpu_handle>(arg1)->cpu.set_regs((generic::virt::vregs*)arg2);
 			return 0;
 		}
 		case vCtlCreateVspace: {
 			#ifdef LOG_SYSCALLS
 			printf("[VIRT]: vCtlCreateVspace\n");
 			#endif
-			return proc::process::get_current_thread()->handle_catalogue.push(new handles::vspace_handle{});
+			return proc::process::get_current_thread()->process->handle_catalogue.push(new handles::vspace_handle{});
 		}
 		case vCtlMapVspace: {
 			#ifdef LOG_SYSCALLS
 			printf("[VIRT]: vCtlMapVspace vspace: %d, guest_base: %x, host_base: %x, size: %x\n", arg1, arg2, arg3, arg4);
 			#endif
 			auto* thread = proc::process::get_current_thread();
-			auto* vspace = thread->handle_catalogue.get<handles::vspace_handle>(arg1);
+			auto* vspace = thread->process->handle_catalogue.get<handles::vspace_handle>(arg1);
 
 			uint64_t guest_phys_base = arg2;
 			uint64_t host_virt_base = arg3;
 			uint64_t size = arg4;
 
 			for(uint64_t i = 0; i < misc::div_ceil(size, mm::pmm::block_size); i++){
-				uint64_t host_phys = thread->vmm.get_phys(host_virt_base + (i * mm::pmm::block_size));
+				uint64_t host_phys = thread->process->vmm.get_phys(host_virt_base + (i * mm::pmm::block_size));
 				uint64_t guest_phys = guest_phys_base + (i * mm::pmm::block_size);
 
 				vspace->space.map(host_phys, guest_phys);
@@ -193,7 +193,7 @@ uint64_t generic::virt::vctl(uint64_t cmd, MAYBE_UNUSED_ATTRIBUTE uint64_t arg1,
 			printf("[VIRT]: vCtlMapVspacePhys vspace: %d, guest_base: %x, host_base: %x, size: %x\n", arg1, arg2, arg3, arg4);
 			#endif
 			auto* thread = proc::process::get_current_thread();
-			auto* vspace = thread->handle_catalogue.get<handles::vspace_handle>(arg1);
+			auto* vspace = thread->process->handle_catalogue.get<handles::vspace_handle>(arg1);
 
 			uint64_t guest_phys_base = arg2;
 			uint64_t host_phys_base = arg3;
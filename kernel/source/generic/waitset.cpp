@@ -0,0 +1,94 @@
+#include <Sigma/generic/waitset.hpp>
+#include <Sigma/smp/cpu.h>
+
+void generic::notify_waitset(generic::waitset* set, size_t slot){
+    set->notify(slot);
+}
+
+generic::waitset::~waitset(){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{this->lock};
+    for(auto& entry : this->entries)
+        if(entry.used)
+            entry.source->detach();
+}
+
+bool generic::waitset::add(generic::event* source, uint64_t key){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{this->lock};
+
+    for(auto& entry : this->entries)
+        if(entry.used && entry.key == key)
+            return false; // Already in the set
+
+    for(size_t i = 0; i < max_entries; i++){
+        auto& entry = this->entries[i];
+        if(entry.used)
+            continue;
+
+        if(!source->attach(this, i))
+            return false; // Already in another waitset
+
+        entry = {.used = true, .key = key, .source = source};
+        this->pending.fetch_and(~(1ull << i)); // Clear stale readiness of a previous user of this slot
+        if(source->is_pending())
+            this->notify(i); // Don't lose triggers that happened before it was added
+
+        return true;
+    }
+
+    return false; // Full
+}
+
+bool generic::waitset::remove(uint64_t key){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{this->lock};
+
+    for(size_t i = 0; i < max_entries; i++){
+        auto& entry = this->entries[i];
+        if(!entry.used || entry.key != key)
+            continue;
+
+        entry.source->detach();
+        entry.used = false;
+        this->pending.fetch_and(~(1ull << i));
+        return true;
+    }
+
+    return false;
+}
+
+size_t generic::waitset::harvest(uint64_t* keys, size_t max){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{this->lock};
+
+    while(this->ready.has_triggered())
+        ; // Everything that triggered it is in pending, which gets handled below
+
+    uint64_t mask = this->pending.exchange(0);
+    size_t n = 0;
+    for(size_t i = 0; i < max_entries && mask; i++){
+        if(!(mask & (1ull << i)))
+            continue;
+
+        if(n == max)
+            break;
+
+        mask &= ~(1ull << i);
+        if(this->entries[i].used)
+            keys[n++] = this->entries[i].key;
+    }
+
+    if(mask){
+        // Didn't fit, keep them for the next harvest
+        this->pending.fetch_or(mask);
+        this->ready.trigger();
+    }
+
+    return n;
+}
+
+void generic::waitset::notify(size_t slot){
+    this->pending.fetch_or(1ull << slot);
+    this->ready.trigger();
+}
@@ -26,11 +26,13 @@
 
 #include <Sigma/acpi/acpi.h>
 #include <Sigma/acpi/madt.h>
+#include <Sigma/acpi/srat.h>
 
 #include <Sigma/proc/initrd.h>
 #include <Sigma/proc/process.h>
 #include <Sigma/proc/syscall.h>
 #include <Sigma/proc/elf.h>
+#include <Sigma/proc/workqueue.h>
 
 #include <Sigma/generic/device.h>
 #include <Sigma/generic/virt.hpp>
@@ -52,6 +54,7 @@ static void enable_cpu_tasking(){
     smp::cpu::get_current_cpu()->tss.rsp0 = rsp;
 
     proc::process::init_cpu();
+    proc::workqueue::init_cpu();
 
     asm("sti"); // Start interrupts and wait for an APIC timer IRQ to arrive for the first scheduling task
     while(1)
@@ -70,6 +73,7 @@ C_LINKAGE void kernel_main(){
 
     auto& entry = cpu_list.empty_entry();
     entry.set_gs();
+    smp::cpu::n_booting_without_gs--;
     entry.pcid_context = {};
     entry.gdt = {};
     entry.tss = {};
@@ -144,6 +148,8 @@ C_LINKAGE void kernel_main(){
         PANIC("Didn't find MADT table\nCan't continue boot");
     }
 
+    acpi::init_numa(madt);
+
     entry.lapic = {};
     entry.lapic.init();
     entry.lapic_id = entry.lapic.get_id();
@@ -182,6 +188,12 @@ C_LINKAGE void kernel_main(){
     //proc::process::thread* vfs = nullptr;
     //if(!proc::elf::start_elf_executable("/usr/bin/zeta", &vfs, proc::process::thread_privilege_level::DRIVER)) printf("Failed to load Zeta\n");
 
+    // Built with the libsigma benchmarks option, sigma-bench-ring prints ops/sec of single against batched syscalls
+    // and sigma-bench-ipc the round trip latency of ipc_call against the message queues
+    //proc::process::thread* bench = nullptr;
+    //if(!proc::elf::start_elf_executable("/usr/bin/sigma-bench-ring", &bench, proc::process::thread_privilege_level::APPLICATION)) printf("Failed to load sigma-bench-ring\n");
+    //if(!proc::elf::start_elf_executable("/usr/bin/sigma-bench-ipc", &bench, proc::process::thread_privilege_level::APPLICATION)) printf("Failed to load sigma-bench-ipc\n");
+
     // TODO: Start this in modular way
     proc::process::thread* block = nullptr;
     if(!proc::elf::start_elf_executable("/usr/bin/nvme", &block, proc::process::thread_privilege_level::DRIVER)) printf("Failed to load nvme\n");
@@ -202,6 +214,7 @@ C_LINKAGE void smp_kernel_main(){
 
     auto& entry = cpu_list.empty_entry();
     entry.set_gs();
+    smp::cpu::n_booting_without_gs--;
 
     entry.gdt = {};
     entry.tss = {};
@@ -224,6 +237,7 @@ C_LINKAGE void smp_kernel_main(){
     mm::vmm::kernel_vmm::get_instance().set();
 
     //printf("Booted CPU with lapic_id: %d\n", entry.lapic_id);
+    smp::ipi::set_online();
 
     enable_cpu_tasking();
     asm("cli; hlt"); // Wait what?
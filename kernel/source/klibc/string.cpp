@@ -37,14 +37,10 @@ int memcmp(const void* s1, const void* s2, size_t n){
 }
 
 void* memcpy(void* dest, const void* src, size_t n){
-    uint8_t* destination = (uint8_t*)dest;
-    uint8_t* source = (uint8_t*)src;
-
-    for(size_t i = 0; i < n; i++) destination[i] = source[i];
-
+    // rep movsb is microcoded into wide copies on anything with ERMS, and still beats a byte loop without it
+    void* destination = dest;
+    asm volatile("rep movsb" : "+D"(destination), "+S"(src), "+c"(n) : : "memory");
     return dest;
-    //asm("rep movsb" : : "S"((uint64_t)src), "D"((uint64_t)dest), "c"(n) : "memory");
-    //return dest;
 }
 
 void* memmove(void* dstptr, const void* srcptr, size_t size) {
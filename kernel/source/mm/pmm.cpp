@@ -1,5 +1,6 @@
 #include <Sigma/mm/pmm.h>
 #include <Sigma/proc/elf.h>
+#include <Sigma/smp/cpu.h>
 
 C_LINKAGE uint64_t _kernel_start;
 C_LINKAGE uint64_t _kernel_end;
@@ -25,40 +26,66 @@ struct rle_stack_entry {
     }
 };
 
-static rle_stack_entry* stack_base;
-static rle_stack_entry* stack_pointer;
-static rle_stack_entry* stack_top;
+// Every NUMA node gets its own stack, they're all carved out of the same area after the kernel
+struct rle_stack {
+    rle_stack_entry* base;
+    rle_stack_entry* pointer;
+    rle_stack_entry* top;
+    uint64_t free_pages;
+};
+
+static rle_stack_entry* stack_area_base;
+static rle_stack_entry* stack_area_top;
+
+static rle_stack stacks[mm::pmm::max_numa_nodes];
+static size_t n_stacks = 1;
 
+struct numa_range {
+    uint64_t base;
+    uint64_t end;
+    uint32_t node;
+};
 
-static rle_stack_entry pop(){
-    stack_pointer--;
-    if(stack_pointer == (stack_base - 1))
+static numa_range numa_ranges[mm::pmm::max_numa_ranges];
+static size_t n_numa_ranges = 0;
+static bool numa_active = false;
+
+static uint32_t node_order[mm::pmm::max_numa_nodes][mm::pmm::max_numa_nodes] = {}; // Nodes sorted by distance, starting with itself
+
+static multiboot_tag_mmap* mmap_tag;
+
+static rle_stack_entry pop(rle_stack& stack){
+    stack.pointer--;
+    if(stack.pointer == (stack.base - 1))
         PANIC("[PMM]: RLE Stack underflow");
 
-    rle_stack_entry ent = *stack_pointer;
+    rle_stack_entry ent = *stack.pointer;
     return ent;
 }
 
-static void push(rle_stack_entry entry){
-    if((stack_pointer + 2) == stack_top)
+static void push(rle_stack& stack, rle_stack_entry entry){
+    if((stack.pointer + 2) >= stack.top)
         PANIC("[PMM]: RLE Stack overflow");
-    *stack_pointer++ = entry;
+    *stack.pointer++ = entry;
 }
 
 void mm::pmm::print_stack(){
     debug_printf("Starting PMM Stack dump\n");
-    size_t i = 0;
-    for(rle_stack_entry* entry = stack_base; entry < stack_pointer; entry++)
-        debug_printf("  Entry %d: Start: %x, Length: %x [%x]\n", i++, entry->base, entry->n_pages, (entry->n_pages * mm::pmm::block_size));
+    for(size_t node = 0; node < n_stacks; node++){
+        debug_printf(" Node %d: Free: %dmb\n", node, (stacks[node].free_pages * 4) / 1024);
+        size_t i = 0;
+        for(rle_stack_entry* entry = stacks[node].base; entry < stacks[node].pointer; entry++)
+            debug_printf("  Entry %d: Start: %x, Length: %x [%x]\n", i++, entry->base, entry->n_pages, (entry->n_pages * mm::pmm::block_size));
+    }
 }
 
-static void sort_stack();
+static void sort_stack(rle_stack& stack);
 
 void mm::pmm::init(boot::boot_protocol* boot_protocol){
     pmm_global_mutex.lock();
 
-    stack_base = reinterpret_cast<rle_stack_entry*>(kernel_end);
-    stack_pointer = stack_base;
+    stack_area_base = reinterpret_cast<rle_stack_entry*>(kernel_end);
+    mmap_tag = reinterpret_cast<multiboot_tag_mmap*>(boot_protocol->mmap);
 
     uint64_t n_blocks = 0;
     {
@@ -70,10 +97,13 @@ void mm::pmm::init(boot::boot_protocol* boot_protocol){
         printf("Detected Memory: %dmb\n", (n_blocks * 4) / 1024);
     }
 
-    uint64_t worst_case_size = (n_blocks * sizeof(rle_stack_entry));
+    uint64_t worst_case_size = ((n_blocks + (2 * mm::pmm::max_numa_nodes)) * sizeof(rle_stack_entry)); // Every stack needs 2 spare entries
     kernel_end += worst_case_size;
 
-    stack_top = reinterpret_cast<rle_stack_entry*>(kernel_end);
+    stack_area_top = reinterpret_cast<rle_stack_entry*>(kernel_end);
+
+    auto& stack = stacks[0];
+    stack = {.base = stack_area_base, .pointer = stack_area_base, .top = stack_area_top, .free_pages = 0};
 
     mbd_start = boot_protocol->reserve_start & ~(mm::pmm::block_size - 1);
     mbd_end = ((boot_protocol->reserve_start + boot_protocol->reserve_length) & ~(mm::pmm::block_size - 1)) + mm::pmm::block_size;
@@ -117,15 +147,15 @@ void mm::pmm::init(boot::boot_protocol* boot_protocol){
         if((entry->addr + entry->len) < (1024 * 1024))
             continue;
         else if(entry->addr < (1024 * 1024))
-            push({.base = (1024 * 1024), .n_pages = ((entry->len - ((1024 * 1024) - entry->addr)) / mm::pmm::block_size)});
+            push(stack, {.base = (1024 * 1024), .n_pages = ((entry->len - ((1024 * 1024) - entry->addr)) / mm::pmm::block_size)});
         else
-            push({.base = entry->addr, .n_pages = (entry->len / mm::pmm::block_size)});
+            push(stack, {.base = entry->addr, .n_pages = (entry->len / mm::pmm::block_size)});
     }
 
-    sort_stack();
+    sort_stack(stack);
 
-    auto reserve_block = [](uint64_t addr){
-        for(rle_stack_entry* entry = stack_base; entry < stack_pointer; entry++){
+    auto reserve_block = [&stack](uint64_t addr){
+        for(rle_stack_entry* entry = stack.base; entry < stack.pointer; entry++){
             if(addr >= entry->base && addr <= (entry->base + (entry->n_pages * mm::pmm::block_size)) && entry->n_pages != 0){
                 // Replace the entry and push the other one
                 uint64_t low_offset = addr - entry->base;
@@ -139,7 +169,7 @@ void mm::pmm::init(boot::boot_protocol* boot_protocol){
                 } else {
                     *entry = first;
                     if(second.n_pages)
-                        push(second);
+                        push(stack, second);
                 }
                 break;
             }
@@ -161,7 +191,10 @@ void mm::pmm::init(boot::boot_protocol* boot_protocol){
     for(uint64_t addr = ALIGN_DOWN(strtab_base, mm::pmm::block_size); addr <= ALIGN_UP(strtab_base + strtab_size, mm::pmm::block_size); addr += mm::pmm::block_size)
         reserve_block(addr);
 
-    sort_stack(); // Cleanup things that might've been left behind by reserve_block()
+    sort_stack(stack); // Cleanup things that might've been left behind by reserve_block()
+
+    for(rle_stack_entry* entry = stack.base; entry < stack.pointer; entry++)
+        stack.free_pages += entry->n_pages;
 
     pmm_global_mutex.unlock();
 
@@ -170,49 +203,207 @@ void mm::pmm::init(boot::boot_protocol* boot_protocol){
         mm::pmm::alloc_block();
 }
 
+// Returns the node containing addr, if end is given it is set to the first address where that could change
+static uint32_t node_for_addr(uint64_t addr, uint64_t* end = nullptr){
+    uint64_t next = ~0ull;
+    for(size_t i = 0; i < n_numa_ranges; i++){
+        if(addr >= numa_ranges[i].base && addr < numa_ranges[i].end){
+            if(end)
+                *end = numa_ranges[i].end;
+            return numa_ranges[i].node;
+        }
+
+        if(numa_ranges[i].base > addr && numa_ranges[i].base < next)
+            next = numa_ranges[i].base;
+    }
+
+    // Memory not described by the SRAT goes to node 0
+    if(end)
+        *end = next;
+    return 0;
+}
+
+void mm::pmm::add_numa_range(uint64_t base, uint64_t len, uint32_t node){
+    std::lock_guard guard{pmm_global_mutex};
+    if(n_numa_ranges == mm::pmm::max_numa_ranges || node >= mm::pmm::max_numa_nodes){
+        debug_printf("[PMM]: Ignoring NUMA range [%x -> %x] for node %d\n", base, base + len, node);
+        return;
+    }
+
+    numa_ranges[n_numa_ranges++] = {.base = base, .end = base + len, .node = node};
+}
+
+void mm::pmm::init_numa(size_t n_nodes, uint8_t distances[mm::pmm::max_numa_nodes][mm::pmm::max_numa_nodes]){
+    if(n_nodes > mm::pmm::max_numa_nodes)
+        n_nodes = mm::pmm::max_numa_nodes;
+
+    // Scratch space to hold the old entries while the stacks get rebuilt in place
+    size_t scratch_pages = misc::div_ceil((stacks[0].pointer - stacks[0].base + 1) * sizeof(rle_stack_entry), mm::pmm::block_size);
+    auto scratch_phys = reinterpret_cast<uint64_t>(mm::pmm::alloc_n_blocks(scratch_pages, 0));
+    auto* scratch = reinterpret_cast<rle_stack_entry*>(scratch_phys + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE);
+
+    {
+        std::lock_guard guard{pmm_global_mutex};
+
+        size_t n_entries = stacks[0].pointer - stacks[0].base;
+        if((n_entries * sizeof(rle_stack_entry)) > (scratch_pages * mm::pmm::block_size))
+            PANIC("[PMM]: NUMA scratch space too small");
+        memcpy(scratch, stacks[0].base, n_entries * sizeof(rle_stack_entry));
+
+        // Every node needs room for the worst case of every one of its pages being a separate entry
+        uint64_t capacity[mm::pmm::max_numa_nodes] = {};
+        for(multiboot_memory_map_t* entry = mmap_tag->entries; (uint64_t)entry < ((uint64_t)mmap_tag + mmap_tag->size); entry++){
+            if(entry->type != MULTIBOOT_MEMORY_AVAILABLE)
+                continue;
+
+            uint64_t end = entry->addr + entry->len;
+            for(uint64_t addr = entry->addr; addr < end;){
+                uint64_t range_end = 0;
+                auto node = node_for_addr(addr, &range_end);
+                uint64_t chunk_end = misc::min(end, range_end);
+
+                capacity[node] += (chunk_end - addr) / mm::pmm::block_size;
+                addr = chunk_end;
+            }
+        }
+
+        rle_stack_entry* cursor = stack_area_base;
+        for(size_t i = 0; i < n_nodes; i++){
+            stacks[i] = {.base = cursor, .pointer = cursor, .top = cursor + capacity[i] + 2, .free_pages = 0};
+            cursor = stacks[i].top;
+        }
+
+        if(cursor > stack_area_top)
+            PANIC("[PMM]: NUMA stacks don't fit in the RLE stack area");
+        n_stacks = n_nodes;
+
+        for(size_t i = 0; i < n_entries; i++){
+            uint64_t end = scratch[i].base + (scratch[i].n_pages * mm::pmm::block_size);
+            for(uint64_t addr = scratch[i].base; addr < end;){
+                uint64_t range_end = 0;
+                auto node = node_for_addr(addr, &range_end);
+                uint64_t n_pages = (misc::min(end, range_end) - addr) / mm::pmm::block_size;
+                if(n_pages == 0)
+                    n_pages = 1; // Range boundary inside a page, just give it to the first node
+
+                push(stacks[node], {.base = addr, .n_pages = n_pages});
+                stacks[node].free_pages += n_pages;
+                addr += n_pages * mm::pmm::block_size;
+            }
+        }
+
+        for(size_t i = 0; i < n_nodes; i++){
+            sort_stack(stacks[i]);
+
+            // Simple selection sort, there are at most 8 nodes
+            for(size_t j = 0; j < n_nodes; j++)
+                node_order[i][j] = j;
+            for(size_t j = 0; j < n_nodes; j++){
+                size_t nearest = j;
+                for(size_t k = j + 1; k < n_nodes; k++)
+                    if(distances[i][node_order[i][k]] < distances[i][node_order[i][nearest]])
+                        nearest = k;
+
+                std::swap(node_order[i][j], node_order[i][nearest]);
+            }
+
+            debug_printf("[PMM]: NUMA node %d: %dmb free, nearest node: %d\n", i, (stacks[i].free_pages * 4) / 1024, (n_nodes > 1) ? node_order[i][1] : i);
+        }
+
+        numa_active = true;
+    }
+
+    for(size_t i = 0; i < scratch_pages; i++)
+        mm::pmm::free_block(reinterpret_cast<void*>(scratch_phys + (i * mm::pmm::block_size)));
+}
+
+uint32_t mm::pmm::get_current_node(){
+    if(!numa_active)
+        return 0;
+
+    // An AP allocates its per CPU entry before GS points at it, GS base is still 0 from INIT until then
+    if(smp::cpu::n_booting_without_gs.load(std::memory_order_acquire) != 0 && x86_64::msr::read(x86_64::msr::gs_base) == 0)
+        return 0;
+
+    return smp::cpu::get_current_cpu()->numa_node;
+}
+
 NODISCARD_ATTRIBUTE
 void* mm::pmm::alloc_block(){
+    return mm::pmm::alloc_block(mm::pmm::get_current_node());
+}
+
+NODISCARD_ATTRIBUTE
+void* mm::pmm::alloc_n_blocks(size_t n){
+    return mm::pmm::alloc_n_blocks(n, mm::pmm::get_current_node());
+}
+
+NODISCARD_ATTRIBUTE
+void* mm::pmm::alloc_block(uint32_t node){
     std::lock_guard guard{pmm_global_mutex};
 
-    rle_stack_entry ent = pop();
-    while(ent.n_pages == 0) 
-        ent = pop();
-    
-    uint64_t addr = ent.base;
-    ent.base += mm::pmm::block_size;
-    ent.n_pages--;
-    if(ent.n_pages != 0) 
-        push(ent);
-
-    return reinterpret_cast<void*>(addr);
+    if(node >= n_stacks)
+        node = 0;
+
+    for(size_t i = 0; i < n_stacks; i++){
+        auto& stack = stacks[node_order[node][i]];
+        if(stack.free_pages == 0)
+            continue; // Node is out of memory, try the next nearest one
+
+        rle_stack_entry ent = pop(stack);
+        while(ent.n_pages == 0) 
+            ent = pop(stack);
+        
+        uint64_t addr = ent.base;
+        ent.base += mm::pmm::block_size;
+        ent.n_pages--;
+        if(ent.n_pages != 0) 
+            push(stack, ent);
+
+        stack.free_pages--;
+        return reinterpret_cast<void*>(addr);
+    }
+
+    PANIC("[PMM]: Out of memory");
+    return nullptr;
 }
 
 NODISCARD_ATTRIBUTE
-void* mm::pmm::alloc_n_blocks(size_t n){
+void* mm::pmm::alloc_n_blocks(size_t n, uint32_t node){
     std::lock_guard guard{pmm_global_mutex};
 
-    uint64_t base = 0;
-    for(rle_stack_entry* entry = stack_base; entry < stack_pointer; entry++){
-        if(entry->n_pages >= n){
-            // Found entry that is big enough to hold us
-            base = entry->base;
-            entry->base += (mm::pmm::block_size * n);
-            entry->n_pages -= n;
+    if(node >= n_stacks)
+        node = 0;
+
+    for(size_t i = 0; i < n_stacks; i++){
+        auto& stack = stacks[node_order[node][i]];
+        if(stack.free_pages < n)
+            continue;
+
+        for(rle_stack_entry* entry = stack.base; entry < stack.pointer; entry++){
+            if(entry->n_pages >= n){
+                // Found entry that is big enough to hold us
+                uint64_t base = entry->base;
+                entry->base += (mm::pmm::block_size * n);
+                entry->n_pages -= n;
+                stack.free_pages -= n;
+                return reinterpret_cast<void*>(base);
+            }
         }
     }
-    if(base == 0){
-        PANIC("[PMM]: Out of memory");
-    }
 
-    return reinterpret_cast<void*>(base);
+    PANIC("[PMM]: Out of memory");
+    return nullptr;
 }
 
 void mm::pmm::free_block(void* block){
     std::lock_guard guard{pmm_global_mutex};
 
     auto addr = reinterpret_cast<uint64_t>(block);
+    auto& stack = stacks[numa_active ? node_for_addr(addr) : 0];
+    stack.free_pages++;
 
-    for(rle_stack_entry* entry = stack_base; entry < stack_pointer; entry++){
+    for(rle_stack_entry* entry = stack.base; entry < stack.pointer; entry++){
         if((addr + mm::pmm::block_size) == entry->base){
             // We're just under this entry
             entry->base -= mm::pmm::block_size;
@@ -226,34 +417,34 @@ void mm::pmm::free_block(void* block){
     }
 
     // We're not consecutive to any entry, add our own
-    push({.base = addr, .n_pages = 1});
+    push(stack, {.base = addr, .n_pages = 1});
 
     return;
 }
 
-static void sorted_insert(rle_stack_entry x){
-    if ((stack_base == stack_pointer) || (x < *stack_pointer))
+static void sorted_insert(rle_stack& stack, rle_stack_entry x){
+    if ((stack.base == stack.pointer) || (x < *stack.pointer))
     { 
-        push(x); 
+        push(stack, x); 
         return; 
     } 
   
     // If top is greater, remove the top item and recur 
-    auto temp = pop(); 
-    sorted_insert(x); 
+    auto temp = pop(stack); 
+    sorted_insert(stack, x); 
   
     // Put back the top item removed earlier 
-    push(temp); 
+    push(stack, temp); 
 } 
 
 // Function to sort stack 
-static void sort_stack() {
-    if(stack_base != stack_pointer){
-        auto entry = pop();
+static void sort_stack(rle_stack& stack) {
+    if(stack.base != stack.pointer){
+        auto entry = pop(stack);
   
-        sort_stack(); 
+        sort_stack(stack); 
 
         if(entry.n_pages != 0)
-            sorted_insert(entry); 
+            sorted_insert(stack, entry); 
     }
-} 
\ No newline at end of file
+}
\ No newline at end of file
@@ -1,12 +1,14 @@
 #include <Sigma/proc/elf.h>
 
 #include <Sigma/proc/initrd.h>
+#include <Sigma/proc/file_map.hpp>
 #include <Sigma/mm/pmm.h>
 #include <Sigma/mm/vmm.h>
 
 #include <Sigma/proc/syscall.h>
 
 #include <Sigma/arch/x86_64/cpu.h>
+#include <Sigma/arch/x86_64/drivers/hpet.h>
 
 using namespace proc::elf;
 
@@ -17,6 +19,12 @@ static bool load_executable(const char* initrd_filename, auxvals* aux, proc::pro
         return false;
     }
 
+    auto* file = proc::initrd::open(initrd_filename);
+    if(file == nullptr){
+        printf("[ELF]: Couldn't open file: %s\n", initrd_filename);
+        return false;
+    }
+
     aux->at_phdr = 0;
     aux->at_phent = sizeof(Elf64_Phdr);
     aux->at_phnum = program_header.e_phnum;
@@ -46,22 +54,9 @@ static bool load_executable(const char* initrd_filename, auxvals* aux, proc::pro
         } else if(program_section_header.p_type == proc::elf::pt_load){ // Normal Program Section
             if(program_section_header.p_memsz == 0) continue;
 
-            uint64_t n_pages = misc::div_ceil(program_section_header.p_memsz, mm::pmm::block_size);
-            for(uint64_t j = 0; j < n_pages; j++){
-                auto frame = reinterpret_cast<uint64_t>(mm::pmm::alloc_block());
-                if(frame == 0){
-                    printf("[ELF]: Couldn't allocate physical frames for process\n");
-                    return false;
-                }
-                thread->resources.frames.push_back(frame);
-
-                uint64_t virt = base + program_section_header.p_vaddr + (j * mm::pmm::block_size);
-                thread->vmm.map_page(frame, virt, map_page_flags_present | map_page_flags_writable);
-                memset_aligned_4k(reinterpret_cast<void*>(virt & ~(mm::pmm::block_size - 1)), 0);
-            }
-
-            if(!proc::initrd::read_file(initrd_filename, reinterpret_cast<uint8_t*>(base + program_section_header.p_vaddr), program_section_header.p_offset, program_section_header.p_filesz)){
-                printf("[ELF]: Couldn't read program data [%s]\n", initrd_filename);
+            if((program_section_header.p_offset % mm::pmm::block_size) != (program_section_header.p_vaddr % mm::pmm::block_size) || program_section_header.p_filesz > program_section_header.p_memsz || \
+               (program_section_header.p_offset + program_section_header.p_filesz) > proc::initrd::get_size(file)){
+                printf("[ELF]: Invalid program section [%s] with index [%d]\n", initrd_filename, i);
                 return false;
             }
 
@@ -70,10 +65,11 @@ static bool load_executable(const char* initrd_filename, auxvals* aux, proc::pro
             if((p_flags & proc::elf::pf_x) == 0) flags |= map_page_flags_no_execute;
             if(p_flags & proc::elf::pf_w) flags |= map_page_flags_writable;
 
-            for(uint64_t j = 0; j < n_pages; j++){
-                uint64_t virt = base + program_section_header.p_vaddr + (j * mm::pmm::block_size);
-                thread->vmm.set_page_protection(virt, flags);
-            }
+            // Nothing gets read yet, pages are populated from the initrd when they are first touched
+            uint64_t vaddr = base + program_section_header.p_vaddr;
+            proc::file_map::add_region(thread->process, {.base = ALIGN_DOWN(vaddr, mm::pmm::block_size), .end = ALIGN_UP(vaddr + program_section_header.p_memsz, mm::pmm::block_size),
+                                                         .vaddr = vaddr, .offset = program_section_header.p_offset, .file_size = program_section_header.p_filesz,
+                                                         .file = file, .map_flags = flags});
         }
     }
 
@@ -127,7 +123,8 @@ static bool check_elf_executable(proc::elf::Elf64_Ehdr* program_header){
     return true;
 }
 
-bool proc::elf::start_elf_executable(const char* initrd_filename, proc::process::thread** thread, proc::process::thread_privilege_level privilige){
+bool proc::elf::start_elf_executable(const char* initrd_filename, proc::process::thread** thread, proc::process::thread_privilege_level privilige, const proc::elf::spawn_args* args){
+    uint64_t start_time = x86_64::hpet::get_time_ms();
     proc::elf::Elf64_Ehdr program_header{};
     if(!proc::initrd::read_file(initrd_filename, reinterpret_cast<uint8_t*>(&program_header), 0, sizeof(proc::elf::Elf64_Ehdr))){
         printf("[ELF]: Couldn't load file: %s\n", initrd_filename);
@@ -139,108 +136,178 @@ bool proc::elf::start_elf_executable(const char* initrd_filename, proc::process:
         return false;
     }
 
+    if(args){
+        auto count_bytes = [](const char* const* strings) -> size_t {
+            size_t n = 0;
+            for(size_t i = 0; strings && strings[i]; i++)
+                n += strlen(strings[i]) + 1;
+            return n;
+        };
+
+        if((count_bytes(args->argv) + count_bytes(args->envp)) > proc::elf::spawn_max_string_bytes){
+            printf("[ELF]: Arguments and environment of %s don't fit on the stack\n", initrd_filename);
+            return false;
+        }
+    }
+
     // File integrity should be fine now
     switch (program_header.e_type)
     {
     case proc::elf::et_exec:
         // Executable File
         {
+            // The thread stays SILENT until the end, so nothing else touches it and its lock is only needed with IRQs off
             proc::process::thread* new_thread = proc::process::create_blocked_thread(privilige);
-            new_thread->thread_lock.lock();
-
-            mm::vmm::kernel_vmm::get_instance().clone_paging_info(new_thread->vmm);
 
-            new_thread->vmm.set();
+            mm::vmm::kernel_vmm::get_instance().clone_paging_info(new_thread->process->vmm);
 
+            // Everything that can fail comes first, nothing outside of new_thread exists yet so it is all that needs tearing down
             char* ld_path = nullptr;
-            auxvals aux{};
-            
+            auxvals aux{}, ld_aux{};
+            bool loaded = false;
             {
                 x86_64::smap::smap_guard guard{};
-                load_executable(initrd_filename, &aux, new_thread, &ld_path, 0);
+                loaded = load_executable(initrd_filename, &aux, new_thread, &ld_path, 0);
+            }
+
+            if(loaded && ld_path){
+                proc::elf::Elf64_Ehdr ld_program_header{};
+                if(!proc::initrd::read_file(ld_path, reinterpret_cast<uint8_t*>(&ld_program_header), 0, sizeof(proc::elf::Elf64_Ehdr))){
+                    printf("[ELF]: Couldn't load file: %s\n", ld_path);
+                    loaded = false;
+                } else if(!check_elf_executable(&ld_program_header)){
+                    printf("[ELF]: Failed file verification: %s\n", ld_path);
+                    loaded = false;
+                } else {
+                    x86_64::smap::smap_guard smap_guard{};
+                    //TODO: Don't hardcode ld.so offset
+                    loaded = load_executable(ld_path, &ld_aux, new_thread, nullptr, 0x800000000);
+                }
+            }
+
+            bool dynamic = (ld_path != nullptr);
+            delete[] ld_path;
+            if(!loaded){
+                printf("[ELF]: Couldn't load %s\n", initrd_filename);
+                proc::process::destroy_blocked_thread(new_thread);
+                return false;
             }
 
-            new_thread->thread_lock.unlock();
             new_thread->expand_thread_stack(10); // Create a stack of 10 pages for the process
-            new_thread->thread_lock.lock();
 
             new_thread->context.rsp = new_thread->image.stack_top;
-            new_thread->context.cr3 = (new_thread->vmm.get_paging_info() - KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE);
-
-            auto push = [&](uint64_t value){
-                new_thread->context.rsp -= sizeof(uint64_t);
-                *(uint64_t*)(new_thread->context.rsp) = value;
-            };
+            new_thread->context.cr3 = (new_thread->process->vmm.get_paging_info() - KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE);
 
             auto* vfs_thread = proc::process::create_blocked_thread(proc::process::thread_privilege_level::KERNEL);
-            auto* vfs_ring = new proc::ipc::ring{vfs_thread->tid, new_thread->tid};
-            uint64_t kernel_vfs_ring_handle = vfs_thread->handle_catalogue.push(new generic::handles::ipc_ring_handle{vfs_ring});
-            uint64_t user_vfs_ring_handle = new_thread->handle_catalogue.push(new generic::handles::ipc_ring_handle{vfs_ring});
+            auto* vfs_ring = new proc::ipc::ring{vfs_thread, new_thread};
+            uint64_t kernel_vfs_ring_handle = vfs_thread->process->handle_catalogue.push(new generic::handles::ipc_ring_handle{vfs_ring});
+            uint64_t user_vfs_ring_handle = new_thread->process->handle_catalogue.push(new generic::handles::ipc_ring_handle{vfs_ring});
 
             proc::process::make_kernel_thread(vfs_thread, [kernel_vfs_ring_handle](){
                 proc::syscall::serve_kernel_vfs(kernel_vfs_ring_handle);
                 PANIC("Left kernel VFS?");
             });
 
-            if(ld_path == nullptr){
+            std::pair<uint64_t, uint64_t> auxv[8] = {}; // {type, value}
+            size_t n_auxv = 0;
+            auxv[n_auxv++] = {at_vfs_server, user_vfs_ring_handle};
+            //auxv[n_auxv++] = {at_kbus_server, servers.kbus};
+
+            if(args && args->n_rings != 0){
+                // The catalogue is fresh so the child side handles are consecutive
+                uint64_t first_ring = 0;
+                for(size_t i = 0; i < args->n_rings; i++){
+                    auto* ring = new proc::ipc::ring{args->parent, new_thread};
+                    args->parent_ring_handles[i] = args->parent->process->handle_catalogue.push(new generic::handles::ipc_ring_handle{ring});
+                    uint64_t handle = new_thread->process->handle_catalogue.push(new generic::handles::ipc_ring_handle{ring});
+                    if(i == 0)
+                        first_ring = handle;
+                }
+
+                auxv[n_auxv++] = {at_sigma_rings, first_ring};
+                auxv[n_auxv++] = {at_sigma_n_rings, args->n_rings};
+            }
+
+            if(!dynamic){
                 // Static Executable, No Dynamic loader
                 new_thread->context.rip = aux.at_entry;
-
-                push(0); // Align stack
-                push(0); // Null
-                push(0); // Null data
-                //push(servers.kbus);
-                //push(0x1001); // AT_KBUS_SERVER
-                push(user_vfs_ring_handle);
-                push(0x1000); // AT_VFS_SERVER
-                push(0);
-                push(0);
-                push(0);
             } else {
-                // Load dynamic stuff
-                proc::elf::Elf64_Ehdr ld_program_header{};
-                if(!proc::initrd::read_file(ld_path, reinterpret_cast<uint8_t*>(&ld_program_header), 0, sizeof(proc::elf::Elf64_Ehdr))){
-                    printf("[ELF]: Couldn't load file: %s\n", ld_path);
-                    return false;
-                }
-    
-                check_elf_executable(&ld_program_header);
-                auxvals ld_aux{};
+                new_thread->context.rip = ld_aux.at_entry;
 
-                {
-                    x86_64::smap::smap_guard smap_guard{};
-                    //TODO: Don't hardcode ld.so offset
-                    load_executable(ld_path, &ld_aux, new_thread, nullptr, 0x800000000);
-                    delete[] ld_path; // Cleanup
-                }
+                auxv[n_auxv++] = {3, aux.at_phdr}; // ph_hdr
+                auxv[n_auxv++] = {4, aux.at_phent}; // ph_ent
+                auxv[n_auxv++] = {5, aux.at_phnum}; // ph_num
+                auxv[n_auxv++] = {9, aux.at_entry}; // entry
+            }
 
-                new_thread->context.rip = ld_aux.at_entry;
+            {
+                // The stack is only reachable through the child address space, don't get scheduled away while it is active
+                std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+                std::lock_guard thread_guard{new_thread->thread_lock};
+                new_thread->process->vmm.set();
+
+                x86_64::smap::smap_guard guard{};
+                auto push = [&](uint64_t value){
+                    new_thread->context.rsp -= sizeof(uint64_t);
+                    *(uint64_t*)(new_thread->context.rsp) = value;
+                };
+
+                auto push_strings = [&](const char* const* strings, size_t& n) -> uint64_t* {
+                    n = 0;
+                    while(strings && strings[n])
+                        n++;
+
+                    auto* addresses = new uint64_t[n + 1];
+                    for(size_t i = 0; i < n; i++){
+                        size_t len = strlen(strings[i]) + 1;
+                        new_thread->context.rsp -= len;
+                        memcpy(reinterpret_cast<void*>(new_thread->context.rsp), strings[i], len);
+                        addresses[i] = new_thread->context.rsp;
+                    }
+                    return addresses;
+                };
+
+                size_t argc = 0, envc = 0;
+                uint64_t* argv = push_strings(args ? args->argv : nullptr, argc);
+                uint64_t* envp = push_strings(args ? args->envp : nullptr, envc);
+                new_thread->context.rsp = ALIGN_DOWN(new_thread->context.rsp, 16);
+
+                // argc, argv, NULL, envp, NULL, auxv, AT_NULL, rsp has to be 16 byte aligned at argc
+                size_t n_words = 1 + (argc + 1) + (envc + 1) + (2 * n_auxv) + 2;
+                if(n_words % 2)
+                    push(0); // Align stack
 
-                push(0); // Align stack
                 push(0); // Null
                 push(0); // Null data
-                //push(servers.kbus);
-                //push(0x1001); // AT_KBUS_SERVER
-                push(user_vfs_ring_handle);
-                push(0x1000); // AT_VFS_SERVER
-                push(aux.at_phdr);
-                push(3); // ph_hdr
-                push(aux.at_phent);
-                push(4); // ph_ent
-                push(aux.at_phnum);
-                push(5); // ph_num
-                push(aux.at_entry);
-                push(9); // entry
-                push(0);
+                for(size_t i = 0; i < n_auxv; i++){
+                    push(auxv[i].second);
+                    push(auxv[i].first);
+                }
+
                 push(0);
+                for(size_t i = envc; i > 0; i--)
+                    push(envp[i - 1]);
+
                 push(0);
+                for(size_t i = argc; i > 0; i--)
+                    push(argv[i - 1]);
+
+                push(argc);
+
+                delete[] argv;
+                delete[] envp;
 
+                mm::vmm::kernel_vmm::get_instance().set();
             }
 
-            mm::vmm::kernel_vmm::get_instance().set();
             *thread = new_thread;
-            new_thread->state = proc::process::thread_state::IDLE;
-            new_thread->thread_lock.unlock();
+            {
+                std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+                std::lock_guard thread_guard{new_thread->thread_lock};
+                new_thread->state = proc::process::thread_state::IDLE;
+            }
+
+            debug_printf("[ELF]: Started %s as tid %d in %d ms\n", initrd_filename, new_thread->tid, x86_64::hpet::get_time_ms() - start_time);
         }
         break;
     default:
@@ -0,0 +1,169 @@
+#include <Sigma/proc/file_map.hpp>
+#include <Sigma/proc/process.h>
+#include <Sigma/smp/ipi.h>
+
+void proc::file_map::add_region(proc::process::process* process, const proc::file_map::region& region){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{process->process_lock};
+    process->resources.file_regions.push_back(region);
+}
+
+bool proc::file_map::overlaps(proc::process::process* process, uint64_t base, size_t size){
+    for(auto& entry : process->resources.file_regions)
+        if(base < entry.end && entry.base < (base + size))
+            return true;
+
+    return false;
+}
+
+// Builds a private copy of the page, call with the process_lock held
+static uint64_t populate_private(proc::process::process* process, proc::file_map::region& region, uint64_t page){
+    auto frame = reinterpret_cast<uint64_t>(mm::pmm::alloc_block());
+    if(frame == 0)
+        return 0;
+    process->resources.frames.push_back(frame);
+
+    auto* data = reinterpret_cast<uint8_t*>(frame + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE);
+    memset_aligned_4k(data, 0);
+
+    // The first page can start before vaddr, those bytes are whatever precedes the segment in the file
+    uint64_t file_start = ALIGN_DOWN(region.vaddr, mm::pmm::block_size);
+    uint64_t start = (page > file_start) ? page : file_start;
+    uint64_t end = region.vaddr + region.file_size;
+    if(end > (page + mm::pmm::block_size))
+        end = page + mm::pmm::block_size;
+
+    if(start < end)
+        proc::initrd::read_file(region.file, data + (start - page), region.offset - (region.vaddr - start), end - start);
+
+    return frame;
+}
+
+// Call with the process_lock held, copied is set when a mapping other CPUs might have cached got replaced
+static bool handle_fault_int(proc::process::process* process, uint64_t addr, bool write, bool& copied){
+    proc::file_map::region* region = nullptr;
+    for(auto& entry : process->resources.file_regions){
+        if(addr >= entry.base && addr < entry.end){
+            region = &entry;
+            break;
+        }
+    }
+
+    if(region == nullptr || region->file == nullptr)
+        return false;
+
+    bool writable = (region->map_flags & map_page_flags_writable);
+    if(write && !writable)
+        return false; // Real protection violation
+
+    uint64_t page = ALIGN_DOWN(addr, mm::pmm::block_size);
+    uint64_t entry = process->vmm.get_entry(page);
+    bool present = bitops<uint64_t>::bit_test(entry, x86_64::paging::page_entry_present);
+    if(present && (!write || bitops<uint64_t>::bit_test(entry, x86_64::paging::page_entry_writeable))){
+        x86_64::paging::invalidate_addr(page); // Another CPU got here first, we only have a stale TLB entry
+        return true;
+    }
+
+    if(present){
+        // Copy on write of a shared page cache frame
+        auto frame = reinterpret_cast<uint64_t>(mm::pmm::alloc_block());
+        if(frame == 0)
+            return false;
+        process->resources.frames.push_back(frame);
+
+        memcpy_aligned_4k(reinterpret_cast<void*>(frame + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE), reinterpret_cast<void*>(process->vmm.get_phys(page) + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE));
+        process->vmm.map_page(frame, page, region->map_flags);
+        copied = true;
+        return true;
+    }
+
+    // Pages that hold nothing but file data can come straight from the page cache
+    if((page + mm::pmm::block_size) <= (region->vaddr + region->file_size)){
+        uint64_t file_page = (ALIGN_DOWN(region->offset, mm::pmm::block_size) + (page - ALIGN_DOWN(region->vaddr, mm::pmm::block_size))) / mm::pmm::block_size;
+        uint64_t frame = proc::initrd::get_page(region->file, file_page);
+        if(frame == 0)
+            return false;
+
+        uint64_t flags = region->map_flags | map_page_flags_shared;
+        if(writable && !write)
+            flags &= ~map_page_flags_writable; // Copied on the first write
+
+        if(!writable || !write){
+            process->vmm.map_page(frame, page, flags);
+            return true;
+        }
+    }
+
+    uint64_t frame = populate_private(process, *region, page);
+    if(frame == 0)
+        return false;
+
+    process->vmm.map_page(frame, page, region->map_flags);
+    return true;
+}
+
+bool proc::file_map::handle_fault(proc::process::process* process, uint64_t addr, bool write){
+    bool copied = false, handled = false;
+    {
+        std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+        std::lock_guard guard{process->process_lock};
+        handled = handle_fault_int(process, addr, write, copied);
+    }
+
+    // Other threads can still read the page cache frame through their TLBs, they would miss everything written to the copy
+    if(copied)
+        smp::ipi::send_shootdown(process->vmm, ALIGN_DOWN(addr, mm::pmm::block_size), mm::pmm::block_size);
+
+    return handled;
+}
+
+void proc::file_map::prefault(proc::process::process* process, uint64_t addr){
+    bool copied = false;
+    {
+        std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+        std::lock_guard guard{process->process_lock};
+
+        bool writable = false;
+        for(auto& entry : process->resources.file_regions){
+            if(addr >= entry.base && addr < entry.end){
+                writable = (entry.map_flags & map_page_flags_writable);
+                break;
+            }
+        }
+
+        handle_fault_int(process, addr, writable, copied);
+    }
+
+    if(copied)
+        smp::ipi::send_shootdown(process->vmm, ALIGN_DOWN(addr, mm::pmm::block_size), mm::pmm::block_size);
+}
+
+void proc::file_map::release_process(proc::process::process* process){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{process->process_lock};
+    process->resources.file_regions.resize(0);
+}
+
+void proc::file_map::fork_process(proc::process::process* parent, proc::process::process* child){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard parent_guard{parent->process_lock};
+    std::lock_guard child_guard{child->process_lock};
+    for(auto& region : parent->resources.file_regions){
+        child->resources.file_regions.push_back(region);
+
+        // Private pages got copied by fork_address_space, only the shared ones are left
+        for(uint64_t page = region.base; page < region.end; page += mm::pmm::block_size){
+            uint64_t entry = parent->vmm.get_entry(page);
+            if(!bitops<uint64_t>::bit_test(entry, x86_64::paging::page_entry_present) || !bitops<uint64_t>::bit_test(entry, x86_64::paging::page_entry_shared))
+                continue;
+
+            uint64_t flags = map_page_flags_present | map_page_flags_user | map_page_flags_shared;
+            if(bitops<uint64_t>::bit_test(entry, x86_64::paging::page_entry_writeable))
+                flags |= map_page_flags_writable;
+            if(bitops<uint64_t>::bit_test(entry, x86_64::paging::page_entry_no_execute))
+                flags |= map_page_flags_no_execute;
+
+            child->vmm.map_page(parent->vmm.get_phys(page), page, flags);
+        }
+    }
+}
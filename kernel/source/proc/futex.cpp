@@ -0,0 +1,156 @@
+#include <Sigma/proc/futex.hpp>
+#include <Sigma/proc/process.h>
+#include <Sigma/arch/x86_64/drivers/hpet.h>
+
+struct bucket {
+    x86_64::spinlock::mutex lock;
+    proc::futex::waiter* head;
+};
+
+static bucket buckets[proc::futex::n_buckets] = {};
+static std::atomic<size_t> n_timed_waiters{0}; // Lets the scheduler tick skip the scan when nobody uses a timeout
+
+static bucket& bucket_for_key(uint64_t key){
+    return buckets[((key >> 2) * 0x9E3779B97F4A7C15ull) >> (64 - proc::futex::bucket_bits)];
+}
+
+// Returns the physical address of addr in the process, or 0 if it isn't mapped, call with the process_lock held
+// File backed pages have to be prefaulted first, otherwise the key is a page cache frame that gets replaced on the first write
+static uint64_t get_key(proc::process::process* process, uint64_t addr){
+    if((addr % sizeof(uint32_t)) != 0)
+        return 0;
+
+    uint64_t page = addr & ~(mm::pmm::block_size - 1);
+    uint64_t entry = process->vmm.get_entry(page);
+    if(!bitops<uint64_t>::bit_test(entry, x86_64::paging::page_entry_present) || !bitops<uint64_t>::bit_test(entry, x86_64::paging::page_entry_user))
+        return 0;
+
+    return process->vmm.get_phys(page) + (addr - page);
+}
+
+// Call with the bucket locked
+static void unlink(proc::futex::waiter** link){
+    auto* waiter = *link;
+    *link = waiter->next;
+    waiter->next = nullptr;
+    if(waiter->deadline != 0)
+        n_timed_waiters.fetch_sub(1);
+}
+
+proc::futex::wait_status proc::futex::wait(proc::process::thread* thread, uint64_t addr, uint32_t expected, uint64_t timeout_ms){
+    proc::file_map::prefault(thread->process, addr);
+
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard process_guard{thread->process->process_lock};
+    uint64_t key = get_key(thread->process, addr);
+    if(key == 0)
+        return proc::futex::wait_status::fault;
+
+    auto& bucket = bucket_for_key(key);
+    std::lock_guard guard{bucket.lock};
+    auto& waiter = thread->futex;
+    if(waiter.key == key){
+        // Second call after the wake, report how the wait ended
+        switch (waiter.state)
+        {
+        case proc::futex::waiter::waiter_state::queued:
+            return proc::futex::wait_status::blocked;
+        case proc::futex::waiter::waiter_state::woken:
+            waiter.state = proc::futex::waiter::waiter_state::idle;
+            return proc::futex::wait_status::woken;
+        case proc::futex::waiter::waiter_state::timed_out:
+            waiter.state = proc::futex::waiter::waiter_state::idle;
+            return proc::futex::wait_status::timed_out;
+        default:
+            break;
+        }
+    }
+
+    // Checking the word and queueing under the bucket lock is what prevents a wake from slipping in between
+    if(*reinterpret_cast<volatile uint32_t*>(key + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE) != expected)
+        return proc::futex::wait_status::mismatch;
+
+    waiter.key = key;
+    waiter.deadline = (timeout_ms != 0) ? (x86_64::hpet::get_time_ms() + timeout_ms) : 0;
+    waiter.state = proc::futex::waiter::waiter_state::queued;
+    waiter.next = bucket.head;
+    bucket.head = &waiter;
+    if(waiter.deadline != 0)
+        n_timed_waiters.fetch_add(1);
+
+    return proc::futex::wait_status::blocked;
+}
+
+size_t proc::futex::wake(proc::process::thread* thread, uint64_t addr, size_t n){
+    proc::file_map::prefault(thread->process, addr);
+
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    uint64_t key = 0;
+    {
+        std::lock_guard process_guard{thread->process->process_lock};
+        key = get_key(thread->process, addr);
+    }
+    if(key == 0)
+        return 0;
+
+    auto& bucket = bucket_for_key(key);
+    std::lock_guard guard{bucket.lock};
+    size_t woken = 0;
+    for(auto** it = &bucket.head; *it != nullptr && woken < n;){
+        auto* waiter = *it;
+        if(waiter->key != key){
+            it = &waiter->next;
+            continue;
+        }
+
+        unlink(it);
+        waiter->state = proc::futex::waiter::waiter_state::woken;
+        waiter->event.trigger();
+        woken++;
+    }
+
+    return woken;
+}
+
+void proc::futex::timeouts_tick(){
+    if(n_timed_waiters.load() == 0)
+        return;
+
+    uint64_t now = x86_64::hpet::get_time_ms();
+    for(auto& bucket : buckets){
+        std::lock_guard guard{bucket.lock};
+        for(auto** it = &bucket.head; *it != nullptr;){
+            auto* waiter = *it;
+            if(waiter->deadline == 0 || waiter->deadline > now){
+                it = &waiter->next;
+                continue;
+            }
+
+            unlink(it);
+            waiter->state = proc::futex::waiter::waiter_state::timed_out;
+            waiter->event.trigger();
+        }
+    }
+}
+
+void proc::futex::release_thread(proc::process::thread* thread){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    auto& waiter = thread->futex;
+    if(waiter.key != 0){
+        auto& bucket = bucket_for_key(waiter.key);
+        std::lock_guard guard{bucket.lock};
+        for(auto** it = &bucket.head; *it != nullptr; it = &(*it)->next){
+            if(*it == &waiter){
+                unlink(it);
+                break;
+            }
+        }
+    }
+
+    while(waiter.event.has_triggered())
+        ; // Drop wakes nobody is going to consume anymore
+
+    waiter.key = 0;
+    waiter.deadline = 0;
+    waiter.state = proc::futex::waiter::waiter_state::idle;
+}
@@ -0,0 +1,168 @@
+#include <Sigma/proc/grant.hpp>
+#include <Sigma/proc/process.h>
+#include <Sigma/smp/ipi.h>
+
+proc::grant::grant::grant(proc::process::process* owner, uint64_t flags): _owner{owner}, _flags{flags}, _revoked{false}, _refs{1}, _frames{}, _mappings{}, _lock{} {}
+
+bool proc::grant::grant::init(uint64_t base, size_t size){
+    if(size == 0 || (base % mm::pmm::block_size) != 0 || base < proc::process::mmap_bottom || (base + size) > proc::process::mmap_top)
+        return false;
+
+    auto* owner = this->_owner;
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{owner->process_lock};
+
+    size_t n_pages = misc::div_ceil(size, mm::pmm::block_size);
+    for(size_t i = 0; i < n_pages; i++){
+        uint64_t virt = base + (i * mm::pmm::block_size);
+        uint64_t entry = owner->vmm.get_entry(virt);
+        if(!bitops<uint64_t>::bit_test(entry, x86_64::paging::page_entry_present) || !bitops<uint64_t>::bit_test(entry, x86_64::paging::page_entry_user))
+            return false;
+
+        // Shared pages belong to an shm object or the initrd, not the owner, they could be freed while grantees still map them
+        if(bitops<uint64_t>::bit_test(entry, x86_64::paging::page_entry_shared))
+            return false;
+
+        if((this->_flags & proc::grant::grant_flags_writable) && !bitops<uint64_t>::bit_test(entry, x86_64::paging::page_entry_writeable))
+            return false; // Can't grant more access than the owner has
+
+        this->_frames.push_back(owner->vmm.get_phys(virt));
+    }
+
+    return true;
+}
+
+uint64_t proc::grant::grant::map(proc::process::process* process, uint64_t flags){
+    if((flags & proc::grant::grant_flags_writable) && !(this->_flags & proc::grant::grant_flags_writable))
+        return 0;
+
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{this->_lock};
+    if(this->_revoked)
+        return 0;
+
+    mapping* slot = nullptr;
+    for(auto& entry : this->_mappings){
+        if(entry.base != 0 && entry.process == process)
+            return 0; // Only map once per process, unmap can then find it by the handle alone
+        else if(entry.base == 0 && !slot)
+            slot = &entry;
+    }
+
+    std::lock_guard process_guard{process->process_lock};
+    uint64_t base = process->vmm.get_free_range(proc::process::mmap_bottom, proc::process::mmap_top, this->get_size());
+    if(base == (uint64_t)-1)
+        return 0;
+
+    uint64_t map_flags = map_page_flags_present | map_page_flags_user | map_page_flags_no_execute | \
+                         ((flags & proc::grant::grant_flags_writable) ? map_page_flags_writable : 0);
+    for(size_t i = 0; i < this->_frames.size(); i++)
+        process->vmm.map_page(this->_frames[i], base + (i * mm::pmm::block_size), map_flags);
+
+    if(slot)
+        *slot = {.process = process, .base = base};
+    else
+        this->_mappings.push_back({.process = process, .base = base});
+
+    return base;
+}
+
+void proc::grant::grant::unmap_int(proc::grant::grant::mapping& entry){
+    std::lock_guard process_guard{entry.process->process_lock};
+
+    // Only flushes the current CPU, callers shoot down the range once they dropped their locks
+    for(size_t i = 0; i < this->_frames.size(); i++)
+        entry.process->vmm.unmap_page(entry.base + (i * mm::pmm::block_size));
+
+    entry.base = 0;
+}
+
+bool proc::grant::grant::unmap(proc::process::process* process){
+    uint64_t base = 0;
+    size_t size = 0;
+    {
+        std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+        std::lock_guard guard{this->_lock};
+
+        for(auto& entry : this->_mappings){
+            if(entry.base != 0 && entry.process == process){
+                base = entry.base;
+                size = this->get_size();
+                this->unmap_int(entry);
+                break;
+            }
+        }
+    }
+
+    if(!base)
+        return false;
+
+    smp::ipi::send_shootdown(process->vmm, base, size);
+    return true;
+}
+
+void proc::grant::grant::revoke(){
+    types::vector<mapping> unmapped{};
+    size_t size = 0;
+    {
+        std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+        std::lock_guard guard{this->_lock};
+        if(this->_revoked)
+            return;
+
+        this->_revoked = true;
+        size = this->get_size();
+        for(auto& entry : this->_mappings){
+            if(entry.base != 0){
+                unmapped.push_back(entry);
+                this->unmap_int(entry);
+            }
+        }
+
+        this->_mappings.resize(0);
+        this->_frames.resize(0);
+    }
+
+    // The owner may free the frames as soon as this returns, so no CPU can be left with a stale translation
+    for(auto& entry : unmapped)
+        smp::ipi::send_shootdown(entry.process->vmm, entry.base, size);
+}
+
+void proc::grant::grant::ref(){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{this->_lock};
+
+    this->_refs++;
+}
+
+void proc::grant::grant::unref(){
+    {
+        std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+        std::lock_guard guard{this->_lock};
+
+        if(--this->_refs != 0)
+            return;
+    }
+
+    this->revoke();
+    delete this;
+}
+
+void proc::grant::release_process(proc::process::process* process){
+    // Mapping a grant takes a handle to it, so the handle references cover every grant the process can have touched
+    for(auto* grant : process->resources.grant_objects){
+        if(grant->_owner == process){
+            grant->revoke();
+        } else {
+            // The address space is about to be torn down anyway, just forget about it so a reused process slot doesn't get unmapped
+            std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+            std::lock_guard guard{grant->_lock};
+            for(auto& entry : grant->_mappings)
+                if(entry.process == process)
+                    entry.base = 0;
+        }
+
+        grant->unref();
+    }
+    process->resources.grant_objects.resize(0);
+}
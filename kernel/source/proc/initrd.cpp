@@ -1,10 +1,22 @@
 #include <Sigma/proc/initrd.h>
+#include <Sigma/proc/process.h>
 #include <klibc/stdio.h>
 #include <Sigma/misc/misc.h>
 #include <Sigma/types/vector.h>
 #include <klibcxx/mutex.hpp>
 
-static misc::lazy_initializer<types::vector<proc::initrd::tar_header*>> headers;
+struct proc::initrd::file {
+    file(): hash{0}, header{nullptr}, size{0}, pages{nullptr}, lock{} {}
+    uint64_t hash;
+    proc::initrd::tar_header* header;
+    size_t size;
+    uint64_t* pages; // Page cache, allocated on the first get_page
+    x86_64::spinlock::mutex lock;
+};
+
+// Open addressing table keyed on the path, only written by init so lookups don't need a lock
+static proc::initrd::file* file_index = nullptr;
+static size_t file_index_mask = 0;
 
 static uint64_t get_header_number(const char* in){
     size_t size = 0;
@@ -17,50 +29,161 @@ static uint64_t get_header_number(const char* in){
     return size;
 }
 
+// FNV-1a
+static uint64_t hash_path(const char* path){
+    uint64_t hash = 0xcbf29ce484222325;
+    for(; *path; path++){
+        hash ^= static_cast<uint8_t>(*path);
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
+
+static proc::initrd::file* find_entry(const char* file_name){
+    if(file_index == nullptr)
+        return nullptr;
+
+    uint64_t hash = hash_path(file_name);
+    for(size_t i = hash & file_index_mask; file_index[i].header != nullptr; i = (i + 1) & file_index_mask)
+        if(file_index[i].hash == hash && strcmp(file_index[i].header->filename, file_name) == 0)
+            return &file_index[i];
+
+    return nullptr;
+}
+
 static std::mutex initrd_lock{};
 
 void proc::initrd::init(uint64_t address, uint64_t size){
     std::lock_guard lock{initrd_lock};
     
-    headers.init();
+    types::vector<proc::initrd::tar_header*> headers{};
     for(uint64_t i = 0; i < size; i++){
         auto* header = reinterpret_cast<proc::initrd::tar_header*>(address);
 
         if(header->filename[0] == '\0') break; // Invalid header
         uint64_t entry_size = get_header_number(header->size);
 
-        headers->push_back(header);
+        headers.push_back(header);
 
         address += ((entry_size / 512) + 1) * 512;
         if(entry_size % 512) address += 512;
     }
+
+    // Keep the load factor under 0.5 so probe chains stay short
+    size_t n_entries = 16;
+    while(n_entries < (headers.size() * 2))
+        n_entries *= 2;
+
+    file_index = new proc::initrd::file[n_entries];
+    file_index_mask = n_entries - 1;
+
+    for(auto* header : headers){
+        if(find_entry(header->filename))
+            continue; // Duplicate path, the first one in the archive wins
+
+        uint64_t hash = hash_path(header->filename);
+        size_t i = hash & file_index_mask;
+        while(file_index[i].header != nullptr)
+            i = (i + 1) & file_index_mask;
+
+        file_index[i].hash = hash;
+        file_index[i].header = header;
+        file_index[i].size = get_header_number(header->size);
+    }
 }
 
 bool proc::initrd::read_file(const char* file_name, uint8_t* buf, uint64_t offset, uint64_t size){
-    if((size + offset) > proc::initrd::get_size(file_name) + 1)
+    return proc::initrd::read_file(find_entry(file_name), buf, offset, size);
+}
+
+bool proc::initrd::read_file(proc::initrd::file* entry, uint8_t* buf, uint64_t offset, uint64_t size){
+    if(entry == nullptr)
+        return false;
+
+    if((size + offset) > entry->size + 1)
         return false; // Yeah lol no, that would be a bit *too* easy wouldn't it
 
-    std::lock_guard lock{initrd_lock};
-    for(auto* header : *headers){
-        if(strcmp(header->filename, file_name) == 0){
-            // Found it
-            void* data = static_cast<void*>(static_cast<uint8_t*>(static_cast<void*>(header)) + 512 + offset);
-            
-            memcpy(static_cast<void*>(buf), data, size);
-
-            return true;
-        }
-    }
-    return false;
+    void* data = static_cast<void*>(static_cast<uint8_t*>(static_cast<void*>(entry->header)) + 512 + offset);
+    memcpy(static_cast<void*>(buf), data, size);
+
+    return true;
 }
 
 size_t proc::initrd::get_size(const char* file_name){
-    std::lock_guard lock{initrd_lock};
-    for(auto* header : *headers){
-        if(strcmp(header->filename, file_name) == 0){
-            return get_header_number(header->size);
-        }
+    return proc::initrd::get_size(find_entry(file_name));
+}
+
+size_t proc::initrd::get_size(proc::initrd::file* file){
+    if(file == nullptr)
+        return 0;
+
+    return file->size;
+}
+
+proc::initrd::file* proc::initrd::open(const char* file_name){
+    return find_entry(file_name);
+}
+
+uint64_t proc::initrd::get_page(proc::initrd::file* file, size_t n){
+    size_t n_pages = misc::div_ceil(file->size, mm::pmm::block_size);
+    if(n >= n_pages)
+        return 0;
+
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{file->lock};
+    if(file->pages == nullptr){
+        file->pages = new uint64_t[n_pages];
+        memset(static_cast<void*>(file->pages), 0, n_pages * sizeof(uint64_t));
     }
 
-    return 0;
-}
\ No newline at end of file
+    if(file->pages[n] == 0){
+        auto frame = reinterpret_cast<uint64_t>(mm::pmm::alloc_block());
+        if(frame == 0)
+            return 0;
+
+        auto* page = reinterpret_cast<uint8_t*>(frame + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE);
+        size_t offset = n * mm::pmm::block_size;
+        size_t size = ((file->size - offset) < mm::pmm::block_size) ? (file->size - offset) : mm::pmm::block_size;
+        memset_aligned_4k(page, 0);
+        memcpy(page, reinterpret_cast<uint8_t*>(file->header) + 512 + offset, size);
+
+        file->pages[n] = frame;
+    }
+
+    return file->pages[n];
+}
+
+uint64_t proc::initrd::map_file(proc::process::process* process, const char* file_name, size_t* size){
+    auto* entry = find_entry(file_name);
+    if(entry == nullptr || entry->size == 0)
+        return 0;
+
+    // File data is only 512 byte aligned in the archive, so map the page cache instead of the archive itself
+    // Its frames only hold this file, zero filled past the end, so none of the neighbouring headers or files leak
+    size_t n_pages = misc::div_ceil(entry->size, mm::pmm::block_size);
+    for(size_t i = 0; i < n_pages; i++)
+        if(get_page(entry, i) == 0)
+            return 0;
+
+    size_t map_size = n_pages * mm::pmm::block_size;
+    uint64_t map_flags = map_page_flags_present | map_page_flags_user | map_page_flags_no_execute | map_page_flags_shared;
+    uint64_t virt = 0;
+    {
+        std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+        std::lock_guard process_guard{process->process_lock};
+        virt = process->vmm.get_free_range(proc::process::mmap_bottom, proc::process::mmap_top, map_size);
+        if(virt == (uint64_t)-1)
+            return 0;
+
+        // The page cache owns the frames, shared keeps exit from freeing them
+        for(size_t i = 0; i < n_pages; i++)
+            process->vmm.map_page(get_page(entry, i), virt + i * mm::pmm::block_size, map_flags);
+    }
+
+    // fork_address_space skips shared pages, the region makes file_map::fork_process map the same frames in the child
+    proc::file_map::add_region(process, {.base = virt, .end = virt + map_size, .vaddr = virt, .offset = 0, .file_size = entry->size, .file = nullptr, .map_flags = map_flags});
+
+    *size = entry->size;
+    return virt;
+}
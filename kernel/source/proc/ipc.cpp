@@ -46,6 +46,68 @@ bool proc::ipc::queue::receive(std::byte* data){
     return true;
 }
 
+bool proc::ipc::queue::send(const proc::ipc::iovec* iov, size_t n_iov){
+    size_t size = 0;
+    for(size_t i = 0; i < n_iov; i++)
+        size += iov[i].len;
+
+    auto* copy = new std::byte[size];
+    if(!copy)
+        return false;
+
+    size_t offset = 0;
+    for(size_t i = 0; i < n_iov; i++){
+        memcpy(copy + offset, iov[i].base, iov[i].len);
+        offset += iov[i].len;
+    }
+
+    queue::message packet{};
+    #ifdef DEBUG
+    packet.magic_low = 0xF00D;
+    packet.magic_high = 0xDEAD;
+    #endif
+    packet.data = copy;
+    packet.size = size;
+
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{this->_lock};
+
+    this->_queue.push(packet);
+    this->_receive_event.trigger();
+    return true;
+}
+
+proc::ipc::receive_status proc::ipc::queue::receive(const proc::ipc::iovec* iov, size_t n_iov, size_t& size, bool truncate){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{this->_lock};
+
+    if(this->_queue.length() == 0)
+        return proc::ipc::receive_status::empty;
+
+    size_t capacity = 0;
+    for(size_t i = 0; i < n_iov; i++)
+        capacity += iov[i].len;
+
+    size = this->_queue.back().size;
+    if(size > capacity && !truncate)
+        return proc::ipc::receive_status::too_small; // Leave it on the queue, so it can be retried with a bigger buffer
+
+    const auto msg = this->_queue.pop();
+
+    #ifdef DEBUG
+    ASSERT(msg.magic_low == 0xF00D && msg.magic_high == 0xDEAD);
+    #endif
+    size_t offset = 0;
+    for(size_t i = 0; i < n_iov && offset < msg.size; i++){
+        size_t len = misc::min(iov[i].len, msg.size - offset);
+        memcpy(iov[i].base, msg.data + offset, len);
+        offset += len;
+    }
+    delete[] msg.data;
+
+    return (size > capacity) ? proc::ipc::receive_status::truncated : proc::ipc::receive_status::ok;
+}
+
 size_t proc::ipc::queue::get_top_message_size(){
     std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
     std::lock_guard guard{this->_lock};
@@ -62,47 +124,86 @@ size_t proc::ipc::queue::get_n_messages(){
     return this->_queue.length();
 }
 
+proc::ipc::ring::ring(proc::process::thread* a, proc::process::thread* b): a{a->tid}, b{b->tid}, _a_process{a->process}, _b_process{b->process}, \
+                      _a_pid{a->process->pid}, _b_pid{b->process->pid}, _a_queue{b->tid, a->tid}, _b_queue{a->tid, b->tid}, _a_sync{}, _b_sync{}, _sync_lock{} {}
+
+int proc::ipc::ring::get_side(proc::process::thread* thread){
+    if(thread->tid == a)
+        return 0;
+    else if(thread->tid == b)
+        return 1;
+    else if(thread->process == _a_process && thread->process->pid == _a_pid)
+        return 0;
+    else if(thread->process == _b_process && thread->process->pid == _b_pid)
+        return 1;
+
+    return -1;
+}
+
+proc::process::thread* proc::ipc::ring::get_call_partner(tid_t self){
+    // Tids get reused once a thread is killed, so make sure it is still the thread of the process the ring was made for
+    tid_t tid = (self == a) ? b : a;
+    auto* process = (self == a) ? _b_process : _a_process;
+    uint64_t pid = (self == a) ? _b_pid : _a_pid;
+
+    auto* thread = proc::process::thread_for_tid(tid);
+    if(!thread || thread->state == proc::process::thread_state::DISABLED || thread->process != process || process->pid != pid)
+        return nullptr;
+
+    return thread;
+}
+
 bool proc::ipc::ring::send(std::byte* data, size_t size){
-    tid_t tid = proc::process::get_current_tid();
-    if(tid == a)
-        return this->_b_queue.send(data, size);
-    else if(tid == b)
-        return this->_a_queue.send(data, size);
-    else
-        PANIC("Tried to send message on non-owned IPC ring");
+    switch (this->get_side(proc::process::get_current_thread()))
+    {
+    case 0: return this->_b_queue.send(data, size);
+    case 1: return this->_a_queue.send(data, size);
+    default: return false;
+    }
 }
 
 bool proc::ipc::ring::receive(std::byte* data){
-    tid_t tid = proc::process::get_current_tid();
-    if(tid == a)
-        return this->_a_queue.receive(data);
-    else if(tid == b)
-        return this->_b_queue.receive(data);
-    else
-        PANIC("Tried to receive message on non-owned IPC ring");
+    switch (this->get_side(proc::process::get_current_thread()))
+    {
+    case 0: return this->_a_queue.receive(data);
+    case 1: return this->_b_queue.receive(data);
+    default: return false;
+    }
+}
+        
+bool proc::ipc::ring::send(const proc::ipc::iovec* iov, size_t n_iov){
+    switch (this->get_side(proc::process::get_current_thread()))
+    {
+    case 0: return this->_b_queue.send(iov, n_iov);
+    case 1: return this->_a_queue.send(iov, n_iov);
+    default: return false;
+    }
+}
+
+proc::ipc::receive_status proc::ipc::ring::receive(const proc::ipc::iovec* iov, size_t n_iov, size_t& size, bool truncate){
+    switch (this->get_side(proc::process::get_current_thread()))
+    {
+    case 0: return this->_a_queue.receive(iov, n_iov, size, truncate);
+    case 1: return this->_b_queue.receive(iov, n_iov, size, truncate);
+    default: return proc::ipc::receive_status::invalid;
+    }
 }
         
 size_t proc::ipc::ring::get_top_message_size(){
-    tid_t tid = proc::process::get_current_tid();
-    if(tid == a)
-        return this->_a_queue.get_top_message_size();
-    else if(tid == b)
-        return this->_b_queue.get_top_message_size();
-    else{
-        printf("Tried to get top message size on non-owned IPC ring: %x\n", tid);
-        PANIC("");
+    switch (this->get_side(proc::process::get_current_thread()))
+    {
+    case 0: return this->_a_queue.get_top_message_size();
+    case 1: return this->_b_queue.get_top_message_size();
+    default: return 0;
     }
 }
 
 size_t proc::ipc::ring::get_n_messages(){
-    tid_t tid = proc::process::get_current_tid();
-    if(tid == a)
-        return this->_a_queue.get_n_messages();
-    else if(tid == b)
-        return this->_b_queue.get_n_messages();
-    else{
-        printf("Tried to get n messages size on non-owned IPC ring: %x\n", tid);
-        PANIC("");
+    switch (this->get_side(proc::process::get_current_thread()))
+    {
+    case 0: return this->_a_queue.get_n_messages();
+    case 1: return this->_b_queue.get_n_messages();
+    default: return 0;
     }
 }
 
@@ -111,49 +212,184 @@ std::pair<tid_t, tid_t> proc::ipc::ring::get_recipients(){
     return {this->a, this->b};
 }
 
-generic::event& proc::ipc::ring::get_receive_event(){
-    tid_t tid = proc::process::get_current_tid();
-    if(tid == a)
-        return this->_a_queue._receive_event;
-    else if(tid == b)
-        return this->_b_queue._receive_event;
-    else
-        PANIC("Tried to get event size on non-owned IPC ring");
+proc::process::process* proc::ipc::ring::get_partner(){
+    switch (this->get_side(proc::process::get_current_thread()))
+    {
+    case 0: return (this->_b_process->pid == this->_b_pid && this->_b_process->n_threads != 0) ? this->_b_process : nullptr;
+    case 1: return (this->_a_process->pid == this->_a_pid && this->_a_process->n_threads != 0) ? this->_a_process : nullptr;
+    default: return nullptr;
+    }
 }
 
-static proc::ipc::ring& get_ring(uint64_t ring){
+generic::event* proc::ipc::ring::get_receive_event(){
+    switch (this->get_side(proc::process::get_current_thread()))
+    {
+    case 0: return &this->_a_queue._receive_event;
+    case 1: return &this->_b_queue._receive_event;
+    default: return nullptr;
+    }
+}
+
+bool proc::ipc::ring::call(size_t size, x86_64::idt::idt_registers* regs){
+    if(size > proc::ipc::call_buffer_max)
+        return false;
+
     auto* thread = proc::process::get_current_thread();
-    ASSERT(thread);
+    if(thread->tid != a && thread->tid != b)
+        return false; // Other threads of the owning processes can only use the queues
+
+    tid_t partner_tid = (thread->tid == a) ? b : a;
+    auto& self = (thread->tid == a) ? _a_sync : _b_sync;
+    auto& partner = (thread->tid == a) ? _b_sync : _a_sync;
 
-    auto* handle = thread->handle_catalogue.get<generic::handles::ipc_ring_handle>(ring);
-    ASSERT(handle);
+    auto* partner_thread = this->get_call_partner(thread->tid);
+    if(!partner_thread)
+        return false;
 
-    auto* ipc_ring = handle->ring;
-    ASSERT(ipc_ring);
+    auto* self_buffer = thread->ipc_buffer;
+    auto* partner_buffer = partner_thread->ipc_buffer;
+    if(!self_buffer || !partner_buffer)
+        return false; // Both sides need to have mapped their buffer
 
-    return *ipc_ring;
+    this->_sync_lock.lock();
+    if(self.awaiting_reply || partner.has_call){
+        this->_sync_lock.unlock();
+        return false; // Only 1 call can be in flight per direction
+    }
+
+    self.awaiting_reply = true;
+    self_buffer->size = size;
+    if(partner.waiting){
+        partner.waiting = false;
+        memcpy(partner_buffer->data, self_buffer->data, size);
+        partner_buffer->size = size;
+        this->_sync_lock.unlock();
+
+        proc::process::block_and_switch(&self.event, partner_tid, &partner.event, regs);
+    } else {
+        partner.has_call = true; // Partner picks it up from our buffer when it is ready
+        partner.call_size = size;
+        this->_sync_lock.unlock();
+
+        thread->block(&self.event, regs);
+    }
+    return true;
+}
+
+bool proc::ipc::ring::reply_and_wait(size_t reply_size, x86_64::idt::idt_registers* regs){
+    if(reply_size != proc::ipc::call_no_reply && reply_size > proc::ipc::call_buffer_max)
+        return false;
+
+    auto* thread = proc::process::get_current_thread();
+    if(thread->tid != a && thread->tid != b)
+        return false; // Other threads of the owning processes can only use the queues
+
+    tid_t partner_tid = (thread->tid == a) ? b : a;
+    auto& self = (thread->tid == a) ? _a_sync : _b_sync;
+    auto& partner = (thread->tid == a) ? _b_sync : _a_sync;
+
+    auto* partner_thread = this->get_call_partner(thread->tid);
+    if(!partner_thread)
+        return false;
+
+    auto* self_buffer = thread->ipc_buffer;
+    auto* partner_buffer = partner_thread->ipc_buffer;
+    if(!self_buffer || !partner_buffer)
+        return false; // Both sides need to have mapped their buffer
+
+    this->_sync_lock.lock();
+    bool replied = false;
+    if(reply_size != proc::ipc::call_no_reply && partner.awaiting_reply){
+        memcpy(partner_buffer->data, self_buffer->data, reply_size);
+        partner_buffer->size = reply_size;
+        partner.awaiting_reply = false;
+        replied = true;
+    }
+
+    if(self.has_call){
+        // The partner called before we got here, no need to block
+        self.has_call = false;
+        size_t size = misc::min(self.call_size, proc::ipc::call_buffer_max);
+        memcpy(self_buffer->data, partner_buffer->data, size);
+        self_buffer->size = size;
+        this->_sync_lock.unlock();
+
+        if(replied)
+            partner.event.trigger();
+        return true;
+    }
+
+    self.waiting = true;
+    this->_sync_lock.unlock();
+
+    if(replied)
+        proc::process::block_and_switch(&self.event, partner_tid, &partner.event, regs);
+    else
+        thread->block(&self.event, regs);
+    return true;
+}
+
+// Returns nullptr for handles that don't exist or aren't rings, userspace passes these straight in
+static proc::ipc::ring* get_ring(uint64_t ring){
+    auto* thread = proc::process::get_current_thread();
+    auto* handle = thread->process->handle_catalogue.find<generic::handles::ipc_ring_handle>(ring);
+    if(!handle)
+        return nullptr;
+
+    return handle->ring;
 }
 
 size_t proc::ipc::get_message_size(uint64_t ring){
-    return get_ring(ring).get_top_message_size();
+    auto* r = get_ring(ring);
+    return r ? r->get_top_message_size() : 0;
 }
 
 size_t proc::ipc::get_n_messages(uint64_t ring){
-    return get_ring(ring).get_n_messages();
+    auto* r = get_ring(ring);
+    return r ? r->get_n_messages() : 0;
 }
 
 bool proc::ipc::send(uint64_t ring, std::byte* data, size_t size){
-    return get_ring(ring).send(data, size);
+    auto* r = get_ring(ring);
+    return r && r->send(data, size);
 }
 
 bool proc::ipc::receive(uint64_t ring, std::byte* data){
-    return get_ring(ring).receive(data);
+    auto* r = get_ring(ring);
+    return r && r->receive(data);
+}
+
+bool proc::ipc::send(uint64_t ring, const proc::ipc::iovec* iov, size_t n_iov){
+    auto* r = get_ring(ring);
+    return r && r->send(iov, n_iov);
 }
 
-generic::event& proc::ipc::get_receive_event(uint64_t ring){
-    return get_ring(ring).get_receive_event();
+proc::ipc::receive_status proc::ipc::receive(uint64_t ring, const proc::ipc::iovec* iov, size_t n_iov, size_t& size, bool truncate){
+    auto* r = get_ring(ring);
+    return r ? r->receive(iov, n_iov, size, truncate) : proc::ipc::receive_status::invalid;
+}
+
+generic::event* proc::ipc::get_receive_event(uint64_t ring){
+    auto* r = get_ring(ring);
+    return r ? r->get_receive_event() : nullptr;
 }
 
 std::pair<tid_t, tid_t> proc::ipc::get_recipients(uint64_t ring){
-    return get_ring(ring).get_recipients();
-}
\ No newline at end of file
+    auto* r = get_ring(ring);
+    return r ? r->get_recipients() : std::pair<tid_t, tid_t>{0, 0};
+}
+
+proc::process::process* proc::ipc::get_partner(uint64_t ring){
+    auto* r = get_ring(ring);
+    return r ? r->get_partner() : nullptr;
+}
+
+bool proc::ipc::call(uint64_t ring, size_t size, x86_64::idt::idt_registers* regs){
+    auto* r = get_ring(ring);
+    return r && r->call(size, regs);
+}
+
+bool proc::ipc::reply_and_wait(uint64_t ring, size_t reply_size, x86_64::idt::idt_registers* regs){
+    auto* r = get_ring(ring);
+    return r && r->reply_and_wait(reply_size, regs);
+}
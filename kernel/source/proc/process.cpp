@@ -2,10 +2,35 @@
 #include <Sigma/types/queue.h>
 #include <Sigma/arch/x86_64/intel/vt-d.hpp>
 #include <Sigma/generic/device.h>
+#include <Sigma/generic/timer.hpp>
+#include <Sigma/proc/grant.hpp>
+#include <Sigma/proc/shm.hpp>
+#include <Sigma/proc/syscall.h>
 
 auto thread_list = types::linked_list<proc::process::thread>();
 static uint64_t current_thread_list_offset = 0;
 
+auto process_list = types::linked_list<proc::process::process>();
+static uint64_t next_pid = 0;
+
+// Call with the scheduler_mutex held
+static proc::process::process* create_process(){
+	proc::process::process* process = nullptr;
+	for(auto& entry : process_list){
+		if(entry.n_threads == 0){
+			process = &entry;
+			break;
+		}
+	}
+
+	if(!process)
+		process = process_list.empty_entry();
+
+	process->pid = next_pid++;
+	process->handle_catalogue = {};
+	return process;
+}
+
 auto cpus = misc::lazy_initializer<types::linked_list<proc::process::managed_cpu>>();
 
 proc::process::thread* kernel_thread;
@@ -29,12 +54,18 @@ proc::process::managed_cpu* proc::process::get_current_managed_cpu(){
 
 types::queue<tid_t> scheduling_queue{};
 
-static proc::process::thread* schedule(proc::process::thread* current){
-	auto round_robin = [current]() -> proc::process::thread* {
-		auto check_thread = [](proc::process::thread& t) -> bool {
+static proc::process::thread* schedule(proc::process::managed_cpu* cpu){
+	auto* current = cpu->current_thread;
+	auto round_robin = [cpu, current]() -> proc::process::thread* {
+		auto check_thread = [cpu, current](proc::process::thread& t) -> bool {
 			std::lock_guard guard{t.thread_lock};
+			if(cpu->id < 64 && !(t.affinity & (1ull << cpu->id)))
+				return false;
+
 			if(t.state == proc::process::thread_state::IDLE){
 				return true;
+			} else if(t.state == proc::process::thread_state::RUNNING && &t == current){
+				return true; // Allow the current thread to keep running if nothing better is available
 			} else if(t.state == proc::process::thread_state::BLOCKED){
 				if(t.event->has_triggered()){
 					t.state = proc::process::thread_state::IDLE;
@@ -45,13 +76,46 @@ static proc::process::thread* schedule(proc::process::thread* current){
 			return false;
 		};
 
+		// Threads go back to the CPU they last ran on, so they find their caches warm and a migration by balance_load sticks
+		// Other CPUs only pick them up when they have nothing of the same priority left, preferably from an SMT sibling or a CPU
+		// sharing the LLC, and not from another NUMA node
+		constexpr int at_home = misc::as_integer(smp::topology::distance::REMOTE) + 1;
+		auto locality = [cpu](proc::process::thread& t) -> int {
+			auto* home = t.last_cpu;
+			if(home == nullptr || home == cpu || !home->enabled || (home->id < 64 && !(t.affinity & (1ull << home->id))))
+				return at_home; // Never ran, or its CPU can't take it anymore
+
+			if(t.numa_node != cpu->cpu.numa_node)
+				return -1;
+
+			return misc::as_integer(smp::topology::distance::REMOTE) - misc::as_integer(smp::topology::get_distance(cpu->cpu.lapic_id, home->cpu.lapic_id));
+		};
+
+		// Round robin order decides among the threads of the highest priority class, locality only comes second
+		// Every thread is on top of the list of its own CPU, where it takes turns with the rest, so nothing starves
+		proc::process::thread* best = nullptr;
+		int best_locality = 0;
+		auto consider = [&best, &best_locality, &check_thread, &locality](proc::process::thread& t) -> bool {
+			int t_locality = locality(t);
+			if(best != nullptr && (t.priority < best->priority || (t.priority == best->priority && t_locality <= best_locality)))
+				return false; // Don't touch the event of threads that can't win anyway
+
+			if(check_thread(t)){
+				best = &t;
+				best_locality = t_locality;
+			}
+
+			// Nothing can beat a realtime thread at home, stop looking
+			return best != nullptr && best->priority == proc::process::thread_priority::REALTIME && best_locality == at_home;
+		};
+
 		if(current == nullptr){
 			// Just got called without any current thread, loop through all of them
 			for(auto& entry : thread_list)
-				if(check_thread(entry))
-					return &entry;
-			
-			return nullptr;
+				if(consider(entry))
+					break;
+
+			return best;
 		}
 
 		auto current_it = thread_list.get_iterator_for_item(current);
@@ -61,27 +125,29 @@ static proc::process::thread* schedule(proc::process::thread* current){
 		}
 
 		auto it = current_it;
+		++it; // Start after the current thread so it gets considered last
 		auto end = thread_list.end();
 		while(it != end){
 			auto& entry = *it;
-			if(check_thread(entry))
-				return &entry;
-			
+			if(consider(entry))
+				return best;
+
 			end = thread_list.end();
 			++it;
 		}
 
 		it = thread_list.begin();
 		end = current_it;
+		++end;
 		while(it != end){
 			auto& entry = *it;
-			if(check_thread(entry))
-				return &entry;
-			
+			if(consider(entry))
+				return best;
+
 			++it;
 		}
 
-		return nullptr;
+		return best;
 	};
 
 	if(scheduling_queue.length() >= 1){
@@ -158,13 +224,13 @@ static void switch_context(x86_64::idt::idt_registers* regs, proc::process::thre
 
 	new_thread->context.simd_state.restore();
 
-	if(old_thread == nullptr || old_thread->context.cr3 != new_thread->context.cr3)
-		new_thread->vmm.set();
+	new_thread->process->vmm.set(); // Doesn't touch CR3 if the address space is still loaded, so switching between threads of 1 process is cheap
 }
 
 auto scheduler_mutex = x86_64::spinlock::mutex();
 
 C_LINKAGE void proc_idle(uint64_t stack);
+C_LINKAGE void proc_idle_mwait(uint64_t stack, std::atomic<uint64_t>* need_resched);
 
 NORETURN_ATTRIBUTE
 NOINLINE_ATTRIBUTE 
@@ -183,20 +249,126 @@ static void idle_cpu(x86_64::idt::idt_registers* regs, proc::process::managed_cp
 	}
 
 
-	uint64_t rsp = (uint64_t)smp::cpu::get_current_cpu()->idle_stack->top();
+	auto* cpu_data = smp::cpu::get_current_cpu();
+	uint64_t rsp = (uint64_t)cpu_data->idle_stack->top();
 	rsp = ALIGN_DOWN(rsp, 16); // Align stack for C code
 
-	smp::cpu::get_current_cpu()->lapic.send_eoi();
+	// Nothing to run, fall back to the default quantum, woken driver threads will IPI us anyway
+	cpu_data->lapic.enable_timer(proc::process::cpu_quantum_interrupt_vector, proc::process::cpu_quantum, x86_64::apic::lapic_timer_modes::PERIODIC);
+	cpu_data->lapic.send_eoi();
 
 	scheduler_mutex.unlock();
 
 	mm::vmm::kernel_vmm::get_instance().set();
-	proc_idle(rsp);
+	if(cpu_data->features.mwait)
+		proc_idle_mwait(rsp, &cpu_data->need_resched); // Wakers set need_resched, which makes us enter the scheduler
+	else
+		proc_idle(rsp);
 
 	while(true)
 		; // proc_idle modifies the stack, it's dangerous, don't return ever
 }
 
+// Runs with the scheduler_mutex held, a thread that just marked itself BLOCKED can still be on its way out of another CPU
+static bool is_current_on_any_cpu(proc::process::thread* thread){
+	for(auto& cpu : *cpus)
+		if(cpu.current_thread == thread)
+			return true;
+
+	return false;
+}
+
+// Runs with the scheduler_mutex held
+static void wake_cpu(proc::process::managed_cpu& cpu){
+	bool idle = cpu.current_thread == nullptr;
+	bool mwait = idle && cpu.cpu_data != nullptr && cpu.cpu_data->features.mwait;
+	if(idle && cpu.wake_tsc == 0){
+		cpu.wake_tsc = x86_64::read_tsc();
+		cpu.wake_mwait = mwait;
+	}
+
+	if(mwait)
+		cpu.cpu_data->need_resched.store(1); // The CPU is MWAITing on this line, the store alone wakes it
+	else
+		smp::cpu::get_current_cpu()->lapic.send_ipi(cpu.cpu.lapic_id, proc::process::cpu_quantum_interrupt_vector);
+}
+
+static uint64_t core_load(proc::process::managed_cpu& cpu){
+	uint64_t load = 0;
+	for(auto& entry : *cpus)
+		if(entry.enabled && smp::topology::get_distance(cpu.cpu.lapic_id, entry.cpu.lapic_id) <= smp::topology::distance::SMT_SIBLING)
+			load += entry.stats.load;
+
+	return load;
+}
+
+// Runs with the scheduler_mutex held
+static void balance_load(){
+	for(auto& cpu : *cpus)
+		cpu.stats.n_runnable = 0;
+
+	for(auto& thread : thread_list){
+		std::lock_guard guard{thread.thread_lock};
+		if(thread.last_cpu != nullptr && (thread.state == proc::process::thread_state::IDLE || thread.state == proc::process::thread_state::RUNNING))
+			thread.last_cpu->stats.n_runnable++;
+	}
+
+	proc::process::managed_cpu* busiest = nullptr;
+	for(auto& cpu : *cpus){
+		cpu.stats.load = (cpu.stats.load * (proc::process::load_decay - 1) + cpu.stats.n_runnable * proc::process::load_scale) / proc::process::load_decay;
+
+		if(cpu.enabled && (busiest == nullptr || cpu.stats.load > busiest->stats.load))
+			busiest = &cpu;
+	}
+
+	if(busiest == nullptr || busiest->stats.n_runnable < 2)
+		return; // Nothing to move, the CPU needs at least 1 thread itself
+
+	// Stay on the same NUMA node if possible, spread over idle cores before SMT siblings,
+	// then prefer CPUs close to the busiest one so caches stay warm
+	proc::process::managed_cpu* target = nullptr;
+	uint64_t target_core_load = 0;
+	bool target_remote = false;
+	for(auto& cpu : *cpus){
+		if(!cpu.enabled || (cpu.stats.load + proc::process::load_scale) >= busiest->stats.load)
+			continue; // No more than 1 thread of difference, moving it would only swap the roles
+
+		uint64_t cpu_core_load = core_load(cpu);
+		bool cpu_remote = cpu.cpu.numa_node != busiest->cpu.numa_node;
+		if(target == nullptr || (target_remote && !cpu_remote) || (target_remote == cpu_remote && (cpu_core_load < target_core_load || (cpu_core_load == target_core_load && \
+		   smp::topology::get_distance(busiest->cpu.lapic_id, cpu.cpu.lapic_id) < smp::topology::get_distance(busiest->cpu.lapic_id, target->cpu.lapic_id))))){
+			target = &cpu;
+			target_core_load = cpu_core_load;
+			target_remote = cpu_remote;
+		}
+	}
+
+	if(target == nullptr)
+		return;
+
+	for(auto& thread : thread_list){
+		std::lock_guard guard{thread.thread_lock};
+		if(thread.last_cpu != busiest || thread.state != proc::process::thread_state::IDLE)
+			continue;
+
+		if(target->id < 64 && !(thread.affinity & (1ull << target->id)))
+			continue;
+
+		if(target_remote && thread.numa_node == busiest->cpu.numa_node)
+			continue; // Only move threads that are already away from their memory across nodes
+
+		thread.last_cpu = target; // Makes target its home, busiest only takes it back when it runs out of its own threads
+		busiest->stats.n_balanced++;
+		target->stats.n_migrations++;
+		busiest->stats.load -= proc::process::load_scale;
+		target->stats.load += proc::process::load_scale;
+
+		if(target != proc::process::get_current_managed_cpu())
+			wake_cpu(*target); // Don't leave it waiting for the next tick over there
+		return;
+	}
+}
+
 static void timer_handler(x86_64::idt::idt_registers* regs, MAYBE_UNUSED_ATTRIBUTE void* userptr){
 	scheduler_mutex.lock();
 	auto* cpu = proc::process::get_current_managed_cpu();
@@ -207,9 +379,35 @@ static void timer_handler(x86_64::idt::idt_registers* regs, MAYBE_UNUSED_ATTRIBU
 		return;
 	}
 
+	smp::cpu::get_current_cpu()->need_resched.store(0);
+	if(cpu->wake_tsc != 0){
+		// Assumes the TSCs of all CPUs are synchronized, which is true for any CPU with an invariant TSC
+		uint64_t now = x86_64::read_tsc();
+		uint64_t latency = (now > cpu->wake_tsc) ? (now - cpu->wake_tsc) : 0;
+		if(cpu->wake_mwait){
+			cpu->stats.n_wakeups_mwait++;
+			cpu->stats.wakeup_tsc_mwait += latency;
+		} else {
+			cpu->stats.n_wakeups_ipi++;
+			cpu->stats.wakeup_tsc_ipi += latency;
+		}
+		cpu->wake_tsc = 0;
+	}
+
+	static uint64_t balance_ticks = 0;
+	if(cpu->id == 0 && ++balance_ticks >= proc::process::load_balance_interval){
+		balance_ticks = 0;
+		balance_load();
+	}
+
+	if(cpu->id == 0){
+		generic::timers_tick();
+		proc::futex::timeouts_tick();
+	}
+
 	proc::process::thread* old_thread = cpu->current_thread;
 
-	proc::process::thread* new_thread = schedule(cpu->current_thread);
+	proc::process::thread* new_thread = schedule(cpu);
 	if(!new_thread)
 		idle_cpu(regs, cpu); 
 	std::lock_guard new_guard{new_thread->thread_lock};
@@ -228,6 +426,14 @@ static void timer_handler(x86_64::idt::idt_registers* regs, MAYBE_UNUSED_ATTRIBU
 	
 	cpu->current_thread = new_thread;
 	cpu->current_thread->state = proc::process::thread_state::RUNNING;
+
+	cpu->stats.n_switches++;
+	if(new_thread->last_cpu != nullptr && new_thread->last_cpu != cpu)
+		cpu->stats.n_migrations++;
+	new_thread->last_cpu = cpu;
+
+	// Rearm the timer so the new thread gets the full slice of its class
+	smp::cpu::get_current_cpu()->lapic.enable_timer(proc::process::cpu_quantum_interrupt_vector, proc::process::time_slice_for_priority(new_thread->priority), x86_64::apic::lapic_timer_modes::PERIODIC);
 	
 	scheduler_mutex.unlock();
 }
@@ -235,12 +441,20 @@ static void timer_handler(x86_64::idt::idt_registers* regs, MAYBE_UNUSED_ATTRIBU
 void proc::process::init_multitasking(acpi::madt& madt){
 	proc::simd::init();
 
+	smp::topology::init(madt.get_cpus());
+	for(auto& entry : madt.get_cpus())
+		if(entry.bsp)
+			smp::cpu::get_current_cpu()->numa_node = entry.numa_node; // Make sure early allocations on the BSP are node local
+
 	cpus.init();
+	uint64_t id = 0;
 	for(auto& entry : madt.get_cpus())
-		cpus->push_back({.cpu = entry, .enabled = false, .current_thread = nullptr});
+		cpus->push_back({.cpu = entry, .enabled = false, .current_thread = nullptr, .id = id++, .topology = smp::topology::get(entry.lapic_id), .stats = {}, .cpu_data = nullptr, .wake_tsc = 0, .wake_mwait = false});
 
 	kernel_thread = thread_list.empty_entry();
 	kernel_thread->tid = current_thread_list_offset++;
+	kernel_thread->process = create_process();
+	kernel_thread->process->n_threads++;
 	kernel_thread->state = proc::process::thread_state::SILENT;
 
 	x86_64::idt::register_interrupt_handler({.vector = proc::process::cpu_quantum_interrupt_vector, .callback = timer_handler, .is_irq = true});
@@ -253,6 +467,8 @@ void proc::process::init_cpu(){
 		if(entry.cpu.lapic_id == current_apic_id){
 			// Found this CPU
 			smp::cpu::get_current_cpu()->lapic.enable_timer(proc::process::cpu_quantum_interrupt_vector, proc::process::cpu_quantum, x86_64::apic::lapic_timer_modes::PERIODIC);
+			smp::cpu::get_current_cpu()->numa_node = entry.cpu.numa_node;
+			entry.cpu_data = smp::cpu::get_current_cpu();
 			entry.enabled = true;
 			entry.current_thread = kernel_thread;
 			return;
@@ -261,16 +477,30 @@ void proc::process::init_cpu(){
 	printf("[MULTITASKING]: Tried to initialize cpu with apic_id: %x, that is not present in the tables\n", current_apic_id);
 }
 
-static proc::process::thread* create_thread_int(proc::process::thread* thread, proc::process::thread_privilege_level privilege, proc::process::thread_state state) {
+static proc::process::thread* create_thread_int(proc::process::thread* thread, proc::process::thread_privilege_level privilege, proc::process::thread_state state, proc::process::process* process) {
 	std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
 	std::lock_guard guard{thread->thread_lock};
-	thread->handle_catalogue = {};
+	if(!process)
+		process = create_process();
+	process->n_threads++;
+	thread->process = process;
+	thread->ipc_buffer = nullptr;
+	thread->ipc_buffer_user = 0;
+	thread->syscall_ring = nullptr;
+	thread->syscall_ring_user = 0;
+	thread->syscall_ring_entries = 0;
+	thread->syscall_ring_sq_offset = 0;
+	thread->syscall_ring_cq_offset = 0;
 	thread->stacks.reset();
 	thread->context = {}; // Start with a clean slate, make sure no data leaks to the next thread
 	thread->context.rflags = ((1 << 1) | (1 << 9)); // Bit 1 is reserved, should always be 1
 													// Bit 9 is IF, Interrupt flag, Force enable this
 													// so timer interrupts arrive
 	thread->privilege = privilege;
+	thread->priority = proc::process::default_priority_for_privilege(privilege);
+	thread->affinity = proc::process::cpu_affinity_all;
+	thread->last_cpu = nullptr;
+	thread->numa_node = mm::pmm::get_current_node(); // Memory for the thread is allocated on the creating CPU
 	thread->context.simd_state.init();
 
 	switch(thread->privilege) {
@@ -296,8 +526,8 @@ void proc::process::make_kernel_thread(proc::process::thread* thread, void (*fun
 	std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
 	std::lock_guard guard{thread->thread_lock};
 
-	mm::vmm::kernel_vmm::get_instance().clone_paging_info(thread->vmm);
-	thread->context.cr3 = (thread->vmm.get_paging_info() - KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE);
+	mm::vmm::kernel_vmm::get_instance().clone_paging_info(thread->process->vmm);
+	thread->context.cr3 = (thread->process->vmm.get_paging_info() - KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE);
 
 	auto kernel_thread_trampoline = +[](void (*f)(void*), void* userptr){
 		f(userptr);
@@ -316,19 +546,19 @@ void proc::process::make_kernel_thread(proc::process::thread* thread, void (*fun
 	thread->state = thread_state::IDLE;
 }
 
-proc::process::thread* proc::process::create_blocked_thread(proc::process::thread_privilege_level privilege){
+proc::process::thread* proc::process::create_blocked_thread(proc::process::thread_privilege_level privilege, proc::process::process* process){
 	std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
 	std::lock_guard guard{scheduler_mutex};
 	for(auto& thread : thread_list){
 		if(thread.state == proc::process::thread_state::DISABLED){
 			// Found an empty thread in the list
-			return create_thread_int(&thread, privilege, proc::process::thread_state::SILENT);
+			return create_thread_int(&thread, privilege, proc::process::thread_state::SILENT, process);
 		}
 	}
 
 	auto* thread = thread_list.empty_entry();
 	thread->tid = current_thread_list_offset++;
-	return create_thread_int(thread, privilege, proc::process::thread_state::SILENT);
+	return create_thread_int(thread, privilege, proc::process::thread_state::SILENT, process);
 }
 
 proc::process::thread* proc::process::thread_for_tid(tid_t tid){
@@ -363,30 +593,218 @@ void proc::process::wake_thread(tid_t tid){
 	thread_for_tid(tid)->wake();
 }
 
+void proc::process::block_and_switch(generic::event* await, tid_t target, generic::event* target_event, x86_64::idt::idt_registers* regs){
+	auto* cpu_data = smp::cpu::get_current_cpu();
+	cpu_data->irq_lock.lock();
+	scheduler_mutex.lock();
+
+	auto* cpu = proc::process::get_current_managed_cpu();
+	auto* old_thread = cpu->current_thread;
+	proc::process::thread* new_thread = nullptr;
+	for(auto& entry : thread_list){
+		if(entry.tid == target){
+			new_thread = &entry;
+			break;
+		}
+	}
+
+	old_thread->thread_lock.lock();
+	old_thread->event = await;
+	old_thread->state = proc::process::thread_state::BLOCKED;
+
+	if(new_thread == nullptr || new_thread == old_thread){
+		old_thread->thread_lock.unlock();
+		scheduler_mutex.unlock();
+		cpu_data->irq_lock.unlock();
+
+		timer_handler(regs, nullptr);
+		return;
+	}
+
+	new_thread->thread_lock.lock();
+	// Only take over threads whose context has been saved, resuming one that is still running elsewhere would reuse its stack
+	bool direct = new_thread->state == proc::process::thread_state::BLOCKED && new_thread->event == target_event && \
+				  (cpu->id >= 64 || (new_thread->affinity & (1ull << cpu->id))) && !is_current_on_any_cpu(new_thread);
+	if(!direct){
+		new_thread->thread_lock.unlock();
+		old_thread->thread_lock.unlock();
+		scheduler_mutex.unlock();
+		cpu_data->irq_lock.unlock();
+
+		target_event->trigger(); // Let the scheduler pick it up wherever it can run
+		timer_handler(regs, nullptr);
+		return;
+	}
+
+	// Hand our CPU and the rest of the slice to the target, this is what makes a call / reply round trip cheap
+	switch_context(regs, new_thread, old_thread);
+	new_thread->state = proc::process::thread_state::RUNNING;
+	new_thread->thread_lock.unlock();
+	old_thread->thread_lock.unlock();
+
+	cpu->current_thread = new_thread;
+	cpu->stats.n_switches++;
+	if(new_thread->last_cpu != nullptr && new_thread->last_cpu != cpu)
+		cpu->stats.n_migrations++;
+	new_thread->last_cpu = cpu;
+
+	scheduler_mutex.unlock();
+	cpu_data->irq_lock.unlock();
+}
+
 bool proc::process::is_blocked(tid_t tid){
 	return proc::process::thread_for_tid(tid)->is_blocked();
 }
 
+void proc::process::preempt_for(tid_t tid){
+	std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+	std::lock_guard guard{scheduler_mutex};
 
+	proc::process::thread* thread = nullptr;
+	for(auto& entry : thread_list){
+		if(entry.tid == tid){
+			thread = &entry;
+			break;
+		}
+	}
 
-void proc::process::kill(x86_64::idt::idt_registers* regs){
-	mm::vmm::kernel_vmm::get_instance().set(); // We want nothing to do with this thread anymore
-	proc::process::thread* thread = proc::process::get_current_thread();
-	thread->thread_lock.lock();
-	smp::cpu::get_current_cpu()->irq_lock.lock();
-	scheduler_mutex.lock();
+	if(thread == nullptr)
+		return;
+
+	// Find the allowed CPU running the lowest priority class, an idle CPU beats everything
+	proc::process::managed_cpu* target = nullptr;
+	int target_priority = 0;
+	for(auto& cpu : *cpus){
+		if(!cpu.enabled || (cpu.id < 64 && !(thread->affinity & (1ull << cpu.id))))
+			continue;
 
+		if(cpu.current_thread == thread)
+			return; // Already running
 
+		int priority = (cpu.current_thread == nullptr) ? -1 : misc::as_integer(cpu.current_thread->priority);
+		if(target == nullptr || priority < target_priority){
+			target = &cpu;
+			target_priority = priority;
+		}
+	}
+
+	if(target == nullptr || target_priority >= misc::as_integer(thread->priority))
+		return; // It'll get picked up at the end of the current slice
+
+	wake_cpu(*target);
+}
+
+
+
+bool proc::process::get_cpu_lapic_id(uint64_t id, uint32_t& lapic_id){
+	for(auto& entry : *cpus){
+		if(entry.id == id){
+			lapic_id = entry.cpu.lapic_id;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool proc::process::get_cpu_stats(uint64_t id, smp::topology::cpu_topology& topology, proc::process::cpu_stats& stats){
+	std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+	std::lock_guard guard{scheduler_mutex};
+	for(auto& entry : *cpus){
+		if(entry.id == id){
+			topology = entry.topology;
+			stats = entry.stats;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Frees everything the address space of the process holds, call once its last thread is going away
+static void release_process_memory(proc::process::process* process){
+	proc::grant::release_process(process); // Nobody else should be able to touch our frames after they are freed
+	proc::shm::release_process(process);
+	proc::file_map::release_process(process);
+
+	std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+	std::lock_guard guard{process->process_lock};
+	for(auto& frame : process->resources.frames) mm::pmm::free_block(reinterpret_cast<void*>(frame)); // Free frames
+	process->resources.frames.resize(0);
+	process->vmm.deinit();
+	process->vmm.init();
+}
+
+// Makes the slot available to create_blocked_thread again, call with the thread_lock and scheduler_mutex held
+static void reset_thread(proc::process::thread* thread){
 	thread->state = proc::process::thread_state::DISABLED;
 
 	thread->stacks.reset();
 	thread->context.simd_state.deinit();
 	thread->context = proc::process::thread_context(); // Remove all traces from previous function
 	thread->privilege = proc::process::thread_privilege_level::APPLICATION; // Lowest privilege
-	for(auto& frame : thread->resources.frames) mm::pmm::free_block(reinterpret_cast<void*>(frame)); // Free frames
+	thread->priority = proc::process::thread_priority::NORMAL;
+	thread->affinity = proc::process::cpu_affinity_all;
+	thread->last_cpu = nullptr;
+	thread->ipc_buffer = nullptr; // The frames are in the resources of the process
+	thread->ipc_buffer_user = 0;
+	thread->syscall_ring = nullptr;
+	thread->syscall_ring_user = 0;
+	thread->syscall_ring_entries = 0;
+	thread->syscall_ring_sq_offset = 0;
+	thread->syscall_ring_cq_offset = 0;
 	thread->image = proc::process::thread_image();
-	thread->vmm.deinit();
-	thread->vmm.init();
+	thread->process = nullptr;
+}
+
+void proc::process::destroy_blocked_thread(proc::process::thread* thread){
+	auto* process = thread->process;
+	proc::futex::release_thread(thread);
+
+	smp::cpu::get_current_cpu()->irq_lock.lock();
+	scheduler_mutex.lock();
+	bool last = (process->n_threads == 1);
+	if(!last)
+		process->n_threads--;
+	scheduler_mutex.unlock();
+	smp::cpu::get_current_cpu()->irq_lock.unlock();
+
+	if(last)
+		release_process_memory(process);
+
+	std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+	std::lock_guard thread_guard{thread->thread_lock};
+	std::lock_guard guard{scheduler_mutex};
+	if(last)
+		process->n_threads = 0;
+
+	reset_thread(thread);
+}
+
+void proc::process::kill(x86_64::idt::idt_registers* regs){
+	mm::vmm::kernel_vmm::get_instance().set(); // We want nothing to do with this thread anymore
+	proc::process::thread* thread = proc::process::get_current_thread();
+	auto* process = thread->process;
+	proc::futex::release_thread(thread);
+
+	smp::cpu::get_current_cpu()->irq_lock.lock();
+	scheduler_mutex.lock();
+	bool last = (process->n_threads == 1); // Keep the count at 1 while tearing down, so the slot doesn't get reused under us
+	if(!last)
+		process->n_threads--;
+	scheduler_mutex.unlock();
+	smp::cpu::get_current_cpu()->irq_lock.unlock();
+
+	if(last)
+		release_process_memory(process);
+
+	thread->thread_lock.lock();
+	smp::cpu::get_current_cpu()->irq_lock.lock();
+	scheduler_mutex.lock();
+	if(last)
+		process->n_threads = 0;
+
+	reset_thread(thread);
 	thread->thread_lock.unlock();
 
 	auto* cpu = get_current_managed_cpu();
@@ -407,25 +825,55 @@ tid_t proc::process::fork(x86_64::idt::idt_registers* regs){
 	parent->thread_lock.lock();
 	auto* child = proc::process::create_blocked_thread(parent->privilege);
 	child->thread_lock.lock();
+	parent->process->process_lock.lock();
 
 	save_context(regs, parent);
 
 	parent->context.copy(child->context);
 	child->image = parent->image;
+	child->priority = parent->priority;
+	child->affinity = parent->affinity;
+	child->numa_node = parent->numa_node;
 	
-	parent->vmm.fork_address_space(*child);
+	parent->process->vmm.fork_address_space(*child->process); // Only the calling thread is forked, the child is single threaded
 
-	child->context.cr3 = child->vmm.get_paging_info() - KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE;
+	child->context.cr3 = child->process->vmm.get_paging_info() - KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE;
 
 	// Set return values
 	child->context.rax = 0; // Child should get 0 as return value
 
+	parent->process->process_lock.unlock();
 	parent->thread_lock.unlock();
 	child->thread_lock.unlock();
+	proc::shm::fork_process(parent->process, child->process);
+	proc::file_map::fork_process(parent->process, child->process);
 	child->wake();
 	return child->tid;
 }
 
+tid_t proc::process::create_thread(uint64_t rip, uint64_t rsp, uint64_t arg){
+	auto* parent = proc::process::get_current_thread();
+	if(parent == nullptr || parent->privilege == proc::process::thread_privilege_level::KERNEL)
+		return 0;
+
+	auto* thread = proc::process::create_blocked_thread(parent->privilege, parent->process);
+
+	std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+	std::lock_guard guard{thread->thread_lock};
+	thread->priority = parent->priority;
+	thread->affinity = parent->affinity;
+	thread->numa_node = parent->numa_node;
+
+	// The stack is allocated by userspace, and the new thread sets up its own TLS with set_fsbase
+	thread->context.rip = rip;
+	thread->context.rsp = ALIGN_DOWN(rsp, 16) - sizeof(uint64_t); // Look like a call just happened, for SysV stack alignment
+	thread->context.rdi = arg;
+	thread->context.cr3 = thread->process->vmm.get_paging_info() - KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE;
+
+	thread->state = proc::process::thread_state::IDLE;
+	return thread->tid;
+}
+
 void proc::process::yield(x86_64::idt::idt_registers* regs){
 	timer_handler(regs, nullptr);
 }
@@ -438,6 +886,17 @@ void proc::process::thread::set_state(proc::process::thread_state new_state){
 	this->state = new_state;
 }
 
+bool proc::process::thread::set_scheduling_params(proc::process::thread_priority new_priority, uint64_t new_affinity){
+	if(new_affinity == 0)
+		return false; // Thread would never be able to run
+
+	std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+	std::lock_guard guard{this->thread_lock};
+	this->priority = new_priority;
+	this->affinity = new_affinity;
+	return true;
+}
+
 void proc::process::thread::block(generic::event* await, x86_64::idt::idt_registers* regs){
 	smp::cpu::get_current_cpu()->irq_lock.lock();
 	this->thread_lock.lock();
@@ -449,6 +908,17 @@ void proc::process::thread::block(generic::event* await, x86_64::idt::idt_regist
 	timer_handler(regs, nullptr); // Switch out of the thread
 }
 
+void proc::process::thread::block(generic::event* await){
+	smp::cpu::get_current_cpu()->irq_lock.lock();
+	this->thread_lock.lock();
+	this->event = await;
+	this->state = proc::process::thread_state::BLOCKED;
+	this->thread_lock.unlock();
+	smp::cpu::get_current_cpu()->irq_lock.unlock();
+
+	asm volatile("int %0" : : "i"(proc::process::cpu_quantum_interrupt_vector) : "memory"); // Enter the scheduler with a frame of our own
+}
+
 void proc::process::thread::wake(){
 	std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
 	std::lock_guard guard{this->thread_lock};
@@ -464,16 +934,16 @@ bool proc::process::thread::is_blocked(){
 
 void proc::process::thread::expand_thread_stack(size_t pages){
 	std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
-	std::lock_guard guard{this->thread_lock};
+	std::lock_guard guard{this->process->process_lock};
 	for(uint64_t i = 0; i < pages; i++){
 		void* phys = mm::pmm::alloc_block();
 		if(phys == nullptr)
 			PANIC("Couldn't allocate extra pages for thread stack");
-		this->resources.frames.push_back(reinterpret_cast<uint64_t>(phys));
+		this->process->resources.frames.push_back(reinterpret_cast<uint64_t>(phys));
 		
 		this->image.stack_bottom -= mm::pmm::block_size;
-		this->vmm.map_page(reinterpret_cast<uint64_t>(phys), this->image.stack_bottom, map_page_flags_present | map_page_flags_writable | map_page_flags_user | map_page_flags_no_execute);
-		memset_aligned_4k((void*)this->image.stack_bottom, 0);
+		this->process->vmm.map_page(reinterpret_cast<uint64_t>(phys), this->image.stack_bottom, map_page_flags_present | map_page_flags_writable | map_page_flags_user | map_page_flags_no_execute);
+		memset_aligned_4k((void*)(reinterpret_cast<uint64_t>(phys) + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE), 0); // The process doesn't have to be the active one
 	}
 }
 
@@ -488,19 +958,111 @@ void proc::process::thread::set_fsbase(uint64_t fs){
 	x86_64::msr::write(x86_64::msr::fs_base, fs);
 }
 
+uint64_t proc::process::thread::map_ipc_buffer(){
+	std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+	std::lock_guard guard{this->process->process_lock};
+	if(this->ipc_buffer)
+		return this->ipc_buffer_user;
+
+	uint64_t virt = this->process->vmm.get_free_range(mmap_bottom, mmap_top, mm::pmm::block_size);
+	if(virt == (uint64_t)-1)
+		return 0;
+
+	void* phys = mm::pmm::alloc_block();
+	if(phys == nullptr)
+		return 0;
+	this->process->resources.frames.push_back(reinterpret_cast<uint64_t>(phys));
+
+	auto* buffer = reinterpret_cast<proc::ipc::call_buffer*>(reinterpret_cast<uint64_t>(phys) + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE);
+	memset_aligned_4k(buffer, 0);
+	this->process->vmm.map_page(reinterpret_cast<uint64_t>(phys), virt, map_page_flags_present | map_page_flags_writable | map_page_flags_user | map_page_flags_no_execute);
+
+	this->ipc_buffer = buffer;
+	this->ipc_buffer_user = virt;
+	return virt;
+}
+
+uint64_t proc::process::thread::map_syscall_ring(size_t n_entries){
+	if(n_entries == 0 || n_entries > proc::syscall::ring_max_entries)
+		return 0;
+
+	std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+	std::lock_guard guard{this->process->process_lock};
+	if(this->syscall_ring)
+		return 0; // Only 1 ring per thread
+
+	uint32_t entries = 1;
+	while(entries < n_entries)
+		entries <<= 1;
+
+	uint32_t sq_offset = ALIGN_UP(sizeof(proc::syscall::ring_header), 64);
+	uint32_t cq_offset = sq_offset + (entries * sizeof(proc::syscall::ring_sqe));
+	size_t n_pages = misc::div_ceil(cq_offset + (entries * sizeof(proc::syscall::ring_cqe)), mm::pmm::block_size);
+
+	uint64_t virt = this->process->vmm.get_free_range(mmap_bottom, mmap_top, n_pages * mm::pmm::block_size);
+	if(virt == (uint64_t)-1)
+		return 0;
+
+	// Contiguous so the kernel can access the whole ring through the physical mapping
+	uint64_t phys = reinterpret_cast<uint64_t>(mm::pmm::alloc_n_blocks(n_pages));
+	if(phys == 0)
+		return 0;
+
+	for(size_t i = 0; i < n_pages; i++){
+		uint64_t frame = phys + (i * mm::pmm::block_size);
+		this->process->resources.frames.push_back(frame);
+		memset_aligned_4k(reinterpret_cast<void*>(frame + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE), 0);
+		this->process->vmm.map_page(frame, virt + (i * mm::pmm::block_size), map_page_flags_present | map_page_flags_writable | map_page_flags_user | map_page_flags_no_execute);
+	}
+
+	auto* ring = reinterpret_cast<proc::syscall::ring_header*>(phys + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE);
+	ring->n_entries = entries;
+	ring->sq_offset = sq_offset;
+	ring->cq_offset = cq_offset;
+
+	this->syscall_ring = ring;
+	this->syscall_ring_user = virt;
+	this->syscall_ring_entries = entries;
+	this->syscall_ring_sq_offset = sq_offset;
+	this->syscall_ring_cq_offset = cq_offset;
+	return virt;
+}
+
 void* proc::process::thread::map_anonymous(size_t size, void *virt_base, void* phys_base, int prot, int flags){
+	if((flags & MAP_SHARED) && phys_base == nullptr){
+		// Back it with a shm object that only the mappings reference, so it stays shared across fork
+		auto* object = new proc::shm::object{};
+		if(!object->resize(size)){
+			object->unref();
+			return nullptr;
+		}
+
+		uint64_t virt = object->map(this->process, reinterpret_cast<uint64_t>(virt_base), prot, flags);
+		object->unref(); // Drop the creation reference, the mapping keeps it alive
+		return reinterpret_cast<void*>(virt);
+	}
+
 	std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
-	std::lock_guard guard{this->thread_lock};
+	std::lock_guard guard{this->process->process_lock};
 
-	if(!virt_base)
-		virt_base = reinterpret_cast<void*>(this->vmm.get_free_range(mmap_bottom, mmap_top, size));
+	if(flags & MAP_FIXED){
+		// Mapping over existing pages would leak their frames and break the bookkeeping of whatever owns them
+		uint64_t base = reinterpret_cast<uint64_t>(virt_base);
+		if(size == 0 || (base % mm::pmm::block_size) != 0 || base > mmap_top || size > (mmap_top - base) || !is_range_unused(this->process, base, size))
+			return nullptr;
+	} else if(virt_base && !is_range_unused(this->process, reinterpret_cast<uint64_t>(virt_base), size)){
+		virt_base = nullptr; // Without MAP_FIXED the address is only a hint
+	}
+
+	if(!virt_base && !(flags & MAP_FIXED)){
+		uint64_t free = this->process->vmm.get_free_range(mmap_bottom, mmap_top, size);
+		virt_base = (free == (uint64_t)-1) ? nullptr : reinterpret_cast<void*>(free);
+	}
 
 	// If we couldn't find any just return
 	if(!virt_base)
 		return nullptr;
 
-	(void)(flags);
-
 	uint64_t map_flags = ((prot & PROT_READ) ? (map_page_flags_present) : 0) | \
 					 ((prot & PROT_WRITE) ? (map_page_flags_writable) : 0) | \
 					 (!(prot & PROT_EXEC) ? (map_page_flags_no_execute) : 0) | \
@@ -516,8 +1078,8 @@ void* proc::process::thread::map_anonymous(size_t size, void *virt_base, void* p
 		if(allocate_phys){
 			void* block = mm::pmm::alloc_block();
 			if(block == nullptr) PANIC("Couldn't allocate pages for map_anonymous");
-			this->resources.frames.push_back(reinterpret_cast<uint64_t>(block));
-			this->vmm.map_page(reinterpret_cast<uint64_t>(block), virt, map_flags);
+			this->process->resources.frames.push_back(reinterpret_cast<uint64_t>(block));
+			this->process->vmm.map_page(reinterpret_cast<uint64_t>(block), virt, map_flags);
 			memset_aligned_4k((void*)virt, 0);
 		} else {
 			// If requested to map a raw phys address also map it into the devices virtual space
@@ -535,16 +1097,20 @@ void* proc::process::thread::map_anonymous(size_t size, void *virt_base, void* p
 			}
 				
 
-			this->vmm.map_page(phys, virt, map_flags);
+			this->process->vmm.map_page(phys, virt, map_flags);
 		}
 	}
 
 	return virt_base;
 }
 
+bool proc::process::is_range_unused(proc::process::process* process, uint64_t base, size_t size){
+	return process->vmm.is_range_free(base, misc::div_ceil(size, mm::pmm::block_size) * mm::pmm::block_size) && !proc::file_map::overlaps(process, base, size);
+}
+
 bool proc::process::thread::get_phys_region(size_t size, int prot, int flags, phys_region* region){
 	std::lock_guard guard{smp::cpu::get_current_cpu()->irq_lock};
-	this->thread_lock.lock();
+	this->process->process_lock.lock();
 	size_t n_pages = misc::div_ceil(size, mm::pmm::block_size);
 	void* phys_addr = mm::pmm::alloc_n_blocks(n_pages);
 	
@@ -554,7 +1120,7 @@ bool proc::process::thread::get_phys_region(size_t size, int prot, int flags, ph
 			uintptr_t cur_phys = phys + (mm::pmm::block_size * i);
 			mm::pmm::free_block((void*)cur_phys);
 		}
-		this->thread_lock.unlock();
+		this->process->process_lock.unlock();
 		smp::cpu::get_current_cpu()->irq_lock.unlock();
 		return false;
 	}
@@ -562,10 +1128,10 @@ bool proc::process::thread::get_phys_region(size_t size, int prot, int flags, ph
 	uintptr_t phys = (uintptr_t)phys_addr;
 	for(size_t i = 0; i < n_pages; i++){
 		uintptr_t cur_phys = phys + (mm::pmm::block_size * i);
-		this->resources.frames.push_back(cur_phys);
+		this->process->resources.frames.push_back(cur_phys);
 	} 
 	
-	this->thread_lock.unlock();
+	this->process->process_lock.unlock();
 	void* virt_addr = this->map_anonymous(size, nullptr, phys_addr, prot, flags);
 	if(virt_addr == nullptr)
 		return false;
@@ -12,6 +12,31 @@ idle_loop:
 
     jmp idle_loop
 
+; rdi: Stack, rsi: Address of the need_resched word
+global proc_idle_mwait
+proc_idle_mwait:
+    mov rsp, rdi ; Switch stacks
+    mov r8, rsi
+
+    sti
+idle_mwait_loop:
+    mov rax, r8
+    xor ecx, ecx
+    xor edx, edx
+    monitor ; Arm the monitor before checking, so a store between the check and mwait still wakes us
+
+    cmp qword [r8], 0
+    jne idle_mwait_resched
+
+    xor eax, eax ; C1, deeper C-states have a too high exit latency for this to be worth it
+    xor ecx, ecx
+    mwait ; Wait for a store to the monitored line or the next interrupt
+
+    jmp idle_mwait_loop
+idle_mwait_resched:
+    int 248 ; proc::process::cpu_quantum_interrupt_vector, enter the scheduler
+    jmp idle_mwait_loop
+
 global xsave_int
 xsave_int:
     push rax
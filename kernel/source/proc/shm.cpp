@@ -0,0 +1,159 @@
+#include <Sigma/proc/shm.hpp>
+#include <Sigma/proc/process.h>
+#include <Sigma/smp/ipi.h>
+
+bool proc::shm::object::resize(size_t size){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{this->_lock};
+
+    size_t n_pages = misc::div_ceil(size, mm::pmm::block_size);
+    if(n_pages < this->_frames.size()){
+        if(this->_n_mappings != 0)
+            return false; // Someone might still be using the frames
+
+        for(size_t i = n_pages; i < this->_frames.size(); i++)
+            mm::pmm::free_block(reinterpret_cast<void*>(this->_frames[i]));
+        this->_frames.resize(n_pages);
+        return true;
+    }
+
+    while(this->_frames.size() < n_pages){
+        void* block = mm::pmm::alloc_block();
+        if(block == nullptr)
+            return false;
+
+        memset_aligned_4k(reinterpret_cast<void*>(reinterpret_cast<uint64_t>(block) + KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE), 0);
+        this->_frames.push_back(reinterpret_cast<uint64_t>(block));
+    }
+
+    return true;
+}
+
+static proc::shm::mapping* find_free_slot(proc::process::process* process){
+    for(auto& entry : process->resources.shm_mappings)
+        if(entry.object == nullptr)
+            return &entry;
+
+    return process->resources.shm_mappings.empty_entry();
+}
+
+uint64_t proc::shm::object::map(proc::process::process* process, uint64_t virt, int prot, int flags){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{this->_lock};
+    size_t size = this->get_size();
+    if(size == 0)
+        return 0;
+
+    std::lock_guard process_guard{process->process_lock};
+    if(flags & MAP_FIXED){
+        if((virt % mm::pmm::block_size) != 0 || virt < proc::process::mmap_bottom || (virt + size) > proc::process::mmap_top)
+            return 0;
+
+        // Replacing anything already there would leak its frames and break the bookkeeping of whatever owns them
+        if(!proc::process::is_range_unused(process, virt, size))
+            return 0;
+    } else if(virt == 0 || (virt % mm::pmm::block_size) != 0 || !proc::process::is_range_unused(process, virt, size)) {
+        virt = process->vmm.get_free_range(proc::process::mmap_bottom, proc::process::mmap_top, size);
+        if(virt == (uint64_t)-1)
+            return 0;
+    }
+
+    uint64_t map_flags = ((prot & PROT_READ) ? (map_page_flags_present) : 0) | \
+                         ((prot & PROT_WRITE) ? (map_page_flags_writable) : 0) | \
+                         (!(prot & PROT_EXEC) ? (map_page_flags_no_execute) : 0) | \
+                         map_page_flags_user | map_page_flags_shared;
+
+    for(size_t i = 0; i < this->_frames.size(); i++)
+        process->vmm.map_page(this->_frames[i], virt + (i * mm::pmm::block_size), map_flags);
+
+    *find_free_slot(process) = {.object = this, .base = virt, .n_pages = this->_frames.size(), .map_flags = map_flags};
+    this->_refs++;
+    this->_n_mappings++;
+    return virt;
+}
+
+bool proc::shm::object::unmap(proc::process::process* process, uint64_t virt){
+    size_t n_pages = 0;
+    {
+        std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+        std::lock_guard guard{this->_lock};
+        std::lock_guard process_guard{process->process_lock};
+
+        proc::shm::mapping* mapping = nullptr;
+        for(auto& entry : process->resources.shm_mappings){
+            if(entry.object == this && entry.base == virt){
+                mapping = &entry;
+                break;
+            }
+        }
+
+        if(!mapping)
+            return false;
+
+        for(size_t i = 0; i < mapping->n_pages; i++)
+            process->vmm.unmap_page(mapping->base + (i * mm::pmm::block_size));
+
+        n_pages = mapping->n_pages;
+        mapping->object = nullptr;
+        this->_n_mappings--;
+    }
+
+    // Other threads of the process might still have the frames in their TLBs, make sure they're gone before they can be freed
+    smp::ipi::send_shootdown(process->vmm, virt, n_pages * mm::pmm::block_size);
+    this->unref(); // Outside of the lock, this could be the last reference
+    return true;
+}
+
+void proc::shm::object::clone_mapping(proc::process::process* child, uint64_t virt, size_t n_pages, uint64_t map_flags){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{this->_lock};
+    std::lock_guard process_guard{child->process_lock};
+
+    for(size_t i = 0; i < n_pages; i++)
+        child->vmm.map_page(this->_frames[i], virt + (i * mm::pmm::block_size), map_flags);
+
+    *find_free_slot(child) = {.object = this, .base = virt, .n_pages = n_pages, .map_flags = map_flags};
+    this->_refs++;
+    this->_n_mappings++;
+}
+
+void proc::shm::object::ref(){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{this->_lock};
+
+    this->_refs++;
+}
+
+void proc::shm::object::unref(){
+    {
+        std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+        std::lock_guard guard{this->_lock};
+
+        if(--this->_refs != 0)
+            return;
+
+        for(auto frame : this->_frames)
+            mm::pmm::free_block(reinterpret_cast<void*>(frame));
+        this->_frames.resize(0);
+    }
+
+    delete this;
+}
+
+void proc::shm::release_process(proc::process::process* process){
+    for(auto& entry : process->resources.shm_mappings)
+        if(entry.object)
+            entry.object->unmap(process, entry.base);
+    process->resources.shm_mappings.resize(0);
+
+    for(auto* object : process->resources.shm_objects)
+        object->unref();
+    process->resources.shm_objects.resize(0);
+}
+
+void proc::shm::fork_process(proc::process::process* parent, proc::process::process* child){
+    // Shared pages are skipped by fork_address_space, map the same frames in the child instead of copying them
+    for(auto& entry : parent->resources.shm_mappings)
+        if(entry.object)
+            entry.object->clone_mapping(child, entry.base, entry.n_pages, entry.map_flags);
+}
@@ -1,6 +1,7 @@
 #include <Sigma/proc/syscall.h>
 #include <Sigma/proc/process.h>
 #include <Sigma/proc/initrd.h>
+#include <Sigma/proc/elf.h>
 #include <Sigma/arch/x86_64/idt.h>
 #include <Sigma/arch/x86_64/cpu.h>
 #include <Sigma/generic/device.h>
@@ -17,8 +18,6 @@
 
 #define SYSCALL_SET_RETURN_VALUE(expr) (regs->rax = (expr))
 
-#define PTR_IS_USERLAND(ptr) ((ptr) <= 0x8000000000000000)
-
 #define CHECK_PTR(ptr) \
 	if(!misc::is_canonical((ptr)) || !PTR_IS_USERLAND((ptr)) || (ptr) == 0){ \
         printf("[SYSCALL]: Pointer check failed [%x]\n", ptr); \
@@ -52,8 +51,8 @@ static uint64_t syscall_kill(x86_64::idt::idt_registers* regs){
 // ARG1: void* to physical addr, only allowed if thread is DRIVER level or KERNEL
 // ARG2: size_t length
 // ARG3: int prot
-// ARG4: int flags
-// RET: addr
+// ARG4: int flags, MAP_FIXED fails if anything is mapped in the range
+// RET: addr, or 0 on failure
 static uint64_t syscall_vm_map(x86_64::idt::idt_registers* regs){
     if(!PTR_IS_USERLAND(SYSCALL_GET_ARG0()))
         return 1;
@@ -63,6 +62,8 @@ static uint64_t syscall_vm_map(x86_64::idt::idt_registers* regs){
 
     
     auto ret = proc::process::get_current_thread()->map_anonymous(SYSCALL_GET_ARG2(), reinterpret_cast<uint8_t*>(SYSCALL_GET_ARG0()), reinterpret_cast<uint8_t*>(SYSCALL_GET_ARG1()), SYSCALL_GET_ARG3(), SYSCALL_GET_ARG4());
+    if(ret == nullptr)
+        return 0; // Out of address space, or MAP_FIXED over something that is already mapped
 
     CHECK_PTR((uint64_t)ret);
 
@@ -92,6 +93,16 @@ static uint64_t syscall_initrd_get_size(x86_64::idt::idt_registers* regs){
     return proc::initrd::get_size(reinterpret_cast<char*>(SYSCALL_GET_ARG0()));
 }
 
+// ARG0: Char* to filename
+// ARG1: size_t* where the file size gets stored
+// RET: Address of the read only mapping of the file, 0 on failure
+static uint64_t syscall_initrd_map(x86_64::idt::idt_registers* regs){
+    CHECK_PTR(SYSCALL_GET_ARG0());
+    CHECK_PTR(SYSCALL_GET_ARG1());
+
+    return proc::initrd::map_file(proc::process::get_current_thread()->process, reinterpret_cast<char*>(SYSCALL_GET_ARG0()), reinterpret_cast<size_t*>(SYSCALL_GET_ARG1()));
+}
+
 // ARG0: Ring handle number
 // ARG1: buf
 // ARG2: buf size
@@ -115,6 +126,257 @@ static uint64_t syscall_ipc_get_message_size(MAYBE_UNUSED_ATTRIBUTE x86_64::idt:
 	return proc::ipc::get_message_size(SYSCALL_GET_ARG0());
 }
 
+// Keep updated with libsigma/sys.h
+constexpr uint64_t ipc_recv_flags_block = (1 << 0);
+constexpr uint64_t ipc_recv_flags_truncate = (1 << 1);
+
+static uint64_t ipc_recv_common(x86_64::idt::idt_registers* regs, const proc::ipc::iovec* iov, size_t n_iov, size_t* size_out, uint64_t flags){
+    size_t size = 0;
+    auto status = proc::ipc::receive(SYSCALL_GET_ARG0(), iov, n_iov, size, flags & ipc_recv_flags_truncate);
+    *size_out = size;
+
+    auto* event = proc::ipc::get_receive_event(SYSCALL_GET_ARG0());
+    if(status == proc::ipc::receive_status::empty && (flags & ipc_recv_flags_block) && event){
+        SYSCALL_SET_RETURN_VALUE(misc::as_integer(status)); // Set return value early for regs, the caller retries after waking up
+        proc::process::get_current_thread()->block(event, regs);
+    }
+
+    return misc::as_integer(status);
+}
+
+// Copies the iovec array in and checks all the buffers it points to, returns false if there are too many
+static bool copy_iovec(uint64_t user_iov, size_t n_iov, proc::ipc::iovec* iov){
+    if(n_iov > proc::ipc::iovec_max)
+        return false;
+
+    memcpy(iov, reinterpret_cast<proc::ipc::iovec*>(user_iov), n_iov * sizeof(proc::ipc::iovec));
+    for(size_t i = 0; i < n_iov; i++){
+        if(iov[i].len == 0)
+            continue;
+
+        uint64_t base = reinterpret_cast<uint64_t>(iov[i].base);
+        if(!misc::is_canonical(base) || !PTR_IS_USERLAND(base) || base == 0 || !PTR_IS_USERLAND(base + iov[i].len) || (base + iov[i].len) < base)
+            return false;
+    }
+
+    return true;
+}
+
+// ARG0: Ring handle number
+// ARG1: buf
+// ARG2: buf size
+// ARG3: size_t* where the full size of the message gets stored
+// ARG4: Flags, bit 0 blocks while the ring is empty, bit 1 allows truncating the message
+// RET: proc::ipc::receive_status
+static uint64_t syscall_ipc_recv(x86_64::idt::idt_registers* regs){
+    CHECK_PTR(SYSCALL_GET_ARG1());
+    CHECK_PTR(SYSCALL_GET_ARG3());
+
+    proc::ipc::iovec iov{.base = reinterpret_cast<std::byte*>(SYSCALL_GET_ARG1()), .len = SYSCALL_GET_ARG2()};
+    return ipc_recv_common(regs, &iov, 1, reinterpret_cast<size_t*>(SYSCALL_GET_ARG3()), SYSCALL_GET_ARG4());
+}
+
+// ARG0: Ring handle number
+// ARG1: iovec array
+// ARG2: Number of iovecs
+static uint64_t syscall_ipc_sendv(x86_64::idt::idt_registers* regs){
+    CHECK_PTR(SYSCALL_GET_ARG1());
+
+    proc::ipc::iovec iov[proc::ipc::iovec_max];
+    if(!copy_iovec(SYSCALL_GET_ARG1(), SYSCALL_GET_ARG2(), iov))
+        return 1;
+
+    return !proc::ipc::send(SYSCALL_GET_ARG0(), iov, SYSCALL_GET_ARG2());
+}
+
+// ARG0: Ring handle number
+// ARG1: iovec array
+// ARG2: Number of iovecs
+// ARG3: size_t* where the full size of the message gets stored
+// ARG4: Flags, same as ipc_recv
+// RET: proc::ipc::receive_status
+static uint64_t syscall_ipc_recvv(x86_64::idt::idt_registers* regs){
+    CHECK_PTR(SYSCALL_GET_ARG1());
+    CHECK_PTR(SYSCALL_GET_ARG3());
+
+    proc::ipc::iovec iov[proc::ipc::iovec_max];
+    if(!copy_iovec(SYSCALL_GET_ARG1(), SYSCALL_GET_ARG2(), iov))
+        return misc::as_integer(proc::ipc::receive_status::too_small);
+
+    return ipc_recv_common(regs, iov, SYSCALL_GET_ARG2(), reinterpret_cast<size_t*>(SYSCALL_GET_ARG3()), SYSCALL_GET_ARG4());
+}
+
+// RET: Userspace address of the IPC buffer of the current thread, 0 on failure
+static uint64_t syscall_ipc_get_buffer(MAYBE_UNUSED_ATTRIBUTE x86_64::idt::idt_registers* regs){
+    return proc::process::get_current_thread()->map_ipc_buffer();
+}
+
+// ARG0: Ring handle number
+// ARG1: Size of the message in the IPC buffer
+// RET: 0 after the partner replied, the reply is in the IPC buffer
+static uint64_t syscall_ipc_call(x86_64::idt::idt_registers* regs){
+    SYSCALL_SET_RETURN_VALUE(0); // Set return value early for regs
+
+    return !proc::ipc::call(SYSCALL_GET_ARG0(), SYSCALL_GET_ARG1(), regs);
+}
+
+// ARG0: Ring handle number
+// ARG1: Size of the reply in the IPC buffer, UINT64_MAX for no reply
+// RET: 0 after a call arrived, the message is in the IPC buffer
+static uint64_t syscall_ipc_reply_and_wait(x86_64::idt::idt_registers* regs){
+    SYSCALL_SET_RETURN_VALUE(0); // Set return value early for regs
+
+    return !proc::ipc::reply_and_wait(SYSCALL_GET_ARG0(), SYSCALL_GET_ARG1(), regs);
+}
+
+static uint64_t push_grant_handle(proc::process::process* process, proc::grant::grant* grant){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{process->process_lock};
+
+    process->resources.grant_objects.push_back(grant);
+    return process->handle_catalogue.push(new generic::handles::grant_handle{grant});
+}
+
+// ARG0: Page aligned base
+// ARG1: Size
+// ARG2: Flags, bit 0 allows receivers to map it writable
+// RET: Grant handle, or UINT64_MAX on failure
+static uint64_t syscall_grant_create(x86_64::idt::idt_registers* regs){
+    auto* thread = proc::process::get_current_thread();
+    auto* grant = new proc::grant::grant{thread->process, SYSCALL_GET_ARG2()};
+    if(!grant->init(SYSCALL_GET_ARG0(), SYSCALL_GET_ARG1())){
+        grant->unref();
+        return UINT64_MAX;
+    }
+
+    return push_grant_handle(thread->process, grant);
+}
+
+// ARG0: Ring handle number
+// ARG1: Grant handle
+// RET: Grant handle in the catalogue of the other side of the ring, or UINT64_MAX on failure, send it in a message so they know
+static uint64_t syscall_grant_send(x86_64::idt::idt_registers* regs){
+    auto* thread = proc::process::get_current_thread();
+    auto* grant = thread->process->handle_catalogue.find<generic::handles::grant_handle>(SYSCALL_GET_ARG1());
+    if(!grant)
+        return UINT64_MAX;
+
+    auto* partner = proc::ipc::get_partner(SYSCALL_GET_ARG0());
+    if(!partner)
+        return UINT64_MAX;
+
+    grant->grant->ref();
+    return push_grant_handle(partner, grant->grant);
+}
+
+// ARG0: Grant handle
+// ARG1: Flags, bit 0 maps it writable
+// RET: Address of the mapping, 0 on failure
+static uint64_t syscall_grant_map(x86_64::idt::idt_registers* regs){
+    auto* thread = proc::process::get_current_thread();
+    auto* grant = thread->process->handle_catalogue.find<generic::handles::grant_handle>(SYSCALL_GET_ARG0());
+    if(!grant)
+        return 0;
+
+    return grant->grant->map(thread->process, SYSCALL_GET_ARG1());
+}
+
+// ARG0: Grant handle
+static uint64_t syscall_grant_unmap(x86_64::idt::idt_registers* regs){
+    auto* thread = proc::process::get_current_thread();
+    auto* grant = thread->process->handle_catalogue.find<generic::handles::grant_handle>(SYSCALL_GET_ARG0());
+    if(!grant)
+        return 1;
+
+    return !grant->grant->unmap(thread->process);
+}
+
+// ARG0: Grant handle, only the owner can revoke
+static uint64_t syscall_grant_revoke(x86_64::idt::idt_registers* regs){
+    auto* thread = proc::process::get_current_thread();
+    auto* grant = thread->process->handle_catalogue.find<generic::handles::grant_handle>(SYSCALL_GET_ARG0());
+    if(!grant || grant->grant->get_owner() != thread->process)
+        return 1;
+
+    grant->grant->revoke();
+    return 0;
+}
+
+static uint64_t push_shm_handle(proc::process::process* process, proc::shm::object* object){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{process->process_lock};
+
+    process->resources.shm_objects.push_back(object);
+    return process->handle_catalogue.push(new generic::handles::shm_handle{object});
+}
+
+// ARG0: Size
+// RET: Shared memory handle, or UINT64_MAX on failure
+static uint64_t syscall_shm_create(x86_64::idt::idt_registers* regs){
+    auto* object = new proc::shm::object{};
+    if(!object->resize(SYSCALL_GET_ARG0())){
+        object->unref();
+        return UINT64_MAX;
+    }
+
+    return push_shm_handle(proc::process::get_current_thread()->process, object);
+}
+
+// ARG0: Shared memory handle
+// ARG1: New size, shrinking fails while it is mapped anywhere
+static uint64_t syscall_shm_resize(x86_64::idt::idt_registers* regs){
+    auto* shm = proc::process::get_current_thread()->process->handle_catalogue.find<generic::handles::shm_handle>(SYSCALL_GET_ARG0());
+    if(!shm)
+        return 1;
+
+    return !shm->object->resize(SYSCALL_GET_ARG1());
+}
+
+// ARG0: Shared memory handle
+// ARG1: Address, a hint unless MAP_FIXED is passed
+// ARG2: int prot
+// ARG3: int flags
+// RET: Address of the mapping, 0 on failure
+static uint64_t syscall_shm_map(x86_64::idt::idt_registers* regs){
+    if(!PTR_IS_USERLAND(SYSCALL_GET_ARG1()))
+        return 0;
+
+    auto* thread = proc::process::get_current_thread();
+    auto* shm = thread->process->handle_catalogue.find<generic::handles::shm_handle>(SYSCALL_GET_ARG0());
+    if(!shm)
+        return 0;
+
+    return shm->object->map(thread->process, SYSCALL_GET_ARG1(), SYSCALL_GET_ARG2(), SYSCALL_GET_ARG3());
+}
+
+// ARG0: Shared memory handle
+// ARG1: Address returned by shm_map
+static uint64_t syscall_shm_unmap(x86_64::idt::idt_registers* regs){
+    auto* thread = proc::process::get_current_thread();
+    auto* shm = thread->process->handle_catalogue.find<generic::handles::shm_handle>(SYSCALL_GET_ARG0());
+    if(!shm)
+        return 1;
+
+    return !shm->object->unmap(thread->process, SYSCALL_GET_ARG1());
+}
+
+// ARG0: Ring handle number
+// ARG1: Shared memory handle
+// RET: Shared memory handle in the catalogue of the other side of the ring, or UINT64_MAX on failure
+static uint64_t syscall_shm_send(x86_64::idt::idt_registers* regs){
+    auto* thread = proc::process::get_current_thread();
+    auto* shm = thread->process->handle_catalogue.find<generic::handles::shm_handle>(SYSCALL_GET_ARG1());
+    if(!shm)
+        return UINT64_MAX;
+
+    auto* partner = proc::ipc::get_partner(SYSCALL_GET_ARG0());
+    if(!partner)
+        return UINT64_MAX;
+
+    shm->object->ref();
+    return push_shm_handle(partner, shm->object);
+}
+
 // ARG0: Reason
 // ARG1: Generic handle
 static uint64_t syscall_block_thread(MAYBE_UNUSED_ATTRIBUTE x86_64::idt::idt_registers* regs){
@@ -130,17 +392,236 @@ static uint64_t syscall_block_thread(MAYBE_UNUSED_ATTRIBUTE x86_64::idt::idt_reg
 
     if(SYSCALL_GET_ARG0() == blockForever)
         thread->set_state(proc::process::thread_state::SILENT);
-    else if(SYSCALL_GET_ARG0() == blockWaitForIpc)
-        thread->block(&proc::ipc::get_receive_event(SYSCALL_GET_ARG1()), regs);
+    else if(SYSCALL_GET_ARG0() == blockWaitForIpc){
+        auto* event = proc::ipc::get_receive_event(SYSCALL_GET_ARG1());
+        if(!event){
+            SYSCALL_SET_RETURN_VALUE(1);
+            return 1;
+        }
+        thread->block(event, regs);
+    }
     else
         printf("[SYSCALL]: Unknown block reason: %x", SYSCALL_GET_ARG0());
     return 0;
 }
 
+static uint64_t syscall_waitset_create(MAYBE_UNUSED_ATTRIBUTE x86_64::idt::idt_registers* regs){
+    return proc::process::get_current_thread()->process->handle_catalogue.push(new generic::handles::waitset_handle{});
+}
+
+// ARG0: Waitset handle
+// ARG1: IRQ, IPC ring or timer handle to add, it is also the key returned by waitset_wait
+static uint64_t syscall_waitset_add(x86_64::idt::idt_registers* regs){
+    auto& catalogue = proc::process::get_current_thread()->process->handle_catalogue;
+    auto* waitset = catalogue.find<generic::handles::waitset_handle>(SYSCALL_GET_ARG0());
+    auto* handle = catalogue.find_handle(SYSCALL_GET_ARG1());
+    if(!waitset || !handle)
+        return 1;
+
+    generic::event* source = nullptr;
+    switch (handle->type)
+    {
+    case generic::handles::handle_type::irq:
+        source = &static_cast<generic::handles::irq_handle*>(handle)->event;
+        break;
+    case generic::handles::handle_type::ipcRing:
+        source = static_cast<generic::handles::ipc_ring_handle*>(handle)->ring->get_receive_event();
+        if(!source)
+            return 1;
+        break;
+    case generic::handles::handle_type::timer:
+        source = &static_cast<generic::handles::timer_handle*>(handle)->timer.event;
+        break;
+    default:
+        return 1;
+    }
+
+    return !waitset->set.add(source, SYSCALL_GET_ARG1());
+}
+
+// ARG0: Waitset handle
+// ARG1: Handle to remove
+static uint64_t syscall_waitset_remove(x86_64::idt::idt_registers* regs){
+    auto* waitset = proc::process::get_current_thread()->process->handle_catalogue.find<generic::handles::waitset_handle>(SYSCALL_GET_ARG0());
+    if(!waitset)
+        return 1;
+
+    return !waitset->set.remove(SYSCALL_GET_ARG1());
+}
+
+// ARG0: Waitset handle
+// ARG1: Pointer to array of handles that are ready
+// ARG2: Max number of handles
+// ARG3: Block when nothing is ready
+// RET: Number of ready handles, 0 when the thread got blocked, in that case call again after waking up, UINT64_MAX on failure
+static uint64_t syscall_waitset_wait(x86_64::idt::idt_registers* regs){
+    CHECK_PTR(SYSCALL_GET_ARG1());
+    CHECK_PTR(SYSCALL_GET_ARG1() + SYSCALL_GET_ARG2() * sizeof(uint64_t));
+
+    auto* thread = proc::process::get_current_thread();
+    auto* waitset = thread->process->handle_catalogue.find<generic::handles::waitset_handle>(SYSCALL_GET_ARG0());
+    if(!waitset || SYSCALL_GET_ARG2() == 0)
+        return UINT64_MAX; // With no room for a handle the caller would block forever
+
+    size_t n = waitset->set.harvest((uint64_t*)SYSCALL_GET_ARG1(), SYSCALL_GET_ARG2());
+    if(n == 0 && SYSCALL_GET_ARG3()){
+        SYSCALL_SET_RETURN_VALUE(0); // Set return value early for regs
+        thread->block(&waitset->set.ready, regs);
+    }
+
+    return n;
+}
+
+// ARG0: Time in ms
+// ARG1: Periodic
+// RET: Timer handle, or UINT64_MAX on failure
+static uint64_t syscall_timer_create(x86_64::idt::idt_registers* regs){
+    if(SYSCALL_GET_ARG0() == 0)
+        return UINT64_MAX;
+
+    return proc::process::get_current_thread()->process->handle_catalogue.push(new generic::handles::timer_handle{SYSCALL_GET_ARG0(), SYSCALL_GET_ARG1() != 0});
+}
+
+// ARG0: Address of the 32bit futex word
+// ARG1: Expected value
+// ARG2: Timeout in ms, 0 for none
+// RET: proc::futex::wait_status, blocked means the thread got blocked, in that case call again with the same address after waking up
+static uint64_t syscall_futex_wait(x86_64::idt::idt_registers* regs){
+    CHECK_PTR(SYSCALL_GET_ARG0());
+
+    auto* thread = proc::process::get_current_thread();
+    auto status = proc::futex::wait(thread, SYSCALL_GET_ARG0(), SYSCALL_GET_ARG1(), SYSCALL_GET_ARG2());
+    if(status == proc::futex::wait_status::blocked){
+        SYSCALL_SET_RETURN_VALUE(misc::as_integer(status)); // Set return value early for regs
+        thread->block(&thread->futex.event, regs);
+    }
+
+    return misc::as_integer(status);
+}
+
+// ARG0: Address of the 32bit futex word
+// ARG1: Max number of waiters to wake
+// RET: Number of waiters woken
+static uint64_t syscall_futex_wake(x86_64::idt::idt_registers* regs){
+    CHECK_PTR(SYSCALL_GET_ARG0());
+
+    return proc::futex::wake(proc::process::get_current_thread(), SYSCALL_GET_ARG0(), SYSCALL_GET_ARG1());
+}
+
 static uint64_t syscall_fork(MAYBE_UNUSED_ATTRIBUTE x86_64::idt::idt_registers* regs){
     return proc::process::fork(regs);
 }
 
+// ARG0: Entry point
+// ARG1: Stack top
+// ARG2: Argument, passed in rdi
+// RET: tid of the new thread, or 0 on failure
+static uint64_t syscall_thread_create(x86_64::idt::idt_registers* regs){
+    if(!misc::is_canonical(SYSCALL_GET_ARG0()) || !PTR_IS_USERLAND(SYSCALL_GET_ARG0()) || !misc::is_canonical(SYSCALL_GET_ARG1()) || !PTR_IS_USERLAND(SYSCALL_GET_ARG1()))
+        return 0;
+
+    return proc::process::create_thread(SYSCALL_GET_ARG0(), SYSCALL_GET_ARG1(), SYSCALL_GET_ARG2());
+}
+
+constexpr size_t spawn_max_strings = 64;
+constexpr size_t spawn_max_rings = 8;
+
+// Copies a nullptr terminated array of strings out of the caller, since they aren't reachable anymore once the child address space is active
+// budget is the number of bytes argv and envp may still take up together
+static char** copy_string_array(uint64_t user_array, size_t& budget){
+    auto** strings = reinterpret_cast<char**>(user_array);
+    size_t lengths[spawn_max_strings] = {};
+    size_t n = 0;
+    for(; strings[n] != nullptr; n++){
+        auto string = reinterpret_cast<uint64_t>(strings[n]);
+        if(!misc::is_canonical(string) || !PTR_IS_USERLAND(string) || n == spawn_max_strings)
+            return nullptr;
+
+        // Don't trust strlen on a string that could run through the whole address space
+        size_t len = 0;
+        while(strings[n][len] != '\0')
+            if(++len >= budget)
+                return nullptr;
+
+        lengths[n] = len;
+        budget -= len + 1;
+    }
+
+    // Only the lengths measured above get copied, the caller could be changing the strings under us
+    auto** copy = new char*[n + 1];
+    for(size_t i = 0; i < n; i++){
+        copy[i] = new char[lengths[i] + 1];
+        memcpy(copy[i], strings[i], lengths[i]);
+        copy[i][lengths[i]] = '\0';
+    }
+    copy[n] = nullptr;
+
+    return copy;
+}
+
+static void free_string_array(char** strings){
+    if(strings == nullptr)
+        return;
+
+    for(size_t i = 0; strings[i] != nullptr; i++)
+        delete[] strings[i];
+    delete[] strings;
+}
+
+// ARG0: Char* to initrd path
+// ARG1: Char** to argv, nullptr terminated, can be nullptr
+// ARG2: Char** to envp, nullptr terminated, can be nullptr
+// ARG3: handle_t* that receives the handles of the rings to the new process
+// ARG4: Number of rings to create
+// RET: tid of the new thread, or 0 on failure
+static uint64_t syscall_spawn(x86_64::idt::idt_registers* regs){
+    CHECK_PTR(SYSCALL_GET_ARG0());
+    if(SYSCALL_GET_ARG4() > spawn_max_rings)
+        return 0;
+    if(SYSCALL_GET_ARG4() != 0)
+        CHECK_PTR(SYSCALL_GET_ARG3());
+
+    auto* thread = proc::process::get_current_thread();
+    uint64_t rings[spawn_max_rings] = {};
+    proc::elf::spawn_args args{.argv = nullptr, .envp = nullptr, .parent = thread, .n_rings = SYSCALL_GET_ARG4(), .parent_ring_handles = rings};
+
+    size_t budget = proc::elf::spawn_max_string_bytes;
+    if(SYSCALL_GET_ARG1() != 0){
+        CHECK_PTR(SYSCALL_GET_ARG1());
+        if((args.argv = copy_string_array(SYSCALL_GET_ARG1(), budget)) == nullptr)
+            return 0;
+    }
+
+    if(SYSCALL_GET_ARG2() != 0){
+        CHECK_PTR(SYSCALL_GET_ARG2());
+        if((args.envp = copy_string_array(SYSCALL_GET_ARG2(), budget)) == nullptr){
+            free_string_array(const_cast<char**>(args.argv));
+            return 0;
+        }
+    }
+
+    auto* user_path = reinterpret_cast<const char*>(SYSCALL_GET_ARG0());
+    auto* path = new char[strlen(user_path) + 1];
+    strcpy(path, user_path);
+
+    proc::process::thread* child = nullptr;
+    bool success = proc::elf::start_elf_executable(path, &child, thread->privilege, &args);
+    {
+        // The loader leaves the kernel address space active, switch back before touching our own memory again
+        std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+        thread->process->vmm.set();
+    }
+
+    delete[] path;
+    free_string_array(const_cast<char**>(args.argv));
+    free_string_array(const_cast<char**>(args.envp));
+    if(!success)
+        return 0;
+
+    memcpy(reinterpret_cast<uint64_t*>(SYSCALL_GET_ARG3()), rings, args.n_rings * sizeof(uint64_t));
+    return child->tid;
+}
+
 // ARG0: Command
 // ARG1 - N: Optional args to devctl
 static uint64_t syscall_devctl(MAYBE_UNUSED_ATTRIBUTE x86_64::idt::idt_registers* regs){
@@ -183,39 +664,200 @@ static uint64_t syscall_yield(x86_64::idt::idt_registers* regs){
     return 0;
 }
 
+// ARG0: Priority class
+// ARG1: CPU affinity bitmap
+static uint64_t syscall_set_scheduling(x86_64::idt::idt_registers* regs){
+    auto* thread = proc::process::get_current_thread();
+
+    // Keep updated with libsigma/sys.h
+    if(SYSCALL_GET_ARG0() > (uint64_t)misc::as_integer(proc::process::thread_priority::REALTIME))
+        return 1;
+
+    auto priority = (proc::process::thread_priority)SYSCALL_GET_ARG0();
+    if(priority > proc::process::thread_priority::NORMAL && thread->privilege < proc::process::thread_privilege_level::DRIVER)
+        return 1;
+
+    return !thread->set_scheduling_params(priority, SYSCALL_GET_ARG1());
+}
+
+
+// ARG0: CPU id
+// ARG1: Pointer to cpu_stats
+static uint64_t syscall_get_cpu_stats(x86_64::idt::idt_registers* regs){
+    CHECK_PTR(SYSCALL_GET_ARG1());
+
+    // Keep updated with libsigma/sys.h
+    struct cpu_stats {
+        uint32_t apic_id;
+        uint32_t package_id;
+        uint32_t core_id;
+        uint32_t smt_id;
+        uint32_t llc_id;
+        uint64_t load;
+        uint64_t n_runnable;
+        uint64_t n_switches;
+        uint64_t n_migrations;
+        uint64_t n_balanced;
+        uint64_t n_wakeups_mwait;
+        uint64_t wakeup_tsc_mwait;
+        uint64_t n_wakeups_ipi;
+        uint64_t wakeup_tsc_ipi;
+    };
+
+    smp::topology::cpu_topology topology{};
+    proc::process::cpu_stats stats{};
+    if(!proc::process::get_cpu_stats(SYSCALL_GET_ARG0(), topology, stats))
+        return 1;
+
+    auto& out = *(cpu_stats*)SYSCALL_GET_ARG1();
+    out.apic_id = topology.apic_id;
+    out.package_id = topology.package_id;
+    out.core_id = topology.core_id;
+    out.smt_id = topology.smt_id;
+    out.llc_id = topology.llc_id;
+    out.load = stats.load;
+    out.n_runnable = stats.n_runnable;
+    out.n_switches = stats.n_switches;
+    out.n_migrations = stats.n_migrations;
+    out.n_balanced = stats.n_balanced;
+    out.n_wakeups_mwait = stats.n_wakeups_mwait;
+    out.wakeup_tsc_mwait = stats.wakeup_tsc_mwait;
+    out.n_wakeups_ipi = stats.n_wakeups_ipi;
+    out.wakeup_tsc_ipi = stats.wakeup_tsc_ipi;
+    return 0;
+}
+
 
 using syscall_function = uint64_t (*)(x86_64::idt::idt_registers*);
 
 struct kernel_syscall {
     syscall_function func;
     const char* name;
+    bool batchable = false; // Can't block or switch threads, so it can run from the syscall ring
 };
 
+// ARG0: Number of entries
+// RET: Userspace address of the ring, 0 on failure
+static uint64_t syscall_ring_setup(x86_64::idt::idt_registers* regs){
+    return proc::process::get_current_thread()->map_syscall_ring(SYSCALL_GET_ARG0());
+}
+
+static uint64_t syscall_ring_enter(x86_64::idt::idt_registers* regs);
+
 kernel_syscall syscalls[] = {
-    {.func = syscall_early_klog, .name = "early_klog"},
+    {.func = syscall_early_klog, .name = "early_klog", .batchable = true},
 
     {.func = syscall_set_fsbase, .name = "set_fsbase"},
     {.func = syscall_kill, .name = "kill"},
     {.func = syscall_fork, .name = "fork"},
+    {.func = syscall_thread_create, .name = "thread_create", .batchable = true},
+    {.func = syscall_spawn, .name = "spawn"},
     {.func = syscall_yield, .name = "yield"},
-    {.func = syscall_get_current_tid, .name = "get_current_tid"},
+    {.func = syscall_get_current_tid, .name = "get_current_tid", .batchable = true},
     {.func = syscall_block_thread, .name = "block_thread"},
+    {.func = syscall_set_scheduling, .name = "set_scheduling", .batchable = true},
+    {.func = syscall_get_cpu_stats, .name = "get_cpu_stats", .batchable = true},
+
+    {.func = syscall_vm_map, .name = "vm_map", .batchable = true},
+    {.func = syscall_get_phys_region, .name = "get_phys_region", .batchable = true},
+
+    {.func = syscall_initrd_read, .name = "initrd_read", .batchable = true},
+    {.func = syscall_initrd_get_size, .name = "initrd_get_size", .batchable = true},
+    {.func = syscall_initrd_map, .name = "initrd_map", .batchable = true},
+
+    {.func = syscall_ipc_send, .name = "ipc_send", .batchable = true},
+    {.func = syscall_ipc_receive, .name = "ipc_receive", .batchable = true},
+    {.func = syscall_ipc_get_message_size, .name = "ipc_get_message_size", .batchable = true},
+    {.func = syscall_ipc_recv, .name = "ipc_recv"},
+    {.func = syscall_ipc_sendv, .name = "ipc_sendv", .batchable = true},
+    {.func = syscall_ipc_recvv, .name = "ipc_recvv"},
+    {.func = syscall_ipc_get_buffer, .name = "ipc_get_buffer"},
+    {.func = syscall_ipc_call, .name = "ipc_call"},
+    {.func = syscall_ipc_reply_and_wait, .name = "ipc_reply_and_wait"},
+
+    {.func = syscall_grant_create, .name = "grant_create", .batchable = true},
+    {.func = syscall_grant_send, .name = "grant_send", .batchable = true},
+    {.func = syscall_grant_map, .name = "grant_map", .batchable = true},
+    {.func = syscall_grant_unmap, .name = "grant_unmap", .batchable = true},
+    {.func = syscall_grant_revoke, .name = "grant_revoke", .batchable = true},
+
+    {.func = syscall_shm_create, .name = "shm_create", .batchable = true},
+    {.func = syscall_shm_resize, .name = "shm_resize", .batchable = true},
+    {.func = syscall_shm_map, .name = "shm_map", .batchable = true},
+    {.func = syscall_shm_unmap, .name = "shm_unmap", .batchable = true},
+    {.func = syscall_shm_send, .name = "shm_send", .batchable = true},
+
+    {.func = syscall_waitset_create, .name = "waitset_create", .batchable = true},
+    {.func = syscall_waitset_add, .name = "waitset_add", .batchable = true},
+    {.func = syscall_waitset_remove, .name = "waitset_remove", .batchable = true},
+    {.func = syscall_waitset_wait, .name = "waitset_wait"},
+    {.func = syscall_timer_create, .name = "timer_create", .batchable = true},
+
+    {.func = syscall_futex_wait, .name = "futex_wait"},
+    {.func = syscall_futex_wake, .name = "futex_wake", .batchable = true},
+
+    {.func = syscall_devctl, .name = "devctl", .batchable = true},
+    {.func = syscall_vctl, .name = "vctl"},
 
-    {.func = syscall_vm_map, .name = "vm_map"},
-    {.func = syscall_get_phys_region, .name = "get_phys_region"},
+    {.func = syscall_ring_setup, .name = "ring_setup"},
+    {.func = syscall_ring_enter, .name = "ring_enter"},
+};
 
-    {.func = syscall_initrd_read, .name = "initrd_read"},
-    {.func = syscall_initrd_get_size, .name = "initrd_get_size"},
+constexpr size_t syscall_count = (sizeof(syscalls) / sizeof(kernel_syscall));
 
-    {.func = syscall_ipc_send, .name = "ipc_send"},
-    {.func = syscall_ipc_receive, .name = "ipc_receive"},
-    {.func = syscall_ipc_get_message_size, .name = "ipc_get_message_size"},
+// ARG0: Max number of submissions to consume
+// RET: Number of submissions consumed, stops early when the completion queue is full
+static uint64_t syscall_ring_enter(x86_64::idt::idt_registers* regs){
+    auto* thread = proc::process::get_current_thread();
+    auto* ring = thread->syscall_ring;
+    if(!ring)
+        return 0;
+
+    // Layout comes from the kernel's own copy, indices are masked with it so they can't leave the ring
+    uint32_t n_entries = thread->syscall_ring_entries;
+    auto* sq = reinterpret_cast<proc::syscall::ring_sqe*>(reinterpret_cast<uint64_t>(ring) + thread->syscall_ring_sq_offset);
+    auto* cq = reinterpret_cast<proc::syscall::ring_cqe*>(reinterpret_cast<uint64_t>(ring) + thread->syscall_ring_cq_offset);
+    uint32_t mask = n_entries - 1;
+
+    uint32_t sq_head = __atomic_load_n(&ring->sq_head, __ATOMIC_RELAXED);
+    uint32_t sq_tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+    uint32_t cq_tail = __atomic_load_n(&ring->cq_tail, __ATOMIC_RELAXED);
+
+    uint64_t n = 0;
+    while(n < SYSCALL_GET_ARG0() && sq_head != sq_tail){
+        if((cq_tail - __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE)) >= n_entries)
+            break; // No room for the completion, userspace has to reap first
+
+        proc::syscall::ring_sqe sqe = sq[sq_head & mask]; // Copy it so userspace can't change it under us
+
+        uint64_t result = proc::syscall::ring_result_invalid;
+        bool batchable = sqe.func < syscall_count && syscalls[sqe.func].batchable;
+        if(batchable && syscalls[sqe.func].func == syscall_devctl && sqe.args[0] == generic::device::devctl_cmd_wait_on_irq)
+            batchable = false; // The only devctl command that blocks
+
+        if(batchable){
+            // Run it with a copy of the frame so the ring_enter return value isn't clobbered
+            x86_64::idt::idt_registers sub = *regs;
+            sub.rax = sqe.func;
+            sub.rbx = sqe.args[0];
+            sub.rcx = sqe.args[1];
+            sub.rdx = sqe.args[2];
+            sub.rsi = sqe.args[3];
+            sub.rdi = sqe.args[4];
+
+            result = syscalls[sqe.func].func(&sub);
+        }
 
-    {.func = syscall_devctl, .name = "devctl"},
-    {.func = syscall_vctl, .name = "vctl"},
-};
+        cq[cq_tail & mask] = {.user_data = sqe.user_data, .result = result};
+        cq_tail++;
+        sq_head++;
+        n++;
+    }
 
-constexpr size_t syscall_count = (sizeof(syscalls) / sizeof(kernel_syscall));
+    __atomic_store_n(&ring->cq_tail, cq_tail, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->sq_head, sq_head, __ATOMIC_RELEASE);
+    return n;
+}
 
 static void syscall_handler(x86_64::idt::idt_registers* regs, MAYBE_UNUSED_ATTRIBUTE void* userptr){
     if(SYSCALL_GET_FUNC() >= syscall_count){
@@ -227,10 +869,13 @@ static void syscall_handler(x86_64::idt::idt_registers* regs, MAYBE_UNUSED_ATTRI
     uint64_t func = SYSCALL_GET_FUNC();
     
     kernel_syscall& syscall = syscalls[func];
+    auto* thread = proc::process::get_current_thread();
 
     {
         x86_64::smap::smap_guard guard{};
-        SYSCALL_SET_RETURN_VALUE(syscall.func(regs));
+        uint64_t ret = syscall.func(regs);
+        if(proc::process::get_current_thread() == thread)
+            SYSCALL_SET_RETURN_VALUE(ret); // Blocking syscalls might have switched regs over to another thread
     }
 
     #ifdef LOG_SYSCALLS
@@ -0,0 +1,77 @@
+#include <Sigma/proc/workqueue.h>
+#include <Sigma/proc/process.h>
+#include <Sigma/smp/cpu.h>
+#include <klibc/stdio.h>
+
+bool proc::workqueue::cpu_queue::push(proc::workqueue::work item){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{this->lock};
+
+    size_t next = (this->tail + 1) % proc::workqueue::queue_size;
+    if(next == this->head){
+        this->n_dropped++;
+        return false;
+    }
+
+    this->items[this->tail] = item;
+    this->tail = next;
+    return true;
+}
+
+bool proc::workqueue::cpu_queue::pop(proc::workqueue::work& item){
+    std::lock_guard irq_guard{smp::cpu::get_current_cpu()->irq_lock};
+    std::lock_guard guard{this->lock};
+
+    if(this->head == this->tail)
+        return false;
+
+    item = this->items[this->head];
+    this->head = (this->head + 1) % proc::workqueue::queue_size;
+    return true;
+}
+
+static void worker_main(void* userptr){
+    auto* queue = (proc::workqueue::cpu_queue*)userptr;
+    while(true){
+        while(queue->event.has_triggered())
+            ; // Every push triggers the event, the loop below handles all of them in one go
+
+        proc::workqueue::work item{};
+        while(queue->pop(item))
+            item.function(item.userptr);
+
+        proc::process::get_current_thread()->block(&queue->event);
+    }
+}
+
+void proc::workqueue::init_cpu(){
+    auto* managed = proc::process::get_current_managed_cpu();
+    if(managed == nullptr)
+        return;
+
+    auto* queue = new proc::workqueue::cpu_queue{};
+    auto* thread = proc::process::create_blocked_thread(proc::process::thread_privilege_level::KERNEL);
+    queue->worker = thread->tid;
+
+    // Work items are short and usually unblock something, so run them before anything else on this CPU
+    thread->set_scheduling_params(proc::process::thread_priority::REALTIME, (managed->id < 64) ? (1ull << managed->id) : proc::process::cpu_affinity_all);
+    proc::process::make_kernel_thread(thread, worker_main, queue);
+
+    smp::cpu::get_current_cpu()->work_queue = queue;
+    debug_printf("[WORKQUEUE]: Started worker for CPU %d on TID: %x\n", managed->id, queue->worker);
+}
+
+bool proc::workqueue::queue(void (*function)(void*), void* userptr){
+    auto* queue = smp::cpu::get_current_cpu()->work_queue;
+    if(queue == nullptr){
+        function(userptr); // Too early, nothing to defer to
+        return true;
+    }
+
+    if(!queue->push({.function = function, .userptr = userptr}))
+        return false;
+
+    queue->event.trigger();
+    proc::process::preempt_for(queue->worker);
+    return true;
+}
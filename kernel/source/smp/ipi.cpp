@@ -4,25 +4,80 @@
 
 #pragma region tlb_shootdown
 
+constexpr size_t max_online_cpus = 256;
+constexpr size_t max_invlpg_pages = 64; // Past this reloading CR3 is cheaper
+
+static smp::cpu::entry* online_cpus[max_online_cpus] = {};
+static size_t n_online_cpus = 0;
+
 static uint64_t shootdown_addr = 0;
 static uint64_t shootdown_length = 0;
+static std::atomic<uint64_t> shootdown_seq{0};
 
 auto shootdown_mutex = x86_64::spinlock::mutex();
 
-void smp::ipi::send_shootdown(uint64_t address, uint64_t length){
+void smp::ipi::set_online(){
     std::lock_guard guard{shootdown_mutex};
+    if(n_online_cpus == max_online_cpus)
+        PANIC("Too many CPUs for TLB shootdowns");
+
+    auto* cpu = smp::cpu::get_current_cpu();
+    cpu->shootdown_seq.store(shootdown_seq.load());
+    online_cpus[n_online_cpus++] = cpu;
+}
+
+// Runs with interrupts disabled, from the IPI or while waiting for another shootdown to finish
+static void handle_shootdown(){
+    auto* cpu = smp::cpu::get_current_cpu();
+    uint64_t seq = shootdown_seq.load(std::memory_order_acquire);
+    if(cpu->shootdown_seq.load(std::memory_order_relaxed) == seq)
+        return;
+
+    // Whatever address space is active, an invlpg in an unrelated one only costs a TLB miss
+    if(shootdown_length > (max_invlpg_pages * mm::pmm::block_size)){
+        uint64_t cr3 = 0;
+        asm volatile("mov %%cr3, %0" : "=r"(cr3));
+        asm volatile("mov %0, %%cr3" : : "r"(cr3) : "memory"); // Bit 63 always reads as 0, so this flushes the active PCID
+    } else {
+        for(uint64_t offset = 0; offset < shootdown_length; offset += mm::pmm::block_size)
+            x86_64::paging::invalidate_addr(shootdown_addr + offset);
+    }
+
+    cpu->shootdown_seq.store(seq, std::memory_order_release);
+}
+
+void smp::ipi::send_shootdown(x86_64::paging::context& context, uint64_t address, uint64_t length){
+    context.bump_generation(); // Covers CPUs that have it cached in an inactive PCID
+
+    auto* cpu = smp::cpu::get_current_cpu();
+    std::lock_guard irq_guard{cpu->irq_lock};
+    while(!shootdown_mutex.try_lock()){
+        handle_shootdown(); // Whoever holds it might be waiting on us
+        asm("pause");
+    }
+
+    if(n_online_cpus <= 1){
+        shootdown_mutex.unlock();
+        return;
+    }
+
     shootdown_addr = address;
     shootdown_length = length;
-    debug_printf("[IPI]: Requested TLB shootdown on addr: %x, length: %x\n", shootdown_addr, shootdown_length);
-    smp::cpu::get_current_cpu()->lapic.send_ipi_raw(0, ((1 << 19) | smp::ipi::shootdown_ipi_vector)); // All including self
-}
+    uint64_t seq = shootdown_seq.load() + 1;
+    cpu->shootdown_seq.store(seq);
+    shootdown_seq.store(seq, std::memory_order_release);
+
+    cpu->lapic.send_ipi_raw(0, ((1 << 19) | (1 << 18) | smp::ipi::shootdown_ipi_vector)); // All excluding self
 
+    for(size_t i = 0; i < n_online_cpus; i++)
+        while(online_cpus[i]->shootdown_seq.load(std::memory_order_acquire) < seq)
+            asm("pause");
 
+    shootdown_mutex.unlock();
+}
 
 static void shootdown_ipi(MAYBE_UNUSED_ATTRIBUTE x86_64::idt::idt_registers* regs, MAYBE_UNUSED_ATTRIBUTE void* userptr) {
-	for(uint64_t offset = 0; offset < shootdown_length; offset += mm::pmm::block_size) {
-		x86_64::paging::invalidate_addr(shootdown_addr + offset);
-	}
+	handle_shootdown();
 }
 
 #pragma endregion
@@ -44,6 +99,7 @@ static void ping_ipi(MAYBE_UNUSED_ATTRIBUTE x86_64::idt::idt_registers* regs, MA
 #pragma endregion
 
 void smp::ipi::init_ipi(){
+    smp::ipi::set_online(); // The BSP
     x86_64::idt::register_interrupt_handler({.vector = smp::ipi::ping_ipi_vector, .callback = ping_ipi, .is_irq = true});
     x86_64::idt::register_interrupt_handler({.vector = smp::ipi::shootdown_ipi_vector, .callback = shootdown_ipi, .is_irq = true});
 }
\ No newline at end of file
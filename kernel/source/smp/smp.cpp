@@ -47,6 +47,7 @@ void smp::multiprocessing::boot_cpu(cpu_entry& e){
     uint64_t* trampoline_paging_addr = &smp::trampoline_paging;
     *trampoline_paging_addr = (mm::vmm::kernel_vmm::get_instance().get_paging_info() - KERNEL_PHYSICAL_VIRTUAL_MAPPING_BASE);
 
+    smp::cpu::n_booting_without_gs++; // Stays raised if the AP never comes up, which only costs an MSR read per allocation
     this->boot_apic(e);
 
     if(wait_for_boot()){
@@ -0,0 +1,122 @@
+#include <Sigma/smp/topology.h>
+#include <Sigma/arch/x86_64/misc/misc.h>
+#include <Sigma/arch/x86_64/cpu.h>
+#include <klibc/stdio.h>
+
+// Bit positions in the APIC id where the next topology level starts
+static uint32_t smt_shift = 0;
+static uint32_t package_shift = 0;
+static uint32_t llc_shift = 0;
+
+static uint32_t count_to_shift(uint32_t count){
+    uint32_t shift = 0;
+    while((1u << shift) < count)
+        shift++;
+    return shift;
+}
+
+static uint32_t mask_for_shift(uint32_t shift){
+    return (shift >= 32) ? ~0u : ((1u << shift) - 1);
+}
+
+// Leaf 0x1F is a superset of 0xB, both list levels in order from SMT up
+static bool parse_extended_topology(uint32_t leaf){
+    uint32_t a = 0, b = 0, c = 0, d = 0;
+    bool found = false;
+    for(uint32_t subleaf = 0; ; subleaf++){
+        if(!x86_64::cpuid(leaf, subleaf, a, b, c, d))
+            return false;
+
+        uint32_t type = (c >> 8) & 0xFF;
+        if(type == 0 || (b & 0xFFFF) == 0)
+            break; // Invalid level, end of list
+
+        uint32_t shift = a & 0x1F;
+        if(type == 1)
+            smt_shift = shift;
+
+        package_shift = shift; // The last valid level gives the package shift
+        found = true;
+    }
+
+    return found;
+}
+
+static void parse_legacy_topology(){
+    uint32_t a = 0, b = 0, c = 0, d = 0;
+    uint32_t logical = 1, cores = 1;
+
+    if(x86_64::cpuid(1, a, b, c, d) && (d & x86_64::cpuid_bits::HTT))
+        logical = (b >> 16) & 0xFF;
+
+    if(x86_64::cpuid(4, 0, a, b, c, d) && (a & 0x1F))
+        cores = ((a >> 26) & 0x3F) + 1;
+
+    if(logical < cores)
+        logical = cores;
+
+    smt_shift = count_to_shift(logical / cores);
+    package_shift = count_to_shift(logical);
+}
+
+// Intel uses leaf 4, AMD has the same layout in leaf 0x8000001D
+static bool parse_cache_topology(uint32_t leaf){
+    uint32_t a = 0, b = 0, c = 0, d = 0;
+    uint32_t highest_level = 0;
+    for(uint32_t subleaf = 0; ; subleaf++){
+        if(!x86_64::cpuid(leaf, subleaf, a, b, c, d))
+            return false;
+
+        uint32_t type = a & 0x1F;
+        if(type == 0)
+            break; // No more caches
+
+        uint32_t level = (a >> 5) & 0x7;
+        if(level >= highest_level){
+            highest_level = level;
+            llc_shift = count_to_shift(((a >> 14) & 0xFFF) + 1);
+        }
+    }
+
+    return highest_level != 0;
+}
+
+void smp::topology::init(types::linked_list<smp::cpu_entry>& cpus){
+    if(!parse_extended_topology(0x1F) && !parse_extended_topology(0xB))
+        parse_legacy_topology();
+
+    if(!parse_cache_topology(4) && !parse_cache_topology(0x8000001D))
+        llc_shift = package_shift; // Assume the LLC is shared per package
+
+    debug_printf("[SMP]: CPU topology, SMT shift: %d, Package shift: %d, LLC shift: %d\n", smt_shift, package_shift, llc_shift);
+    for(auto& cpu : cpus){
+        auto topo = smp::topology::get(cpu.lapic_id);
+        debug_printf("    APIC id: %d -> Package: %d, Core: %d, Thread: %d, LLC: %d\n", topo.apic_id, topo.package_id, topo.core_id, topo.smt_id, topo.llc_id);
+    }
+}
+
+smp::topology::cpu_topology smp::topology::get(uint32_t apic_id){
+    smp::topology::cpu_topology topo{};
+    topo.apic_id = apic_id;
+    topo.smt_id = apic_id & mask_for_shift(smt_shift);
+    topo.core_id = (apic_id >> smt_shift) & mask_for_shift(package_shift - smt_shift);
+    topo.package_id = (package_shift >= 32) ? 0 : (apic_id >> package_shift);
+    topo.llc_id = (llc_shift >= 32) ? 0 : (apic_id >> llc_shift);
+    return topo;
+}
+
+smp::topology::distance smp::topology::get_distance(uint32_t a, uint32_t b){
+    if(a == b)
+        return smp::topology::distance::SAME_CPU;
+
+    auto topo_a = smp::topology::get(a);
+    auto topo_b = smp::topology::get(b);
+    if(topo_a.package_id == topo_b.package_id && topo_a.core_id == topo_b.core_id)
+        return smp::topology::distance::SMT_SIBLING;
+    else if(topo_a.package_id == topo_b.package_id && topo_a.llc_id == topo_b.llc_id)
+        return smp::topology::distance::SHARED_CACHE;
+    else if(topo_a.package_id == topo_b.package_id)
+        return smp::topology::distance::SAME_PACKAGE;
+
+    return smp::topology::distance::REMOTE;
+}
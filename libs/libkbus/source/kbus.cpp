@@ -22,6 +22,24 @@ static handle_t get_kbus_ring(){
     return kbus_ring;
 }
 
+// Blocks until the response arrives, only needs a second syscall when it doesn't fit in the default buffer
+static bool receive_response(std::vector<uint8_t>& res){
+    res.resize(256);
+
+    size_t len = 0;
+    auto status = libsigma_ipc_recv(get_kbus_ring(), res.data(), res.size(), &len, SIGMA_IPC_RECV_BLOCK);
+    if(status == SIGMA_IPC_RECV_TOO_SMALL){
+        res.resize(len);
+        status = libsigma_ipc_recv(get_kbus_ring(), res.data(), res.size(), &len, 0);
+    }
+
+    if(status != SIGMA_IPC_RECV_OK)
+        return false;
+
+    res.resize(len);
+    return true;
+}
+
 kbus::object_id kbus::allocate_object(){
     using namespace sigma::kbus;
     client_request_builder builder{};
@@ -33,13 +51,8 @@ kbus::object_id kbus::allocate_object(){
         return -1;
     }
 
-    libsigma_block_thread(SIGMA_BLOCK_WAITING_FOR_IPC, get_kbus_ring());
-
-    size_t res_size = libsigma_ipc_get_msg_size(get_kbus_ring());
     std::vector<uint8_t> res{};
-    res.resize(res_size);
-
-    if(libsigma_ipc_receive(get_kbus_ring(), (libsigma_message_t*)res.data())){
+    if(!receive_response(res)){
         printf("libkbus: Failed to receive CreateDevice response\n");
         return -1;
     }
@@ -66,13 +79,8 @@ std::vector<kbus::object> kbus::find_devices(std::string query){
         return {};
     }
 
-    libsigma_block_thread(SIGMA_BLOCK_WAITING_FOR_IPC, get_kbus_ring());
-
-    size_t res_size = libsigma_ipc_get_msg_size(get_kbus_ring());
     std::vector<uint8_t> res{};
-    res.resize(res_size);
-
-    if(libsigma_ipc_receive(get_kbus_ring(), (libsigma_message_t*)res.data())){
+    if(!receive_response(res)){
         printf("libkbus: Failed to receive FindDevices response\n");
         return {};
     }
@@ -108,13 +116,8 @@ std::string kbus::object::get_attribute(std::string key){
         return "";
     }
 
-    libsigma_block_thread(SIGMA_BLOCK_WAITING_FOR_IPC, get_kbus_ring());
-
-    size_t res_size = libsigma_ipc_get_msg_size(get_kbus_ring());
     std::vector<uint8_t> res{};
-    res.resize(res_size);
-
-    if(libsigma_ipc_receive(get_kbus_ring(), (libsigma_message_t*)res.data())){
+    if(!receive_response(res)){
         printf("libkbus: Failed to receive GetAttribute response\n");
         return "";
     }
@@ -143,13 +146,8 @@ using namespace sigma::kbus;
         return;
     }
     
-    libsigma_block_thread(SIGMA_BLOCK_WAITING_FOR_IPC, get_kbus_ring());
-
-    size_t res_size = libsigma_ipc_get_msg_size(get_kbus_ring());
     std::vector<uint8_t> res{};
-    res.resize(res_size);
-
-    if(libsigma_ipc_receive(get_kbus_ring(), (libsigma_message_t*)res.data())){
+    if(!receive_response(res)){
         printf("libkbus: Failed to receive AddAttribute response\n");
         return;
     }
@@ -0,0 +1,61 @@
+#ifndef LIBSIGMA_BENCH_H
+#define LIBSIGMA_BENCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <libsigma/sys.h>
+
+// Runs count whole ticks of 1 periodic timer, starting right at a tick so the first one isn't cut short
+// There is no way to close a handle, so every run of a program shares the timer and its waitset
+
+#define BENCH_TICK_MS 10
+#define BENCH_N_TICKS 100
+
+// Operations between looks at the timer, looking is a syscall of its own
+// The waitset reports ticks that pile up as 1, so keep this well below a tick worth of work
+#define BENCH_CHECK_INTERVAL 64
+
+typedef struct {
+    handle_t waitset, timer;
+    size_t n_ticks;
+} bench_clock_t;
+
+static inline bool bench_clock_init(bench_clock_t* clock){
+    clock->waitset = libsigma_waitset_create();
+    clock->timer = libsigma_timer_create(BENCH_TICK_MS, true);
+    clock->n_ticks = 0;
+    return clock->waitset != UINT64_MAX && clock->timer != UINT64_MAX && libsigma_waitset_add(clock->waitset, clock->timer) == 0;
+}
+
+// Throws away ticks that piled up since the last run, then waits for the next one to start counting
+static inline bool bench_clock_start(bench_clock_t* clock){
+    handle_t ready[1] = {0};
+    size_t n = 0;
+    while((n = libsigma_waitset_poll(clock->waitset, ready, 1)) != 0 && n != SIZE_MAX)
+        ;
+
+    clock->n_ticks = 0;
+    return n != SIZE_MAX && libsigma_waitset_wait(clock->waitset, ready, 1) != SIZE_MAX;
+}
+
+// True once the run is over, or the timer broke
+static inline bool bench_clock_expired(bench_clock_t* clock){
+    handle_t ready[1] = {0};
+    size_t n = libsigma_waitset_poll(clock->waitset, ready, 1);
+    if(n == SIZE_MAX)
+        return true;
+
+    clock->n_ticks += n;
+    return clock->n_ticks >= BENCH_N_TICKS;
+}
+
+// Scales n operations of the last run to 1 second, 0 if the timer broke before the first tick
+static inline uint64_t bench_per_second(const bench_clock_t* clock, uint64_t n){
+    if(clock->n_ticks == 0)
+        return 0;
+
+    return n * 1000 / (clock->n_ticks * BENCH_TICK_MS);
+}
+
+#endif
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/auxv.h>
+#include <libsigma/sys.h>
+#include "bench.h"
+
+// Round trip latency of ipc_call / ipc_reply_and_wait against ipc_send and
+// block_thread / ipc_get_msg_size / ipc_receive on a ring, with a copy of this program spawned as the echo server
+// The server stays blocked in ipc_reply_and_wait after the last call, there is no way to only reply
+
+enum {benchPing = 0, benchReady, benchSwitch};
+
+static uint8_t queue_buffer[SIGMA_IPC_BUFFER_MAX];
+
+// The way every server receives without the call API, the kernel triggers the ring once per message
+static size_t queue_receive(handle_t ring){
+    if(libsigma_block_thread(SIGMA_BLOCK_WAITING_FOR_IPC, ring))
+        return 0;
+
+    size_t size = libsigma_ipc_get_msg_size(ring);
+    if(size == 0 || size > sizeof(queue_buffer) || libsigma_ipc_receive(ring, (libsigma_message_t*)queue_buffer))
+        return 0;
+
+    return size;
+}
+
+static int serve(handle_t ring){
+    libsigma_ipc_buffer_t* call_buffer = libsigma_ipc_get_buffer();
+    if(!call_buffer)
+        return 1;
+
+    // Calls fail until both sides mapped their buffer, so only tell the client we are there after that
+    queue_buffer[0] = benchReady;
+    if(libsigma_ipc_send(ring, (libsigma_message_t*)queue_buffer, 1))
+        return 1;
+
+    while(1){
+        size_t size = queue_receive(ring);
+        if(size == 0)
+            return 1;
+
+        if(queue_buffer[0] == benchSwitch)
+            break;
+
+        if(libsigma_ipc_send(ring, (libsigma_message_t*)queue_buffer, size))
+            return 1;
+    }
+
+    if(libsigma_ipc_reply_and_wait(ring, SIGMA_IPC_NO_REPLY))
+        return 1;
+
+    while(1)
+        if(libsigma_ipc_reply_and_wait(ring, call_buffer->size))
+            return 1;
+}
+
+// Both return the number of round trips, or UINT64_MAX if one failed or came back with the wrong size
+static uint64_t run_queue(bench_clock_t* clock, handle_t ring, size_t size){
+    uint64_t n_round_trips = 0;
+    if(!bench_clock_start(clock))
+        return 0;
+
+    do {
+        for(size_t i = 0; i < BENCH_CHECK_INTERVAL; i++){
+            queue_buffer[0] = benchPing;
+            if(libsigma_ipc_send(ring, (libsigma_message_t*)queue_buffer, size) || queue_receive(ring) != size)
+                return UINT64_MAX;
+        }
+        n_round_trips += BENCH_CHECK_INTERVAL;
+    } while(!bench_clock_expired(clock));
+
+    return n_round_trips;
+}
+
+static uint64_t run_call(bench_clock_t* clock, handle_t ring, libsigma_ipc_buffer_t* call_buffer, size_t size){
+    uint64_t n_round_trips = 0;
+    if(!bench_clock_start(clock))
+        return 0;
+
+    do {
+        for(size_t i = 0; i < BENCH_CHECK_INTERVAL; i++){
+            call_buffer->data[0] = benchPing;
+            if(libsigma_ipc_call(ring, size) || call_buffer->size != size)
+                return UINT64_MAX;
+        }
+        n_round_trips += BENCH_CHECK_INTERVAL;
+    } while(!bench_clock_expired(clock));
+
+    return n_round_trips;
+}
+
+static void print_result(const char* path, size_t size, bench_clock_t* clock, uint64_t n_round_trips){
+    uint64_t per_second = bench_per_second(clock, n_round_trips);
+    printf("bench: %s, %ld bytes: %ld round trips/sec, %ld ns each\n", path, size, per_second, per_second ? (1000000000 / per_second) : 0);
+}
+
+static const size_t sizes[] = {8, 512, SIGMA_IPC_BUFFER_MAX};
+
+static int run(void){
+    bench_clock_t clock;
+    if(!bench_clock_init(&clock)){
+        printf("bench: Couldn't set up the timer\n");
+        return 1;
+    }
+
+    libsigma_ipc_buffer_t* call_buffer = libsigma_ipc_get_buffer();
+    if(!call_buffer){
+        printf("bench: Couldn't map the IPC buffer\n");
+        return 1;
+    }
+
+    const char* argv[] = {"/usr/bin/sigma-bench-ipc", "server", NULL};
+    handle_t ring = 0;
+    if(libsigma_spawn(argv[0], argv, NULL, &ring, 1) == 0){
+        printf("bench: Couldn't spawn the server\n");
+        return 1;
+    }
+
+    if(queue_receive(ring) != 1 || queue_buffer[0] != benchReady){
+        printf("bench: Server didn't come up\n");
+        return 1;
+    }
+
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+        uint64_t n = run_queue(&clock, ring, sizes[i]);
+        if(n == UINT64_MAX){
+            printf("bench: Round trip through the queues failed\n");
+            return 1;
+        }
+        print_result("ipc_send/ipc_receive", sizes[i], &clock, n);
+    }
+
+    queue_buffer[0] = benchSwitch;
+    if(libsigma_ipc_send(ring, (libsigma_message_t*)queue_buffer, 1))
+        return 1;
+
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++){
+        uint64_t n = run_call(&clock, ring, call_buffer, sizes[i]);
+        if(n == UINT64_MAX){
+            printf("bench: Round trip through ipc_call failed\n");
+            return 1;
+        }
+        print_result("ipc_call/ipc_reply_and_wait", sizes[i], &clock, n);
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv){
+    if(argc > 1 && strcmp(argv[1], "server") == 0)
+        return serve(getauxval(SIGMA_AT_RINGS));
+
+    return run();
+}
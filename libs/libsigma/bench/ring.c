@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <libsigma/sys.h>
+#include <libsigma/ring.h>
+#include <libsigma/syscall.h>
+#include "bench.h"
+
+// Compares syscalls made 1 at a time against batches of them through the syscall ring
+// get_current_tid does next to no work, so this measures the cost of getting in and out of the kernel
+
+static uint64_t run_single(bench_clock_t* clock){
+    uint64_t n_ops = 0;
+    if(!bench_clock_start(clock))
+        return 0;
+
+    do {
+        for(size_t i = 0; i < BENCH_CHECK_INTERVAL; i++)
+            libsigma_get_current_tid();
+        n_ops += BENCH_CHECK_INTERVAL;
+    } while(!bench_clock_expired(clock));
+
+    return n_ops;
+}
+
+// Returns UINT64_MAX if the kernel refused a batched entry
+static uint64_t run_batched(bench_clock_t* clock, libsigma_ring_t* ring, size_t batch){
+    static libsigma_ring_cqe_t cqes[SIGMA_RING_MAX_ENTRIES];
+    tid_t tid = libsigma_get_current_tid();
+
+    uint64_t n_ops = 0;
+    if(!bench_clock_start(clock))
+        return 0;
+
+    do {
+        for(size_t done = 0; done < BENCH_CHECK_INTERVAL; done += batch){
+            for(size_t i = 0; i < batch; i++)
+                libsigma_ring_prep(libsigma_ring_get_sqe(ring), sigmaSyscallGetCurrentTid, 0, 0, 0, 0, 0, i);
+
+            libsigma_ring_submit(ring);
+
+            size_t n = libsigma_ring_reap(ring, cqes, batch);
+            for(size_t i = 0; i < n; i++)
+                if(cqes[i].result != tid)
+                    return UINT64_MAX;
+            n_ops += n;
+        }
+    } while(!bench_clock_expired(clock));
+
+    return n_ops;
+}
+
+int main(){
+    bench_clock_t clock;
+    if(!bench_clock_init(&clock)){
+        printf("bench: Couldn't set up the timer\n");
+        return 1;
+    }
+
+    libsigma_ring_t ring;
+    if(libsigma_ring_init(&ring, SIGMA_RING_MAX_ENTRIES)){
+        printf("bench: Couldn't set up the syscall ring\n");
+        return 1;
+    }
+
+    uint64_t n_single = run_single(&clock);
+    printf("bench: get_current_tid, 1 per syscall: %ld ops/sec\n", bench_per_second(&clock, n_single));
+
+    for(size_t batch = 1; batch <= SIGMA_RING_MAX_ENTRIES; batch *= 4){
+        uint64_t n_batched = run_batched(&clock, &ring, batch);
+        if(n_batched == UINT64_MAX){
+            printf("bench: get_current_tid got refused on the ring\n");
+            return 1;
+        }
+
+        printf("bench: get_current_tid, %ld per ring_enter: %ld ops/sec\n", batch, bench_per_second(&clock, n_batched));
+    }
+
+    return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef LIBSIGMA_RING_H
+#define LIBSIGMA_RING_H
+
+#if defined(__cplusplus)
+extern "C" {
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#elif defined(__STDC__)
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#else 
+#error "Compiling libsigma/ring.h on unknown language"
+#endif
+
+// Batched syscalls, queue any number of them and submit them all with 1 kernel entry
+// Only syscalls that can't block are accepted, the others complete with SIGMA_RING_RESULT_INVALID
+// Keep updated with Sigma/proc/syscall.h
+
+typedef struct {
+    uint64_t func; // sigmaSyscall* number
+    uint64_t args[5];
+    uint64_t user_data; // Copied to the completion as is
+} libsigma_ring_sqe_t;
+
+typedef struct {
+    uint64_t user_data;
+    uint64_t result; // What the syscall would have returned
+} libsigma_ring_cqe_t;
+
+typedef struct {
+    uint32_t sq_head, sq_tail;
+    uint32_t cq_head, cq_tail;
+    uint32_t n_entries;
+    uint32_t sq_offset, cq_offset;
+    uint32_t reserved;
+} libsigma_ring_header_t;
+
+typedef struct {
+    volatile libsigma_ring_header_t* header;
+    libsigma_ring_sqe_t* sq;
+    libsigma_ring_cqe_t* cq;
+    uint32_t mask;
+    uint32_t sq_tail; // Queued but not yet published to the kernel
+} libsigma_ring_t;
+
+#define SIGMA_RING_MAX_ENTRIES 256
+#define SIGMA_RING_RESULT_INVALID (~0ull)
+
+int libsigma_ring_init(libsigma_ring_t* ring, size_t n_entries); // 1 ring per thread
+
+// Returns NULL when the submission queue is full
+libsigma_ring_sqe_t* libsigma_ring_get_sqe(libsigma_ring_t* ring);
+void libsigma_ring_prep(libsigma_ring_sqe_t* sqe, uint64_t func, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5, uint64_t user_data);
+
+// Publishes all queued entries and asks the kernel to run them, returns the number it consumed
+size_t libsigma_ring_submit(libsigma_ring_t* ring);
+
+// Returns the number of completions copied into cqes
+size_t libsigma_ring_reap(libsigma_ring_t* ring, libsigma_ring_cqe_t* cqes, size_t max);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
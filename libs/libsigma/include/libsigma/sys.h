@@ -22,10 +22,11 @@ enum {
     devCtlFindPci = 2,
     devCtlFindPciClass = 3,
     devCtlGetResourceRegion = 4,
-    devCtlEnableIrq = 5,
+    devCtlEnableIrq = 5, // arg2: Legacy ISA IRQ the device is hardwired to if it has no MSI, 0 to use its INTx line as routed by ACPI
     devCtlWaitOnIrq = 6,
     devCtlReadPci = 7,
     devCtlWritePci = 8,
+    devCtlEnableMsix = 9, // arg2: Number of vectors, arg3: uint64_t[n] target CPU ids, arg4: handle_t[n] IRQ handles out
 };
 
 enum {
@@ -47,17 +48,53 @@ uint64_t devctl(uint64_t command, uint64_t arg1, uint64_t arg2, uint64_t arg3, u
 
 int libsigma_read_initrd_file(const char* filename, uint8_t* buffer, uint64_t offset, uint64_t length);
 size_t libsigma_initrd_get_file_size(const char* filename);
+// Maps the file read only into the address space without copying it, returns NULL on failure
+const void* libsigma_initrd_map_file(const char* filename, size_t* size);
 
 int libsigma_set_fsbase(uint64_t fs);
 void libsigma_kill(void);
 void libsigma_yield(void);
 uint64_t libsigma_fork(void);
+// The new thread shares the address space and handles, stack points to the top of memory allocated by the caller
+// entry must not return, end the thread with libsigma_kill
+tid_t libsigma_thread_create(void (*entry)(void*), void* stack, void* arg);
+
+// Sigma specific auxv entries, the spawned process finds its side of the rings with getauxval
+#define SIGMA_AT_RINGS 0x1002 // Handle of the first ring, the others follow it
+#define SIGMA_AT_N_RINGS 0x1003
+// Starts an initrd executable as a new process without forking, argv and envp are NULL terminated and can be NULL
+// rings receives the handles of n_rings IPC rings between the caller and the new process, returns its tid or 0 on failure
+tid_t libsigma_spawn(const char* path, const char* const* argv, const char* const* envp, handle_t* rings, size_t n_rings);
 
 tid_t libsigma_get_current_tid(void);
 
 enum libsigma_block_reasons{SIGMA_BLOCK_FOREVER = 0, SIGMA_BLOCK_WAITING_FOR_IPC};
 int libsigma_block_thread(enum libsigma_block_reasons reason, handle_t handle);
 
+enum libsigma_priorities{SIGMA_PRIORITY_IDLE = 0, SIGMA_PRIORITY_NORMAL, SIGMA_PRIORITY_DRIVER, SIGMA_PRIORITY_REALTIME};
+#define SIGMA_AFFINITY_ALL (~0ull)
+int libsigma_set_scheduling(enum libsigma_priorities priority, uint64_t affinity);
+
+#define SIGMA_LOAD_SCALE 1024
+typedef struct {
+    uint32_t apic_id;
+    uint32_t package_id;
+    uint32_t core_id;
+    uint32_t smt_id;
+    uint32_t llc_id;
+    uint64_t load; // Average runnable threads * SIGMA_LOAD_SCALE
+    uint64_t n_runnable;
+    uint64_t n_switches;
+    uint64_t n_migrations;
+    uint64_t n_balanced;
+    uint64_t n_wakeups_mwait; // Wakeups out of idle by a store to the MONITORed line
+    uint64_t wakeup_tsc_mwait; // Total TSC cycles from wake to the scheduler running, divide by n_wakeups_mwait for the average
+    uint64_t n_wakeups_ipi; // Wakeups out of idle by IPI, used when MWAIT isn't available
+    uint64_t wakeup_tsc_ipi;
+} libsigma_cpu_stats_t;
+
+int libsigma_get_cpu_stats(uint64_t cpu, libsigma_cpu_stats_t* stats);
+
 typedef struct libsigma_message {
     uint8_t byte;
     uint8_t data[];
@@ -67,6 +104,78 @@ int libsigma_ipc_send(handle_t ring, libsigma_message_t* msg, size_t msg_size);
 int libsigma_ipc_receive(handle_t ring, libsigma_message_t* msg);
 size_t libsigma_ipc_get_msg_size(handle_t ring);
 
+typedef struct {
+    void* base;
+    size_t len;
+} libsigma_iovec_t;
+
+#define SIGMA_IPC_IOVEC_MAX 64
+
+#define SIGMA_IPC_RECV_BLOCK (1 << 0) // Wait for a message when the ring is empty
+#define SIGMA_IPC_RECV_TRUNCATE (1 << 1) // Drop the part that doesn't fit instead of failing with SIGMA_IPC_RECV_TOO_SMALL
+
+enum libsigma_ipc_recv_status {SIGMA_IPC_RECV_OK = 0, SIGMA_IPC_RECV_EMPTY, SIGMA_IPC_RECV_TOO_SMALL, SIGMA_IPC_RECV_TRUNCATED, SIGMA_IPC_RECV_INVALID};
+
+// Receives in 1 syscall, len is set to the full size of the message, with SIGMA_IPC_RECV_TOO_SMALL the message stays on the ring
+enum libsigma_ipc_recv_status libsigma_ipc_recv(handle_t ring, void* buf, size_t cap, size_t* len, int flags);
+int libsigma_ipc_sendv(handle_t ring, const libsigma_iovec_t* iov, size_t n_iov); // Sends the buffers as 1 message
+enum libsigma_ipc_recv_status libsigma_ipc_recvv(handle_t ring, const libsigma_iovec_t* iov, size_t n_iov, size_t* len, int flags);
+
+// Synchronous IPC, messages are passed in a per thread buffer and the kernel switches straight to the partner when it is waiting
+typedef struct {
+    uint64_t size;
+    uint8_t data[];
+} libsigma_ipc_buffer_t;
+
+#define SIGMA_IPC_BUFFER_MAX (0x1000 - sizeof(libsigma_ipc_buffer_t))
+#define SIGMA_IPC_NO_REPLY (~0ull)
+
+libsigma_ipc_buffer_t* libsigma_ipc_get_buffer(void);
+int libsigma_ipc_call(handle_t ring, size_t size); // Sends size bytes from the buffer, returns when the reply is in the buffer
+int libsigma_ipc_reply_and_wait(handle_t ring, size_t reply_size); // Replies with reply_size bytes from the buffer, or SIGMA_IPC_NO_REPLY, then waits for the next call
+
+// Grants let the other side of a ring map a range of our pages instead of copying it through messages
+#define SIGMA_GRANT_WRITABLE (1 << 0)
+
+handle_t libsigma_grant_create(void* base, size_t size, uint64_t flags); // base has to be page aligned and the range can't be shm or initrd mappings, returns UINT64_MAX on failure
+handle_t libsigma_grant_send(handle_t ring, handle_t grant); // Returns the handle on the other side, send it along in a message
+void* libsigma_grant_map(handle_t grant, uint64_t flags);
+int libsigma_grant_unmap(handle_t grant);
+int libsigma_grant_revoke(handle_t grant); // Unmaps it from everyone, only the creator can revoke
+
+// Shared memory objects stay alive as long as a handle or mapping of them exists
+handle_t libsigma_shm_create(size_t size); // Returns UINT64_MAX on failure
+int libsigma_shm_resize(handle_t shm, size_t size);
+void* libsigma_shm_map(handle_t shm, void* addr, int prot, int flags); // addr is a hint unless MAP_FIXED is passed
+int libsigma_shm_unmap(handle_t shm, void* addr);
+handle_t libsigma_shm_send(handle_t ring, handle_t shm); // Returns the handle on the other side, send it along in a message
+
+// Waitsets take IRQ, IPC ring and timer handles, a handle is reported once for every batch of events since the last wait
+handle_t libsigma_waitset_create(void);
+int libsigma_waitset_add(handle_t waitset, handle_t handle);
+int libsigma_waitset_remove(handle_t waitset, handle_t handle);
+size_t libsigma_waitset_wait(handle_t waitset, handle_t* ready, size_t max); // Blocks until at least 1 handle is ready, SIZE_MAX on an invalid waitset or max of 0
+size_t libsigma_waitset_poll(handle_t waitset, handle_t* ready, size_t max); // Same, but returns 0 instead of blocking
+
+handle_t libsigma_timer_create(uint64_t ms, bool periodic);
+
+enum libsigma_futex_status {SIGMA_FUTEX_WOKEN = 0, SIGMA_FUTEX_MISMATCH, SIGMA_FUTEX_TIMED_OUT, SIGMA_FUTEX_BLOCKED, SIGMA_FUTEX_FAULT};
+
+// Sleeps as long as *addr == expected, timeout_ms of 0 waits forever, wakes can be spurious so always recheck the word
+enum libsigma_futex_status libsigma_futex_wait(uint32_t* addr, uint32_t expected, uint64_t timeout_ms);
+size_t libsigma_futex_wake(uint32_t* addr, size_t n);
+
+// Only enters the kernel when the lock is contended, 0 is unlocked
+typedef struct {
+    uint32_t state;
+} libsigma_mutex_t;
+
+#define LIBSIGMA_MUTEX_INITIALIZER {0}
+
+void libsigma_mutex_lock(libsigma_mutex_t* mutex);
+bool libsigma_mutex_trylock(libsigma_mutex_t* mutex);
+void libsigma_mutex_unlock(libsigma_mutex_t* mutex);
+
 void* libsigma_vm_map(size_t size, void *virt_addr, void* phys_addr, int prot, int flags);
 
 typedef struct {
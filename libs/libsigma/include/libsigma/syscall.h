@@ -18,22 +18,57 @@ enum {
     sigmaSyscallSetFsBase,
     sigmaSyscallKill,
     sigmaSyscallFork,
+    sigmaSyscallThreadCreate,
+    sigmaSyscallSpawn,
     sigmaSyscallYield,
     sigmaSyscallGetCurrentTid,
     sigmaSyscallBlockThread,
+    sigmaSyscallSetScheduling,
+    sigmaSyscallGetCpuStats,
 
     sigmaSyscallVmMap,
     sigmaSyscallGetPhysRegion,
 
     sigmaSyscallReadInitrd,
     sigmaSyscallInitrdSize,
+    sigmaSyscallInitrdMap,
 
     sigmaSyscallIpcSend,
     sigmaSyscallIpcReceive,
     sigmaSyscallIpcGetSize,
+    sigmaSyscallIpcRecv,
+    sigmaSyscallIpcSendv,
+    sigmaSyscallIpcRecvv,
+    sigmaSyscallIpcGetBuffer,
+    sigmaSyscallIpcCall,
+    sigmaSyscallIpcReplyAndWait,
+
+    sigmaSyscallGrantCreate,
+    sigmaSyscallGrantSend,
+    sigmaSyscallGrantMap,
+    sigmaSyscallGrantUnmap,
+    sigmaSyscallGrantRevoke,
+
+    sigmaSyscallShmCreate,
+    sigmaSyscallShmResize,
+    sigmaSyscallShmMap,
+    sigmaSyscallShmUnmap,
+    sigmaSyscallShmSend,
+
+    sigmaSyscallWaitsetCreate,
+    sigmaSyscallWaitsetAdd,
+    sigmaSyscallWaitsetRemove,
+    sigmaSyscallWaitsetWait,
+    sigmaSyscallTimerCreate,
+
+    sigmaSyscallFutexWait,
+    sigmaSyscallFutexWake,
 
     sigmaSyscallDevCtl,
     sigmaSyscallVCtl,
+
+    sigmaSyscallRingSetup,
+    sigmaSyscallRingEnter,
 };
 
 uint64_t libsigma_syscall0(uint64_t number);
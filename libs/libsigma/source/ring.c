@@ -0,0 +1,64 @@
+#include <libsigma/ring.h>
+#include <libsigma/syscall.h>
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int libsigma_ring_init(libsigma_ring_t* ring, size_t n_entries){
+    uint64_t base = libsigma_syscall1(sigmaSyscallRingSetup, n_entries);
+    if(!base)
+        return 1;
+
+    ring->header = (volatile libsigma_ring_header_t*)base;
+    ring->sq = (libsigma_ring_sqe_t*)(base + ring->header->sq_offset);
+    ring->cq = (libsigma_ring_cqe_t*)(base + ring->header->cq_offset);
+    ring->mask = ring->header->n_entries - 1;
+    ring->sq_tail = ring->header->sq_tail;
+    return 0;
+}
+
+libsigma_ring_sqe_t* libsigma_ring_get_sqe(libsigma_ring_t* ring){
+    uint32_t head = __atomic_load_n(&ring->header->sq_head, __ATOMIC_ACQUIRE);
+    if((ring->sq_tail - head) > ring->mask)
+        return NULL;
+
+    return &ring->sq[ring->sq_tail++ & ring->mask];
+}
+
+void libsigma_ring_prep(libsigma_ring_sqe_t* sqe, uint64_t func, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5, uint64_t user_data){
+    sqe->func = func;
+    sqe->args[0] = arg1;
+    sqe->args[1] = arg2;
+    sqe->args[2] = arg3;
+    sqe->args[3] = arg4;
+    sqe->args[4] = arg5;
+    sqe->user_data = user_data;
+}
+
+size_t libsigma_ring_submit(libsigma_ring_t* ring){
+    __atomic_store_n(&ring->header->sq_tail, ring->sq_tail, __ATOMIC_RELEASE);
+
+    uint32_t pending = ring->sq_tail - __atomic_load_n(&ring->header->sq_head, __ATOMIC_ACQUIRE);
+    if(!pending)
+        return 0;
+
+    return libsigma_syscall1(sigmaSyscallRingEnter, pending);
+}
+
+size_t libsigma_ring_reap(libsigma_ring_t* ring, libsigma_ring_cqe_t* cqes, size_t max){
+    uint32_t head = ring->header->cq_head;
+    uint32_t tail = __atomic_load_n(&ring->header->cq_tail, __ATOMIC_ACQUIRE);
+
+    size_t n = 0;
+    while(n < max && head != tail)
+        cqes[n++] = ring->cq[head++ & ring->mask];
+
+    __atomic_store_n(&ring->header->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -18,6 +18,10 @@ size_t libsigma_initrd_get_file_size(const char* filename){
     return libsigma_syscall1(sigmaSyscallInitrdSize, (uint64_t) filename);
 }
 
+const void* libsigma_initrd_map_file(const char* filename, size_t* size){
+    return (const void*)libsigma_syscall2(sigmaSyscallInitrdMap, (uint64_t)filename, (uint64_t)size);
+}
+
 int libsigma_ipc_send(handle_t ring, libsigma_message_t* msg, size_t msg_size){
     return libsigma_syscall3(sigmaSyscallIpcSend, ring, (uint64_t)msg, msg_size);
 }
@@ -30,6 +34,139 @@ size_t libsigma_ipc_get_msg_size(handle_t ring){
     return libsigma_syscall1(sigmaSyscallIpcGetSize, ring);
 }
 
+enum libsigma_ipc_recv_status libsigma_ipc_recv(handle_t ring, void* buf, size_t cap, size_t* len, int flags){
+    enum libsigma_ipc_recv_status status;
+    while((status = libsigma_syscall5(sigmaSyscallIpcRecv, ring, (uint64_t)buf, cap, (uint64_t)len, flags)) == SIGMA_IPC_RECV_EMPTY && (flags & SIGMA_IPC_RECV_BLOCK))
+        ; // Got blocked, try again now that a message arrived
+    return status;
+}
+
+int libsigma_ipc_sendv(handle_t ring, const libsigma_iovec_t* iov, size_t n_iov){
+    return libsigma_syscall3(sigmaSyscallIpcSendv, ring, (uint64_t)iov, n_iov);
+}
+
+enum libsigma_ipc_recv_status libsigma_ipc_recvv(handle_t ring, const libsigma_iovec_t* iov, size_t n_iov, size_t* len, int flags){
+    enum libsigma_ipc_recv_status status;
+    while((status = libsigma_syscall5(sigmaSyscallIpcRecvv, ring, (uint64_t)iov, n_iov, (uint64_t)len, flags)) == SIGMA_IPC_RECV_EMPTY && (flags & SIGMA_IPC_RECV_BLOCK))
+        ;
+    return status;
+}
+
+libsigma_ipc_buffer_t* libsigma_ipc_get_buffer(void){
+    return (libsigma_ipc_buffer_t*)libsigma_syscall0(sigmaSyscallIpcGetBuffer);
+}
+
+int libsigma_ipc_call(handle_t ring, size_t size){
+    return libsigma_syscall2(sigmaSyscallIpcCall, ring, size);
+}
+
+int libsigma_ipc_reply_and_wait(handle_t ring, size_t reply_size){
+    return libsigma_syscall2(sigmaSyscallIpcReplyAndWait, ring, reply_size);
+}
+
+handle_t libsigma_grant_create(void* base, size_t size, uint64_t flags){
+    return libsigma_syscall3(sigmaSyscallGrantCreate, (uint64_t)base, size, flags);
+}
+
+handle_t libsigma_grant_send(handle_t ring, handle_t grant){
+    return libsigma_syscall2(sigmaSyscallGrantSend, ring, grant);
+}
+
+void* libsigma_grant_map(handle_t grant, uint64_t flags){
+    return (void*)libsigma_syscall2(sigmaSyscallGrantMap, grant, flags);
+}
+
+int libsigma_grant_unmap(handle_t grant){
+    return libsigma_syscall1(sigmaSyscallGrantUnmap, grant);
+}
+
+int libsigma_grant_revoke(handle_t grant){
+    return libsigma_syscall1(sigmaSyscallGrantRevoke, grant);
+}
+
+handle_t libsigma_shm_create(size_t size){
+    return libsigma_syscall1(sigmaSyscallShmCreate, size);
+}
+
+int libsigma_shm_resize(handle_t shm, size_t size){
+    return libsigma_syscall2(sigmaSyscallShmResize, shm, size);
+}
+
+void* libsigma_shm_map(handle_t shm, void* addr, int prot, int flags){
+    return (void*)libsigma_syscall4(sigmaSyscallShmMap, shm, (uint64_t)addr, prot, flags);
+}
+
+int libsigma_shm_unmap(handle_t shm, void* addr){
+    return libsigma_syscall2(sigmaSyscallShmUnmap, shm, (uint64_t)addr);
+}
+
+handle_t libsigma_shm_send(handle_t ring, handle_t shm){
+    return libsigma_syscall2(sigmaSyscallShmSend, ring, shm);
+}
+
+handle_t libsigma_waitset_create(void){
+    return libsigma_syscall0(sigmaSyscallWaitsetCreate);
+}
+
+int libsigma_waitset_add(handle_t waitset, handle_t handle){
+    return libsigma_syscall2(sigmaSyscallWaitsetAdd, waitset, handle);
+}
+
+int libsigma_waitset_remove(handle_t waitset, handle_t handle){
+    return libsigma_syscall2(sigmaSyscallWaitsetRemove, waitset, handle);
+}
+
+size_t libsigma_waitset_wait(handle_t waitset, handle_t* ready, size_t max){
+    size_t n = 0;
+    while((n = libsigma_syscall4(sigmaSyscallWaitsetWait, waitset, (uint64_t)ready, max, 1)) == 0)
+        ; // Got blocked, try again now that something is ready, SIZE_MAX means it never will be
+    return n;
+}
+
+size_t libsigma_waitset_poll(handle_t waitset, handle_t* ready, size_t max){
+    return libsigma_syscall4(sigmaSyscallWaitsetWait, waitset, (uint64_t)ready, max, 0);
+}
+
+handle_t libsigma_timer_create(uint64_t ms, bool periodic){
+    return libsigma_syscall2(sigmaSyscallTimerCreate, ms, periodic);
+}
+
+enum libsigma_futex_status libsigma_futex_wait(uint32_t* addr, uint32_t expected, uint64_t timeout_ms){
+    enum libsigma_futex_status status;
+    while((status = libsigma_syscall3(sigmaSyscallFutexWait, (uint64_t)addr, expected, timeout_ms)) == SIGMA_FUTEX_BLOCKED)
+        ; // Got blocked, the next call reports if it was a wake or a timeout
+    return status;
+}
+
+size_t libsigma_futex_wake(uint32_t* addr, size_t n){
+    return libsigma_syscall2(sigmaSyscallFutexWake, (uint64_t)addr, n);
+}
+
+// 0: Unlocked, 1: Locked, 2: Locked and there might be waiters
+void libsigma_mutex_lock(libsigma_mutex_t* mutex){
+    uint32_t state = 0;
+    if(__atomic_compare_exchange_n(&mutex->state, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+
+    if(state != 2)
+        state = __atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE);
+
+    while(state != 0){
+        libsigma_futex_wait(&mutex->state, 2, 0);
+        state = __atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+bool libsigma_mutex_trylock(libsigma_mutex_t* mutex){
+    uint32_t state = 0;
+    return __atomic_compare_exchange_n(&mutex->state, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void libsigma_mutex_unlock(libsigma_mutex_t* mutex){
+    if(__atomic_exchange_n(&mutex->state, 0, __ATOMIC_RELEASE) == 2)
+        libsigma_futex_wake(&mutex->state, 1);
+}
+
 int libsigma_klog(const char* str){
     return libsigma_syscall1(sigmaSyscallEarlyKlog, (uint64_t)str);
 }
@@ -61,10 +198,26 @@ int libsigma_block_thread(enum libsigma_block_reasons reason, handle_t handle){
     return libsigma_syscall2(sigmaSyscallBlockThread, reason, handle);
 }
 
+int libsigma_set_scheduling(enum libsigma_priorities priority, uint64_t affinity){
+    return libsigma_syscall2(sigmaSyscallSetScheduling, priority, affinity);
+}
+
+int libsigma_get_cpu_stats(uint64_t cpu, libsigma_cpu_stats_t* stats){
+    return libsigma_syscall2(sigmaSyscallGetCpuStats, cpu, (uint64_t)stats);
+}
+
 uint64_t libsigma_fork(void){
     return libsigma_syscall0(sigmaSyscallFork);
 }
 
+tid_t libsigma_thread_create(void (*entry)(void*), void* stack, void* arg){
+    return libsigma_syscall3(sigmaSyscallThreadCreate, (uint64_t)entry, (uint64_t)stack, (uint64_t)arg);
+}
+
+tid_t libsigma_spawn(const char* path, const char* const* argv, const char* const* envp, handle_t* rings, size_t n_rings){
+    return libsigma_syscall5(sigmaSyscallSpawn, (uint64_t)path, (uint64_t)argv, (uint64_t)envp, (uint64_t)rings, n_rings);
+}
+
 void libsigma_yield(void){
     libsigma_syscall0(sigmaSyscallYield);
 }